@@ -0,0 +1,127 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+// Frame queues: contention of producers and consumers sharing a queue,
+// and the cost of a frame hand-off. LockedQueue is the baseline.
+/* -------------------------------------------------------------------------- */
+
+#include "BoundedQueue.h"
+#include "LockedQueue.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+using Frame = std::vector<char>;
+
+constexpr size_t QUEUE_LEN = 1024;
+constexpr size_t ITEMS_PER_PRODUCER = 200000;
+constexpr size_t FRAME_LEN = 256;
+
+// Pairs of a producer and a consumer (state.range(0) of them) move
+// plain integers, so that only the queue is measured
+template <class Queue>
+void transfer(benchmark::State &state, Queue &queue)
+{
+   const size_t threads = size_t(state.range(0));
+
+   for (auto _ : state)
+   {
+      std::vector<std::thread> workers;
+
+      for (size_t i = 0; i < threads; ++i)
+      {
+         workers.emplace_back([&queue] {
+            for (uint64_t n = 0; n < ITEMS_PER_PRODUCER; ++n)
+            {
+               while (!queue.push(uint64_t(n)))
+                  std::this_thread::yield();
+            }
+         });
+
+         workers.emplace_back([&queue] {
+            uint64_t item = 0;
+
+            for (size_t n = 0; n < ITEMS_PER_PRODUCER; ++n)
+               queue.pop(item, -1);
+
+            benchmark::DoNotOptimize(item);
+         });
+      }
+
+      for (auto &worker : workers)
+         worker.join();
+   }
+
+   state.SetItemsProcessed(int64_t(state.iterations() * threads * ITEMS_PER_PRODUCER));
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+static void BM_LockedQueue(benchmark::State &state)
+{
+   LockedQueue<uint64_t> queue(QUEUE_LEN);
+   transfer(state, queue);
+}
+
+static void BM_BoundedQueueMpmc(benchmark::State &state)
+{
+   BoundedQueue<uint64_t> queue(QUEUE_LEN);
+   transfer(state, queue);
+}
+
+static void BM_BoundedQueueSpsc(benchmark::State &state)
+{
+   BoundedQueue<uint64_t, QueueMode::Spsc> queue(QUEUE_LEN);
+   transfer(state, queue);
+}
+
+// Argument: producer/consumer pairs
+BENCHMARK(BM_LockedQueue)->Arg(1)->Arg(2)->Arg(4)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_BoundedQueueMpmc)->Arg(1)->Arg(2)->Arg(4)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_BoundedQueueSpsc)->Arg(1)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+/* -------------------------------------------------------------------------- */
+
+// Uncontended hand-off of a frame, in a single thread: LockedQueue
+// copies it out, BoundedQueue moves it
+template <class Queue>
+static void handOff(benchmark::State &state, Queue &queue)
+{
+   Frame frame(FRAME_LEN);
+
+   for (auto _ : state)
+   {
+      queue.push(std::move(frame));
+      queue.pop(frame, 0);
+   }
+}
+
+static void BM_LockedQueueHandOff(benchmark::State &state)
+{
+   LockedQueue<Frame> queue(QUEUE_LEN);
+   handOff(state, queue);
+}
+
+static void BM_BoundedQueueHandOff(benchmark::State &state)
+{
+   BoundedQueue<Frame> queue(QUEUE_LEN);
+   handOff(state, queue);
+}
+
+BENCHMARK(BM_LockedQueueHandOff);
+BENCHMARK(BM_BoundedQueueHandOff);
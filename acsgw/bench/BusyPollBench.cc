@@ -0,0 +1,141 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+// Wake-up latency of the TCP bearer receiver: TcpConnectionMgr::recv()
+// either blocks in select() (spin budget 0, the baseline) or spins on
+// non-blocking reads first. A sender writes a timestamp every SEND_GAP_US
+// on a loopback connection; the one-way delay of each message is sampled
+// and its p50/p99 reported.
+/* -------------------------------------------------------------------------- */
+
+#include "TcpConnectionMgr.h"
+#include "TcpListener.h"
+#include "TcpSocket.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+constexpr int SEND_GAP_US = 100;
+
+using Clock = std::chrono::steady_clock;
+
+// Exposes the receive primitive of the TCP bearers
+class Receiver : public TcpConnectionMgr
+{
+public:
+   Receiver() : TcpConnectionMgr(IpAddress(std::string("127.0.0.1")), 0)
+   {
+   }
+
+   using TcpConnectionMgr::recv;
+};
+
+struct Connection
+{
+   TcpListener::Handle listener;
+   TcpSocket::Handle client;
+   TcpSocket::Handle server;
+};
+
+bool connectLoopback(Connection &conn)
+{
+   conn.listener = TcpListener::create();
+
+   if (!conn.listener->bind("127.0.0.1", 0) || !conn.listener->listen())
+      return false;
+
+   sockaddr_in sin = {0};
+   socklen_t len = sizeof(sin);
+
+   if (::getsockname(conn.listener->getSocketFd(), reinterpret_cast<sockaddr *>(&sin), &len) != 0)
+      return false;
+
+   conn.client = TcpSocket::make(std::string("127.0.0.1"), ntohs(sin.sin_port));
+
+   if (!conn.client || !conn.client->connect())
+      return false;
+
+   conn.server = conn.listener->accept();
+
+   return conn.server != nullptr;
+}
+
+double percentile(std::vector<double> &samples, double p)
+{
+   if (samples.empty())
+      return 0;
+
+   const size_t i = std::min(samples.size() - 1, size_t(p * double(samples.size())));
+   std::nth_element(samples.begin(), samples.begin() + i, samples.end());
+
+   return samples[i];
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+// Argument: spin budget (us)
+static void BM_TcpRecvWakeUp(benchmark::State &state)
+{
+   Connection conn;
+
+   if (!connectLoopback(conn))
+   {
+      state.SkipWithError("cannot open a loopback TCP connection");
+      return;
+   }
+
+   Receiver receiver;
+   receiver.setBusyPoll(std::chrono::microseconds(state.range(0)));
+
+   std::atomic_bool stop{false};
+
+   std::thread sender([&] {
+      while (!stop)
+      {
+         const int64_t sentAt = Clock::now().time_since_epoch().count();
+         conn.client->send(reinterpret_cast<const char *>(&sentAt), sizeof(sentAt));
+         std::this_thread::sleep_for(std::chrono::microseconds(SEND_GAP_US));
+      }
+   });
+
+   std::vector<double> latencies;
+
+   for (auto _ : state)
+   {
+      int64_t sentAt = 0;
+
+      if (receiver.recv(*conn.server, reinterpret_cast<char *>(&sentAt), sizeof(sentAt), 1) != sizeof(sentAt))
+      {
+         state.SkipWithError("receive failed");
+         break;
+      }
+
+      latencies.push_back(double(Clock::now().time_since_epoch().count() - sentAt) / 1000.0);
+   }
+
+   stop = true;
+   sender.join();
+
+   state.counters["p50_us"] = percentile(latencies, 0.50);
+   state.counters["p99_us"] = percentile(latencies, 0.99);
+}
+
+BENCHMARK(BM_TcpRecvWakeUp)->Arg(0)->Arg(50)->Arg(200)->Iterations(20000)->UseRealTime();
@@ -0,0 +1,52 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+// Internet checksum of a buffer by the SIMD kernels of Checksum::sum()
+// against the scalar loop. The argument is the buffer length: an IPv4
+// header, a small packet, a full-size one and a jumbo frame.
+/* -------------------------------------------------------------------------- */
+
+#include "Checksum.h"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+static void BM_Checksum(benchmark::State &state, const char *name)
+{
+   const auto kernel = Checksum::findKernel(name);
+
+   if (!kernel)
+   {
+      state.SkipWithError("kernel not supported by the CPU");
+      return;
+   }
+
+   const size_t len = size_t(state.range(0));
+
+   std::mt19937 rng(1);
+   std::vector<uint8_t> data(len);
+
+   for (auto &byte : data)
+      byte = uint8_t(rng());
+
+   for (auto _ : state)
+   {
+      benchmark::DoNotOptimize(Checksum::fold(kernel(data.data(), data.size(), 0)));
+   }
+
+   state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(len));
+}
+
+BENCHMARK_CAPTURE(BM_Checksum, scalar, "scalar")->Arg(20)->Arg(64)->Arg(1400)->Arg(9000);
+BENCHMARK_CAPTURE(BM_Checksum, sse2, "sse2")->Arg(20)->Arg(64)->Arg(1400)->Arg(9000);
+BENCHMARK_CAPTURE(BM_Checksum, avx2, "avx2")->Arg(20)->Arg(64)->Arg(1400)->Arg(9000);
@@ -0,0 +1,182 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+// Packet rate of the GTP-U bearer framing against the UDP bearer one, on
+// a loopback socket: each packet is encapsulated (GTP-U long header, or
+// the pktid trailer of the UDP bearers), sent, received and decapsulated.
+// The argument is the number of datagrams per sendmmsg()/recvmmsg() call,
+// BEARER_TX_BATCH being the one the bearers use.
+/* -------------------------------------------------------------------------- */
+
+#include "GtpU.h"
+#include "MpTunnel.h"
+#include "TunnelFragment.h"
+#include "UdpSocket.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+constexpr size_t PACKET_LEN = 200; // inner packet
+constexpr size_t SLOT_LEN = 2048;
+constexpr uint32_t TEID = 1001;
+
+struct Loopback
+{
+   UdpSocket rx;
+   UdpSocket tx;
+   UdpSocket::PortType port = 0;
+
+   bool open()
+   {
+      IpAddress local(std::string("127.0.0.1"));
+      UdpSocket::PortType txPort = 0;
+
+      return rx.bind(port, local) && tx.bind(txPort, local);
+   }
+};
+
+size_t encapUdp(const char *packet, size_t len, uint64_t seq, char *out)
+{
+   const uint64_t pktid = makeFramePktId(seq, FrameKind::Packet);
+
+   memcpy(out, packet, len);
+   memcpy(out + len, &pktid, sizeof(pktid));
+
+   return len + sizeof(pktid);
+}
+
+bool decapUdp(const char *datagram, size_t len, uint64_t &pktid)
+{
+   if (len <= sizeof(pktid))
+      return false;
+
+   memcpy(&pktid, datagram + len - sizeof(pktid), sizeof(pktid));
+
+   return getFrameKind(pktid) == FrameKind::Packet;
+}
+
+size_t encapGtp(const char *packet, size_t len, uint64_t seq, char *out)
+{
+   gtp1_header_long header;
+   GtpU::makeTpduHeader(header, TEID, uint16_t(seq), len);
+
+   memcpy(out, &header, sizeof(header));
+   memcpy(out + sizeof(header), packet, len);
+
+   return sizeof(header) + len;
+}
+
+bool decapGtp(const char *datagram, size_t len, uint64_t &pktid)
+{
+   GtpU::Message msg;
+
+   if (!GtpU::parse(datagram, len, msg) || msg.type != GtpU::MSG_TPDU)
+      return false;
+
+   pktid = GtpU::makePktId(msg.teid, msg.seq);
+
+   return true;
+}
+
+template <class Encap, class Decap>
+void runBearer(benchmark::State &state, Encap encap, Decap decap)
+{
+   Loopback loop;
+
+   if (!loop.open())
+   {
+      state.SkipWithError("cannot open the loopback sockets");
+      return;
+   }
+
+   const int batch = int(state.range(0));
+   const size_t slots = size_t(batch);
+   const IpAddress dst(std::string("127.0.0.1"));
+
+   std::vector<char> packet(PACKET_LEN, 'x');
+   std::vector<char> txData(slots * SLOT_LEN);
+   std::vector<char> rxData(slots * SLOT_LEN);
+   std::vector<iovec> txVec(slots);
+   std::vector<iovec> rxVec(slots);
+   std::vector<int> lens(slots);
+   std::vector<IpAddress> srcAddrs(slots);
+   std::vector<UdpSocket::PortType> srcPorts(slots);
+
+   uint64_t seq = 0;
+   uint64_t pktid = 0;
+
+   for (auto _ : state)
+   {
+      for (int i = 0; i < batch; ++i)
+      {
+         char *slot = txData.data() + size_t(i) * SLOT_LEN;
+         txVec[size_t(i)] = {slot, encap(packet.data(), packet.size(), seq++, slot)};
+      }
+
+      if (loop.tx.sendBatch(txVec.data(), batch, dst, loop.port) != batch)
+      {
+         state.SkipWithError("send failed");
+         break;
+      }
+
+      // Loopback datagrams are queued by the time sendmmsg() returns
+      for (int received = 0; received < batch;)
+      {
+         for (int i = 0; i < batch - received; ++i)
+            rxVec[size_t(i)] = {rxData.data() + size_t(i) * SLOT_LEN, SLOT_LEN};
+
+         const int n = loop.rx.recvBatch(rxVec.data(), lens.data(), srcAddrs.data(), srcPorts.data(),
+                                         batch - received, MSG_DONTWAIT);
+
+         if (n <= 0)
+         {
+            state.SkipWithError("receive failed");
+            return;
+         }
+
+         for (int i = 0; i < n; ++i)
+         {
+            if (!decap(rxData.data() + size_t(i) * SLOT_LEN, size_t(lens[size_t(i)]), pktid))
+            {
+               state.SkipWithError("malformed datagram");
+               return;
+            }
+         }
+
+         received += n;
+      }
+
+      benchmark::DoNotOptimize(pktid);
+   }
+
+   state.SetItemsProcessed(state.iterations() * batch);
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+static void BM_UdpBearer(benchmark::State &state)
+{
+   runBearer(state, encapUdp, decapUdp);
+}
+
+static void BM_GtpBearer(benchmark::State &state)
+{
+   runBearer(state, encapGtp, decapGtp);
+}
+
+BENCHMARK(BM_UdpBearer)->Arg(1)->Arg(BEARER_TX_BATCH);
+BENCHMARK(BM_GtpBearer)->Arg(1)->Arg(BEARER_TX_BATCH);
@@ -1,13 +1,14 @@
-//  
+//
 // This file is part of acsgw
 // Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
-// All rights reserved.  
-// Licensed under the MIT License. 
+// All rights reserved.
+// Licensed under the MIT License.
 // See COPYING file in the project root for full license information.
 //
 
 #pragma once
 
+#include <chrono>
 #include <queue>
 #include <mutex>
 #include <condition_variable>
@@ -15,11 +16,12 @@
 
 /* -------------------------------------------------------------------------- */
 
+// The queue BoundedQueue replaced, kept as the baseline of its benchmarks
 template <class T>
 class LockedQueue
 {
 public:
-   LockedQueue(int maxSize = 1) : _maxSize(maxSize) {}
+   LockedQueue(size_t maxSize = 1) : _maxSize(maxSize) {}
 
    bool push(T &&item)
    {
@@ -38,7 +40,7 @@ public:
       return true;
    }
 
-   // return false either if a timeout occours or timeout=0 and there is no data ready 
+   // return false either if a timeout occours or timeout=0 and there is no data ready
    bool pop(T &res, int timeout, std::function<bool()> cond = [] { return false; })
    {
       std::unique_lock<std::mutex> lk(_lock);
@@ -77,7 +79,7 @@ public:
    }
 
 private:
-   int _maxSize = 1;
+   size_t _maxSize = 1;
    std::mutex _lock;
    std::condition_variable _cv;
    std::queue<T> _data;
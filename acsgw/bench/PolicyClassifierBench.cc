@@ -0,0 +1,191 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+// Per-packet cost of PolicyClassifier::classify() with 1k service rules
+// (prefixes, protocol, port ranges, DSCP), against a first-match linear
+// scan of the same rules.
+/* -------------------------------------------------------------------------- */
+
+#include "PolicyClassifier.h"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+constexpr size_t RULES = 1000;
+constexpr size_t PACKETS = 4096; // power of two
+
+struct Packet
+{
+   uint32_t src;
+   uint32_t dst;
+   uint8_t protocol;
+   uint16_t srcPort;
+   uint16_t dstPort;
+   uint8_t dscp;
+};
+
+PolicyClassifier::Prefix makePrefix(uint32_t addr, unsigned len)
+{
+   PolicyClassifier::Prefix prefix;
+   prefix.addr = addr & (~uint32_t(0) << (32 - len));
+   prefix.len = len;
+   return prefix;
+}
+
+// Services of a /16 site each: a destination subnet, a protocol, a
+// port range and, for some, a DSCP
+std::vector<PolicyClassifier::Rule> makeRules(std::mt19937 &rng)
+{
+   std::vector<PolicyClassifier::Rule> rules(RULES);
+
+   for (auto &rule : rules)
+   {
+      const uint32_t site = 0x0a000000 | ((rng() % 256) << 16);
+
+      rule.dstPrefixes.push_back(makePrefix(site | (rng() & 0xffff), 24 + rng() % 9));
+
+      if (rng() % 4 == 0)
+         rule.srcPrefixes.push_back(makePrefix(0xac100000 | (rng() & 0xfffff), 16 + rng() % 9));
+
+      rule.protocol = rng() % 2 ? 6 : 17;
+
+      const uint16_t port = uint16_t(1024 + rng() % 60000);
+      rule.dstPorts.push_back({port, uint16_t(port + rng() % 16)});
+
+      if (rng() % 8 == 0)
+         rule.dscps.push_back(uint8_t(rng() % 64));
+   }
+
+   return rules;
+}
+
+std::vector<Packet> makePackets(std::mt19937 &rng, const std::vector<PolicyClassifier::Rule> &rules, bool hits)
+{
+   std::vector<Packet> packets(PACKETS);
+
+   for (auto &pkt : packets)
+   {
+      pkt.src = 0xac100000 | (rng() & 0xfffff);
+      pkt.dscp = uint8_t(rng() % 64);
+      pkt.srcPort = uint16_t(1024 + rng() % 60000);
+
+      if (hits)
+      {
+         // Aimed at a random rule
+         const auto &rule = rules[rng() % rules.size()];
+         const auto &prefix = rule.dstPrefixes[0];
+
+         pkt.dst = prefix.addr | (rng() & (prefix.len == 32 ? 0 : ~uint32_t(0) >> prefix.len));
+         pkt.protocol = uint8_t(rule.protocol);
+         pkt.dstPort = rule.dstPorts[0].first;
+         pkt.dscp = rule.dscps.empty() ? pkt.dscp : rule.dscps[0];
+      }
+      else
+      {
+         // Outside every rule: the worst case of the linear scan
+         pkt.dst = 0xc0a80000 | (rng() & 0xffff);
+         pkt.protocol = 17;
+         pkt.dstPort = uint16_t(rng());
+      }
+   }
+
+   return packets;
+}
+
+int linearScan(const std::vector<PolicyClassifier::Rule> &rules, const Packet &pkt)
+{
+   auto inPrefixes = [](const std::vector<PolicyClassifier::Prefix> &prefixes, uint32_t addr) {
+      if (prefixes.empty())
+         return true;
+
+      for (const auto &p : prefixes)
+      {
+         if ((addr & (~uint32_t(0) << (32 - p.len))) == p.addr)
+            return true;
+      }
+
+      return false;
+   };
+
+   auto inPorts = [](const std::vector<PolicyClassifier::PortRange> &ranges, uint16_t port) {
+      if (ranges.empty())
+         return true;
+
+      for (const auto &r : ranges)
+      {
+         if (port >= r.first && port <= r.last)
+            return true;
+      }
+
+      return false;
+   };
+
+   for (size_t i = 0; i < rules.size(); ++i)
+   {
+      const auto &rule = rules[i];
+      bool dscpMatch = rule.dscps.empty();
+
+      for (auto dscp : rule.dscps)
+         dscpMatch = dscpMatch || dscp == pkt.dscp;
+
+      if ((rule.protocol < 0 || rule.protocol == pkt.protocol) && inPrefixes(rule.dstPrefixes, pkt.dst) &&
+          inPrefixes(rule.srcPrefixes, pkt.src) && inPorts(rule.dstPorts, pkt.dstPort) &&
+          inPorts(rule.srcPorts, pkt.srcPort) && dscpMatch)
+      {
+         return int(i);
+      }
+   }
+
+   return PolicyClassifier::NO_MATCH;
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+// Argument: 1 if packets match some rule, 0 if they match none
+static void BM_PolicyClassifier(benchmark::State &state)
+{
+   std::mt19937 rng(1);
+   const auto rules = makeRules(rng);
+   const auto packets = makePackets(rng, rules, state.range(0) != 0);
+   const PolicyClassifier classifier(rules);
+
+   size_t i = 0;
+
+   for (auto _ : state)
+   {
+      const Packet &pkt = packets[i++ & (PACKETS - 1)];
+      benchmark::DoNotOptimize(
+         classifier.classify(pkt.src, pkt.dst, pkt.protocol, true, pkt.srcPort, pkt.dstPort, pkt.dscp));
+   }
+}
+
+static void BM_LinearScan(benchmark::State &state)
+{
+   std::mt19937 rng(1);
+   const auto rules = makeRules(rng);
+   const auto packets = makePackets(rng, rules, state.range(0) != 0);
+
+   size_t i = 0;
+
+   for (auto _ : state)
+   {
+      benchmark::DoNotOptimize(linearScan(rules, packets[i++ & (PACKETS - 1)]));
+   }
+}
+
+BENCHMARK(BM_PolicyClassifier)->Arg(1)->Arg(0);
+BENCHMARK(BM_LinearScan)->Arg(1)->Arg(0);
@@ -0,0 +1,83 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include <cstddef>
+#include <cstdint>
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Internet checksum (RFC 1071).
+ * Sums are taken over 16-bit words in memory order, which makes them
+ * byte order agnostic: a checksum returned here is stored as it is.
+ * Long buffers are summed by the widest SIMD kernel the CPU supports,
+ * selected at run time.
+ */
+namespace Checksum {
+
+// One's complement sum of data added to sum (not folded)
+uint64_t sum(const void *data, size_t len, uint64_t sum = 0) noexcept;
+
+// Folds a sum into 16 bits
+inline uint16_t fold(uint64_t sum) noexcept
+{
+   sum = (sum & 0xffffffff) + (sum >> 32);
+   sum = (sum & 0xffff) + (sum >> 16);
+   sum = (sum & 0xffff) + (sum >> 16);
+   sum = (sum & 0xffff) + (sum >> 16);
+
+   return uint16_t(sum);
+}
+
+// Checksum of data
+inline uint16_t compute(const void *data, size_t len) noexcept
+{
+   return uint16_t(~fold(sum(data, len)));
+}
+
+// True if data, checksum field included, sums up correctly
+inline bool verify(const void *data, size_t len) noexcept
+{
+   return fold(sum(data, len)) == 0xffff;
+}
+
+// True if packet starts with a well-formed IPv4 header whose checksum
+// is correct
+bool verifyIpv4Header(const char *packet, size_t len) noexcept;
+
+// Incremental update of a checksum when one of the 16-bit words it
+// covers changes (RFC 1624, eqn. 3)
+inline uint16_t update(uint16_t checksum, uint16_t oldWord, uint16_t newWord) noexcept
+{
+   return uint16_t(~fold(uint64_t(uint16_t(~checksum)) + uint16_t(~oldWord) + newWord));
+}
+
+// As above, for a 32-bit field (i.e. an address) at an even offset
+inline uint16_t update(uint16_t checksum, uint32_t oldField, uint32_t newField) noexcept
+{
+   return uint16_t(~fold(uint64_t(uint16_t(~checksum)) +
+                         uint16_t(~oldField) + uint16_t(~(oldField >> 16)) +
+                         uint16_t(newField) + uint16_t(newField >> 16)));
+}
+
+// Kernel used by sum(): "avx2", "sse2" or "scalar"
+const char *kernelName() noexcept;
+
+// Kernels of sum() by name, whatever the length (for tests and
+// benchmarks). Returns nullptr if the CPU does not support it.
+using SumKernel = uint64_t (*)(const void *data, size_t len, uint64_t sum);
+
+SumKernel findKernel(const char *name) noexcept;
+
+} // namespace Checksum
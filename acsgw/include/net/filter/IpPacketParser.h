@@ -1,6 +1,12 @@
 #pragma once
 
+#include "Checksum.h"
+#include "TrafficClass.h"
+
 #include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <deque>
 #include <unordered_map>
 #include <unordered_set>
 #include <map>
@@ -41,6 +47,44 @@ public:
     {
     }
 
+    bool isValid() const noexcept
+    {
+        return _size >= int(sizeof(Ip4Header)) &&
+               (((Ip4Header *)_bytes)->ver_hlen >> 4) == 4 &&
+               getHeaderLength() >= int(sizeof(Ip4Header)) &&
+               getHeaderLength() <= _size;
+    }
+
+    int getHeaderLength() const noexcept
+    {
+        return (((Ip4Header *)_bytes)->ver_hlen & 0x0f) << 2;
+    }
+
+    uint8_t getTos() const noexcept
+    {
+        return ((Ip4Header *)_bytes)->service;
+    }
+
+    uint8_t getDscp() const noexcept
+    {
+        return getTos() >> 2;
+    }
+
+    TrafficClass getTrafficClass() const noexcept
+    {
+        return dscpToTrafficClass(getDscp());
+    }
+
+    // Classifies the packet by inner DSCP and transport ports
+    TrafficClass getTrafficClass(const TrafficClassMap &classMap) const noexcept
+    {
+        const bool hasPorts = hasTransportHeader();
+
+        return classMap.classify(getDscp(), hasPorts,
+                                 hasPorts ? getSrcPort() : 0,
+                                 hasPorts ? getDstPort() : 0);
+    }
+
     uint16_t getLength() const noexcept
     {
         return ntohs(((Ip4Header *)_bytes)->length);
@@ -81,6 +125,41 @@ public:
         return getProtocol() == IP_PROTO_ICMP;
     }
 
+    // True if the packet carries the transport header (first fragment or
+    // not fragmented at all)
+    bool hasTransportHeader() const noexcept
+    {
+        return (isTcp() || isUdp()) &&
+               (getFragment() & 0x1fff) == 0 &&
+               getHeaderLength() + 4 <= _size;
+    }
+
+    // Transport ports are meaningful only if hasTransportHeader() is true
+    uint16_t getSrcPort() const noexcept
+    {
+        return hasTransportHeader() ? ntohs(*(uint16_t *)(_bytes + getHeaderLength())) : 0;
+    }
+
+    uint16_t getDstPort() const noexcept
+    {
+        return hasTransportHeader() ? ntohs(*(uint16_t *)(_bytes + getHeaderLength() + 2)) : 0;
+    }
+
+    // Hash of the inner flow (addresses, protocol, ports), stable for
+    // every packet of the same flow
+    uint32_t getFlowHash() const noexcept
+    {
+        if (!isValid())
+            return 0;
+
+        uint64_t h = (uint64_t(getU32SrcAddr()) << 32) | getU32DstAddr();
+        h ^= (uint64_t(getProtocol()) << 32) |
+             (uint32_t(getSrcPort()) << 16) | getDstPort();
+        h *= 0x9e3779b97f4a7c15ULL;
+
+        return uint32_t(h >> 32);
+    }
+
     uint32_t getU32SrcAddr() const noexcept
     {
         return ntohl(((Ip4Header *)_bytes)->src_addr);
@@ -120,7 +199,96 @@ public:
         os << buf;
     }
 
+    // Lowers in place the MSS option of a TCP SYN to maxMss, updating the
+    // TCP checksum incrementally. Returns true if the packet was changed.
+    static bool clampTcpMss(char *packet, int size, uint16_t maxMss) noexcept
+    {
+        const IpPacketParser parser(packet, size);
+
+        if (!parser.isValid() || !parser.isTcp() || (parser.getFragment() & 0x1fff) != 0)
+            return false;
+
+        const int ipHeaderLen = parser.getHeaderLength();
+
+        if (ipHeaderLen + TCP_HEADER_LEN > size)
+            return false;
+
+        uint8_t *tcp = (uint8_t *)packet + ipHeaderLen;
+        const int tcpHeaderLen = (tcp[12] >> 4) << 2;
+
+        if ((tcp[13] & TCP_FLAG_SYN) == 0 || tcpHeaderLen < TCP_HEADER_LEN ||
+            ipHeaderLen + tcpHeaderLen > size)
+        {
+            return false;
+        }
+
+        for (int i = TCP_HEADER_LEN; i < tcpHeaderLen;)
+        {
+            const uint8_t kind = tcp[i];
+
+            if (kind == TCP_OPT_END)
+                break;
+
+            if (kind == TCP_OPT_NOP)
+            {
+                ++i;
+                continue;
+            }
+
+            if (i + 1 >= tcpHeaderLen || tcp[i + 1] < 2 || i + tcp[i + 1] > tcpHeaderLen)
+                break;
+
+            if (kind == TCP_OPT_MSS && tcp[i + 1] == 4)
+            {
+                uint16_t oldMss = 0;
+                memcpy(&oldMss, tcp + i + 2, sizeof(oldMss));
+
+                if (ntohs(oldMss) <= maxMss)
+                    return false;
+
+                const uint16_t newMss = htons(maxMss);
+                memcpy(tcp + i + 2, &newMss, sizeof(newMss));
+
+                // A field at an odd offset is summed with its bytes swapped
+                const bool odd = (i & 1) != 0;
+                uint16_t checksum = 0;
+                memcpy(&checksum, tcp + 16, sizeof(checksum));
+                checksum = updateChecksum(checksum,
+                                          odd ? swapBytes(oldMss) : oldMss,
+                                          odd ? swapBytes(newMss) : newMss);
+                memcpy(tcp + 16, &checksum, sizeof(checksum));
+
+                return true;
+            }
+
+            i += tcp[i + 1];
+        }
+
+        return false;
+    }
+
+    // Incremental update of an Internet checksum when one of the 16-bit
+    // words it covers changes (RFC 1624). Byte order agnostic.
+    static uint16_t updateChecksum(uint16_t checksum, uint16_t oldWord, uint16_t newWord) noexcept
+    {
+        return Checksum::update(checksum, oldWord, newWord);
+    }
+
 private:
+    enum
+    {
+        TCP_HEADER_LEN = 20,
+        TCP_FLAG_SYN = 0x02,
+        TCP_OPT_END = 0,
+        TCP_OPT_NOP = 1,
+        TCP_OPT_MSS = 2,
+    };
+
+    static uint16_t swapBytes(uint16_t word) noexcept
+    {
+        return uint16_t((word << 8) | (word >> 8));
+    }
+
     const char *_bytes;
     const int _size;
 };
@@ -144,11 +312,40 @@ public:
 
     static constexpr int DUP_HISTORY_LEN = 10;
 
+    // Copies of a packet may arrive as late as the copy delay of its path
+    // plus the one-way delay of the slowest bearer, so ids are remembered
+    // for a time rather than for a number of packets. Above the limit the
+    // oldest ones are forgotten anyway (this keeps memory use bounded).
+    static constexpr size_t PKTID_HISTORY_MAX = 1 << 20;
+
+    using Clock = std::chrono::steady_clock;
+
+    explicit Ip4DupDetector(std::chrono::milliseconds retention) : _retention(retention)
+    {
+    }
+
     bool isADuplicated(const IpPacketParser &parser);
 
     bool isADuplicated(const uint64_t & id) {
+        return isADuplicated(id, Clock::now());
+    }
+
+    bool isADuplicated(uint64_t id, Clock::time_point now) {
         const std::lock_guard<std::mutex> lock(_mutex);
-        return _pktidset.insert(id).second == false;
+
+        while (!_pktidHistory.empty() &&
+               (now - _pktidHistory.front().second >= _retention || _pktidHistory.size() >= PKTID_HISTORY_MAX))
+        {
+            _pktidset.erase(_pktidHistory.front().first);
+            _pktidHistory.pop_front();
+        }
+
+        if (!_pktidset.insert(id).second)
+            return true;
+
+        _pktidHistory.emplace_back(id, now);
+
+        return false;
     }
 
 private:
@@ -156,4 +353,6 @@ private:
     std::mutex _mutex;
     uint64_t _pktcnt{0};
     std::unordered_set<uint64_t> _pktidset;
+    std::deque<std::pair<uint64_t, Clock::time_point>> _pktidHistory;
+    std::chrono::milliseconds _retention;
 };
\ No newline at end of file
@@ -0,0 +1,179 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include "Config.h"
+#include "IpPacketParser.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+/* -- config example --
+
+[etcs]
+src_prefix = "10.1.0.0/16, 10.3.0.0/24" # fields not given match anything
+dst_prefix = "10.2.0.0/16"
+protocol   = "udp"             # "tcp", "udp", "icmp" or a protocol number
+src_ports  = "5000-5010"
+dst_ports  = "5000-5010, 6000"
+dscp       = "46, 48"
+
+*/
+
+/**
+ * Classifies inner packets against an ordered list of rules.
+ * Rules are compiled in per-field lookup tables (a multibit trie for each
+ * address, indexed interval tables for ports, direct tables for protocol
+ * and DSCP), each yielding the bitset of rules matching that field.
+ * A packet matches the rules set in every bitset; the first of them wins.
+ * Each bitset starts with a summary of its non-empty words, so that only
+ * the words where every field has some rule are ANDed.
+ */
+class PolicyClassifier
+{
+public:
+   static constexpr int NO_MATCH = -1;
+
+   struct Prefix
+   {
+      uint32_t addr = 0; // host byte order
+      unsigned len = 0;
+   };
+
+   struct PortRange
+   {
+      uint16_t first = 0;
+      uint16_t last = 0xffff;
+   };
+
+   // Empty lists (and a negative protocol) match anything
+   struct Rule
+   {
+      std::vector<Prefix> srcPrefixes;
+      std::vector<Prefix> dstPrefixes;
+      int protocol = -1;
+      std::vector<PortRange> srcPorts;
+      std::vector<PortRange> dstPorts;
+      std::vector<uint8_t> dscps;
+   };
+
+   PolicyClassifier() = default;
+
+   // Compiles the rules; their position is their priority
+   explicit PolicyClassifier(const std::vector<Rule> &rules);
+
+   // Returns the index of the first matching rule or NO_MATCH
+   int classify(const IpPacketParser &ipParser) const noexcept
+   {
+      if (_words == 0 || !ipParser.isValid())
+         return NO_MATCH;
+
+      const bool hasPorts = ipParser.hasTransportHeader();
+
+      return classify(ipParser.getU32SrcAddr(), ipParser.getU32DstAddr(), ipParser.getProtocol(),
+                      hasPorts, hasPorts ? ipParser.getSrcPort() : 0, hasPorts ? ipParser.getDstPort() : 0,
+                      ipParser.getDscp());
+   }
+
+   int classify(uint32_t srcAddr, uint32_t dstAddr, uint8_t protocol,
+                bool hasPorts, uint16_t srcPort, uint16_t dstPort,
+                uint8_t dscp) const noexcept;
+
+   size_t size() const noexcept
+   {
+      return _rules;
+   }
+
+   // Parses the rule fields of a config section.
+   // Returns false on syntax errors.
+   static bool parseRule(const Config::ConfigNamespacedParagraph &namespace_data, Rule &rule);
+
+private:
+   using SetId = uint32_t; // offset of a bitset in _sets
+
+   struct TrieEntry
+   {
+      int32_t child = -1;
+      SetId set = 0;
+   };
+
+   // 4 bits per level, so an address is resolved in at most 8 steps
+   using TrieNode = std::array<TrieEntry, 16>;
+
+   struct PortTable
+   {
+      std::vector<uint16_t> bounds; // first port of each interval
+      std::vector<SetId> sets;      // rules matching each interval
+      SetId noPortsSet = 0;         // rules not constraining the ports
+
+      // Interval containing the first port of each 256-port block, so
+      // that a lookup only searches the intervals of a block
+      std::array<uint32_t, 257> blocks{};
+   };
+
+   // Bit w of a set summary is set if word w has some rule (the last
+   // bit stands for all the words from there on)
+   static constexpr size_t SUMMARY_BITS = 64;
+
+   size_t _rules = 0;
+   size_t _words = 0;           // 64-bit words per bitset
+   std::vector<uint64_t> _sets; // distinct bitsets: a summary, then _words
+
+   std::vector<TrieNode> _srcTrie;
+   std::vector<TrieNode> _dstTrie;
+   PortTable _srcPorts;
+   PortTable _dstPorts;
+   std::array<SetId, 256> _protocolSets{};
+   std::array<SetId, 64> _dscpSets{};
+
+   static SetId lookup(const std::vector<TrieNode> &trie, uint32_t addr) noexcept
+   {
+      const TrieNode *node = &trie[0];
+
+      for (int shift = 28;; shift -= 4)
+      {
+         const TrieEntry &entry = (*node)[(addr >> shift) & 0xf];
+
+         if (entry.child < 0)
+            return entry.set;
+
+         node = &trie[entry.child];
+      }
+   }
+
+   static SetId lookup(const PortTable &table, bool hasPorts, uint16_t port) noexcept
+   {
+      if (!hasPorts)
+         return table.noPortsSet;
+
+      const uint32_t first = table.blocks[port >> 8];
+      const uint16_t *base = &table.bounds[first];
+      size_t n = table.blocks[(port >> 8) + 1] - first + 1;
+
+      // Branchless search of the last interval starting at or before port
+      while (n > 1)
+      {
+         const size_t half = n / 2;
+         base = base[half] <= port ? base + half : base;
+         n -= half;
+      }
+
+      return table.sets[size_t(base - table.bounds.data())];
+   }
+
+   class Builder;
+};
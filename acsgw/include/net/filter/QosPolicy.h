@@ -0,0 +1,123 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include "Config.h"
+#include "IpPacketParser.h"
+#include "TrafficClass.h"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/* -------------------------------------------------------------------------- */
+
+/* -- config example --
+
+[qos]
+critical_deadline_ms    = 300   # queued frames older than this are dropped
+interactive_deadline_ms = 1000
+default_deadline_ms     = 3000
+bulk_deadline_ms        = 0     # 0 means no deadline
+
+critical_dscp           = "46, 48, 56" # inner DSCP values of the class
+critical_ports          = "5000-5010"  # inner src/dst ports (win over DSCP)
+
+interactive_weight      = 4     # WFQ share among non critical classes
+default_weight          = 2     # (critical is always served first)
+bulk_weight             = 1
+
+critical_outer_dscp     = 46    # DSCP of the bearer packets of the class
+critical_so_priority    = 6     # SO_PRIORITY of the bearer packets
+
+bulk_rate_kbps          = 2000  # rate ceiling of the class on each bearer
+bulk_burst_kb           = 64    # (0 = no ceiling)
+
+*/
+
+// Bytes a WFQ class may send per round and per unit of weight
+#define WFQ_QUANTUM_BYTES 1500
+
+/**
+ * Gateway-wide quality of service settings of each traffic class
+ */
+class QosPolicy
+{
+   QosPolicy();
+   QosPolicy(const QosPolicy &) = delete;
+   QosPolicy &operator=(const QosPolicy &) = delete;
+
+public:
+   struct ClassPolicy
+   {
+      // Maximum time a frame can wait in a transmit queue (0 = unlimited)
+      std::chrono::milliseconds deadline{0};
+
+      // WFQ weight (not used by the critical class, strictly prioritised)
+      unsigned weight = 1;
+
+      // Marking of the outer (bearer) packets (-1 = leave unchanged)
+      int outerDscp = -1;
+      int socketPriority = -1;
+
+      // Rate ceiling on each bearer, in bytes per second (0 = unlimited),
+      // and its burst in bytes
+      uint64_t rate = 0;
+      size_t burst = 0;
+
+      // Time the small packets of the class wait for others to be bundled
+      // with, on the bearers which bundle them (0 = bundled only with the
+      // packets already queued)
+      std::chrono::microseconds bundleDelay{0};
+   };
+
+   using Quanta = std::array<size_t, TRAFFIC_CLASS_COUNT>;
+
+   static QosPolicy &getInstance();
+
+   bool configure(const Config &config);
+
+   const ClassPolicy &getClassPolicy(TrafficClass tc) const noexcept
+   {
+      return _classes[size_t(tc)];
+   }
+
+   std::chrono::milliseconds getDeadline(TrafficClass tc) const noexcept
+   {
+      return getClassPolicy(tc).deadline;
+   }
+
+   // WFQ quantum (bytes per round) of each class
+   Quanta getQuanta() const noexcept
+   {
+      Quanta quanta;
+
+      for (size_t i = 0; i < TRAFFIC_CLASS_COUNT; ++i)
+         quanta[i] = size_t(_classes[i].weight) * WFQ_QUANTUM_BYTES;
+
+      return quanta;
+   }
+
+   TrafficClass classify(const IpPacketParser &ipParser) const noexcept
+   {
+      return ipParser.isValid() ? ipParser.getTrafficClass(_classMap) : TrafficClass::Default;
+   }
+
+private:
+   std::array<ClassPolicy, TRAFFIC_CLASS_COUNT> _classes;
+   TrafficClassMap _classMap;
+
+   bool parseClassMap(const std::string &className, TrafficClass tc,
+                      const Config::ConfigNamespacedParagraph &namespace_data);
+};
@@ -0,0 +1,140 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Priority classes of inner (tunnelled) traffic, higher priority first
+ */
+enum class TrafficClass : uint8_t
+{
+   Critical,    // railway signalling (i.e. ETCS), network control
+   Interactive, // voice, telemetry, interactive sessions
+   Default,     // best effort
+   Bulk         // video, file transfers, background traffic
+};
+
+constexpr size_t TRAFFIC_CLASS_COUNT = 4;
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Maps an inner DSCP code point to its default traffic class
+ * (CS6, CS7 and EF are critical; CS4, CS5, AF3x, AF4x are interactive;
+ * CS1 is bulk; everything else is best effort)
+ */
+inline TrafficClass dscpToTrafficClass(uint8_t dscp) noexcept
+{
+   switch (dscp)
+   {
+   case 46: // EF
+   case 48: // CS6
+   case 56: // CS7
+      return TrafficClass::Critical;
+
+   case 32: // CS4
+   case 34: // AF41
+   case 36: // AF42
+   case 38: // AF43
+   case 40: // CS5
+   case 26: // AF31
+   case 28: // AF32
+   case 30: // AF33
+      return TrafficClass::Interactive;
+
+   case 8: // CS1
+      return TrafficClass::Bulk;
+
+   default:
+      return TrafficClass::Default;
+   }
+}
+
+/* -------------------------------------------------------------------------- */
+
+inline const char *trafficClassName(TrafficClass tc) noexcept
+{
+   switch (tc)
+   {
+   case TrafficClass::Critical:
+      return "critical";
+   case TrafficClass::Interactive:
+      return "interactive";
+   case TrafficClass::Bulk:
+      return "bulk";
+   case TrafficClass::Default:
+   default:
+      return "default";
+   }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Configurable classification of inner packets.
+ * Port rules (matching either source or destination port) take precedence
+ * over the DSCP table, which defaults to dscpToTrafficClass().
+ */
+class TrafficClassMap
+{
+public:
+   struct PortRule
+   {
+      uint16_t first = 0;
+      uint16_t last = 0;
+      TrafficClass tc = TrafficClass::Default;
+   };
+
+   TrafficClassMap() noexcept
+   {
+      for (size_t dscp = 0; dscp < _dscpTable.size(); ++dscp)
+         _dscpTable[dscp] = dscpToTrafficClass(uint8_t(dscp));
+   }
+
+   void setDscpClass(uint8_t dscp, TrafficClass tc) noexcept
+   {
+      _dscpTable[dscp & 0x3f] = tc;
+   }
+
+   void addPortRule(uint16_t first, uint16_t last, TrafficClass tc)
+   {
+      _portRules.push_back({first, last, tc});
+   }
+
+   // Ports are ignored if hasPorts is false (i.e. ICMP, non-first fragments)
+   TrafficClass classify(uint8_t dscp, bool hasPorts, uint16_t srcPort, uint16_t dstPort) const noexcept
+   {
+      if (hasPorts)
+      {
+         for (const auto &rule : _portRules)
+         {
+            if ((srcPort >= rule.first && srcPort <= rule.last) ||
+                (dstPort >= rule.first && dstPort <= rule.last))
+               return rule.tc;
+         }
+      }
+
+      return _dscpTable[dscp & 0x3f];
+   }
+
+private:
+   std::array<TrafficClass, 64> _dscpTable;
+   std::vector<PortRule> _portRules;
+};
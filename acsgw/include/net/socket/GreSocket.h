@@ -41,6 +41,33 @@ public:
 
    typedef uint16_t PortType;
 
+   enum
+   {
+      BASE_HEADER_LEN = 4,
+      MAX_HEADER_LEN = 16 // with checksum, key and sequence number
+   };
+
+   // Optional GRE key (RFC 2890), which tells apart tunnels between
+   // the same pair of addresses
+   struct Key
+   {
+      bool present = false;
+      uint32_t value = 0;
+
+      bool operator<(const Key &other) const noexcept
+      {
+         return present != other.present ? present < other.present : value < other.value;
+      }
+   };
+
+   // Optional GRE sequence number (RFC 2890), which numbers the packets
+   // of a measured bearer
+   struct Sequence
+   {
+      bool present = false;
+      uint32_t value = 0;
+   };
+
 private:
    int _sock = -1;
 
@@ -96,14 +123,73 @@ public:
        const IpAddress &ip,
        int flags = 0) const noexcept;
 
+   // Sends a packet to be released at departureNs (monotonic clock) by
+   // the egress qdisc. The socket must have SO_TXTIME set.
+   int sendAt(
+       const char *buf,
+       int len,
+       const IpAddress &ip,
+       uint64_t departureNs,
+       int flags = 0) const noexcept;
+
+   // Receives an IPv4-over-GRE packet: the inner packet starts at
+   // payloadOffset and its length is returned (0 if the packet is not
+   // an IPv4-over-GRE one, -1 on error). With SO_RXQ_OVFL set,
+   // kernelDrops (if not null) gets the packets the kernel has dropped on
+   // the socket so far.
    int recvfrom(
        char *buf,
        int len,
        IpAddress &src_addr,
        int &payloadOffset,
-       int flags = 0) const noexcept;
+       Key &key,
+       Sequence &seq,
+       int flags = 0,
+       uint32_t *kernelDrops = nullptr) const noexcept;
+
+   // Writes the header of an IPv4-over-GRE packet (buf must hold
+   // MAX_HEADER_LEN bytes), with a sequence number field if sequenced
+   // (see setSequence()). Returns its length.
+   static int makeHeader(char *buf, const Key &key, bool sequenced = false) noexcept;
+
+   // Sets the sequence number of a header made by makeHeader(). Returns
+   // false if the header has no sequence number field.
+   static bool setSequence(char *header, size_t len, uint32_t seq) noexcept;
+
+   // True if a header made by makeHeader() has a sequence number field
+   static bool isSequenced(const char *header, size_t len) noexcept;
 
    bool bind(
        const IpAddress &ip = IpAddress(INADDR_ANY),
        bool reuse_addr = true) const noexcept;
+
+   // Received packets only come from ip
+   bool connect(const IpAddress &ip) const noexcept;
+
+   // Drops in the kernel the packets which are not IPv4-over-GRE ones
+   bool attachGreFilter() const noexcept;
+
+   // Drops in the kernel every received packet (for sockets used to
+   // transmit only)
+   bool setSendOnly() const noexcept;
+
+   bool setBusyPoll(int usecs) const noexcept;
+
+   bool setTrafficMarking(int dscp, int priority) const noexcept;
+
+   // Packets are sent with the DF bit set (no fragmentation on the path)
+   bool setDontFragment() const noexcept;
+
+   // Sent packets may carry a departure time (see sendAt())
+   bool setTxTime() const noexcept;
+
+   // Socket buffer sizes, see Tools::setSocketBuffer()
+   bool setBufferSize(bool receive, size_t bytes) const noexcept;
+   int bufferSize(bool receive) const noexcept;
+
+   // Received packets carry the kernel drop counter (see recvfrom())
+   bool setRxQueueOverflow() const noexcept;
+
+   // Bytes queued for sending in the kernel (-1 on error)
+   int sendQueueBytes() const noexcept;
 };
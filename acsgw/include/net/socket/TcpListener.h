@@ -61,11 +61,13 @@ public:
     /**
      * Returns a handle to a new listener object.
      *
+     * @param mptcp Listen for Multipath TCP connections (plain TCP ones
+     *              are accepted too), if the kernel supports it
      * @return the handle to a new listenr object instance
      */
-    static Handle create()
+    static Handle create(bool mptcp = false)
     {
-        return Handle(new TcpListener());
+        return Handle(new TcpListener(mptcp));
     }
 
     /**
@@ -91,5 +93,5 @@ public:
 private:
     std::atomic<Status> _status;
 
-    TcpListener();
+    explicit TcpListener(bool mptcp);
 };
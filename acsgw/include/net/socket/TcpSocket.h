@@ -63,11 +63,21 @@ public:
 
     bool connect();
 
+    // True if the connection runs Multipath TCP, i.e. the socket is an
+    // MPTCP one and neither end fell back to plain TCP
+    bool isMptcp() const;
+
     // Create a new socket
-    static Handle make(bool disableTcpDelay = true);
+    static Handle make(bool disableTcpDelay = true, bool mptcp = false);
+
+    // Create a new client socket. If mptcp, the socket is an MPTCP one
+    // unless the kernel does not support it (see openStream()).
+    static Handle make(const std::string& remoteAddr, const Port& Port, 
+                       bool disableTcpDelay = true, bool mptcp = false);
 
-    // Create a new client socket
-    static Handle make(const std::string& remoteAddr, const Port& Port, bool disableTcpDelay = true);
+    // Opens a stream socket, MPTCP if mptcp and the kernel supports it,
+    // TCP otherwise. Returns the descriptor (-1 on error).
+    static int openStream(bool mptcp);
 
     // Sends a string on this socket
     TcpSocket& operator<<(const std::string& text);
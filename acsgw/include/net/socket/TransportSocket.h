@@ -104,6 +104,17 @@ public:
         return bind("", port);
     }
 
+    bool setBusyPoll(int usecs) noexcept;
+
+    bool setTrafficMarking(int dscp, int priority) noexcept;
+
+    // Socket buffer sizes, see Tools::setSocketBuffer(). For TCP, setting
+    // a size disables the kernel autotuning of that buffer.
+    bool setBufferSize(bool receive, size_t bytes) noexcept;
+
+    // Bytes sent but not yet acknowledged by the peer (-1 on error)
+    int sendQueueBytes() const noexcept;
+
 private:
     SocketFd _socket = 0;
     enum
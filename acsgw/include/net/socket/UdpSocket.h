@@ -29,6 +29,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <cstdint>
+#include <sys/uio.h>
+#include <linux/filter.h>
 
 
 /* -------------------------------------------------------------------------- */
@@ -45,6 +47,9 @@ class UdpSocket
 
       typedef uint16_t PortType;
 
+      // Datagrams moved by a single sendBatch()/recvBatch() call
+      enum { MAX_BATCH = 64 };
+
    private:
       int _sock = -1;
 
@@ -105,6 +110,16 @@ class UdpSocket
           PortType port,
           int flags = 0) const noexcept;
 
+      // Sends a datagram to be released at departureNs (monotonic clock)
+      // by the egress qdisc. The socket must have SO_TXTIME set.
+      int sendAt(
+          const char *buf,
+          int len,
+          const IpAddress &ip,
+          PortType port,
+          uint64_t departureNs,
+          int flags = 0) const noexcept;
+
       int recvfrom(
           char *buf,
           int len,
@@ -112,9 +127,65 @@ class UdpSocket
           PortType &src_port,
           int flags = 0) const noexcept;
 
+      // Sends count datagrams (at most MAX_BATCH) with a single system
+      // call. Returns the number of datagrams sent, or -1 on error.
+      // If departuresNs is given, the i-th datagram is released at
+      // departuresNs[i] (see sendAt()).
+      int sendBatch(
+          const iovec *datagrams,
+          int count,
+          const IpAddress &ip,
+          PortType port,
+          int flags = 0,
+          const uint64_t *departuresNs = nullptr) const noexcept;
+
+      // Receives up to count datagrams (at most MAX_BATCH) with a single
+      // system call: the i-th one is stored in buffers[i], its length in
+      // lens[i] and its source in src_addrs[i]:src_ports[i]. With
+      // SO_RXQ_OVFL set, kernelDrops (if not null) gets the datagrams the
+      // kernel has dropped on the socket so far.
+      // Returns the number of datagrams received, or -1 on error.
+      int recvBatch(
+          const iovec *buffers,
+          int *lens,
+          IpAddress *src_addrs,
+          PortType *src_ports,
+          int count,
+          int flags = 0,
+          uint32_t *kernelDrops = nullptr) const noexcept;
+
       bool bind(
           PortType &port,
           const IpAddress &ip = IpAddress(INADDR_ANY),
           bool reuse_addr = true) const noexcept;
+
+      // Lets sockets bound to the same address and port share its
+      // datagrams (SO_REUSEPORT). Call before bind().
+      bool setReusePort() const noexcept;
+
+      // Selects which socket of the SO_REUSEPORT group receives a
+      // datagram: prog sees the UDP payload and returns the socket
+      // index, in bind() order
+      bool attachReusePortFilter(const struct sock_fprog &prog) const noexcept;
+
+      bool setBusyPoll(int usecs) const noexcept;
+
+      bool setTrafficMarking(int dscp, int priority) const noexcept;
+
+      // Packets are sent with the DF bit set (no fragmentation on the path)
+      bool setDontFragment() const noexcept;
+
+      // Sent datagrams may carry a departure time (see sendAt())
+      bool setTxTime() const noexcept;
+
+      // Socket buffer sizes, see Tools::setSocketBuffer()
+      bool setBufferSize(bool receive, size_t bytes) const noexcept;
+      int bufferSize(bool receive) const noexcept;
+
+      // Received datagrams carry the kernel drop counter (see recvBatch())
+      bool setRxQueueOverflow() const noexcept;
+
+      // Bytes queued for sending in the kernel (-1 on error)
+      int sendQueueBytes() const noexcept;
 };
 
@@ -0,0 +1,134 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include "MpTunnel.h"
+#include "Metrics.h"
+#include "TrafficClass.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Active-backup selection of the bearers of a tunnel.
+ * A single bearer (the active one) carries the traffic, the others are
+ * kept warm: TCP bearers stay connected and every idle bearer sends
+ * keepalives, so that each one is known to be up or down (see
+ * TunnelPath::isUp()).
+ * The active bearer is the most preferred one (by configuration order)
+ * which is up. As soon as it goes down the next one takes over, and the
+ * packets sent on the failed bearer since it may have stopped working
+ * are replayed on the new one, the peer dropping the copies which got
+ * through. A recovered bearer is preferred again (preemption) only
+ * after it has been up for the hold-down time.
+ * Used by the tunnel transmitter only, so it is not thread safe.
+ */
+class ActiveBackup
+{
+public:
+   using Handle = std::shared_ptr<ActiveBackup>;
+   using Clock = std::chrono::steady_clock;
+   using Bearers = std::list<TunnelPath::Handle>;
+
+   ActiveBackup(const std::string &name, const ActiveBackupSettings &settings);
+
+   const ActiveBackupSettings &settings() const noexcept
+   {
+      return _settings;
+   }
+
+   // Elects the active bearer. Returns true on a failover, i.e. if the
+   // previous active bearer has gone down.
+   bool elect(const Bearers &bearers, Clock::time_point now);
+
+   // Slot of the active bearer (-1 = none yet)
+   int activeSlot() const noexcept
+   {
+      return _active;
+   }
+
+   // Bearer a packet of path is sent on: the active one or, if the path
+   // does not include it, the most preferred bearer of the path which is
+   // up. Returns -1 if the path has no bearer.
+   int select(const Bearers &bearers, const PathPolicy &path, Clock::time_point now) const noexcept;
+
+   // Keeps a copy of a packet sent on the active bearer
+   void remember(const char *packet, size_t len, uint64_t pktid, TrafficClass tc, Clock::time_point now);
+
+   // Calls send(packet, len, pktid, tc) for each packet sent on the
+   // failed bearer since it may have gone down, oldest first.
+   // Returns the number of packets replayed.
+   template <class Send>
+   size_t replay(Clock::time_point now, Send send)
+   {
+      const auto since = now - _settings.deadInterval - _settings.keepaliveInterval;
+      size_t replayed = 0;
+
+      for (size_t i = 0; i < _count; ++i)
+      {
+         auto &sent = _sent[(_head + i) % _sent.size()];
+
+         if (sent.at >= since)
+         {
+            send(sent.data.data(), sent.data.size(), sent.pktid, sent.tc);
+            ++replayed;
+         }
+      }
+
+      _count = 0;
+      Metrics::add(*_metrics.replayedPackets, replayed);
+
+      return replayed;
+   }
+
+   // GRE bearers carry inner packets only: their keepalive is a bare
+   // IPv4 header (protocol 253, RFC 3692) from and to 0.0.0.0.
+   // Returns the probe length.
+   static size_t makeGreProbe(char *buf) noexcept;
+   static bool isGreProbe(const char *packet, size_t len) noexcept;
+
+private:
+   struct SentPacket
+   {
+      Clock::time_point at;
+      uint64_t pktid = 0;
+      TrafficClass tc = TrafficClass::Default;
+      std::vector<char> data;
+   };
+
+   std::string _name;
+   ActiveBackupSettings _settings;
+   int _active = -1;
+
+   // Ring of the last packets sent on the active bearer
+   std::vector<SentPacket> _sent;
+   size_t _head = 0;
+   size_t _count = 0;
+
+   struct BackupMetrics
+   {
+      Metrics::Value *activeBearer = nullptr;
+      Metrics::Value *failovers = nullptr;
+      Metrics::Value *preemptions = nullptr;
+      Metrics::Value *replayedPackets = nullptr;
+   } _metrics;
+
+   void activate(const TunnelPath &tp, bool failover);
+};
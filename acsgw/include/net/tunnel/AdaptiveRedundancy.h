@@ -0,0 +1,115 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include "MpTunnel.h"
+#include "Metrics.h"
+#include "TrafficClass.h"
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+
+/* -------------------------------------------------------------------------- */
+
+// Copies sent of the packets of an adaptive tunnel
+enum class Redundancy
+{
+   Single,    // on the best bearer only
+   Selective, // the duplicated classes on every bearer, the others on the best one
+   Mirroring  // on every bearer
+};
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Adaptive redundancy of the bearers of a tunnel.
+ * Mirroring every packet on every bearer wastes bandwidth while the
+ * bearers are clean. The peer reports the loss and delay of each bearer
+ * (see BearerFeedback), which selects the redundancy level by the best
+ * bearer: the traffic goes on it alone while its loss is low, the
+ * duplicated classes (e.g. signalling) are mirrored once it exceeds the
+ * selective threshold and everything is above the mirroring one.
+ * Bearers without recent reports (including GTP and GRE ones, which are
+ * not measured) are not usable as the best one; with no usable bearer
+ * every packet is mirrored.
+ * Used by the tunnel transmitter only, so it is not thread safe.
+ */
+class AdaptiveRedundancy
+{
+public:
+   using Handle = std::shared_ptr<AdaptiveRedundancy>;
+   using Clock = std::chrono::steady_clock;
+   using Bearers = std::list<TunnelPath::Handle>;
+
+   AdaptiveRedundancy(const std::string &name, const AdaptiveSettings &settings);
+
+   const AdaptiveSettings &settings() const noexcept
+   {
+      return _settings;
+   }
+
+   // Re-evaluates the best bearer and the redundancy level, at most once
+   // per feedback interval. Returns true if the level has changed.
+   bool update(const Bearers &bearers, Clock::time_point now);
+
+   Redundancy level() const noexcept
+   {
+      return _level;
+   }
+
+   // Slot of the best bearer (-1 = none)
+   int bestSlot() const noexcept
+   {
+      return _best;
+   }
+
+   // True if the packets of class tc are sent on every bearer
+   bool mirrors(TrafficClass tc) const noexcept
+   {
+      return _level == Redundancy::Mirroring ||
+             (_level == Redundancy::Selective && (_settings.duplicateClasses >> unsigned(tc)) & 1);
+   }
+
+   // Bearer a packet of path which is not mirrored is sent on: the best
+   // one or, if the path does not include it, the path bearer with the
+   // lowest loss. Returns -1 if the path has no bearer.
+   int select(const Bearers &bearers, const PathPolicy &path, Clock::time_point now) const noexcept;
+
+   static const char *levelName(Redundancy level) noexcept;
+
+private:
+   std::string _name;
+   AdaptiveSettings _settings;
+   Redundancy _level = Redundancy::Mirroring;
+   int _best = -1;
+
+   Clock::time_point _updatedAt;
+   Clock::time_point _lowerSince; // since the bearers allow a lower level
+   bool _lowering = false;
+
+   struct AdaptiveMetrics
+   {
+      Metrics::Value *redundancy = nullptr;
+      Metrics::Value *changes = nullptr;
+      Metrics::Value *bestBearer = nullptr;
+   } _metrics;
+
+   // True if the bearer has been reported on recently
+   bool usable(const TunnelPath &tp, Clock::time_point now) const noexcept;
+
+   // Level required by the best bearer (nullptr = none usable)
+   Redundancy target(const TunnelPath *best) const noexcept;
+};
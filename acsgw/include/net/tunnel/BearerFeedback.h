@@ -0,0 +1,130 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+/* -------------------------------------------------------------------------- */
+
+#define FEEDBACK_INTV_MS 100 // reports on each bearer of the adaptive tunnels
+#define FEEDBACK_GRE_LEN 48  // GRE report: IPv4 header and FeedbackReport
+
+/* -------------------------------------------------------------------------- */
+
+// Report of the frames received on a bearer since the previous report,
+// sent back to the peer on the same bearer. Timestamps (microseconds,
+// wrapping) are echoed to measure the round trip time as in RTCP
+// (RFC 3550). Fields in network order.
+#pragma pack(push, 1)
+struct FeedbackReport
+{
+   uint32_t expected;      // frames sent by the peer (by bearer sequence)
+   uint32_t received;      // frames received
+   uint32_t timestamp;     // sender clock
+   uint32_t echoTimestamp; // last timestamp received from the peer (0 = none)
+   uint32_t echoDelay;     // time since it was received
+   uint32_t receivedBytes; // bytes of the frames received
+   uint32_t highestSeq;    // highest bearer sequence number received
+};
+#pragma pack(pop)
+
+// A report of the peer, as applied to the sender side
+struct FeedbackSample
+{
+   uint32_t expected = 0;
+   uint32_t received = 0;
+   uint32_t receivedBytes = 0;
+   int64_t intervalUs = 0; // covered by the report, peer clock (0 = unknown)
+   int64_t rttUs = -1;     // round trip time (-1 = none)
+   uint16_t highestSeq = 0;
+};
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Loss and delay measurement of a bearer.
+ * The receiver counts the frames received by bearer sequence number and
+ * periodically reports them to the peer, whose sender applies the
+ * reports: it gets the bearer loss rate (of its own frames) and round
+ * trip time, both smoothed. A bearer whose reports stop coming is not
+ * usable.
+ */
+class BearerFeedback
+{
+public:
+   using Clock = std::chrono::steady_clock;
+
+   // Counts a frame of bytes received with bearer sequence number seq
+   void countFrame(uint16_t seq, size_t bytes) noexcept;
+
+   // Report of the frames counted since the previous one
+   FeedbackReport makeReport(Clock::time_point now) noexcept;
+
+   // Applies a report of the peer on the frames sent on the bearer
+   FeedbackSample applyReport(const FeedbackReport &report, Clock::time_point now) noexcept;
+
+   // GRE bearers carry inner packets only: their reports follow a bare
+   // IPv4 header (protocol 254, RFC 3692) from and to 0.0.0.0, which
+   // buf must hold FEEDBACK_GRE_LEN bytes of. Returns the packet length.
+   static size_t makeGreReport(char *buf, const FeedbackReport &report) noexcept;
+
+   // True if packet is a GRE report, whose report is then copied
+   static bool parseGreReport(const char *packet, size_t len, FeedbackReport &report) noexcept;
+
+   bool reportDue(Clock::time_point now, std::chrono::milliseconds interval) const noexcept
+   {
+      return now.time_since_epoch().count() - _reportedAt >= Clock::duration(interval).count();
+   }
+
+   // True if a report of the peer was applied within maxAge
+   bool fresh(Clock::time_point now, Clock::duration maxAge) const noexcept
+   {
+      const int64_t at = _appliedAt;
+      return at != 0 && now.time_since_epoch().count() - at <= maxAge.count();
+   }
+
+   // Smoothed loss rate of the frames sent, in parts per million
+   uint32_t lossPpm() const noexcept
+   {
+      return _lossPpm;
+   }
+
+   // Smoothed round trip time in microseconds (-1 = unknown)
+   int64_t rttUs() const noexcept
+   {
+      return _rttUs;
+   }
+
+private:
+   // Receiver side, shared by the receive threads of the bearer
+   std::mutex _lock;
+   bool _started = false;
+   uint16_t _lastSeq = 0;
+   uint64_t _highest = 0;         // extended highest sequence number
+   uint64_t _reportedHighest = 0; // as of the previous report
+   uint32_t _received = 0;
+   uint32_t _receivedBytes = 0;
+
+   // Last timestamp of the peer, echoed in the reports
+   uint32_t _peerTimestamp = 0;
+   int64_t _peerTimestampAt = 0;
+   std::atomic<int64_t> _reportedAt{0};
+
+   // Sender side
+   std::atomic<int64_t> _appliedAt{0};
+   std::atomic<uint32_t> _lossPpm{0};
+   std::atomic<int64_t> _rttUs{-1};
+};
@@ -0,0 +1,171 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include "BearerFeedback.h"
+#include "Metrics.h"
+#include "TokenBucket.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+#define CC_FEEDBACK_INTV_MS   20    // reports on the bearers with congestion control
+#define CC_INITIAL_RATE_KBPS  1000
+#define CC_MIN_RATE_KBPS      64
+#define CC_MIN_CWND_KB        8
+#define CC_BW_WINDOW          10    // reports the bottleneck bandwidth is the highest of
+#define CC_MIN_RTT_WINDOW_S   10    // the minimum RTT expires after this long
+#define CC_MAX_QUEUE_DELAY_MS 50    // queueing delay on the path the sender drains above
+#define CC_LOSS_PPM           20000 // loss above which the bandwidth estimate is cut
+#define CC_SEQ_RING           4096  // frames in flight whose departure is remembered
+#define CC_INITIAL_RTT_MS     500   // round trip time assumed until measured
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Congestion control of a UDP or GRE bearer, modelled on BBR: the rate
+ * the peer receives at (the bottleneck bandwidth, highest over the last
+ * reports) and the minimum round trip time are measured from the peer
+ * feedback reports (see BearerFeedback). Frames are paced at that rate
+ * times a gain and the bytes in flight bound by a window of twice the
+ * bandwidth-delay product.
+ * The gain probes for more bandwidth at start up (doubling the rate per
+ * report until it no longer grows), then cycles around 1, briefly above
+ * to find more bandwidth and below to drain the queue that made.
+ * Delay bounds the queue on the path: while the round trip time exceeds
+ * the minimum one by more than CC_MAX_QUEUE_DELAY_MS the gain stays below
+ * 1, and heavy loss cuts the bandwidth estimate to the rate received.
+ * Reports of a sender which had little to send (application limited)
+ * never lower the estimate.
+ * If no report tells of frames received for twice the round trip time
+ * plus a report interval (i.e. the path or the peer is down), the bytes
+ * in flight are deemed lost: the window opens again and the bandwidth
+ * estimate is halved.
+ */
+class CongestionControl
+{
+public:
+   using Clock = std::chrono::steady_clock;
+
+   enum class State
+   {
+      Startup,
+      Drain,
+      ProbeBw
+   };
+
+   // Metrics are named after prefix (i.e. "bearer.<name>"), reports come
+   // every reportInterval
+   CongestionControl(const std::string &prefix, std::chrono::milliseconds reportInterval);
+
+   CongestionControl(const CongestionControl &) = delete;
+   CongestionControl &operator=(const CongestionControl &) = delete;
+
+   // Sender side, transmit thread only
+
+   // Waits up to timeout for the window to let a frame go (or for the
+   // frames in flight to be deemed lost). Returns false on timeout.
+   bool awaitWindow(std::chrono::milliseconds timeout);
+
+   // Accounts the frame of bytes sent with bearer sequence number seq
+   void onSend(uint16_t seq, size_t bytes) noexcept;
+
+   // Pacer at the current rate
+   TokenBucket &pacer() noexcept;
+
+   // Receiver side
+
+   // Applies a feedback report of the peer
+   void onFeedback(const FeedbackSample &sample, Clock::time_point now) noexcept;
+
+   // Pacing rate, in bytes per second
+   uint64_t rate() const noexcept
+   {
+      return _rate;
+   }
+
+   // True if the bytes in flight fill the window
+   bool windowFull() const noexcept
+   {
+      return _inflight >= _cwnd;
+   }
+
+   static const char *stateName(State state) noexcept;
+
+private:
+   const std::chrono::milliseconds _reportInterval;
+
+   std::mutex _lock;
+   std::condition_variable _windowCond;
+
+   // Cumulative bytes sent as of each frame (by sequence number)
+   std::vector<uint64_t> _sentAt;
+   uint64_t _sentBytes = 0;
+   uint64_t _sentAtReport = 0; // as of the previous report
+   uint16_t _nextSeq = 0;
+   bool _sending = false;
+   uint64_t _lostAt = 0; // bytes sent as of the latest loss timeout
+   uint16_t _highestSeq = 0; // highest frame reported received
+   Clock::time_point _progressAt; // since the frames in flight are unreported
+
+   State _state = State::Startup;
+   uint64_t _bw[CC_BW_WINDOW] = {0}; // delivery rate samples, bytes per second
+   size_t _bwNext = 0;
+   uint64_t _btlBw = 0;
+   uint64_t _fullBw = 0; // start up ends once the bandwidth stops growing
+   unsigned _fullBwReports = 0;
+   int64_t _minRttUs = -1;
+   Clock::time_point _minRttAt;
+   int64_t _rttUs = -1; // latest sample
+   unsigned _cycle = 0; // phase of the probing gain cycle
+   Clock::time_point _cycleAt;
+
+   std::atomic<uint64_t> _rate{uint64_t(CC_INITIAL_RATE_KBPS) * 1000 / 8};
+   std::atomic<uint64_t> _inflight{0};
+   std::atomic<uint64_t> _cwnd{UINT64_MAX};
+
+   // Transmit thread only
+   TokenBucket _pacer;
+
+   struct CcMetrics
+   {
+      Metrics::Value *state = nullptr;
+      Metrics::Value *rate = nullptr;
+      Metrics::Value *cwnd = nullptr;
+      Metrics::Value *inflight = nullptr;
+      Metrics::Value *minRttUs = nullptr;
+      Metrics::Value *lossTimeouts = nullptr;
+   } _metrics;
+
+   // Adds a delivery rate sample to the bandwidth filter
+   void addBwSample(uint64_t bw) noexcept;
+
+   // Pacing gain, in eighths
+   unsigned gain(Clock::time_point now) noexcept;
+
+   // Time after which unreported frames in flight are deemed lost
+   Clock::duration lossTimeout() const noexcept;
+
+   // Drops the frames in flight and cuts the bandwidth estimate
+   void onLossTimeout() noexcept;
+
+   void setState(State state) noexcept;
+};
@@ -0,0 +1,147 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include "BoundedQueue.h"
+#include "GreSocket.h"
+#include "IpAddress.h"
+#include "Metrics.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+#define GRE_INBOUND_QUEUE_LEN 4096 // packets per bearer
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Receiver shared by the GRE bearers of a local address.
+ * A raw GRE socket gets a copy of every GRE packet of the host, so there
+ * is a single one per local address, filtered in the kernel (see
+ * GreSocket::attachGreFilter()). Its packets are dispatched by remote
+ * address and GRE key to the inbound queues of the bearers: the cost
+ * of receiving does not depend on the number of GRE bearers.
+ */
+class GreDemux
+{
+public:
+   using Handle = std::shared_ptr<GreDemux>;
+
+   // Inner packet received for a bearer
+   struct Frame
+   {
+      std::vector<char> data;
+      IpAddress remoteAddr;
+      GreSocket::Sequence seq;
+   };
+
+   using Inbound = BoundedQueue<Frame, QueueMode::Spsc>;
+
+   // Route of a bearer, removed when destroyed
+   class Registration
+   {
+   public:
+      ~Registration();
+
+      Registration(const Registration &) = delete;
+      Registration &operator=(const Registration &) = delete;
+
+      Inbound &inbound() noexcept
+      {
+         return *_inbound;
+      }
+
+      // Times the socket stopped receiving (polling failed): when it
+      // changes, the consumers of inbound() are woken up and the bearer
+      // is to be taken down
+      uint32_t failures() const noexcept
+      {
+         return _demux->_failures;
+      }
+
+   private:
+      friend class GreDemux;
+
+      Registration(Handle demux, uint32_t remoteAddr, const GreSocket::Key &key,
+                   std::shared_ptr<Inbound> inbound);
+
+      Handle _demux;
+      uint32_t _remoteAddr = 0;
+      GreSocket::Key _key;
+      std::shared_ptr<Inbound> _inbound;
+   };
+
+   // Routes to the returned registration the packets received on
+   // localAddr from remoteAddr with key. Returns nullptr if the socket
+   // cannot be opened or if the route belongs to another bearer.
+   // A spin budget > 0 enables the busy-poll mode.
+   // The socket receive buffer is the largest rcvBuf the bearers ask for
+   // (0 = system default); while the kernel drops packets it doubles, up
+   // to the largest rcvBufMax.
+   static std::unique_ptr<Registration> registerBearer(
+      const IpAddress &localAddr,
+      const IpAddress &remoteAddr,
+      const GreSocket::Key &key,
+      std::chrono::microseconds spinBudget = std::chrono::microseconds(0),
+      size_t rcvBuf = 0,
+      size_t rcvBufMax = 0);
+
+   explicit GreDemux(const IpAddress &localAddr);
+   ~GreDemux();
+
+   GreDemux(const GreDemux &) = delete;
+   GreDemux &operator=(const GreDemux &) = delete;
+
+private:
+   using Route = std::pair<uint32_t, GreSocket::Key>; // remote address, key
+   using Routes = std::map<Route, std::shared_ptr<Inbound>>;
+
+   IpAddress _localAddr;
+   GreSocket _socket;
+   std::mutex _lock;
+   Routes _routes;
+   std::atomic_bool _stop{false};
+   std::unique_ptr<std::thread> _thread;
+   std::atomic<uint32_t> _failures{0};
+
+   // Receive buffer, guarded by _lock
+   size_t _rcvBuf = 0;
+   size_t _rcvBufMax = 0;
+
+   uint32_t _kernelDrops = 0; // receiving thread only
+
+   struct DemuxMetrics
+   {
+      Metrics::Value *unknownDrops = nullptr;
+      Metrics::Value *queueDrops = nullptr;
+      Metrics::Value *kernelDrops = nullptr;
+      Metrics::Value *rcvBufBytes = nullptr;
+   } _metrics;
+
+   bool open();
+   void setRcvBuf(size_t rcvBuf, size_t rcvBufMax);
+   void countKernelDrops(uint32_t drops);
+   bool addRoute(const Route &route, std::shared_ptr<Inbound> inbound);
+   void delRoute(const Route &route);
+   void notifyFailure();
+   void run();
+};
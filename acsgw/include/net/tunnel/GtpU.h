@@ -0,0 +1,171 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include "Gtp.h"
+
+#include <arpa/inet.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/* -------------------------------------------------------------------------- */
+
+// GTPv1-U (3GPP TS 29.281) encapsulation of the GTP bearers: inner
+// packets are T-PDUs, sent with the long header to carry a sequence number
+namespace GtpU {
+
+constexpr uint8_t FLAGS_V1 = 0x30; // version 1, protocol type GTP
+constexpr uint8_t FLAG_E = 0x04;   // extension header
+constexpr uint8_t FLAG_S = 0x02;   // sequence number
+constexpr uint8_t FLAG_PN = 0x01;  // N-PDU number
+
+constexpr uint8_t MSG_ECHO_REQUEST = 1;
+constexpr uint8_t MSG_ECHO_RESPONSE = 2;
+constexpr uint8_t MSG_ERROR_INDICATION = 26;
+constexpr uint8_t MSG_END_MARKER = 254;
+constexpr uint8_t MSG_TPDU = 255;
+
+constexpr uint8_t IE_RECOVERY = 14;
+
+constexpr size_t SHORT_HEADER_LEN = sizeof(gtp1_header_short);
+constexpr size_t LONG_HEADER_LEN = sizeof(gtp1_header_long);
+
+// Fields of a received message
+struct Message
+{
+   uint8_t type = 0;
+   uint32_t teid = 0;
+   bool hasSeq = false;
+   uint16_t seq = 0;
+   size_t payloadOffset = 0;
+   size_t payloadLen = 0;
+};
+
+// Id of a received T-PDU for the duplicate detection: copies sent on
+// bearers sharing the TEID have the same one. The flag keeps it apart
+// from the pktids of the UDP and TCP bearers.
+inline uint64_t makePktId(uint32_t teid, uint16_t seq) noexcept
+{
+   constexpr uint64_t GTP_PKTID_FLAG = uint64_t(1) << 48;
+
+   return GTP_PKTID_FLAG | uint64_t(teid) << 16 | seq;
+}
+
+// Builds the header of a T-PDU carrying len bytes
+inline void makeTpduHeader(gtp1_header_long &header, uint32_t teid, uint16_t seq, size_t len) noexcept
+{
+   header.flags = FLAGS_V1 | FLAG_S;
+   header.type = MSG_TPDU;
+   // The length counts the optional fields (seq, npdu, next) too
+   header.length = htons(uint16_t(len + LONG_HEADER_LEN - SHORT_HEADER_LEN));
+   header.tei = htonl(teid);
+   header.seq = htons(seq);
+   header.npdu = 0;
+   header.next = 0;
+}
+
+// Parses a GTPv1-U message, skipping any extension header.
+// Returns false if it is malformed.
+inline bool parse(const char *data, size_t len, Message &msg) noexcept
+{
+   if (len < SHORT_HEADER_LEN)
+      return false;
+
+   gtp1_header_short header;
+   memcpy(&header, data, sizeof(header));
+
+   // GTP' and other versions are not accepted
+   if ((header.flags & 0xf0) != FLAGS_V1)
+      return false;
+
+   const size_t msgLen = SHORT_HEADER_LEN + ntohs(header.length);
+
+   if (msgLen > len)
+      return false;
+
+   msg.type = header.type;
+   msg.teid = ntohl(header.tei);
+   msg.hasSeq = header.flags & FLAG_S;
+   msg.seq = 0;
+
+   size_t offset = SHORT_HEADER_LEN;
+
+   // Optional fields are present if any of E, S, PN is set
+   if (header.flags & (FLAG_E | FLAG_S | FLAG_PN))
+   {
+      if (msgLen < LONG_HEADER_LEN)
+         return false;
+
+      gtp1_header_long longHeader;
+      memcpy(&longHeader, data, sizeof(longHeader));
+
+      msg.seq = ntohs(longHeader.seq);
+      offset = LONG_HEADER_LEN;
+
+      uint8_t next = (header.flags & FLAG_E) ? longHeader.next : 0;
+
+      // Extension header length is in 4 byte units, the last byte is
+      // the type of the next one
+      while (next != 0)
+      {
+         if (offset >= msgLen)
+            return false;
+
+         const size_t extLen = size_t(uint8_t(data[offset])) * 4;
+
+         if (extLen == 0 || offset + extLen > msgLen)
+            return false;
+
+         next = uint8_t(data[offset + extLen - 1]);
+         offset += extLen;
+      }
+   }
+
+   msg.payloadOffset = offset;
+   msg.payloadLen = msgLen - offset;
+
+   return true;
+}
+
+// Builds an Echo Request, i.e. a keepalive of the path (buf must hold
+// LONG_HEADER_LEN bytes). Returns its length.
+inline size_t makeEchoRequest(uint16_t seq, char *buf) noexcept
+{
+   gtp1_header_long header;
+   makeTpduHeader(header, 0, seq, 0);
+   header.type = MSG_ECHO_REQUEST;
+
+   memcpy(buf, &header, sizeof(header));
+
+   return sizeof(header);
+}
+
+// Builds the Echo Response to an Echo Request (buf must hold
+// LONG_HEADER_LEN + 2 bytes). Returns its length.
+inline size_t makeEchoResponse(const Message &request, char *buf) noexcept
+{
+   constexpr size_t RECOVERY_IE_LEN = 2; // type, restart counter (always 0)
+
+   gtp1_header_long header;
+   makeTpduHeader(header, 0, request.seq, RECOVERY_IE_LEN);
+   header.type = MSG_ECHO_RESPONSE;
+
+   memcpy(buf, &header, sizeof(header));
+   buf[sizeof(header)] = char(IE_RECOVERY);
+   buf[sizeof(header) + 1] = 0;
+
+   return sizeof(header) + RECOVERY_IE_LEN;
+}
+
+} // namespace GtpU
@@ -0,0 +1,230 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include "Config.h"
+#include "Metrics.h"
+#include "TrafficClass.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+/* -------------------------------------------------------------------------- */
+
+/* -- config example --
+
+[memory]
+gateway_budget_kb       = 65536 # bytes queued by all the tunnels
+bulk_admit_pct          = 50    # a class is dropped once the gateway usage
+default_admit_pct       = 70    # exceeds its share of the budget
+interactive_admit_pct   = 90
+critical_admit_pct      = 100
+backpressure_timeout_ms = 100   # max time the TUN reader is held back
+
+*/
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Byte budget of a single queue
+ */
+class ByteBudget
+{
+public:
+   explicit ByteBudget(size_t limit = 0) noexcept : _limit(limit) {}
+
+   ByteBudget(const ByteBudget &) = delete;
+   ByteBudget &operator=(const ByteBudget &) = delete;
+
+   // 0 means unlimited
+   void setLimit(size_t limit) noexcept
+   {
+      _limit = limit;
+   }
+
+   size_t limit() const noexcept
+   {
+      return _limit;
+   }
+
+   size_t used() const noexcept
+   {
+      return _used.load(std::memory_order_relaxed);
+   }
+
+   // An empty queue always accepts a frame, even if larger than the limit
+   bool tryCharge(size_t bytes) noexcept
+   {
+      size_t cur = _used.load(std::memory_order_relaxed);
+
+      do
+      {
+         if (_limit > 0 && cur > 0 && cur + bytes > _limit)
+            return false;
+      } while (!_used.compare_exchange_weak(cur, cur + bytes, std::memory_order_relaxed));
+
+      return true;
+   }
+
+   // As tryCharge(), waiting up to timeout for bytes to be released
+   bool chargeWait(size_t bytes, std::chrono::milliseconds timeout)
+   {
+      if (tryCharge(bytes))
+         return true;
+
+      std::unique_lock<std::mutex> lock(_lock);
+      ++_waiters;
+
+      const bool charged = _released.wait_for(lock, timeout, [&]() { return tryCharge(bytes); });
+
+      --_waiters;
+
+      return charged;
+   }
+
+   void release(size_t bytes) noexcept
+   {
+      _used.fetch_sub(bytes, std::memory_order_relaxed);
+
+      // Pairs with the waiters registration in chargeWait()
+      if (_waiters.load() > 0)
+      {
+         std::lock_guard<std::mutex> guard(_lock);
+         _released.notify_all();
+      }
+   }
+
+private:
+   size_t _limit = 0;
+   std::atomic<size_t> _used{0};
+   std::atomic<unsigned> _waiters{0};
+   std::mutex _lock;
+   std::condition_variable _released;
+};
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Bytes charged to a queue and to the gateway budget.
+ * Charge is given back when the object is destroyed, so a queued frame
+ * releases its memory whatever path it leaves the queue through.
+ */
+class MemoryCharge
+{
+public:
+   MemoryCharge() = default;
+
+   MemoryCharge(ByteBudget *queueBudget, size_t bytes, bool global) noexcept :
+      _queueBudget(queueBudget), _bytes(bytes), _global(global)
+   {
+   }
+
+   MemoryCharge(MemoryCharge &&other) noexcept
+   {
+      *this = std::move(other);
+   }
+
+   MemoryCharge &operator=(MemoryCharge &&other) noexcept;
+
+   MemoryCharge(const MemoryCharge &) = delete;
+   MemoryCharge &operator=(const MemoryCharge &) = delete;
+
+   ~MemoryCharge()
+   {
+      reset();
+   }
+
+   size_t bytes() const noexcept
+   {
+      return _bytes;
+   }
+
+   void reset() noexcept;
+
+   // Takes over the charge of other, if to the same budgets (otherwise
+   // other keeps it)
+   void merge(MemoryCharge &&other) noexcept;
+
+private:
+   ByteBudget *_queueBudget = nullptr;
+   size_t _bytes = 0;
+   bool _global = false;
+};
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Gateway-wide memory budget for queued tunnel frames.
+ * When the usage crosses the admission threshold of a class, frames of
+ * that class are dropped (lower classes first). Critical frames above the
+ * budget hold back the caller (i.e. the TUN reader) until some memory is
+ * released, and are only dropped if that takes too long.
+ */
+class MemoryGovernor
+{
+   MemoryGovernor();
+   MemoryGovernor(const MemoryGovernor &) = delete;
+   MemoryGovernor &operator=(const MemoryGovernor &) = delete;
+
+public:
+   static MemoryGovernor &getInstance();
+
+   bool configure(const Config &config);
+
+   // Charges bytes to queueBudget and to the gateway budget.
+   // Returns an empty charge (bytes() == 0) if the frame must be dropped.
+   // If mayWait is true the caller can be held back as backpressure.
+   MemoryCharge admit(ByteBudget &queueBudget, size_t bytes, TrafficClass tc, bool mayWait);
+
+   // Charges bytes to queueBudget only. Used for inbound queues, whose
+   // readers push back on the remote sender by not reading the socket:
+   // the caller waits up to wait for the queue to be drained.
+   static MemoryCharge admitLocal(ByteBudget &queueBudget, size_t bytes,
+                                  std::chrono::milliseconds wait = std::chrono::milliseconds(0));
+
+   size_t budget() const noexcept
+   {
+      return _budget;
+   }
+
+   size_t used() const noexcept
+   {
+      return _used.load(std::memory_order_relaxed);
+   }
+
+private:
+   friend class MemoryCharge;
+
+   size_t _budget = 0; // 0 means unlimited
+   std::array<unsigned, TRAFFIC_CLASS_COUNT> _admitPct;
+   std::chrono::milliseconds _backpressureTimeout{100};
+
+   std::atomic<size_t> _used{0};
+   std::atomic<unsigned> _waiters{0};
+   std::mutex _lock;
+   std::condition_variable _roomAvailable;
+
+   struct
+   {
+      Metrics::Value *usedBytes = nullptr;
+      Metrics::Value *backpressureWaits = nullptr;
+      std::array<Metrics::Value *, TRAFFIC_CLASS_COUNT> drops{};
+   } _metrics;
+
+   bool tryCharge(size_t bytes, size_t limit) noexcept;
+   void release(size_t bytes) noexcept;
+};
@@ -12,6 +12,9 @@
 
 /* -------------------------------------------------------------------------- */
 
+#include "BearerFeedback.h"
+#include "CongestionControl.h"
+#include "GreDemux.h"
 #include "GreSocket.h"
 #include "UdpSocket.h"
 #include "TcpSocket.h"
@@ -19,21 +22,244 @@
 #include "VirtualIfMgr.h"
 #include "TcpConnectionMgr.h"
 #include "IpPacketParser.h"
-
+#include "MemoryGovernor.h"
+#include "PolicyClassifier.h"
+#include "SelectiveArq.h"
+#include "TokenBucket.h"
+#include "TunnelBundle.h"
+#include "TunnelFragment.h"
+#include "TxScheduler.h"
+#include "TimerWheel.h"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <thread>
 #include <mutex>
+#include <chrono>
 #include <string>
 #include <sstream>
 #include <map>
 #include <list>
 #include <memory>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+#define BEARER_TX_QUEUE_LEN 1024 // frame slots per class, memory is bound by the budget
+#define MAX_TUNNEL_BEARERS  64   // bearer sets are 64-bit masks
+#define TUN_DEFAULT_MTU     1500
+#define TUN_MIN_MTU         576  // IPv4 minimum datagram every host accepts
+#define PMTU_REFRESH_INTV   10   // seconds between path MTU probes
+#define BEARER_TX_BATCH     16   // frames sent by a single system call
+#define BEARER_RX_BATCH     8    // datagrams read by a single system call
+#define MAX_RX_SHARDS       16   // receive sockets of a UDP bearer
+#define KEEPALIVE_INTV_MS   100  // keepalives on the idle bearers of active-backup tunnels
+#define KEEPALIVE_TICK_MS   10   // keepalive timers resolution
+#define BEARER_DEAD_INTV_MS 300  // bearers silent for longer are down
+#define FAILBACK_HOLD_MS    5000 // a recovered bearer is preferred again after this
+#define REPLAY_MAX_PACKETS  256  // packets re-sent on the new bearer on failover
+#define SELECTIVE_LOSS_PPM  1000  // adaptive tunnels duplicate some classes above this loss
+#define MIRRORING_LOSS_PPM  10000 // and mirror everything above this one
+#define ADAPT_HOLD_MS       10000 // redundancy is lowered after this long below the thresholds
+#define COPY_MAX_DELAY_MS   1000 // delayed copies of the packets, see PathPolicy
+#define COPY_WHEEL_TICK_US  500  // resolution of their timers
+#define COPY_WHEEL_SLOTS    1024 // ticks of a timer wheel turn
+#define COPY_MAX_PENDING    8192 // copies waiting at once, further ones are dropped
+#define COPY_MAX_SKEW_MS    1000 // one-way delay of a bearer over the ones of the others
+#define PKTID_RETENTION_MS  (COPY_MAX_DELAY_MS + COPY_MAX_SKEW_MS) // received ids are deduplicated this long
+#define TXTIME_MAX_LEAD_US  2000 // departure times are set at most this far ahead
+#define ADMIT_MAX_WAIT_MS   1000 // frames of classes without deadline wait for the window
+#define SOCKBUF_MAX_KB      65536 // automatically sized socket buffers grow up to this
+#define SOCKBUF_SAMPLE_MS   100  // socket queues are sampled at most this often
+#define SOCKBUF_RTT_MS      100  // round trip time buffers are sized for, unless measured
 
 /* -------------------------------------------------------------------------- */
 
 enum class TunnelProtocol {
    Gre,
    Udp,
-   Tcp
+   Tcp,
+   Gtp  // GTP-U over UDP
+};
+
+// Criteria used to spread frames over the subflows of a TCP bearer
+enum class SubflowDispatch {
+   Flow,  // by inner flow hash, keeps per-flow ordering
+   Class  // critical traffic on the first subflow, the rest by flow hash
+};
+
+// How a packet is sent over the bearers selected for it
+enum class MultipathMode {
+   Mirroring,   // a copy on each bearer
+   Balanced,    // a single bearer, chosen by inner flow hash
+   ActiveBackup, // the most preferred bearer which is up, the others on standby
+   Adaptive      // single bearer or copies, by the loss measured on the bearers
+};
+
+// Bearers (by slot, i.e. position in the tunnel configuration) and
+// multipath mode used for a class of packets
+struct PathPolicy
+{
+   uint64_t bearers = ~uint64_t(0);
+   MultipathMode mode = MultipathMode::Mirroring;
+
+   // Time diversity: a copy of each packet is sent again after the delay
+   // (0 = none), on the bearer the packet was sent on or on copyBearer
+   // (slot). Radio losses come in bursts, which an immediate copy on the
+   // same bearer would likely fall in too.
+   std::chrono::milliseconds copyDelay{0};
+   int copyBearer = -1;
+
+   bool includes(size_t slot) const noexcept
+   {
+      return slot < MAX_TUNNEL_BEARERS && (bearers >> slot) & 1;
+   }
+};
+
+// Service-based path selection of a tunnel: packets matching the
+// classifier rule i follow paths[i], the others the default path
+struct TunnelPolicy
+{
+   using Handle = std::shared_ptr<const TunnelPolicy>;
+
+   PolicyClassifier classifier;
+   std::vector<PathPolicy> paths;
+   PathPolicy defaultPath;
+
+   const PathPolicy &select(const IpPacketParser &ipParser) const noexcept
+   {
+      const int rule = classifier.classify(ipParser);
+      return rule == PolicyClassifier::NO_MATCH ? defaultPath : paths[size_t(rule)];
+   }
+};
+
+// MTU settings of a tunnel device
+struct TunnelMtu
+{
+   int fixed = 0;        // configured MTU (0 = minimum usable bearer MTU)
+   bool mssClamp = true; // clamp the MSS of inner TCP SYNs to the MTU
+   int current = 0;      // MTU set on the device (0 = not set yet)
+
+   // UDP bearers split the packets exceeding their MTU in tunnel
+   // fragments, so they do not bound the device MTU
+   bool fragmentation = false;
+   std::chrono::milliseconds reassemblyTimeout{REASSEMBLY_TIMEOUT_MS};
+   size_t reassemblyMaxPackets = REASSEMBLY_MAX_PACKETS;
+};
+
+// Active-backup settings of a tunnel. Bearers are preferred in the
+// configuration order; standby bearers are kept up by keepalives.
+struct ActiveBackupSettings
+{
+   std::chrono::milliseconds keepaliveInterval{KEEPALIVE_INTV_MS};
+   std::chrono::milliseconds deadInterval{BEARER_DEAD_INTV_MS};
+
+   // Traffic goes back to a preferred bearer once it has been up for
+   // the hold-down time
+   bool preempt = true;
+   std::chrono::milliseconds holdDown{FAILBACK_HOLD_MS};
+
+   // Recent packets of a failed bearer are sent again on the new one
+   // (0 = none), the peer drops the copies which got through
+   size_t replayPackets = REPLAY_MAX_PACKETS;
+};
+
+class ActiveBackup;
+
+// Adaptive redundancy settings of a tunnel. The peer reports the loss
+// and delay of each bearer; the best one carries the traffic alone while
+// it is clean, the classes to duplicate are mirrored on every bearer as
+// its loss grows and then every packet is.
+struct AdaptiveSettings
+{
+   std::chrono::milliseconds feedbackInterval{FEEDBACK_INTV_MS};
+
+   // Loss rates (parts per million) of the best bearer above which the
+   // duplicated classes and then all of them are mirrored
+   uint32_t selectiveLossPpm = SELECTIVE_LOSS_PPM;
+   uint32_t mirroringLossPpm = MIRRORING_LOSS_PPM;
+
+   // Round trip time of the best bearer above which everything is
+   // mirrored (0 = no delay threshold)
+   std::chrono::milliseconds mirroringRtt{0};
+
+   // Redundancy is raised at once, lowered only after the bearers have
+   // stayed below the thresholds for the hold-down time
+   std::chrono::milliseconds holdDown{ADAPT_HOLD_MS};
+
+   // Traffic classes mirrored in selective mode (bit i = TrafficClass i)
+   uint32_t duplicateClasses = 1u << unsigned(TrafficClass::Critical);
+};
+
+class AdaptiveRedundancy;
+
+// Per-bearer tunables (set via bearer configuration section)
+struct BearerOptions
+{
+   size_t subflows = 1; // number of parallel TCP connections (TCP only)
+   SubflowDispatch subflowDispatch = SubflowDispatch::Flow;
+   size_t queueBudget = DEFAULT_QUEUE_BUDGET_KB * 1024; // bytes per direction
+   bool busyPoll = false; // spin on non-blocking reads before blocking
+   std::chrono::microseconds spinBudget{50};
+
+   // Sockets (and threads) receiving the bearer datagrams, which are
+   // spread by inner flow (UDP and GTP only)
+   size_t rxShards = 1;
+
+   // Transmit shaping and receive policing, rates in bytes per second
+   // (0 = unlimited) and bursts in bytes
+   uint64_t rate = 0;
+   size_t burst = 0;
+   uint64_t policeRate = 0;
+   size_t policeBurst = 0;
+
+   // Shaper of the whole tunnel, shared by its bearers (may be null)
+   std::shared_ptr<TokenBucket> tunnelShaper;
+
+   // GTP-U tunnel endpoint ids (GTP only): local is expected in
+   // received T-PDUs, remote is set in sent ones
+   uint32_t localTeid = 0;
+   uint32_t remoteTeid = 0;
+
+   // GRE key of the bearer packets, both ways (GRE only)
+   GreSocket::Key greKey;
+
+   // Keepalives sent while the bearer is idle (0 = none), and silence
+   // after which the bearer is down
+   std::chrono::milliseconds keepaliveInterval{0};
+   std::chrono::milliseconds deadInterval{BEARER_DEAD_INTV_MS};
+
+   // Feedback reports on the frames received, sent to the peer (0 = none,
+   // UDP and TCP only)
+   std::chrono::milliseconds feedbackInterval{0};
+
+   // Lost frames are retransmitted by selective ARQ (UDP only)
+   bool reliable = false;
+
+   // Connections are Multipath TCP ones, if the kernel supports it (TCP only)
+   bool mptcp = false;
+
+   // Frames carry their departure time (SO_TXTIME), released by the fq
+   // qdisc instead of being paced by the sender (UDP, GTP and GRE only)
+   bool txTime = false;
+
+   // Sending rate and bytes in flight follow the bandwidth and delay
+   // reported by the peer, see CongestionControl (UDP and GRE only, not
+   // reliable bearers, which have their own window)
+   bool congestionControl = false;
+
+   // Small packets of a class are sent together in bundles (UDP only)
+   bool bundling = false;
+
+   // Socket buffer sizes in bytes (0 = system default). Automatically
+   // sized buffers (UDP, GTP and GRE only) start there and grow with the
+   // bandwidth-delay product of the bearer, and while the kernel drops
+   // received datagrams or fills the send buffer. The GRE receive socket
+   // is shared by the bearers of a local address (see GreDemux).
+   size_t rcvBuf = 0;
+   size_t sndBuf = 0;
+   bool autoBuffers = false;
 };
 
 class TunnelPath
@@ -44,6 +270,23 @@ public:
    using GreSocketPtr = std::shared_ptr<GreSocket>;
    using UdpSocketPtr = std::shared_ptr<UdpSocket>;
 
+   // Frame queued on the transmit scheduler of a UDP, GTP or GRE bearer
+   struct TxFrame
+   {
+      TcpConnectionMgr::Buffer data;
+      MemoryCharge charge;
+      TrafficClass tc = TrafficClass::Default;
+      std::chrono::steady_clock::time_point queuedAt;
+
+      size_t size() const noexcept
+      {
+         return data.size();
+      }
+   };
+
+   using TxQueue = TxScheduler<TxFrame>;
+   using Clock = std::chrono::steady_clock;
+
    enum class Exception
    {
       BINDING_SOCKET_ERROR,
@@ -58,6 +301,9 @@ public:
       int _localPort = -1;
       int _remotePort = -1;
       TunnelProtocol _tunnelProtocol = TunnelProtocol::Gre;
+      BearerOptions _options;
+      std::string _name;
+      size_t _slot = 0;
 
       Bearer() = delete;
 
@@ -90,16 +336,37 @@ public:
          return _tunnelProtocol;
       }
 
+      const BearerOptions &options() const noexcept
+      {
+         return _options;
+      }
+
+      const std::string &name() const noexcept
+      {
+         return _name;
+      }
+
+      size_t slot() const noexcept
+      {
+         return _slot;
+      }
+
       explicit inline Bearer(const IpAddress &lip, 
                              const IpAddress &rip,
                              int localPort,
                              int remotePort,
-                             const TunnelProtocol& protocol) : 
+                             const TunnelProtocol& protocol,
+                             const BearerOptions& options = BearerOptions(),
+                             const std::string& name = std::string(),
+                             size_t slot = 0) : 
           _localAddr(lip),
           _remoteAddr(rip),
           _localPort(localPort),
           _remotePort(remotePort),
-          _tunnelProtocol(protocol)
+          _tunnelProtocol(protocol),
+          _options(options),
+          _name(name),
+          _slot(slot)
       {
       }
 
@@ -142,6 +409,27 @@ public:
       return _remotePort;
    }
 
+   const BearerOptions &options() const noexcept
+   {
+      return _options;
+   }
+
+   const std::string &name() const noexcept
+   {
+      return _name;
+   }
+
+   TunnelProtocol protocol() const noexcept
+   {
+      return _protocol;
+   }
+
+   // Position of the bearer in the tunnel configuration
+   size_t slot() const noexcept
+   {
+      return _slot;
+   }
+
    bool removeReqPending() const noexcept
    {
       return _remove_req_pending;
@@ -150,6 +438,12 @@ public:
    void notifyRemoveReqPending() noexcept
    {
       _remove_req_pending = true;
+
+      if (_txQueue)
+         _txQueue->wakeAll();
+
+      if (_greReceiver)
+         _greReceiver->inbound().wakeAll();
    }
 
    void lock() noexcept
@@ -196,9 +490,300 @@ public:
    bool makeTcpConnection() noexcept;
 
    GreSocketPtr getGreSocket() const noexcept { return _greSocket; }
+   GreDemux::Registration *getGreReceiver() const noexcept { return _greReceiver.get(); }
    UdpSocketPtr getUdpSocket() const noexcept { return _udpSocket; }
+   UdpSocketPtr getUdpShard(size_t shard) const noexcept { return _udpShards[shard]; }
+
+   // Number of receive threads of the bearer
+   size_t rxShardCount() const noexcept
+   {
+      return _udpShards.empty() ? 1 : _udpShards.size();
+   }
    TcpConnMgrPtr getTcpConnMgr() const noexcept { return _tcpConnectionMgr; }
 
+   // Selects the TCP subflow which the inner packet has to be sent on
+   size_t selectSubflow(const IpPacketParser &ipParser, TrafficClass tc) const noexcept;
+
+   // Queues a copy of frame on the bearer transmit scheduler (UDP, GTP
+   // and GRE only). Returns false if the frame has been dropped.
+   bool queueFrame(const char *frame, size_t len, TrafficClass tc)
+   {
+      return queueFrame(nullptr, 0, frame, len, tc);
+   }
+
+   // As above, the frame being header followed by payload
+   bool queueFrame(const char *header, size_t headerLen,
+                   const char *payload, size_t len, TrafficClass tc);
+
+   // Pops the next frame to send, Critical first then by WFQ. Bearers
+   // with congestion control drop the frames which have waited past the
+   // deadline of their class.
+   bool nextFrame(TxFrame &frame, int timeout);
+
+   // True if the bearer sends small packets in bundles
+   bool bundling() const noexcept
+   {
+      return _options.bundling && _protocol == TunnelProtocol::Udp;
+   }
+
+   // Bundles a small packet frame with the next ones of its class, taken
+   // from the scheduler until the bundle is full or the class bundle delay
+   // since the frame was queued has passed. Returns true if next holds a
+   // frame taken but not bundled, to be sent next.
+   bool bundleFrames(TxFrame &frame, TxFrame &next);
+
+   // Marks the bearer socket with the outer DSCP/priority of tc
+   void markSocket(TrafficClass tc) noexcept;
+
+   // True if the bearer or its tunnel is rate limited
+   bool shaped() const noexcept
+   {
+      return _shaper.limited() || (_options.tunnelShaper && _options.tunnelShaper->limited()) || _cc;
+   }
+
+   // Waits until bytes can be sent within the bearer, tunnel and
+   // congestion control rates
+   void pace(size_t bytes) noexcept
+   {
+      if (TokenBucket::pace(bytes, {&_shaper, _options.tunnelShaper.get(), _cc ? &_cc->pacer() : nullptr}))
+         Metrics::add(*_metrics.shapingDelays, 1);
+   }
+
+   // True if the sent frames carry their departure time
+   bool txTime() const noexcept
+   {
+      return _txTime;
+   }
+
+   // Books bytes within the bearer and tunnel rates and returns the
+   // departure time of the frame (ns of the monotonic clock). Waits only
+   // if that is over TXTIME_MAX_LEAD_US ahead.
+   uint64_t departure(size_t bytes) noexcept;
+
+   // Queries the kernel for the path MTU towards the remote end (at most
+   // once per PMTU_REFRESH_INTV unless forced). Returns true if it changed.
+   bool probePathMtu(bool force = false) noexcept;
+
+   // Path MTU (-1 = unknown)
+   int pathMtu() const noexcept
+   {
+      return _pathMtu;
+   }
+
+   // Bytes added to an inner packet by the bearer encapsulation
+   int encapOverhead() const noexcept;
+
+   // Largest inner packet carried without fragmentation (-1 = unknown)
+   int usableMtu() const noexcept
+   {
+      const int mtu = _pathMtu;
+      return mtu > 0 ? mtu - encapOverhead() : -1;
+   }
+
+   // Largest inner packet sent whole, larger ones are sent in tunnel
+   // fragments (0 = no fragmentation)
+   int fragmentThreshold() const noexcept
+   {
+      return _fragmentThreshold;
+   }
+
+   void setFragmentThreshold(int threshold) noexcept
+   {
+      _fragmentThreshold = threshold;
+   }
+
+   // Queues the packet pktid as tunnel fragments (UDP only).
+   // Returns false if any fragment has been dropped.
+   bool queueFragments(const char *packet, size_t len, uint64_t pktid, TrafficClass tc);
+
+   // MSS which inner TCP SYNs are clamped to (0 = no clamping)
+   uint16_t maxMss() const noexcept
+   {
+      return _maxMss;
+   }
+
+   void setMaxMss(uint16_t mss) noexcept
+   {
+      _maxMss = mss;
+   }
+
+   // Returns false if a received frame exceeds the policed rate
+   bool police(size_t bytes) noexcept
+   {
+      if (_policer.tryConsume(bytes, TokenBucket::Clock::now()))
+         return true;
+
+      Metrics::add(*_metrics.policedDrops, 1);
+      return false;
+   }
+
+   // Returns false if the IPv4 header of a received inner packet is
+   // corrupted (other packets are not checked)
+   bool checkInnerHeader(const IpPacketParser &ipParser, const char *packet, size_t len) noexcept
+   {
+      if (!ipParser.isValid() || Checksum::verifyIpv4Header(packet, len))
+         return true;
+
+      Metrics::add(*_metrics.badChecksums, 1);
+      return false;
+   }
+
+   // Records a frame received from the peer: a bearer is up while
+   // frames (keepalives at least) keep coming
+   void touchRx() noexcept
+   {
+      // Liveness only matters to active-backup tunnels, whose bearers
+      // send keepalives
+      if (_options.keepaliveInterval.count() == 0)
+         return;
+
+      const int64_t now = Clock::now().time_since_epoch().count();
+      const int64_t last = _lastRxAt.exchange(now);
+
+      if (now - last > Clock::duration(_options.deadInterval).count())
+         _upSince = now;
+   }
+
+   // Records a frame sent to the peer, which makes a keepalive useless
+   void touchTx(Clock::time_point now) noexcept
+   {
+      _lastTxAt = now.time_since_epoch().count();
+   }
+
+   // Takes the bearer down until the next frame received (i.e. the
+   // local link has failed)
+   void markDown() noexcept
+   {
+      _lastRxAt = 0;
+   }
+
+   // True if the peer has been heard within the dead interval (and, for
+   // TCP, a subflow is connected)
+   bool isUp(Clock::time_point now) const noexcept
+   {
+      const int64_t last = _lastRxAt;
+
+      return last != 0 &&
+             now.time_since_epoch().count() - last <= Clock::duration(_options.deadInterval).count() &&
+             (!_tcpConnectionMgr || _tcpConnectionMgr->connected());
+   }
+
+   // Time the bearer has been up for
+   Clock::duration upFor(Clock::time_point now) const noexcept
+   {
+      return Clock::duration(now.time_since_epoch().count() - _upSince);
+   }
+
+   bool keepaliveDue(Clock::time_point now) const noexcept
+   {
+      return _options.keepaliveInterval.count() > 0 &&
+             now.time_since_epoch().count() - _lastTxAt >= Clock::duration(_options.keepaliveInterval).count();
+   }
+
+   // Sends a keepalive to the peer, which only takes it as a sign of life
+   bool sendKeepalive();
+
+   // Loss and delay of the bearer, measured if feedback is enabled
+   BearerFeedback &feedback() noexcept
+   {
+      return _feedback;
+   }
+
+   const BearerFeedback &feedback() const noexcept
+   {
+      return _feedback;
+   }
+
+   // True if the bearer frames carry a sequence number and are reported
+   // on (GRE bearers only with congestion control, see sendFeedback())
+   bool measured() const noexcept
+   {
+      return _options.feedbackInterval.count() > 0 &&
+             (_protocol == TunnelProtocol::Udp || _protocol == TunnelProtocol::Tcp ||
+              (_protocol == TunnelProtocol::Gre && _options.congestionControl));
+   }
+
+   // Sets the next bearer sequence number in the pktid of a frame, if the
+   // bearer is measured. Only TCP frames are numbered as they are queued,
+   // the others as they are sent (see admitFrame()).
+   uint64_t stampPktId(uint64_t pktid) noexcept
+   {
+      return measured() && _protocol == TunnelProtocol::Tcp ? setBearerSeq(pktid, _txSeq++) : pktid;
+   }
+
+   bool feedbackDue(Clock::time_point now) const noexcept
+   {
+      return measured() && _feedback.reportDue(now, _options.feedbackInterval);
+   }
+
+   // Sends the peer a report on the frames received since the previous one
+   bool sendFeedback();
+
+   // Applies a report of the peer on the frames sent on the bearer
+   void applyFeedback(const FeedbackReport &report, Clock::time_point now) noexcept;
+
+   // Selective ARQ of a reliable bearer (nullptr if not reliable)
+   SelectiveArq *arq() const noexcept
+   {
+      return _arq.get();
+   }
+
+   // Congestion control of the bearer (nullptr if none)
+   CongestionControl *cc() const noexcept
+   {
+      return _cc.get();
+   }
+
+   // True if the bearer cannot take more traffic without queueing it:
+   // its window is full or its queue holds more than the path takes in
+   // CC_MAX_QUEUE_DELAY_MS
+   bool congested() const noexcept
+   {
+      return _cc && (_cc->windowFull() || _txBudget.used() > _cc->rate() * CC_MAX_QUEUE_DELAY_MS / 1000);
+   }
+
+   // Numbers a frame about to be sent on a measured or reliable bearer,
+   // once the congestion window (if any) lets it go, and keeps it for
+   // retransmission if reliable. Returns false if the frame is to be
+   // dropped: the window has not opened within the deadline of its class
+   // (ADMIT_MAX_WAIT_MS if none).
+   bool admitFrame(TxFrame &frame);
+
+   // Sends the peer an acknowledgement of the frames received
+   bool sendArqAck();
+
+   // Flushes the pending acknowledgement and retransmits the frames
+   // whose timeout has expired
+   void arqTick(Clock::time_point now);
+
+   // Accounts datagrams the kernel dropped on a receive socket of the
+   // bearer (receiving threads)
+   void countKernelDrops(uint32_t drops) noexcept
+   {
+      if (drops == 0)
+         return;
+
+      _rxKernelDrops += drops;
+      Metrics::add(*_metrics.rxKernelDrops, drops);
+   }
+
+   // Accounts bytes received, the receive buffer is sized on
+   void countRx(size_t bytes) noexcept
+   {
+      _rxBytes.fetch_add(bytes, std::memory_order_relaxed);
+   }
+
+   // Samples the send queue of the bearer socket and resizes the buffers
+   // sized automatically, at most once per SOCKBUF_SAMPLE_MS (any thread,
+   // UDP, GTP and GRE only)
+   void sampleSockets(Clock::time_point now) noexcept;
+
+   // Accounts a delayed copy of a packet for the bearer
+   void countDelayedCopy(bool dropped) noexcept
+   {
+      Metrics::add(dropped ? *_metrics.delayedCopyDrops : *_metrics.delayedCopies, 1);
+   }
+
    enum class ConnRoleType {
       Client,
       Server
@@ -225,11 +810,81 @@ private:
    IpAddress _remoteAddr;
    uint16_t _localPort = 0;
    uint16_t _remotePort = 0;
+   TunnelProtocol _protocol = TunnelProtocol::Gre;
+   BearerOptions _options;
+   std::string _name;
+   size_t _slot = 0;
 
-   GreSocketPtr _greSocket;
+   GreSocketPtr _greSocket; // transmit only, see GreDemux
+   std::unique_ptr<GreDemux::Registration> _greReceiver;
    UdpSocketPtr _udpSocket;
+   std::vector<UdpSocketPtr> _udpShards; // the first one is _udpSocket
    TcpConnMgrPtr _tcpConnectionMgr;
 
+   // Budget must outlive the queued frames charged to it
+   ByteBudget _txBudget;
+   std::unique_ptr<TxQueue> _txQueue;
+   int _markedClass = -1; // traffic class the socket is marked for
+   bool _txTime = false;  // SO_TXTIME set on the transmitting socket
+
+   TokenBucket _shaper;
+   TokenBucket _policer;
+   std::array<TokenBucket, TRAFFIC_CLASS_COUNT> _classShapers;
+
+   std::atomic<int> _pathMtu{-1};
+   std::atomic<uint16_t> _maxMss{0};
+   std::atomic<int> _fragmentThreshold{0};
+   std::chrono::steady_clock::time_point _pathMtuProbedAt;
+   std::mutex _pathMtuLock;
+
+   // Liveness, in steady clock ticks
+   std::atomic<int64_t> _lastRxAt{0};
+   std::atomic<int64_t> _upSince{0};
+   std::atomic<int64_t> _lastTxAt{0};
+
+   BearerFeedback _feedback;
+   std::unique_ptr<SelectiveArq> _arq;
+   std::unique_ptr<CongestionControl> _cc;
+   std::atomic<uint16_t> _txSeq{0}; // TCP frames are numbered by the queueing threads
+
+   // Socket buffers, see sampleSockets()
+   std::atomic<uint64_t> _rxBytes{0};
+   std::atomic<uint64_t> _rxKernelDrops{0};
+   std::atomic<int64_t> _sampledAt{0};
+   uint64_t _rxBytesSampled = 0;
+   uint64_t _rxKernelDropsSampled = 0;
+   size_t _rcvBuf = 0;
+   size_t _sndBuf = 0;
+
+   struct PathMetrics
+   {
+      Metrics::Value *shapingDelays = nullptr;
+      Metrics::Value *policedDrops = nullptr;
+      Metrics::Value *pathMtu = nullptr;
+      Metrics::Value *fragmentedPackets = nullptr;
+      Metrics::Value *badChecksums = nullptr;
+      Metrics::Value *lossPpm = nullptr;
+      Metrics::Value *rttUs = nullptr;
+      Metrics::Value *delayedCopies = nullptr;
+      Metrics::Value *delayedCopyDrops = nullptr;
+      Metrics::Value *expiredDrops = nullptr;
+      Metrics::Value *bundles = nullptr;
+      Metrics::Value *bundledPackets = nullptr;
+      Metrics::Value *rxKernelDrops = nullptr;
+      Metrics::Value *sendQueueBytes = nullptr;
+      Metrics::Value *sendQueueMax = nullptr;
+      Metrics::Value *rcvBufBytes = nullptr;
+      Metrics::Value *sndBufBytes = nullptr;
+   } _metrics;
+
+   void makeTxQueue();
+
+   // Sets the receive (every shard) or send buffer of the bearer sockets
+   void setSocketBuffers(bool receive, size_t bytes) noexcept;
+
+   // Pops the next frame until deadline, see nextFrame()
+   bool popFrame(TxFrame &frame, Clock::time_point deadline);
+
    mutable std::recursive_mutex _lock;
    using lock_guard_t = std::lock_guard<std::recursive_mutex>;
 
@@ -258,22 +913,95 @@ private:
    using MpTunnel = std::list<TunnelPath::Handle>;
    using Dev2MpTunnelLookupTbl = std::map<std::string, MpTunnel>;
    using Remote2DevLookupTbl = std::map<uint32_t, std::string>;
+   using Dev2PolicyLookupTbl = std::map<std::string, TunnelPolicy::Handle>;
+   using Dev2MtuLookupTbl = std::map<std::string, TunnelMtu>;
+   using Dev2ReassemblerLookupTbl = std::map<std::string, TunnelReassembler::Handle>;
+   using Dev2BackupLookupTbl = std::map<std::string, std::shared_ptr<ActiveBackup>>;
+   using Dev2AdaptiveLookupTbl = std::map<std::string, std::shared_ptr<AdaptiveRedundancy>>;
    using ThreadHandle = std::unique_ptr<std::thread>;
 
+   // Packet copy sent on a bearer once its timer expires
+   struct DelayedCopy
+   {
+      TunnelPath::Handle tp;
+      std::string ifname;
+      std::vector<char> packet;
+      uint64_t pktid = 0;
+      TrafficClass tc = TrafficClass::Default;
+   };
+
    mutable std::recursive_mutex _lock;
-   ThreadHandle _tunnelXmitThreadObj;
+   std::vector<ThreadHandle> _tunnelXmitThreadObjs; // a TUN reader per device queue
+   ThreadHandle _keepaliveThreadObj;
    Dev2MpTunnelLookupTbl _dev2mpTunnel;
    Remote2DevLookupTbl _rpeer2dev;
+   Dev2PolicyLookupTbl _dev2policy;
+   Dev2MtuLookupTbl _dev2mtu;
+   Dev2ReassemblerLookupTbl _dev2reassembler;
+   Dev2BackupLookupTbl _dev2backup;
+   Dev2AdaptiveLookupTbl _dev2adaptive;
+
+   // Delayed copies of every tunnel, sent by a single thread
+   ThreadHandle _copyThreadObj;
+   std::mutex _copyLock;
+   std::condition_variable _copyCond;
+   TimerWheel<DelayedCopy> _copyWheel{std::chrono::microseconds(COPY_WHEEL_TICK_US), COPY_WHEEL_SLOTS};
 
    static int tunnelRecvThreadFunc(
        const std::string &name_,
        MpTunnelMgr *tvm_,
        std::shared_ptr<VirtualIfMgr> vifPtr,
-       TunnelPath::Handle tunnelHandle);
+       TunnelPath::Handle tunnelHandle,
+       TunnelReassembler::Handle reassembler,
+       size_t shard);
 
    static int tunnelXmitThreadFunc(
        MpTunnelMgr *tvm_,
-       std::shared_ptr<VirtualIfMgr> vifPtr);
+       std::shared_ptr<VirtualIfMgr> vifPtr,
+       size_t queue);
+
+   static int tunnelBearerXmitThreadFunc(
+       const std::string &name_,
+       MpTunnelMgr *tvm_,
+       std::shared_ptr<VirtualIfMgr> vifPtr,
+       TunnelPath::Handle tunnelHandle);
+
+   static int tunnelKeepaliveThreadFunc(MpTunnelMgr *tvm_);
+
+   // Starts the thread sending keepalives and feedback, if not running
+   void startKeepaliveThread();
+
+   static int tunnelCopyThreadFunc(MpTunnelMgr *tvm_);
+
+   // Schedules a copy of the packet on the bearer after delay. Returns
+   // false if too many copies are pending.
+   bool scheduleCopy(
+       const TunnelPath::Handle &tp,
+       const std::string &ifname,
+       const char *packet,
+       size_t len,
+       uint64_t pktid,
+       TrafficClass tc,
+       std::chrono::milliseconds delay);
+
+   // Queues the packet read from the TUN device on a bearer. buf holds
+   // 4 spare bytes, the packet and its pktid.
+   // Returns false if the packet has been dropped.
+   static bool queueOnBearer(
+       TunnelPath &tp,
+       char *buf,
+       size_t buflen,
+       uint64_t pktid,
+       TrafficClass tc,
+       const IpPacketParser &ipParser,
+       const std::string &ifname);
+
+   // Replays on the active bearer the packets sent on the failed one
+   static void replayOnActive(
+       ActiveBackup &backup,
+       const MpTunnel &mpTunnel,
+       std::chrono::steady_clock::time_point now,
+       const std::string &ifname);
 
    MpTunnelMgr(const MpTunnelMgr &) = delete;
    MpTunnelMgr &operator=(const MpTunnelMgr &) = delete;
@@ -283,8 +1011,14 @@ public:
 
    ~MpTunnelMgr()
    {
-      if (_tunnelXmitThreadObj)
-         _tunnelXmitThreadObj->join();
+      for (auto &thread : _tunnelXmitThreadObjs)
+         thread->join();
+
+      if (_keepaliveThreadObj)
+         _keepaliveThreadObj->join();
+
+      if (_copyThreadObj)
+         _copyThreadObj->join();
    }
 
    size_t size() const noexcept
@@ -313,6 +1047,61 @@ public:
 
    MpTunnel getMpTunnel(const std::string &ifname);
 
+   // Sets the path policy of a tunnel (nullptr means every packet on every bearer)
+   void setTunnelPolicy(const std::string &ifname, TunnelPolicy::Handle policy)
+   {
+      lock_guard_t cs(_lock);
+
+      _dev2policy[ifname] = std::move(policy);
+   }
+
+   TunnelPolicy::Handle getTunnelPolicy(const std::string &ifname) const
+   {
+      lock_guard_t cs(_lock);
+
+      auto it = _dev2policy.find(ifname);
+      return it != _dev2policy.end() ? it->second : nullptr;
+   }
+
+   // Enables the active-backup mode on a tunnel, used by its paths in
+   // that mode
+   void setActiveBackup(const std::string &ifname, const ActiveBackupSettings &settings);
+
+   std::shared_ptr<ActiveBackup> getActiveBackup(const std::string &ifname) const
+   {
+      lock_guard_t cs(_lock);
+
+      auto it = _dev2backup.find(ifname);
+      return it != _dev2backup.end() ? it->second : nullptr;
+   }
+
+   // Enables the adaptive redundancy on a tunnel, used by its paths in
+   // adaptive mode
+   void setAdaptiveRedundancy(const std::string &ifname, const AdaptiveSettings &settings);
+
+   std::shared_ptr<AdaptiveRedundancy> getAdaptiveRedundancy(const std::string &ifname) const
+   {
+      lock_guard_t cs(_lock);
+
+      auto it = _dev2adaptive.find(ifname);
+      return it != _dev2adaptive.end() ? it->second : nullptr;
+   }
+
+   // Sets the MTU settings of a tunnel, applied as its bearers are added
+   void setTunnelMtu(const std::string &ifname, const TunnelMtu &settings)
+   {
+      lock_guard_t cs(_lock);
+
+      auto &mtu = _dev2mtu[ifname];
+      const int current = mtu.current;
+      mtu = settings;
+      mtu.current = current;
+   }
+
+   // Sets the device MTU to the smallest usable MTU of the tunnel bearers
+   // (probing the path MTUs which are due) and the MSS clamping accordingly
+   void updateTunnelMtu(const std::string &ifname, VirtualIfMgr &vif);
+
    bool delMpTunnel(const std::string &ifname) noexcept;
 
    friend std::stringstream &operator<<(
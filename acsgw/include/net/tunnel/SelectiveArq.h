@@ -0,0 +1,168 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include "Metrics.h"
+#include "TrafficClass.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+#define ARQ_WINDOW           256 // frames in flight, as many as an ack covers
+#define ARQ_INITIAL_CWND     16
+#define ARQ_MIN_CWND         4
+#define ARQ_ACK_FRAMES       4   // in-order frames acknowledged together
+#define ARQ_REORDER_FRAMES   3   // later frames acknowledged before a frame is lost
+#define ARQ_MIN_RTO_MS       20
+#define ARQ_MAX_RETRANSMITS  4
+
+/* -------------------------------------------------------------------------- */
+
+// Selective acknowledgement of the frames of a reliable bearer: the
+// highest sequence number received and, bit i of the map, whether
+// highest - 1 - i was received too. Fields in network order.
+#pragma pack(push, 1)
+struct ArqAck
+{
+   uint16_t highest;
+   uint8_t received[ARQ_WINDOW / 8];
+};
+#pragma pack(pop)
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Selective repeat ARQ of a reliable UDP bearer, an alternative to TCP
+ * bearers without their head-of-line blocking.
+ * Frames are delivered as they arrive, in any order: the receiver only
+ * acknowledges them (see ArqAck), right away when a frame is missing or
+ * fills a gap. The sender keeps the frames in flight and sends again
+ * those reported missing (once later frames have arrived, one is enough
+ * for critical frames) or not acknowledged within the retransmission
+ * timeout. A frame is abandoned rather than retransmitted once it would
+ * arrive after the deadline of its class (see QosPolicy), so late frames
+ * never hold back the others.
+ * The frames in flight are bound by a congestion window (AIMD, in
+ * frames), halved once per round trip on loss.
+ * Sequence numbers are the bearer sequence numbers of the frames (see
+ * setBearerSeq()), assigned as frames are sent.
+ */
+class SelectiveArq
+{
+public:
+   using Clock = std::chrono::steady_clock;
+
+   // Sends a datagram again
+   using Send = std::function<void(const char *data, size_t len, TrafficClass tc)>;
+
+   // Metrics are named after prefix (i.e. "bearer.<name>")
+   explicit SelectiveArq(const std::string &prefix);
+
+   SelectiveArq(const SelectiveArq &) = delete;
+   SelectiveArq &operator=(const SelectiveArq &) = delete;
+
+   // Sender side
+
+   // Waits up to timeout for the congestion window to let a frame go.
+   // Returns false on timeout.
+   bool awaitWindow(std::chrono::milliseconds timeout);
+
+   // Sets the next sequence number in the pktid which ends the datagram
+   // about to be sent, and keeps a copy of it. Returns the number.
+   uint16_t onSend(char *datagram, size_t len, TrafficClass tc, Clock::time_point now);
+
+   // Applies an acknowledgement of the peer, retransmitting the frames
+   // it reports missing
+   void onAck(const ArqAck &ack, Clock::time_point now, const Send &send);
+
+   // Retransmits (or abandons) the frames whose timeout has expired
+   void onTick(Clock::time_point now, const Send &send);
+
+   // Receiver side
+
+   // Records a frame received. Returns true if an acknowledgement has to
+   // be sent at once.
+   bool onData(uint16_t seq) noexcept;
+
+   // True if frames have been received since the last acknowledgement
+   bool ackPending() const noexcept;
+
+   ArqAck makeAck() noexcept;
+
+private:
+   struct Outstanding
+   {
+      std::vector<char> data;
+      TrafficClass tc = TrafficClass::Default;
+      Clock::time_point firstSentAt;
+      Clock::time_point sentAt;
+      unsigned retransmits = 0;
+      bool inUse = false;
+   };
+
+   // Sender side
+   std::mutex _lock;
+   std::condition_variable _windowCond;
+   std::vector<Outstanding> _window;
+   uint16_t _nextSeq = 0;
+   uint16_t _oldest = 0; // oldest frame possibly in flight
+   size_t _inflight = 0;
+
+   double _cwnd = ARQ_INITIAL_CWND;
+   double _ssthresh = ARQ_WINDOW;
+   uint16_t _recoverySeq = 0; // losses of frames before it are the same event
+   bool _recovering = false;
+
+   int64_t _srttUs = -1;
+   int64_t _rttvarUs = 0;
+
+   // Receiver side
+   mutable std::mutex _rxLock;
+   bool _rxStarted = false;
+   uint16_t _rxHighest = 0;
+   uint64_t _rxMap[ARQ_WINDOW / 64] = {0}; // bit i: _rxHighest - 1 - i received
+   size_t _rxUnacked = 0;
+
+   struct ArqMetrics
+   {
+      Metrics::Value *retransmits = nullptr;
+      Metrics::Value *abandoned = nullptr;
+      Metrics::Value *cwnd = nullptr;
+      Metrics::Value *srttUs = nullptr;
+   } _metrics;
+
+   Clock::duration rto(unsigned retransmits) const noexcept;
+
+   // Sends a frame again, or abandons it if it is late
+   void retransmit(Outstanding &frame, Clock::time_point now, const Send &send);
+
+   void release(Outstanding &frame) noexcept;
+
+   // Congestion response to the loss of frame seq
+   void onLoss(uint16_t seq) noexcept;
+
+   void rttSample(Clock::duration rtt) noexcept;
+
+   // Moves _oldest past the frames no longer in flight
+   void advanceOldest() noexcept;
+
+   void shiftRxMap(unsigned n) noexcept;
+};
@@ -3,7 +3,13 @@
 #include "Exception.h"
 #include "Logger.h"
 #include "IpAddress.h"
-#include "LockedQueue.h"
+#include "BoundedQueue.h"
+#include "Metrics.h"
+#include "MemoryGovernor.h"
+#include "QosPolicy.h"
+#include "TokenBucket.h"
+#include "TrafficClass.h"
+#include "TxScheduler.h"
 #include "TcpListener.h"
 #include "TcpSocket.h"
 
@@ -21,34 +27,65 @@
 #include <map>
 #include <signal.h>
 #include <cerrno>
+#include <thread>
+#include <atomic>
+#include <vector>
 
 /* -------------------------------------------------------------------------- */
 
-#define OUTGOING_MSG_QUEUE_LEN 10000
-#define INBOUND_MSG_QUEUE_LEN  10000
+#define OUTGOING_MSG_QUEUE_LEN 1024  // frame slots per class, memory is bound by the budget
+#define INBOUND_MSG_QUEUE_LEN  4096
+#define DEFAULT_QUEUE_BUDGET_KB 4096 // per direction
 #define RECV_TIMEOUT          10    // seconds
+#define INBOUND_WAIT_MS       100   // the connection state is checked this often while over budget
 #define CONNECT_RETRY_INTV    800   // milliseconds
+#define MAX_TCP_SUBFLOWS      16
+#define SEND_QUEUE_SAMPLE_MS  100   // socket send queues are sampled at most this often
    
 /* -------------------------------------------------------------------------- */
 
+/**
+ * Manages a TCP bearer made of one or more parallel connections (subflows).
+ * Each subflow has its own outgoing queue, so frames dispatched to a
+ * subflow never wait behind frames stalled on a different one.
+ * Outgoing queues are scheduled per traffic class (see TxScheduler), and
+ * segments are marked with the outer DSCP/priority of the frame class.
+ * Inbound frames of every subflow are merged into a single queue.
+ * Outgoing frames carry a deadline: frames which expire while queued
+ * (i.e. while the connection is being re-established) are dropped
+ * instead of being sent late.
+ * Queued bytes are bound by a per-direction budget shared by all the
+ * subflows; outgoing frames are also charged to the MemoryGovernor.
+ * Senders are paced by the bearer (and tunnel) rate, while each class
+ * is capped by its QosPolicy ceiling, shared by all the subflows.
+ */
 class TcpConnectionMgr
 {
 public:
     using TranspPort = TcpListener::TranspPort;
     using Buffer = std::vector<char>;
+    using Clock = std::chrono::steady_clock;
 
     TcpConnectionMgr() = delete;
 
-    TcpConnectionMgr(const IpAddress& localAddr, const TranspPort localPort) :
+    TcpConnectionMgr(const IpAddress& localAddr, const TranspPort localPort, 
+                     size_t subflows = 1) :
         _localAddr(localAddr), _localPort(localPort), _server(true)
-    {}
+    {
+        makeSubflows(subflows);
+        makeMetrics();
+    }
 
     TcpConnectionMgr(
         const IpAddress& localAddr, const TranspPort localPort,
-        const IpAddress& remoteAddr, const TranspPort remotePort
+        const IpAddress& remoteAddr, const TranspPort remotePort,
+        size_t subflows = 1
     ) : _localAddr(localAddr), _localPort(localPort), _server(false),
         _remoteAddr(remoteAddr), _remotePort(remotePort)
-    {}
+    {
+        makeSubflows(subflows);
+        makeMetrics();
+    }
 
     const IpAddress& getLocalAddr() const noexcept
     {
@@ -70,34 +107,166 @@ public:
         return _remotePort;
     }
 
-    bool recvMessage(Buffer& buf, int timeout) {
-        return _inboundMessageQueue.pop(buf, timeout);
+    size_t subflowCount() const noexcept
+    {
+        return _subflows.size();
     }
 
-    bool sendMessage(Buffer&& buf) {
-        return _outgoingMessageQueue.push(std::move(buf));
+    // True if any subflow is connected
+    bool connected() const noexcept
+    {
+        for (const auto& sf : _subflows)
+        {
+            if (sf->connected)
+                return true;
+        }
+
+        return false;
     }
 
+    // Sets the byte budget of both outgoing and inbound queues
+    void setQueueBudget(size_t bytes) noexcept
+    {
+        _outgoingBudget.setLimit(bytes);
+        _inboundBudget.setLimit(bytes);
+    }
+
+    // Makes senders and receivers spin for up to spinBudget before blocking
+    // and enables SO_BUSY_POLL on the subflow sockets. Call before run().
+    void setBusyPoll(std::chrono::microseconds spinBudget) noexcept;
+
+    // Paces the senders at rate bytes per second (0 = unlimited) and
+    // within the tunnel shaper, if any. Call before run().
+    void setShaping(uint64_t rate, size_t burst, std::shared_ptr<TokenBucket> tunnelShaper) noexcept
+    {
+        _shaper.configure(rate, burst);
+        _tunnelShaper = std::move(tunnelShaper);
+    }
+
+    // Opens Multipath TCP connections (if the kernel supports it, TCP
+    // otherwise): each subflow connection may then run on several paths,
+    // scheduled by the kernel. Call before run().
+    void setMptcp(bool mptcp) noexcept
+    {
+        _mptcp = mptcp;
+    }
+
+    // Sets the socket buffer sizes of the connections in bytes (0 leaves
+    // the kernel autotuning the buffer). Call before run().
+    void setSocketBuffers(size_t rcvBuf, size_t sndBuf) noexcept
+    {
+        _rcvBuf = rcvBuf;
+        _sndBuf = sndBuf;
+    }
+
+    bool recvMessage(Buffer& buf, int timeout) {
+        InboundFrame frame;
+
+        if (!_inboundMessageQueue.pop(frame, timeout))
+            return false;
+
+        buf = std::move(frame.data);
+        return true;
+    }
+
+    // Queues a message on the given subflow (modulo the number of subflows). 
+    // If that subflow is down the message is moved to the next connected one.
+    // A message not sent within the deadline is discarded (0 = no deadline).
+    // A message which does not fit the memory budget is discarded too.
+    bool sendMessage(
+        Buffer&& buf, 
+        size_t subflow = 0, 
+        std::chrono::milliseconds deadline = std::chrono::milliseconds(0),
+        TrafficClass tc = TrafficClass::Default);
+
     bool run();
 
 protected:
-    void runConnectionManagerThread();
-    int recv(char* buf, int bufSize, int timeoutSec);
-    int send(const char* buf, int bufSize);
-    void runRecv();
+    struct Frame
+    {
+        Buffer data;
+        Clock::time_point enqueuedAt;
+        Clock::time_point expiresAt = Clock::time_point::max();
+        MemoryCharge charge;
+        TrafficClass tc = TrafficClass::Default;
+
+        size_t size() const noexcept
+        {
+            return data.size();
+        }
+
+        bool expired(const Clock::time_point& now) const noexcept
+        {
+            return now > expiresAt;
+        }
+    };
+
+    struct InboundFrame
+    {
+        Buffer data;
+        MemoryCharge charge;
+    };
+
+    struct Subflow
+    {
+        size_t index = 0;
+        TranspPort localPort = 0;
+        std::atomic_bool connected{false};
+        TcpSocket::Handle socket;
+        std::unique_ptr<std::thread> thread;
+        TxScheduler<Frame> outgoingMessageQueue{ OUTGOING_MSG_QUEUE_LEN, QosPolicy::getInstance().getQuanta() };
+        int markedClass = -1; // traffic class the socket is marked for
+        Clock::time_point queueSampledAt; // send queue depth, see SEND_QUEUE_SAMPLE_MS
+    };
+
+    // Exported per-bearer counters
+    struct BearerMetrics
+    {
+        Metrics::Value* sentFrames = nullptr;
+        Metrics::Value* expiredDrops = nullptr;
+        Metrics::Value* budgetDrops = nullptr;
+        Metrics::Value* sojournUsTotal = nullptr;
+        Metrics::Value* sojournUsMax = nullptr;
+        Metrics::Value* shapingDelays = nullptr;
+        Metrics::Value* mptcpConnections = nullptr;
+        Metrics::Value* mptcpFallbacks = nullptr;
+        Metrics::Value* sendQueueBytes = nullptr;
+        Metrics::Value* sendQueueMax = nullptr;
+    };
+
+    void makeSubflows(size_t subflows);
+    void makeMetrics();
+    bool dropIfExpired(const Frame& frame, Subflow& sf);
+    void checkMptcp(Subflow& sf);
+    void applySocketBuffers(TransportSocket& socket);
+    void sampleSendQueue(Subflow& sf, Clock::time_point now);
+    void markSocket(Subflow& sf, TrafficClass tc);
+    void runConnectionManagerThread(Subflow& sf);
+    int recv(TcpSocket& socket, char* buf, int bufSize, int timeoutSec);
+    int send(TcpSocket& socket, const char* buf, int bufSize);
+    void runRecv(Subflow& sf);
 
 private:
     IpAddress _localAddr;
     TranspPort _localPort;
     bool _server = true;
+    bool _mptcp = false;
+    size_t _rcvBuf = 0;
+    size_t _sndBuf = 0;
     IpAddress _remoteAddr;
     TranspPort _remotePort;
     TcpListener::Handle _listener;
-    bool _connected = false;
-    TcpSocket::Handle _connectionSocket;
-    std::unique_ptr<std::thread> _connectionMgrHandle;
-    LockedQueue<Buffer> _outgoingMessageQueue{ OUTGOING_MSG_QUEUE_LEN };
-    LockedQueue<Buffer> _inboundMessageQueue{ INBOUND_MSG_QUEUE_LEN };
+    // Budgets must outlive the queued frames charged to them
+    ByteBudget _outgoingBudget{ DEFAULT_QUEUE_BUDGET_KB * 1024 };
+    ByteBudget _inboundBudget{ DEFAULT_QUEUE_BUDGET_KB * 1024 };
+    // Class shapers are referenced by the subflow schedulers
+    std::array<TokenBucket, TRAFFIC_CLASS_COUNT> _classShapers;
+    std::vector<std::unique_ptr<Subflow>> _subflows;
+    BoundedQueue<InboundFrame> _inboundMessageQueue{ INBOUND_MSG_QUEUE_LEN };
+    BearerMetrics _metrics;
+    std::chrono::microseconds _spinBudget{0}; // 0 = busy-poll disabled
+    TokenBucket _shaper;
+    std::shared_ptr<TokenBucket> _tunnelShaper;
 
 };
 
@@ -0,0 +1,209 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <thread>
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Rate limiter implemented as a virtual scheduling token bucket (GCRA):
+ * the state is the theoretical arrival time of the next byte, so that
+ * a bucket is a single atomic and can be shared by several threads.
+ * Shapers book bytes and wait for the returned time (reserve()), while
+ * policers only accept what conforms at once (tryConsume()).
+ */
+class TokenBucket
+{
+public:
+   using Clock = std::chrono::steady_clock;
+
+   TokenBucket() = default;
+   TokenBucket(const TokenBucket &) = delete;
+   TokenBucket &operator=(const TokenBucket &) = delete;
+
+   // rate is in bytes per second (0 = unlimited), burst in bytes
+   TokenBucket(uint64_t rate, size_t burst) noexcept
+   {
+      configure(rate, burst);
+   }
+
+   void configure(uint64_t rate, size_t burst) noexcept
+   {
+      _rate = rate;
+      _tolerance = rate > 0 ? int64_t(uint64_t(burst) * NS_PER_SEC / rate) : 0;
+      _tat.store(0, std::memory_order_relaxed);
+   }
+
+   // Changes the rate, keeping the bytes already booked (so that no
+   // burst is allowed). Not to be called while the bucket is in use by
+   // other threads.
+   void setRate(uint64_t rate, size_t burst) noexcept
+   {
+      _rate = rate;
+      _tolerance = rate > 0 ? int64_t(uint64_t(burst) * NS_PER_SEC / rate) : 0;
+   }
+
+   // One millisecond of traffic, but at least two full size frames
+   static size_t defaultBurst(uint64_t rate) noexcept
+   {
+      return std::max<size_t>(size_t(rate / 1000), 2 * 1500);
+   }
+
+   bool limited() const noexcept
+   {
+      return _rate > 0;
+   }
+
+   uint64_t rate() const noexcept
+   {
+      return _rate;
+   }
+
+   // Books bytes and returns the time they can be sent at
+   Clock::time_point reserve(size_t bytes, Clock::time_point now) noexcept
+   {
+      if (_rate == 0)
+         return now;
+
+      const int64_t t = toNs(now);
+      const int64_t cost = costOf(bytes);
+      int64_t tat = _tat.load(std::memory_order_relaxed);
+      int64_t sendAt = 0;
+
+      do
+      {
+         sendAt = std::max(t, tat - _tolerance);
+      } while (!_tat.compare_exchange_weak(tat, std::max(tat, sendAt) + cost, std::memory_order_relaxed));
+
+      return fromNs(sendAt);
+   }
+
+   // True if bytes could be sent at now
+   bool conforms(Clock::time_point now) const noexcept
+   {
+      return _rate == 0 || _tat.load(std::memory_order_relaxed) - _tolerance <= toNs(now);
+   }
+
+   // Time at which the bucket accepts traffic again
+   Clock::time_point conformAt(Clock::time_point now) const noexcept
+   {
+      return _rate == 0 ? now : fromNs(std::max(toNs(now), _tat.load(std::memory_order_relaxed) - _tolerance));
+   }
+
+   // Books bytes only if they conform at now
+   bool tryConsume(size_t bytes, Clock::time_point now) noexcept
+   {
+      if (_rate == 0)
+         return true;
+
+      const int64_t t = toNs(now);
+      const int64_t cost = costOf(bytes);
+      int64_t tat = _tat.load(std::memory_order_relaxed);
+
+      do
+      {
+         if (tat - _tolerance > t)
+            return false;
+      } while (!_tat.compare_exchange_weak(tat, std::max(tat, t) + cost, std::memory_order_relaxed));
+
+      return true;
+   }
+
+   // Books bytes on every limited bucket and returns the time all of
+   // them allow the transmission at
+   static Clock::time_point reserve(size_t bytes, std::initializer_list<TokenBucket *> buckets,
+                                    Clock::time_point now) noexcept
+   {
+      auto sendAt = now;
+
+      for (auto bucket : buckets)
+      {
+         if (bucket && bucket->limited())
+            sendAt = std::max(sendAt, bucket->reserve(bytes, now));
+      }
+
+      return sendAt;
+   }
+
+   // Books bytes on every limited bucket for a frame released by the
+   // qdisc at the returned departure time (SO_TXTIME). The sender must
+   // not run further than maxLead ahead of the departures: holdUntil is
+   // set to the time it has to wait for (now if it need not).
+   static Clock::time_point departure(size_t bytes, std::initializer_list<TokenBucket *> buckets,
+                                      Clock::time_point now, Clock::duration maxLead,
+                                      Clock::time_point &holdUntil) noexcept
+   {
+      const auto sendAt = reserve(bytes, buckets, now);
+
+      holdUntil = sendAt - now > maxLead ? sendAt - maxLead : now;
+
+      return sendAt;
+   }
+
+   // Books bytes on every limited bucket, then waits until all of them
+   // allow the transmission. Returns true if the caller has been delayed.
+   static bool pace(size_t bytes, std::initializer_list<TokenBucket *> buckets) noexcept
+   {
+      const auto now = Clock::now();
+      const auto sendAt = reserve(bytes, buckets, now);
+
+      if (sendAt <= now)
+         return false;
+
+      waitUntil(sendAt);
+
+      return true;
+   }
+
+   // Sleeps until t. The last microseconds are spun, as a timer
+   // would overshoot them.
+   static void waitUntil(Clock::time_point t) noexcept
+   {
+      constexpr std::chrono::microseconds SPIN_THRESHOLD{20};
+
+      if (t - Clock::now() > SPIN_THRESHOLD)
+         std::this_thread::sleep_until(t - SPIN_THRESHOLD);
+
+      while (Clock::now() < t)
+         std::this_thread::yield();
+   }
+
+private:
+   static constexpr uint64_t NS_PER_SEC = 1000000000ULL;
+
+   uint64_t _rate = 0;      // bytes per second
+   int64_t _tolerance = 0;  // ns of traffic which can be sent back to back
+   std::atomic<int64_t> _tat{0};
+
+   int64_t costOf(size_t bytes) const noexcept
+   {
+      return int64_t(uint64_t(bytes) * NS_PER_SEC / _rate);
+   }
+
+   static int64_t toNs(Clock::time_point t) noexcept
+   {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+   }
+
+   static Clock::time_point fromNs(int64_t ns) noexcept
+   {
+      return Clock::time_point(std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(ns)));
+   }
+};
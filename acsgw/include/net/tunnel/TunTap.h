@@ -14,6 +14,7 @@
 #include <strings.h>
 #include <net/if.h>
 #include <linux/if_tun.h>
+#include <chrono>
 #include <string>
 
 #include "IpAddress.h"
@@ -35,9 +36,19 @@ public:
 
     int readPacket(char *buf, size_t bufsize)
     {
+        if (_spinBudget.count() > 0)
+            return spinReadPacket(buf, bufsize);
+
         return read(_fd, buf, bufsize);
     }
 
+    // Makes readPacket() spin on non-blocking reads for up to spinBudget
+    // before blocking (0 restores plain blocking reads)
+    bool setBusyPoll(std::chrono::microseconds spinBudget);
+
+    // Sets the MTU of the device
+    bool setMtu(int mtu);
+
     int writePacket(const char *buf, size_t wbutes)
     {
         return write(_fd, buf, wbutes);
@@ -51,4 +62,8 @@ public:
 
 private:
     int _fd = -1;
+    std::string _ifname;
+    std::chrono::microseconds _spinBudget{0};
+
+    int spinReadPacket(char *buf, size_t bufsize);
 };
@@ -15,12 +15,17 @@
 #include "MpTunnel.h"
 
 #include <cassert>
+#include <chrono>
 #include <iostream>
 #include <memory>
 #include <stdlib.h>
 #include <string.h>
 #include <string>
 
+/* -------------------------------------------------------------------------- */
+
+#define MPTCP_MAX_ENDPOINTS 8 // kernel limit of the subflows of a connection
+
 /*
 Example of a valid configuration file content
 
@@ -28,6 +33,11 @@ Example of a valid configuration file content
 #
 [tunnels]
 list = "tunnel1, tunnel2" # list of tunnels to create
+shared_device = "acsgw0"  # a single TUN device carries all the tunnels, each
+                          # packet goes to the tunnel of the longest of their
+                          # routes containing its inner destination
+shared_queues = 4         # device queues, each read by a thread (up to 16)
+shared_routes = "10.0.0.0/8, 172.16.0.0/12" # kernel routes to the device
 
 # Defines the bearer used by tunnels
 [bearer1]
@@ -37,6 +47,43 @@ remote_address="192.168.0.46"
 [bearer2]
 local_address ="192.168.0.73"  # TBD
 remote_address="192.168.0.46" # TBD
+type            ="tcp"         # "udp", "rudp" (UDP with selective retransmission
+                               # of lost frames, no head-of-line blocking), "tcp",
+                               # "mptcp" (Multipath TCP, TCP if the kernel has
+                               # none), "gtp" or "gre" (default: the tunnel type)
+mptcp_endpoints = "192.168.2.73, 192.168.3.73" # MPTCP: further local addresses
+                               # of the connections (added to the kernel path
+                               # manager, shared by all MPTCP sockets)
+subflows        = 4            # parallel TCP connections (both ends must match)
+subflow_dispatch="class"       # "flow" (default) or "class"
+queue_budget_kb = 4096         # bytes queued per direction (TCP only)
+rate_kbps       = 10000        # transmit shaping rate (0 = unlimited)
+burst_kb        = 16           # bytes sent back to back (default 1 ms of traffic)
+police_rate_kbps= 20000        # received traffic above this rate is dropped
+police_burst_kb = 64
+txtime          ="yes"         # UDP/GTP/GRE: frames carry their departure time
+                               # (SO_TXTIME), released at the shaping rate by
+                               # the fq qdisc of the egress device, which must
+                               # be set (tc qdisc replace dev <dev> root fq)
+rx_shards       = 4            # UDP/GTP: receive sockets (SO_REUSEPORT) and
+                               # threads, packets spread by inner flow
+bundle          ="yes"         # UDP: small packets of a class share datagrams,
+                               # waiting up to <class>_bundle_us of [qos]
+congestion_control="yes"       # UDP/GRE: sending rate and bytes in flight
+                               # follow the bandwidth and delay reported by
+                               # the peer every 20 ms (both ends must use it)
+rcvbuf_kb       = 4096         # socket receive/send buffers (default: the
+sndbuf_kb       = 1024         # system ones), TCP ones are then not autotuned
+socket_buffers  ="auto"        # UDP/GTP/GRE: buffers grow with the bandwidth-
+                               # delay product and while the kernel drops or
+                               # queues datagrams (up to 64 MB)
+
+[bearer3]
+local_address ="192.168.1.73"
+remote_address="192.168.1.46"
+type          ="gtp"         # GTP-U over UDP port 2152 (unless port is set)
+local_teid    = 1001         # TEID of received T-PDUs (default: the tunnel one)
+remote_teid   = 2002         # TEID of sent T-PDUs
 
 # Defines the tunnels
 [tunnel1]
@@ -45,13 +92,60 @@ type          ="udp"        # Tunnelling protocol
 local_address ="10.0.0.1"   # Logical address of tunnel ingress
 remote_address="10.0.0.2"   # Logical address of tunnel egress
 port          = 28774
+local_teid    = 1001       # GTP-U TEIDs of the tunnel bearers (GTP only),
+remote_teid   = 2002       # copies are recognised among bearers sharing them
+gre_key       = 7          # GRE key (RFC 2890) of the bearers (GRE only), tells
+                           # apart tunnels between the same addresses
 
 [tunnel2]
 bearers        ="bearer1, bearer2" # Multiple baerers tunnel
 type           ="gre"              
 local_address  ="10.0.0.3"
 remote_address ="10.0.0.4"
-multipath      ="mirroring" # Defines the algo used in case of multiple paths*/
+multipath      ="mirroring" # "mirroring" (a copy on each bearer), "balanced",
+                            # "active-backup" (the first bearer which is up) or
+                            # "adaptive" (copies only as the bearers get lossy)
+keepalive_ms   = 100        # Active-backup: keepalives on idle bearers (both
+dead_ms        = 300        # ends must use it), bearer down after this silence
+preempt        ="yes"       # Go back to a preferred bearer once recovered...
+hold_down_ms   = 5000       # ...and up for this long
+replay_packets = 256        # Recent packets sent again on failover (0 = none)
+feedback_ms    = 100        # Adaptive: loss/delay reports of each UDP/TCP bearer
+                            # (both ends must use it)
+selective_loss_ppm = 1000   # Best bearer loss above which duplicate_classes...
+duplicate_classes  ="critical" # ...are mirrored on every bearer
+mirroring_loss_ppm = 10000  # and above which every packet is
+mirroring_rtt_ms   = 0      # Mirror everything above this RTT (0 = never)
+adapt_hold_ms  = 10000      # Redundancy is lowered after this long below them
+copy_delay_ms  = 30         # Time diversity: each packet sent again after this
+copy_bearer    ="bearer2"   # on this bearer (default: the same one, not GRE)
+busy_poll      ="yes"       # Spin on non-blocking reads before blocking
+spin_budget_us = 50         # Spin time before falling back to blocking reads
+mtu            = 0          # Device MTU, 0 (default) follows the bearers path MTU
+mss_clamp      ="yes"       # Clamp the MSS of inner TCP SYNs to the MTU
+fragmentation  ="yes"       # UDP bearers fragment packets over their MTU,
+                            # which then does not bound the device MTU
+reassembly_timeout_ms  = 500
+reassembly_max_packets = 256
+rate_kbps      = 15000      # Shaping rate of the whole tunnel (all bearers)
+burst_kb       = 32
+policies       ="etcs, cctv" # Service rules, first match wins (see PolicyClassifier.h)
+routes         ="10.1.0.0/16" # Shared device: inner destinations of the tunnel
+                            # (besides remote_address and SIP registrations)
+
+# Rule fields (prefixes, protocol, ports, dscp) select the packets,
+# bearers and multipath their path
+[etcs]
+dst_prefix ="10.0.0.4/32"
+protocol   ="udp"
+dst_ports  ="5000-5010"
+bearers    ="bearer1, bearer2" # Subset of the tunnel bearers
+multipath  ="mirroring"
+copy_delay_ms = 30             # Overrides the tunnel settings (0 = no copy)
+
+[cctv]
+dscp       ="8, 10"
+bearers    ="bearer2"*/
 
 
 class TunnelBuilder
@@ -64,7 +158,11 @@ public:
       std::string localAddress;
       std::string remoteAddress;
       TunnelProtocol tunnelProtocol { TunnelProtocol::Gre };
-      int port = 28774; // Server port TCP/UDP transport
+      int port = 28774; // Server port TCP/UDP transport (GTP: 2152)
+      BearerOptions options;
+      std::string name;
+      size_t slot = 0;  // position in the tunnel bearer list
+      std::list<std::string> mptcpEndpoints; // local addresses of MPTCP subflows
    };
 
    struct Tunnel
@@ -74,6 +172,22 @@ public:
       std::string localAddress;
       std::string remoteAddress;
       int port = 28774; // Server port TCP/UDP transport
+      MultipathMode multipath = MultipathMode::Mirroring;
+      TunnelPolicy::Handle policy; // nullptr if there are no service rules
+      TunnelMtu mtu;
+      bool activeBackup = false; // some path is in active-backup mode
+      ActiveBackupSettings backup;
+      bool adaptive = false; // some path is in adaptive mode
+      AdaptiveSettings redundancy;
+      std::list<std::string> routes; // shared device only
+   };
+
+   struct SharedDevice
+   {
+      std::string name; // empty if each tunnel has its own device
+      size_t queues = 1;
+      std::list<std::string> routes; // kernel routes to the device
+      std::chrono::microseconds spinBudget{0}; // busy-poll mode if > 0
    };
 
    using LookupTbl = std::map<std::string, Tunnel>;
@@ -94,7 +208,28 @@ private:
    LookupTblHandler _tunnels;
    MpTunnelMgr _mpTunnelMgr;
    std::shared_ptr<VirtualIfMgr> _vifmgr;
+   SharedDevice _shared;
 
    bool createTunnel(const std::string &ifname, const Tunnel &tunnel);
+
+   // Opens the shared device and adds its kernel routes
+   bool createSharedDevice();
+
+   // Routes the inner destinations of a tunnel of the shared device
+   void addSharedRoutes(const std::string &ifname, const Tunnel &tunnel);
+
+   static SharedDevice parseSharedDevice(const Config &cfg);
    static LookupTblHandler parseCfg(const Config &cfg);
+   static bool parseMultipathMode(const std::string &text, MultipathMode &mode);
+   static TunnelPolicy::Handle parsePolicies(
+      const Config &cfg, const std::string &tunnel,
+      const std::list<std::string> &bearers, const PathPolicy &defaultPath);
+
+   // Adds the MPTCP endpoints of a bearer to the kernel path manager
+   static void configureMptcp(const Bearer &bearer);
+
+   // Delayed copy settings of a tunnel or policy section
+   static bool parseDelayedCopy(
+      const Config &cfg, const std::string &name,
+      const std::list<std::string> &bearers, PathPolicy &path);
 };
@@ -0,0 +1,88 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include "TunnelFragment.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+#define BUNDLE_MAX_PACKET_LEN 256  // longer inner packets are sent on their own
+#define BUNDLE_MAX_LEN        1400 // bundle payload while the path MTU is unknown
+#define BUNDLE_MAX_DELAY_US   10000
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Bundle of small inner packets sent in a single UDP bearer datagram,
+ * which saves an outer IP/UDP header and a system call per packet.
+ * Each entry is the frame the packet would have been sent in alone (the
+ * packet followed by its pktid), after its length (2 bytes, network
+ * order); the bundle ends with a pktid of kind Bundle, which carries the
+ * bearer sequence number of the datagram.
+ */
+class TunnelBundle
+{
+public:
+   using Buffer = std::vector<char>;
+
+   // maxLen bounds the datagram payload, the bundle pktid included
+   explicit TunnelBundle(size_t maxLen);
+
+   // True if frame is a small packet which can be bundled
+   static bool bundleable(const char *frame, size_t len) noexcept;
+
+   // Adds a frame, unless it does not fit
+   bool add(const char *frame, size_t len);
+
+   // True if no further frame would fit
+   bool full() const noexcept;
+
+   // Frames added
+   size_t count() const noexcept
+   {
+      return _count;
+   }
+
+   // Ends the bundle with its pktid and moves it to datagram
+   void finish(Buffer &datagram);
+
+private:
+   size_t _maxLen;
+   Buffer _data;
+   size_t _count = 0;
+};
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Takes the frames of a received bundle one by one, so that each goes
+ * through the processing of a datagram.
+ */
+class TunnelUnbundler
+{
+public:
+   // Loads the entries of a bundle (payload without the bundle pktid).
+   // Returns false if it is malformed, then nothing is loaded.
+   bool load(const char *payload, size_t len);
+
+   // Copies the next frame into buf, returns its length (-1 if none is left)
+   int next(char *buf, size_t size) noexcept;
+
+private:
+   std::vector<char> _data;
+   size_t _next = 0;
+};
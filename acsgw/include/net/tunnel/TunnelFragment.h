@@ -0,0 +1,158 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include "Metrics.h"
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+#define REASSEMBLY_TIMEOUT_MS  500 // incomplete packets are dropped after this
+#define REASSEMBLY_MAX_PACKETS 256 // packets being reassembled per tunnel
+
+/* -------------------------------------------------------------------------- */
+
+// Kind of a frame carrying a pktid trailer, stored in the pktid top byte
+// (sequence numbers never reach it)
+enum class FrameKind : uint8_t
+{
+   Packet = 0,   // a whole inner packet
+   Fragment = 1, // FragmentHeader followed by a slice of an inner packet
+   Keepalive = 2, // no payload, a sign of life of the bearer
+   Feedback = 3,  // FeedbackReport on the frames received on the bearer
+   Ack = 4,       // ArqAck of the frames received on a reliable bearer
+   Bundle = 5     // small packets sent together, see TunnelBundle
+};
+
+constexpr int FRAME_KIND_SHIFT = 56;
+constexpr uint64_t FRAME_SEQ_MASK = (uint64_t(1) << FRAME_KIND_SHIFT) - 1;
+
+inline uint64_t makeFramePktId(uint64_t seq, FrameKind kind) noexcept
+{
+   return (seq & FRAME_SEQ_MASK) | (uint64_t(kind) << FRAME_KIND_SHIFT);
+}
+
+inline FrameKind getFrameKind(uint64_t pktid) noexcept
+{
+   return FrameKind(pktid >> FRAME_KIND_SHIFT);
+}
+
+// Sequence number of a frame on its bearer, stored below the frame kind
+// by the tunnels measuring the loss of their bearers (see BearerFeedback).
+// It is not part of the packet identity: copies on other bearers differ.
+constexpr int BEARER_SEQ_SHIFT = 40;
+constexpr uint64_t BEARER_SEQ_MASK = uint64_t(0xffff) << BEARER_SEQ_SHIFT;
+
+inline uint64_t setBearerSeq(uint64_t pktid, uint16_t seq) noexcept
+{
+   return (pktid & ~BEARER_SEQ_MASK) | (uint64_t(seq) << BEARER_SEQ_SHIFT);
+}
+
+inline uint16_t getBearerSeq(uint64_t pktid) noexcept
+{
+   return uint16_t((pktid & BEARER_SEQ_MASK) >> BEARER_SEQ_SHIFT);
+}
+
+// Bits of the pktid identifying the packet, which wraps within them
+constexpr uint64_t PACKET_ID_MASK = (uint64_t(1) << BEARER_SEQ_SHIFT) - 1;
+
+/* -------------------------------------------------------------------------- */
+
+// Header of a tunnel fragment. Fragments of a packet share its pktid,
+// whatever bearer they are sent on.
+#pragma pack(push, 1)
+struct FragmentHeader
+{
+   uint16_t offset; // of the slice in the inner packet (network order)
+   uint16_t length; // inner packet length (network order)
+};
+#pragma pack(pop)
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Reassembles the inner packets fragmented by the peer tunnel.
+ * Fragments may come from any bearer of the tunnel, duplicated and
+ * with different sizes (as bearers have different MTUs): a packet is
+ * complete once its fragments cover it.
+ * The table is bounded: incomplete packets are dropped after a timeout
+ * or, if too many, starting from the oldest one. Copies of fragments of
+ * a recently completed packet are ignored.
+ */
+class TunnelReassembler
+{
+public:
+   using Buffer = std::vector<char>;
+   using Clock = std::chrono::steady_clock;
+   using Handle = std::shared_ptr<TunnelReassembler>;
+
+   TunnelReassembler(const std::string &name,
+                     std::chrono::milliseconds timeout = std::chrono::milliseconds(REASSEMBLY_TIMEOUT_MS),
+                     size_t maxPackets = REASSEMBLY_MAX_PACKETS);
+
+   TunnelReassembler(const TunnelReassembler &) = delete;
+   TunnelReassembler &operator=(const TunnelReassembler &) = delete;
+
+   // Adds a fragment frame (header and slice) of the packet seq.
+   // Returns true if the packet is complete, moving it to packet.
+   bool add(uint64_t seq, const char *frame, size_t len, Buffer &packet);
+
+private:
+   // Byte ranges [first, second) of a packet received so far
+   using Ranges = std::vector<std::pair<uint32_t, uint32_t>>;
+
+   struct Entry
+   {
+      uint64_t seq = 0;
+      Clock::time_point expiresAt;
+      Buffer data;
+      Ranges ranges;
+   };
+
+   using Entries = std::list<Entry>; // oldest first
+
+   std::mutex _lock;
+   std::chrono::milliseconds _timeout;
+   size_t _maxPackets;
+   Entries _entries;
+   std::unordered_map<uint64_t, Entries::iterator> _index;
+
+   // Recently completed packets, oldest first
+   std::unordered_set<uint64_t> _completed;
+   std::deque<uint64_t> _completedHistory;
+
+   struct ReassemblyMetrics
+   {
+      Metrics::Value *reassembled = nullptr;
+      Metrics::Value *timeouts = nullptr;
+      Metrics::Value *evictions = nullptr;
+      Metrics::Value *malformed = nullptr;
+   } _metrics;
+
+   void erase(Entries::iterator it);
+
+   // Adds [first, last) to ranges, returns true if they cover [0, length)
+   static bool cover(Ranges &ranges, uint32_t first, uint32_t last, uint32_t length);
+};
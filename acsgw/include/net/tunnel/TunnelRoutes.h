@@ -0,0 +1,108 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Egress routes of the tunnels sharing a TUN device (see
+ * VirtualIfMgr::setSharedDevice()): a packet goes to the tunnel of the
+ * longest prefix containing its inner destination.
+ * Routes come from the configuration and from the SIP registrations.
+ * They are compiled in a multibit trie (4 bits per level, each prefix
+ * expanded to the node entries it covers), so an address is resolved in
+ * at most 8 steps, through the nodes of a single array.
+ * Every change compiles a new trie; readers take it without locking
+ * until the next change.
+ */
+class TunnelRouteTable
+{
+public:
+   static TunnelRouteTable &getInstance();
+
+   TunnelRouteTable(const TunnelRouteTable &) = delete;
+   TunnelRouteTable &operator=(const TunnelRouteTable &) = delete;
+
+   // Parses "a.b.c.d[/len]" (address in host byte order, host bits
+   // cleared). Returns false on syntax errors.
+   static bool parsePrefix(const std::string &text, uint32_t &addr, unsigned &len);
+
+   // Routes the prefix to tunnel, replacing its previous route
+   void add(uint32_t addr, unsigned len, const std::string &tunnel);
+
+   // Returns false if the prefix has no route
+   bool del(uint32_t addr, unsigned len);
+
+   // Removes the routes of a tunnel
+   void delTunnel(const std::string &tunnel);
+
+   // Gets the tunnel of the longest prefix containing addr (host byte
+   // order). Returns false if there is none.
+   bool lookup(uint32_t addr, std::string &tunnel) const;
+
+   size_t size() const;
+
+   // Shared device the routes are for (empty if tunnels have their own)
+   void setDevice(const std::string &device);
+   std::string device() const;
+
+   // Records a kernel route of an aggregate to the shared device (see
+   // [tunnels] shared_routes): the tunnel routes it covers need no
+   // kernel route of their own
+   void addDeviceRoute(uint32_t addr, unsigned len);
+
+   // True if a kernel route to the shared device covers the prefix
+   bool deviceCovers(uint32_t addr, unsigned len) const;
+
+private:
+   static constexpr int32_t NO_TUNNEL = -1;
+
+   struct TrieEntry
+   {
+      int32_t child = -1;
+      int32_t tunnel = NO_TUNNEL; // longest prefix covering the entry
+   };
+
+   using TrieNode = std::array<TrieEntry, 16>;
+
+   struct Trie
+   {
+      std::vector<TrieNode> nodes;
+      std::vector<std::string> tunnels;
+   };
+
+   using Prefix = std::pair<uint32_t, unsigned>; // address, length
+
+   mutable std::mutex _lock;
+   std::map<Prefix, std::string> _routes;
+   std::shared_ptr<const Trie> _trie;
+   std::atomic<uint64_t> _version{0};
+   std::string _device;
+   std::vector<Prefix> _deviceRoutes;
+
+   TunnelRouteTable();
+
+   // Compiles the routes, then publishes the trie (lock held)
+   void publish();
+};
@@ -0,0 +1,269 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include "BoundedQueue.h"
+#include "TokenBucket.h"
+#include "TrafficClass.h"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Transmit scheduler of a bearer: one queue per traffic class.
+ * Critical frames are strictly prioritised; the other classes share the
+ * remaining capacity by deficit round robin, in proportion to their quanta
+ * (a byte-based approximation of weighted fair queueing).
+ * A class can be capped by a token bucket: while over its rate it is
+ * skipped, so that it never holds back the other classes.
+ * Any number of producers, a single consumer. T must provide size().
+ */
+template <class T>
+class TxScheduler
+{
+public:
+   using Quanta = std::array<size_t, TRAFFIC_CLASS_COUNT>;
+   using Clock = TokenBucket::Clock;
+
+   TxScheduler(size_t classQueueLen, const Quanta &quanta)
+   {
+      for (size_t i = 0; i < TRAFFIC_CLASS_COUNT; ++i)
+      {
+         _classes[i].queue = std::make_unique<BoundedQueue<T>>(classQueueLen);
+         _classes[i].quantum = quanta[i] > 0 ? quanta[i] : 1;
+      }
+   }
+
+   TxScheduler(const TxScheduler &) = delete;
+   TxScheduler &operator=(const TxScheduler &) = delete;
+
+   // Returns false if the class queue is full (item is left untouched)
+   bool push(T &&item, TrafficClass tc)
+   {
+      if (!_classes[size_t(tc)].queue->tryPush(std::move(item)))
+      {
+         return false;
+      }
+
+      _event.notify();
+
+      return true;
+   }
+
+   // Return false either if a timeout occours, cond() is true or
+   // timeout=0 and there is no data ready. A negative timeout waits forever.
+   template <class Cond>
+   bool pop(T &res, int timeout, Cond cond)
+   {
+      if (!_shaped)
+      {
+         return _event.await([&]() { return tryPop(res); }, timeout, cond, _spinBudget);
+      }
+
+      if (timeout == 0)
+      {
+         return tryPop(res);
+      }
+
+      const auto deadline = timeout < 0 ? Clock::time_point::max() :
+                                          Clock::now() + std::chrono::milliseconds(timeout);
+
+      return popUntil(res, deadline, cond);
+   }
+
+   // As pop(), up to an absolute deadline
+   template <class Cond>
+   bool popUntil(T &res, Clock::time_point deadline, Cond cond)
+   {
+      // tryPop() moves the wake-up time earlier while a class is throttled
+      do
+      {
+         _wakeAt = deadline;
+
+         if (_event.awaitUntil([&]() { return tryPop(res); }, _wakeAt, cond, _spinBudget))
+         {
+            return true;
+         }
+      } while (!cond() && Clock::now() < deadline);
+
+      return false;
+   }
+
+   bool pop(T &res, int timeout)
+   {
+      return pop(res, timeout, [] { return false; });
+   }
+
+   // Consumer side only
+   bool tryPop(T &res)
+   {
+      const auto now = _shaped ? Clock::now() : Clock::time_point();
+
+      // Strict priority first
+      if (fetch(res, TrafficClass::Critical, now))
+      {
+         return true;
+      }
+
+      // Deficit round robin among the other classes: each visit adds the
+      // class quantum to its deficit, which is spent to send head frames
+      constexpr size_t FIRST_DRR_CLASS = size_t(TrafficClass::Critical) + 1;
+      constexpr size_t DRR_CLASSES = TRAFFIC_CLASS_COUNT - FIRST_DRR_CLASS;
+
+      size_t idleVisits = 0;
+
+      while (idleVisits < DRR_CLASSES)
+      {
+         ClassQueue &cq = _classes[FIRST_DRR_CLASS + _cursor];
+
+         if (!cq.hasHead && !(cq.hasHead = cq.queue->tryPop(cq.head)))
+         {
+            // An idle class does not accumulate credit
+            cq.deficit = 0;
+            nextDrrClass();
+            ++idleVisits;
+            continue;
+         }
+
+         // A throttled class neither sends nor accumulates credit
+         if (throttled(cq, now))
+         {
+            nextDrrClass();
+            ++idleVisits;
+            continue;
+         }
+
+         idleVisits = 0;
+
+         if (_newVisit)
+         {
+            cq.deficit += cq.quantum;
+            _newVisit = false;
+         }
+
+         const size_t size = cq.head.size();
+
+         if (size <= cq.deficit && (!cq.shaper || cq.shaper->tryConsume(size, now)))
+         {
+            cq.deficit -= size;
+            res = std::move(cq.head);
+            cq.hasHead = false;
+            return true;
+         }
+
+         nextDrrClass();
+      }
+
+      return false;
+   }
+
+   // Wakes up the blocked consumer, so that it can re-evaluate its
+   // pop() condition
+   void wakeAll() noexcept
+   {
+      _event.wakeAll();
+   }
+
+   // Caps the rate of a class (nullptr removes the cap). The bucket must
+   // outlive the scheduler. Call before pop() is first used.
+   void setShaper(TrafficClass tc, TokenBucket *shaper) noexcept
+   {
+      _classes[size_t(tc)].shaper = shaper && shaper->limited() ? shaper : nullptr;
+
+      _shaped = false;
+
+      for (const auto &cq : _classes)
+         _shaped = _shaped || cq.shaper;
+   }
+
+   // Time pop() keeps polling empty queues before blocking
+   void setSpinBudget(std::chrono::nanoseconds spinBudget) noexcept
+   {
+      _spinBudget = spinBudget;
+   }
+
+   // Approximated number of queued items
+   size_t size() const noexcept
+   {
+      size_t n = 0;
+
+      for (const auto &cq : _classes)
+         n += cq.queue->size() + (cq.hasHead ? 1 : 0);
+
+      return n;
+   }
+
+private:
+   struct ClassQueue
+   {
+      std::unique_ptr<BoundedQueue<T>> queue;
+      TokenBucket *shaper = nullptr;
+      size_t quantum = 1;
+      size_t deficit = 0;
+      T head{}; // frame popped but not yet affordable
+      bool hasHead = false;
+   };
+
+   std::array<ClassQueue, TRAFFIC_CLASS_COUNT> _classes;
+   size_t _cursor = 0; // DRR position (relative to the first DRR class)
+   bool _newVisit = true;
+
+   EventCount _event;
+   std::chrono::nanoseconds _spinBudget = EventCount::defaultSpinBudget();
+
+   bool _shaped = false;
+   Clock::time_point _wakeAt = Clock::time_point::max();
+
+   // True if the class head frame is over the class rate, in which
+   // case the consumer is woken up when the class conforms again
+   bool throttled(const ClassQueue &cq, Clock::time_point now) noexcept
+   {
+      if (!cq.shaper || cq.shaper->conforms(now))
+         return false;
+
+      _wakeAt = std::min(_wakeAt, cq.shaper->conformAt(now));
+
+      return true;
+   }
+
+   bool fetch(T &res, TrafficClass tc, Clock::time_point now)
+   {
+      ClassQueue &cq = _classes[size_t(tc)];
+
+      if (!cq.hasHead && !(cq.hasHead = cq.queue->tryPop(cq.head)))
+      {
+         return false;
+      }
+
+      if (throttled(cq, now) || (cq.shaper && !cq.shaper->tryConsume(cq.head.size(), now)))
+      {
+         return false;
+      }
+
+      res = std::move(cq.head);
+      cq.hasHead = false;
+
+      return true;
+   }
+
+   void nextDrrClass() noexcept
+   {
+      _cursor = (_cursor + 1) % (TRAFFIC_CLASS_COUNT - size_t(TrafficClass::Critical) - 1);
+      _newVisit = true;
+   }
+};
@@ -14,6 +14,7 @@
 
 #include "MacAddress.h"
 #include "IpAddress.h"
+#include "Metrics.h"
 #include "TunTap.h"
 
 #include <sys/types.h>
@@ -23,8 +24,10 @@
 #include <string>
 #include <unistd.h>
 
+#include <chrono>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 /* -------------------------------------------------------------------------- */
 
@@ -33,15 +36,44 @@ class VirtualIfMgr
 public:
    enum
    {
-      MAX_PKT_SIZE = 64 * 1024
+      MAX_PKT_SIZE = 64 * 1024,
+      MAX_QUEUES = 16 // of a shared device
    };
 
 private:
    std::unordered_map<std::string, std::shared_ptr<TunTap>> _devs;
 
+   // Shared device: its queues, and the MTU each tunnel wants (the
+   // device takes the smallest)
+   std::string _sharedDev;
+   std::vector<std::shared_ptr<TunTap>> _queues;
+   std::unordered_map<std::string, int> _mtus;
+   int _sharedMtu = -1;
+   Metrics::Value *_unroutedDrops = nullptr;
+
 public:
    VirtualIfMgr() = default;
 
+   // Every tunnel added afterwards shares the TUN device name, whose
+   // queues (IFF_MULTI_QUEUE) are read by as many threads: the tunnel of
+   // an egress packet is the route of its inner destination in
+   // TunnelRouteTable. Call before addIf().
+   bool setSharedDevice(
+       const std::string &name,
+       size_t queues) noexcept;
+
+   // Name of the shared device (empty if each tunnel has its own)
+   const std::string &sharedDevice() const noexcept
+   {
+      return _sharedDev;
+   }
+
+   // Queues the packets of the tunnels are read from
+   size_t queueCount() const noexcept
+   {
+      return _queues.empty() ? 1 : _queues.size();
+   }
+
    ssize_t addIf(
        const std::string &ifname
        //int mtu
@@ -52,8 +84,20 @@ public:
        const char *data,
        size_t datalen) noexcept;
 
+   // Reads an egress packet and the tunnel it belongs to. Packets of
+   // the shared device without a route are dropped.
    ssize_t getPacket(
        char *buf,
        size_t bufsize,
-       std::string &ifname) noexcept;
+       std::string &ifname,
+       size_t queue = 0) noexcept;
+
+   // Reads from ifname spin for up to spinBudget before blocking
+   bool setBusyPoll(
+       const std::string &ifname,
+       std::chrono::microseconds spinBudget) noexcept;
+
+   bool setMtu(
+       const std::string &ifname,
+       int mtu) noexcept;
 };
@@ -11,7 +11,7 @@
 
 /* -------------------------------------------------------------------------- */
 
-#include "LockedQueue.h"
+#include "BoundedQueue.h"
 #include "TransportSocket.h"
 #include "SipParsedMessage.h"
 
@@ -58,7 +58,7 @@ private:
    std::atomic_bool _stop{false};
    std::unique_ptr<std::thread> _connectionMgrHandle;
 
-   LockedQueue<std::string> _sendMsg{1};
-   LockedQueue<SipParsedMessage::Handle> _recvMsg{1};
+   BoundedQueue<std::string> _sendMsg{1};
+   BoundedQueue<SipParsedMessage::Handle> _recvMsg{1};
 };
 
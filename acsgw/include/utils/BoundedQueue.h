@@ -0,0 +1,556 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* -------------------------------------------------------------------------- */
+
+enum class QueueMode
+{
+   Mpmc, // multiple producers, multiple consumers
+   Spsc  // single producer, single consumer
+};
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Lets consumers of lock-free containers block while there is nothing
+ * to consume. A consumer sleeps on a futex only after failing to fetch
+ * an item, and producers issue the wake-up system call only if some
+ * consumer is actually sleeping.
+ */
+class EventCount
+{
+public:
+   EventCount() = default;
+   EventCount(const EventCount &) = delete;
+   EventCount &operator=(const EventCount &) = delete;
+
+   using Clock = std::chrono::steady_clock;
+
+   // Calls tryFetch() until it succeeds, cond() is true or the timeout
+   // (ms) expires. It polls for spinBudget before sleeping.
+   // timeout=0 only tries once, a negative timeout waits forever.
+   template <class TryFetch, class Cond>
+   bool await(TryFetch tryFetch, int timeout, Cond cond, std::chrono::nanoseconds spinBudget)
+   {
+      if (timeout == 0)
+      {
+         return tryFetch();
+      }
+
+      const auto deadline = timeout < 0 ? Clock::time_point::max() :
+                                          Clock::now() + std::chrono::milliseconds(timeout);
+
+      return awaitUntil(tryFetch, deadline, cond, spinBudget);
+   }
+
+   // As await(), up to an absolute deadline (time_point::max() waits
+   // forever). The deadline is re-read at each wake-up, so tryFetch()
+   // may move it earlier.
+   template <class TryFetch, class Cond>
+   bool awaitUntil(TryFetch tryFetch, const Clock::time_point &deadline, Cond cond,
+                   std::chrono::nanoseconds spinBudget)
+   {
+      if (tryFetch())
+      {
+         return true;
+      }
+
+      // Spin for a while before paying for a futex sleep/wake-up round trip
+      if (spinBudget.count() > 0)
+      {
+         const auto spinDeadline = std::min(deadline, Clock::now() + spinBudget);
+
+         do
+         {
+            cpuRelax();
+
+            if (tryFetch())
+            {
+               return true;
+            }
+         } while (Clock::now() < spinDeadline && !cond());
+      }
+
+      while (!cond())
+      {
+         // Announce a sleeper, then re-check: a producer either sees the
+         // flag or we see its item
+         const uint32_t key = _event.fetch_or(WAITERS_FLAG, std::memory_order_seq_cst) | WAITERS_FLAG;
+
+         if (tryFetch())
+         {
+            return true;
+         }
+
+         bool expired = false;
+
+         if (deadline == Clock::time_point::max())
+         {
+            futexWait(key, nullptr);
+         }
+         else
+         {
+            const auto left = deadline - Clock::now();
+
+            if (left.count() <= 0)
+            {
+               expired = true;
+            }
+            else
+            {
+               const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+               struct timespec ts = {time_t(ns / 1000000000LL), long(ns % 1000000000LL)};
+               futexWait(key, &ts);
+            }
+         }
+
+         if (tryFetch())
+         {
+            return true;
+         }
+
+         if (expired)
+         {
+            break;
+         }
+      }
+
+      return false;
+   }
+
+   // To be called by producers after publishing an item
+   void notify() noexcept
+   {
+      // Pairs with the flag set in await(): either the producer sees the
+      // sleeping consumer or the consumer sees the new item
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      uint32_t event = _event.load(std::memory_order_relaxed);
+
+      // Only the producer which clears the flag pays for the system call.
+      // Sleepers are all woken up, as they cannot be told apart.
+      while (event & WAITERS_FLAG)
+      {
+         if (_event.compare_exchange_weak(event, (event | WAITERS_FLAG) + 1,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed))
+         {
+            futexWake(INT_MAX);
+            break;
+         }
+      }
+   }
+
+   // Wakes up any blocked consumer, so that it can re-evaluate its condition
+   void wakeAll() noexcept
+   {
+      _event.fetch_add(EVENT_STEP, std::memory_order_release);
+      futexWake(INT_MAX);
+   }
+
+   // Spinning is pointless if producer and consumer share the only CPU
+   static std::chrono::nanoseconds defaultSpinBudget() noexcept
+   {
+      static const std::chrono::nanoseconds spinBudget(
+         std::thread::hardware_concurrency() > 1 ? 5000 : 0);
+      return spinBudget;
+   }
+
+private:
+   // Bit 0 is set while some consumer is (about to be) sleeping,
+   // the other bits are an epoch counter the consumers wait on
+   static constexpr uint32_t WAITERS_FLAG = 1;
+   static constexpr uint32_t EVENT_STEP = 2;
+
+   std::atomic<uint32_t> _event{0};
+
+   static void cpuRelax() noexcept
+   {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#else
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+   }
+
+   void futexWait(uint32_t key, const struct timespec *timeout) noexcept
+   {
+      ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&_event),
+                FUTEX_WAIT_PRIVATE, key, timeout, nullptr, 0);
+   }
+
+   void futexWake(int count) noexcept
+   {
+      ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&_event),
+                FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+   }
+};
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Blocking part of the bounded queues.
+ * Derived class must implement tryPush(T&&) and tryPop(T&).
+ */
+template <class T, class Derived>
+class BoundedQueueBase
+{
+public:
+   // Returns false if the queue is full (item is left untouched)
+   bool push(T &&item)
+   {
+      if (!derived().tryPush(std::move(item)))
+      {
+         return false;
+      }
+
+      _event.notify();
+
+      return true;
+   }
+
+   // Moves up to n items into the queue, returns how many were pushed
+   size_t push_n(T *items, size_t n)
+   {
+      size_t pushed = 0;
+
+      while (pushed < n && derived().tryPush(std::move(items[pushed])))
+      {
+         ++pushed;
+      }
+
+      if (pushed > 0)
+      {
+         _event.notify();
+      }
+
+      return pushed;
+   }
+
+   // Return false either if a timeout occours, cond() is true or
+   // timeout=0 and there is no data ready. A negative timeout waits forever.
+   template <class Cond>
+   bool pop(T &res, int timeout, Cond cond)
+   {
+      return _event.await([&]() { return derived().tryPop(res); }, timeout, cond, _spinBudget);
+   }
+
+   bool pop(T &res, int timeout)
+   {
+      return pop(res, timeout, [] { return false; });
+   }
+
+   // Waits as pop() for the first item, then moves out up to n items
+   // which are already available. Returns how many were popped.
+   template <class Cond>
+   size_t pop_n(T *out, size_t n, int timeout, Cond cond)
+   {
+      if (n == 0 || !pop(out[0], timeout, cond))
+      {
+         return 0;
+      }
+
+      size_t popped = 1;
+
+      while (popped < n && derived().tryPop(out[popped]))
+      {
+         ++popped;
+      }
+
+      return popped;
+   }
+
+   size_t pop_n(T *out, size_t n, int timeout)
+   {
+      return pop_n(out, n, timeout, [] { return false; });
+   }
+
+   // Wakes up any blocked consumer, so that it can re-evaluate its
+   // pop() condition
+   void wakeAll() noexcept
+   {
+      _event.wakeAll();
+   }
+
+   // Time pop() keeps polling an empty queue before blocking
+   void setSpinBudget(std::chrono::nanoseconds spinBudget) noexcept
+   {
+      _spinBudget = spinBudget;
+   }
+
+protected:
+   BoundedQueueBase() = default;
+
+   static size_t roundUpCapacity(size_t maxSize) noexcept
+   {
+      size_t capacity = 2;
+
+      while (capacity < maxSize)
+      {
+         capacity <<= 1;
+      }
+
+      return capacity;
+   }
+
+private:
+   EventCount _event;
+   std::chrono::nanoseconds _spinBudget = EventCount::defaultSpinBudget();
+
+   Derived &derived() noexcept
+   {
+      return static_cast<Derived &>(*this);
+   }
+};
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Bounded lock-free queue (D. Vyukov's MPMC ring buffer).
+ * Capacity is rounded up to the next power of two.
+ */
+template <class T, QueueMode Mode = QueueMode::Mpmc>
+class BoundedQueue : public BoundedQueueBase<T, BoundedQueue<T, Mode>>
+{
+public:
+   explicit BoundedQueue(size_t maxSize = 1) :
+      _mask(BoundedQueue::roundUpCapacity(maxSize) - 1),
+      _cells(new Cell[_mask + 1])
+   {
+      for (size_t i = 0; i <= _mask; ++i)
+      {
+         _cells[i].sequence.store(i, std::memory_order_relaxed);
+      }
+   }
+
+   ~BoundedQueue()
+   {
+      T item;
+      while (tryPop(item))
+      {
+      }
+   }
+
+   BoundedQueue(const BoundedQueue &) = delete;
+   BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+   bool tryPush(T &&item)
+   {
+      Cell *cell = nullptr;
+      size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+
+      while (true)
+      {
+         cell = &_cells[pos & _mask];
+         const size_t seq = cell->sequence.load(std::memory_order_acquire);
+         const intptr_t dif = intptr_t(seq) - intptr_t(pos);
+
+         if (dif == 0)
+         {
+            if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+               break;
+         }
+         else if (dif < 0)
+         {
+            return false; // full
+         }
+         else
+         {
+            pos = _enqueuePos.load(std::memory_order_relaxed);
+         }
+      }
+
+      new (&cell->storage) T(std::move(item));
+      cell->sequence.store(pos + 1, std::memory_order_release);
+
+      return true;
+   }
+
+   bool tryPop(T &res)
+   {
+      Cell *cell = nullptr;
+      size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+
+      while (true)
+      {
+         cell = &_cells[pos & _mask];
+         const size_t seq = cell->sequence.load(std::memory_order_acquire);
+         const intptr_t dif = intptr_t(seq) - intptr_t(pos + 1);
+
+         if (dif == 0)
+         {
+            if (_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+               break;
+         }
+         else if (dif < 0)
+         {
+            return false; // empty
+         }
+         else
+         {
+            pos = _dequeuePos.load(std::memory_order_relaxed);
+         }
+      }
+
+      T *item = reinterpret_cast<T *>(&cell->storage);
+      res = std::move(*item);
+      item->~T();
+
+      cell->sequence.store(pos + _mask + 1, std::memory_order_release);
+
+      return true;
+   }
+
+   size_t capacity() const noexcept
+   {
+      return _mask + 1;
+   }
+
+   // Approximated number of queued items
+   size_t size() const noexcept
+   {
+      const size_t enq = _enqueuePos.load(std::memory_order_relaxed);
+      const size_t deq = _dequeuePos.load(std::memory_order_relaxed);
+      return enq > deq ? enq - deq : 0;
+   }
+
+   bool empty() const noexcept
+   {
+      return size() == 0;
+   }
+
+private:
+   struct Cell
+   {
+      std::atomic<size_t> sequence;
+      typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+   };
+
+   const size_t _mask;
+   std::unique_ptr<Cell[]> _cells;
+
+   alignas(64) std::atomic<size_t> _enqueuePos{0};
+   alignas(64) std::atomic<size_t> _dequeuePos{0};
+};
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Single producer/single consumer specialisation: no CAS loop, producer and
+ * consumer only exchange their ring indices.
+ */
+template <class T>
+class BoundedQueue<T, QueueMode::Spsc> : public BoundedQueueBase<T, BoundedQueue<T, QueueMode::Spsc>>
+{
+public:
+   explicit BoundedQueue(size_t maxSize = 1) :
+      _mask(BoundedQueue::roundUpCapacity(maxSize) - 1),
+      _slots(new Slot[_mask + 1])
+   {
+   }
+
+   ~BoundedQueue()
+   {
+      T item;
+      while (tryPop(item))
+      {
+      }
+   }
+
+   BoundedQueue(const BoundedQueue &) = delete;
+   BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+   bool tryPush(T &&item)
+   {
+      const size_t tail = _tail.load(std::memory_order_relaxed);
+
+      if (tail - _headCache > _mask)
+      {
+         _headCache = _head.load(std::memory_order_acquire);
+
+         if (tail - _headCache > _mask)
+            return false; // full
+      }
+
+      new (&_slots[tail & _mask].storage) T(std::move(item));
+      _tail.store(tail + 1, std::memory_order_release);
+
+      return true;
+   }
+
+   bool tryPop(T &res)
+   {
+      const size_t head = _head.load(std::memory_order_relaxed);
+
+      if (head == _tailCache)
+      {
+         _tailCache = _tail.load(std::memory_order_acquire);
+
+         if (head == _tailCache)
+            return false; // empty
+      }
+
+      T *item = reinterpret_cast<T *>(&_slots[head & _mask].storage);
+      res = std::move(*item);
+      item->~T();
+
+      _head.store(head + 1, std::memory_order_release);
+
+      return true;
+   }
+
+   size_t capacity() const noexcept
+   {
+      return _mask + 1;
+   }
+
+   size_t size() const noexcept
+   {
+      return _tail.load(std::memory_order_relaxed) - _head.load(std::memory_order_relaxed);
+   }
+
+   bool empty() const noexcept
+   {
+      return size() == 0;
+   }
+
+private:
+   struct Slot
+   {
+      typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+   };
+
+   const size_t _mask;
+   std::unique_ptr<Slot[]> _slots;
+
+   alignas(64) std::atomic<size_t> _head{0};
+   size_t _tailCache = 0; // consumer side copy of _tail
+
+   alignas(64) std::atomic<size_t> _tail{0};
+   size_t _headCache = 0; // producer side copy of _head
+};
@@ -1,5 +1,13 @@
 #pragma once 
 
+#include <stdint.h>
+
+#ifndef GTP_MAX
+#define GTP_MAX 1500 /* payload room of the packet structs */
+#endif
+
+#define GTP1U_PORT 2152 /* GTP-U, 3GPP 29.281 */
+
 /* GTP 0 header. 
  * Explanation to some of the fields:
  * SNDCP NPDU Number flag = 0 except for inter SGSN handover situations
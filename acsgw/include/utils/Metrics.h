@@ -0,0 +1,87 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include "Config.h"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+/* -------------------------------------------------------------------------- */
+
+/* -- config example --
+
+[metrics]
+file     = "/tmp/acsgw.metrics" # metrics are periodically dumped here
+interval = 5                    # seconds
+
+*/
+
+/**
+ * Registry of named counters and gauges.
+ * Metrics are never removed, so the references returned by get() can be
+ * cached by the owners and updated lock-free from data-plane threads.
+ */
+class Metrics
+{
+   Metrics() = default;
+   Metrics(const Metrics &) = delete;
+   Metrics &operator=(const Metrics &) = delete;
+
+public:
+   using Value = std::atomic<uint64_t>;
+
+   static Metrics &getInstance();
+
+   bool configure(const Config &config);
+
+   // Returns the metric of the given name, creating it if it does not exist
+   Value &get(const std::string &name);
+
+   static void add(Value &metric, uint64_t value) noexcept
+   {
+      metric.fetch_add(value, std::memory_order_relaxed);
+   }
+
+   static void set(Value &metric, uint64_t value) noexcept
+   {
+      metric.store(value, std::memory_order_relaxed);
+   }
+
+   static void updateMax(Value &metric, uint64_t value) noexcept
+   {
+      uint64_t cur = metric.load(std::memory_order_relaxed);
+
+      while (value > cur &&
+             !metric.compare_exchange_weak(cur, value, std::memory_order_relaxed))
+      {
+      }
+   }
+
+   void describe(std::ostream &os) const;
+
+private:
+   std::map<std::string, std::unique_ptr<Value>> _metrics;
+   mutable std::mutex _lock;
+   std::string _fileName;
+   int _interval = 5; // sec
+   std::unique_ptr<std::thread> _exporter;
+
+   void exportToFile() const;
+};
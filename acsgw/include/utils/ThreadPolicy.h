@@ -0,0 +1,86 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include "Config.h"
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+/* -- config example --
+
+[threads]
+xmit_cpus     = "2"     # CPU list, e.g. "1,3" or "2-5"
+xmit_priority = 80      # SCHED_FIFO priority (0 = default scheduler)
+recv_cpus     = "3"
+recv_priority = 80
+tcp_cpus      = "2-3"   # TCP bearer sender/receiver threads
+tcp_priority  = 70
+control_cpus  = "0-1"   # SIP, metrics and any other thread
+numa_local    = "yes"   # data-plane threads allocate on their NUMA node
+
+*/
+
+/* -------------------------------------------------------------------------- */
+
+enum class ThreadRole
+{
+   Xmit,    // TUN reader, tunnel transmitter
+   Recv,    // per-bearer tunnel receiver
+   Tcp,     // TCP bearer connection threads
+   Control, // signalling and housekeeping
+};
+
+constexpr size_t THREAD_ROLE_COUNT = 4;
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * CPU affinity, scheduling and memory placement of each thread role.
+ * Threads call apply() for their own role as soon as they start.
+ */
+class ThreadPolicy
+{
+   ThreadPolicy() = default;
+   ThreadPolicy(const ThreadPolicy &) = delete;
+   ThreadPolicy &operator=(const ThreadPolicy &) = delete;
+
+public:
+   static ThreadPolicy &getInstance();
+
+   bool configure(const Config &config);
+
+   // Applies the role policy to the calling thread and names it
+   // (name is truncated to 15 characters). Roles not configured
+   // are left untouched. Threads sharing some work (i.e. the shards
+   // of a bearer) can be given a slot: slot i then runs on the i-th
+   // CPU of the role list only.
+   bool apply(ThreadRole role, const char *name = nullptr, int slot = -1) const noexcept;
+
+   // Parses a CPU list such as "0,2-4"
+   static bool parseCpuList(const std::string &text, std::vector<int> &cpus);
+
+private:
+   struct RolePolicy
+   {
+      std::vector<int> cpus; // empty means any CPU
+      int priority = 0;      // SCHED_FIFO priority, 0 = SCHED_OTHER
+   };
+
+   std::array<RolePolicy, THREAD_ROLE_COUNT> _roles;
+   bool _numaLocal = false;
+};
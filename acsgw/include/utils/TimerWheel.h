@@ -0,0 +1,136 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#pragma once
+
+/* -------------------------------------------------------------------------- */
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Hashed timer wheel (G. Varghese, T. Lauck).
+ * Timers are kept in a ring of slots, one per tick: scheduling and
+ * expiring a timer cost O(1) however many are pending. Deadlines are
+ * rounded up to the tick; timers further than a wheel turn wait in
+ * their slot for the following turns.
+ * Not thread safe.
+ */
+template <class T>
+class TimerWheel
+{
+public:
+   using Clock = std::chrono::steady_clock;
+
+   TimerWheel(Clock::duration tick, size_t slots, Clock::time_point start = Clock::now()) :
+      _tick(tick),
+      _start(start),
+      _slots(std::max<size_t>(slots, 1))
+   {
+   }
+
+   // Adds a timer expiring at deadline. Deadlines already past expire
+   // on the next advance().
+   void schedule(Clock::time_point deadline, T item)
+   {
+      const uint64_t tick = std::max(tickOf(deadline), _current);
+
+      _slots[tick % _slots.size()].push_back({tick, std::move(item)});
+      ++_size;
+   }
+
+   // Calls expire(T&&) for each timer due by now, in deadline order (to
+   // the tick). Returns the number of expired timers.
+   template <class Expire>
+   size_t advance(Clock::time_point now, Expire expire)
+   {
+      if (now < _start)
+         return 0;
+
+      const uint64_t last = uint64_t((now - _start) / _tick);
+      size_t expired = 0;
+
+      for (; _current <= last && _size > 0; ++_current)
+      {
+         auto &slot = _slots[_current % _slots.size()];
+         size_t kept = 0;
+
+         // Timers of the following turns stay in the slot
+         for (size_t i = 0; i < slot.size(); ++i)
+         {
+            if (slot[i].tick <= _current)
+            {
+               expire(std::move(slot[i].item));
+               ++expired;
+               --_size;
+            }
+            else
+            {
+               if (kept != i)
+                  slot[kept] = std::move(slot[i]);
+
+               ++kept;
+            }
+         }
+
+         slot.erase(slot.begin() + kept, slot.end());
+      }
+
+      // An empty wheel catches up at once
+      if (_current <= last)
+         _current = last + 1;
+
+      return expired;
+   }
+
+   // Time the next tick is due at (the earliest a timer can expire)
+   Clock::time_point nextTick() const noexcept
+   {
+      return _start + _tick * int64_t(_current);
+   }
+
+   size_t size() const noexcept
+   {
+      return _size;
+   }
+
+   bool empty() const noexcept
+   {
+      return _size == 0;
+   }
+
+private:
+   struct Timer
+   {
+      uint64_t tick;
+      T item;
+   };
+
+   Clock::duration _tick;
+   Clock::time_point _start;
+   std::vector<std::vector<Timer>> _slots;
+   uint64_t _current = 0; // next tick to expire
+   size_t _size = 0;
+
+   uint64_t tickOf(Clock::time_point deadline) const noexcept
+   {
+      if (deadline <= _start)
+         return 0;
+
+      // Rounded up: a timer never expires early
+      return uint64_t((deadline - _start + _tick - Clock::duration(1)) / _tick);
+   }
+};
@@ -15,8 +15,11 @@
 /* -------------------------------------------------------------------------- */
 
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <regex>
 #include <string>
+#include <sys/socket.h>
 #include <time.h>
 
 
@@ -110,4 +113,164 @@ bool splitLineInTokens(const std::string& line,
     std::vector<std::string>& tokens, const std::string& sep);
 
 
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Enables the kernel busy polling of a socket (SO_BUSY_POLL), asking the
+ * kernel to prefer it over interrupt driven processing (SO_PREFER_BUSY_POLL)
+ * where supported.
+ *
+ * @param sd Socket descriptor
+ * @param usecs Time the kernel may busy poll the device queue on receive
+ * @return true if SO_BUSY_POLL has been set, false otherwise
+ */
+bool setBusyPoll(int sd, int usecs);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Marks the IPv4 packets sent by a socket with a DSCP (IP_TOS) and assigns
+ * them a queueing priority in the local qdiscs (SO_PRIORITY).
+ *
+ * @param sd Socket descriptor
+ * @param dscp DSCP value (0-63), negative to leave it unchanged
+ * @param priority Socket priority (0-6), negative to leave it unchanged
+ * @return true if the marking has been set, false otherwise
+ */
+bool setTrafficMarking(int sd, int dscp, int priority);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Sets the DF bit on the IPv4 packets sent by a socket, so that they are
+ * never fragmented: sends larger than the known path MTU fail (EMSGSIZE)
+ * and ICMP "fragmentation needed" errors update the kernel path MTU.
+ *
+ * @param sd Socket descriptor
+ * @return true if the option has been set, false otherwise
+ */
+bool setDontFragment(int sd);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Returns the path MTU the kernel knows for the route between two IPv4
+ * addresses (host byte order).
+ *
+ * @param localAddr Source address (0 = any)
+ * @param remoteAddr Destination address
+ * @return the path MTU, or -1 if there is no route
+ */
+int getPathMtu(uint32_t localAddr, uint32_t remoteAddr);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Lets the datagrams sent by a socket carry their departure time
+ * (SO_TXTIME), against the monotonic clock (i.e. steady_clock), which
+ * the fq qdisc of the egress device honours, releasing each datagram
+ * no earlier than its time.
+ *
+ * @param sd Socket descriptor
+ * @return true if the option has been set, false otherwise
+ */
+bool setTxTime(int sd);
+
+
+/* -------------------------------------------------------------------------- */
+
+// Room for the control message carrying a departure time
+union TxTimeCmsg
+{
+    char buf[CMSG_SPACE(sizeof(uint64_t))];
+    cmsghdr align;
+};
+
+/**
+ * Attaches a departure time to a message sent by a socket which has
+ * SO_TXTIME set (see setTxTime()).
+ *
+ * @param msg Message to send
+ * @param cmsg Control message buffer, which must outlive the send
+ * @param departureNs Departure time, ns of the monotonic clock
+ */
+void setDepartureTime(msghdr& msg, TxTimeCmsg& cmsg, uint64_t departureNs);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Sets the receive (SO_RCVBUF) or send (SO_SNDBUF) buffer size of a
+ * socket, beyond the system maximum if the process is allowed to
+ * (SO_RCVBUFFORCE/SO_SNDBUFFORCE).
+ *
+ * @param sd Socket descriptor
+ * @param receive true for the receive buffer, false for the send one
+ * @param bytes Requested size
+ * @return true if the size has been set, false otherwise
+ */
+bool setSocketBuffer(int sd, bool receive, size_t bytes);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Returns the receive or send buffer size of a socket, as the kernel
+ * accounts it (twice the requested size, which covers its overhead).
+ *
+ * @param sd Socket descriptor
+ * @param receive true for the receive buffer, false for the send one
+ * @return the size, or -1 on error
+ */
+int getSocketBuffer(int sd, bool receive);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Lets each datagram received by a socket carry the number of datagrams
+ * the kernel has dropped on its receive queue so far (SO_RXQ_OVFL).
+ *
+ * @param sd Socket descriptor
+ * @return true if the option has been set, false otherwise
+ */
+bool setRxQueueOverflow(int sd);
+
+
+/* -------------------------------------------------------------------------- */
+
+// Room for the control message carrying the drop counter
+union RxQueueOverflowCmsg
+{
+    char buf[CMSG_SPACE(sizeof(uint32_t))];
+    cmsghdr align;
+};
+
+/**
+ * Reads the drop counter of a message received by a socket which has
+ * SO_RXQ_OVFL set (see setRxQueueOverflow()).
+ *
+ * @param msg Message received
+ * @param drops Datagrams dropped by the socket since it was opened
+ * @return true if the message carries the counter, false otherwise
+ */
+bool getRxQueueOverflow(const msghdr& msg, uint32_t& drops);
+
+
+/* -------------------------------------------------------------------------- */
+
+/**
+ * Returns the bytes queued on the send side of a socket (SIOCOUTQ): not
+ * yet sent (or, for TCP, not yet acknowledged).
+ *
+ * @param sd Socket descriptor
+ * @return the bytes, or -1 on error
+ */
+int getSendQueue(int sd);
+
+
 } // namespace Tools
@@ -16,6 +16,10 @@
 #include "MpTunnel.h"
 #include "TunnelBuilder.h"
 #include "LogicalIpAddrMgr.h"
+#include "QosPolicy.h"
+#include "Metrics.h"
+#include "MemoryGovernor.h"
+#include "ThreadPolicy.h"
 #include "Logger.h"
 
 #include <cassert>
@@ -32,6 +36,7 @@
 #include <map>
 #include <signal.h>
 #include <cerrno>
+#include <cstring>
 
 /* -------------------------------------------------------------------------- */
 
@@ -370,8 +375,19 @@ public:
       // Configure the logical ip addresses manager
       LogicalIpAddrMgr::getInstance().configure(*_cfgHandle);
 
+      // Configure threads placement, traffic class policies, 
+      // memory budget and metrics exporter
+      ThreadPolicy::getInstance().configure(*_cfgHandle);
+      QosPolicy::getInstance().configure(*_cfgHandle);
+      MemoryGovernor::getInstance().configure(*_cfgHandle);
+      Metrics::getInstance().configure(*_cfgHandle);
+
       _tunnelBuilder = makeTunnelBuilder(*_cfgHandle);
 
+      // Data-plane threads are running, from now on the main thread and
+      // any thread it spawns (i.e. SIP workers) are control plane
+      ThreadPolicy::getInstance().apply(ThreadRole::Control);
+
       _sipServer =
           makeSipServer(_cfgHandle, _tunnelBuilder->getTunnelsTbl(), _progArgs);
    }
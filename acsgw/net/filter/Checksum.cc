@@ -0,0 +1,242 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "Checksum.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHECKSUM_X86 1
+#endif
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+// Shorter buffers (i.e. IP headers) are not worth a SIMD kernel
+constexpr size_t SIMD_MIN_LEN = 64;
+
+using SumKernel = uint64_t (*)(const uint8_t *data, size_t len, uint64_t sum);
+
+/* -------------------------------------------------------------------------- */
+
+// 32-bit words added in a 64-bit accumulator, which cannot overflow
+// (wrapped carries are restored by fold()).
+// Inlined in the SIMD kernels to sum their tail with the same encoding:
+// switching from AVX2 to legacy SSE code is slower than the whole
+// 256-bit loop on some CPUs, vzeroupper notwithstanding.
+__attribute__((always_inline)) inline uint64_t sumScalar(const uint8_t *data, size_t len, uint64_t sum)
+{
+    while (len >= 16)
+    {
+        uint32_t w[4];
+        memcpy(w, data, sizeof(w));
+
+        sum += uint64_t(w[0]) + w[1] + w[2] + w[3];
+        data += 16;
+        len -= 16;
+    }
+
+    while (len >= 4)
+    {
+        uint32_t w;
+        memcpy(&w, data, sizeof(w));
+
+        sum += w;
+        data += 4;
+        len -= 4;
+    }
+
+    if (len >= 2)
+    {
+        uint16_t w;
+        memcpy(&w, data, sizeof(w));
+
+        sum += w;
+        data += 2;
+        len -= 2;
+    }
+
+    // A trailing byte is padded with zero, in memory order
+    if (len > 0)
+    {
+        uint8_t last[2] = {*data, 0};
+        uint16_t w;
+        memcpy(&w, last, sizeof(w));
+
+        sum += w;
+    }
+
+    return sum;
+}
+
+/* -------------------------------------------------------------------------- */
+
+#ifdef CHECKSUM_X86
+
+// 32-bit words are widened to 64-bit lanes, then added
+__attribute__((target("sse2")))
+uint64_t sumSse2(const uint8_t *data, size_t len, uint64_t sum)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+
+    while (len >= 32)
+    {
+        const __m128i v0 = _mm_loadu_si128((const __m128i *)data);
+        const __m128i v1 = _mm_loadu_si128((const __m128i *)(data + 16));
+
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v0, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v0, zero));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v1, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v1, zero));
+
+        data += 32;
+        len -= 32;
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+
+    // Lane sums are below 2^63, so that their total does not overflow
+    sum += (lanes[0] & 0xffffffff) + (lanes[0] >> 32) +
+           (lanes[1] & 0xffffffff) + (lanes[1] >> 32);
+
+    return sumScalar(data, len, sum);
+}
+
+/* -------------------------------------------------------------------------- */
+
+__attribute__((target("avx2")))
+uint64_t sumAvx2(const uint8_t *data, size_t len, uint64_t sum)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+
+    while (len >= 64)
+    {
+        const __m256i v0 = _mm256_loadu_si256((const __m256i *)data);
+        const __m256i v1 = _mm256_loadu_si256((const __m256i *)(data + 32));
+
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+
+        data += 64;
+        len -= 64;
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+
+    for (const auto lane : lanes)
+        sum += (lane & 0xffffffff) + (lane >> 32);
+
+    return sumScalar(data, len, sum);
+}
+
+#endif
+
+/* -------------------------------------------------------------------------- */
+
+struct Kernel
+{
+    SumKernel func;
+    const char *name;
+};
+
+Kernel selectKernel() noexcept
+{
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return {sumAvx2, "avx2"};
+
+    if (__builtin_cpu_supports("sse2"))
+        return {sumSse2, "sse2"};
+#endif
+
+    return {sumScalar, "scalar"};
+}
+
+const Kernel &kernel() noexcept
+{
+    static const Kernel selected = selectKernel();
+    return selected;
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+uint64_t Checksum::sum(const void *data, size_t len, uint64_t sum) noexcept
+{
+    const auto bytes = static_cast<const uint8_t *>(data);
+
+    if (len < SIMD_MIN_LEN)
+        return sumScalar(bytes, len, sum);
+
+    return kernel().func(bytes, len, sum);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool Checksum::verifyIpv4Header(const char *packet, size_t len) noexcept
+{
+    constexpr size_t IP_HEADER_MIN_LEN = 20;
+
+    if (len < IP_HEADER_MIN_LEN || (uint8_t(packet[0]) >> 4) != 4)
+        return false;
+
+    const size_t headerLen = size_t(packet[0] & 0x0f) << 2;
+
+    if (headerLen < IP_HEADER_MIN_LEN || headerLen > len)
+        return false;
+
+    return verify(packet, headerLen);
+}
+
+/* -------------------------------------------------------------------------- */
+
+const char *Checksum::kernelName() noexcept
+{
+    return kernel().name;
+}
+
+/* -------------------------------------------------------------------------- */
+
+Checksum::SumKernel Checksum::findKernel(const char *name) noexcept
+{
+    if (strcmp(name, "scalar") == 0)
+        return [](const void *data, size_t len, uint64_t sum) {
+            return sumScalar(static_cast<const uint8_t *>(data), len, sum);
+        };
+
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+
+    if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+        return [](const void *data, size_t len, uint64_t sum) {
+            return sumSse2(static_cast<const uint8_t *>(data), len, sum);
+        };
+
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+        return [](const void *data, size_t len, uint64_t sum) {
+            return sumAvx2(static_cast<const uint8_t *>(data), len, sum);
+        };
+#endif
+
+    return nullptr;
+}
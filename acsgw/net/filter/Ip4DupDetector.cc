@@ -16,7 +16,8 @@ bool Ip4DupDetector::isADuplicated(const IpPacketParser &parser)
     const auto pktId = makeUniqueId(parser);
     const auto dup = !dupTable.insert(pktId).second;
 
-    if (dup)
+    // Track the new ids, so that the oldest ones can be forgotten
+    if (!dup)
     {
         orderedByIdTable.insert({++_pktcnt, pktId});
 
@@ -0,0 +1,432 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "PolicyClassifier.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <map>
+#include <sstream>
+#include <string>
+
+/* -------------------------------------------------------------------------- */
+
+// Splits a list of items separated by commas and/or blanks
+static std::vector<std::string> splitList(std::string text)
+{
+    std::replace(text.begin(), text.end(), ',', ' ');
+
+    std::stringstream ss(text);
+    std::vector<std::string> items;
+    std::string item;
+
+    while (ss >> item)
+        items.push_back(item);
+
+    return items;
+}
+
+/* -------------------------------------------------------------------------- */
+
+// Bitsets are interned while compiling, so that lookup tables refer to a
+// small pool of distinct sets
+class PolicyClassifier::Builder
+{
+public:
+    using Bits = std::vector<uint64_t>;
+
+    explicit Builder(PolicyClassifier &classifier) : _pc(classifier) {}
+
+    Bits makeBits() const
+    {
+        return Bits(_pc._words, 0);
+    }
+
+    static void setBit(Bits &bits, size_t rule) noexcept
+    {
+        bits[rule / 64] |= uint64_t(1) << (rule % 64);
+    }
+
+    SetId intern(const Bits &bits)
+    {
+        auto it = _ids.find(bits);
+
+        if (it != _ids.end())
+            return it->second;
+
+        // The summary word tells which words have some rule set
+        uint64_t summary = 0;
+
+        for (size_t w = 0; w < bits.size(); ++w)
+        {
+            if (bits[w])
+                summary |= uint64_t(1) << std::min<size_t>(w, SUMMARY_BITS - 1);
+        }
+
+        const SetId id = SetId(_pc._sets.size());
+        _pc._sets.push_back(summary);
+        _pc._sets.insert(_pc._sets.end(), bits.begin(), bits.end());
+        _ids.emplace(bits, id);
+
+        return id;
+    }
+
+    void buildTrie(std::vector<TrieNode> &trie, const std::vector<Rule> &rules,
+                   std::vector<Prefix> Rule::*field);
+
+    void buildPortTable(PortTable &table, const std::vector<Rule> &rules,
+                        std::vector<PortRange> Rule::*field);
+
+private:
+    // A prefix ending within a trie node, covering the entries whose
+    // first 'bits' bits are equal to those of 'value'
+    struct NodePrefix
+    {
+        size_t rule;
+        unsigned bits;
+        unsigned value;
+    };
+
+    PolicyClassifier &_pc;
+    std::map<Bits, SetId> _ids;
+
+    void fillTrie(std::vector<TrieNode> &trie, const std::vector<std::vector<NodePrefix>> &prefixes,
+                  size_t node, const Bits &inherited);
+};
+
+/* -------------------------------------------------------------------------- */
+
+void PolicyClassifier::Builder::buildTrie(
+    std::vector<TrieNode> &trie, const std::vector<Rule> &rules, std::vector<Prefix> Rule::*field)
+{
+    std::vector<std::vector<NodePrefix>> nodePrefixes(1);
+    Bits wildcard = makeBits();
+
+    trie.assign(1, TrieNode());
+
+    for (size_t r = 0; r < rules.size(); ++r)
+    {
+        const auto &prefixes = rules[r].*field;
+
+        if (prefixes.empty())
+            setBit(wildcard, r);
+
+        for (const auto &prefix : prefixes)
+        {
+            if (prefix.len == 0)
+            {
+                setBit(wildcard, r);
+                continue;
+            }
+
+            // Walk down to the node where the prefix ends
+            const unsigned depth = (prefix.len - 1) / 4;
+            size_t node = 0;
+
+            for (unsigned d = 0; d < depth; ++d)
+            {
+                const unsigned nibble = (prefix.addr >> (28 - 4 * d)) & 0xf;
+
+                if (trie[node][nibble].child < 0)
+                {
+                    trie[node][nibble].child = int32_t(trie.size());
+                    trie.emplace_back();
+                    nodePrefixes.emplace_back();
+                }
+
+                node = size_t(trie[node][nibble].child);
+            }
+
+            nodePrefixes[node].push_back(
+                {r, prefix.len - 4 * depth, (prefix.addr >> (28 - 4 * depth)) & 0xf});
+        }
+    }
+
+    fillTrie(trie, nodePrefixes, 0, wildcard);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void PolicyClassifier::Builder::fillTrie(
+    std::vector<TrieNode> &trie, const std::vector<std::vector<NodePrefix>> &prefixes,
+    size_t node, const Bits &inherited)
+{
+    // Every entry holds the rules of all the prefixes covering it, so a
+    // lookup just returns the set of the last entry it visits
+    for (unsigned e = 0; e < 16; ++e)
+    {
+        Bits bits = inherited;
+
+        for (const auto &prefix : prefixes[node])
+        {
+            if ((e >> (4 - prefix.bits)) == (prefix.value >> (4 - prefix.bits)))
+                setBit(bits, prefix.rule);
+        }
+
+        trie[node][e].set = intern(bits);
+
+        if (trie[node][e].child >= 0)
+            fillTrie(trie, prefixes, size_t(trie[node][e].child), bits);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void PolicyClassifier::Builder::buildPortTable(
+    PortTable &table, const std::vector<Rule> &rules, std::vector<PortRange> Rule::*field)
+{
+    Bits wildcard = makeBits();
+    std::vector<uint32_t> cuts{0};
+
+    for (size_t r = 0; r < rules.size(); ++r)
+    {
+        const auto &ranges = rules[r].*field;
+
+        if (ranges.empty())
+            setBit(wildcard, r);
+
+        for (const auto &range : ranges)
+        {
+            cuts.push_back(range.first);
+            cuts.push_back(uint32_t(range.last) + 1);
+        }
+    }
+
+    std::sort(cuts.begin(), cuts.end());
+    cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+
+    if (cuts.back() > 0xffff)
+        cuts.pop_back();
+
+    // Rules are constant within each interval between two cuts
+    table.bounds.clear();
+    table.sets.clear();
+
+    for (const auto port : cuts)
+    {
+        Bits bits = wildcard;
+
+        for (size_t r = 0; r < rules.size(); ++r)
+        {
+            for (const auto &range : rules[r].*field)
+            {
+                if (port >= range.first && port <= range.last)
+                {
+                    setBit(bits, r);
+                    break;
+                }
+            }
+        }
+
+        table.bounds.push_back(uint16_t(port));
+        table.sets.push_back(intern(bits));
+    }
+
+    table.noPortsSet = intern(wildcard);
+
+    for (uint32_t block = 0; block < table.blocks.size(); ++block)
+    {
+        const uint32_t port = std::min<uint32_t>(block << 8, 0xffff);
+        const auto it = std::upper_bound(table.bounds.begin(), table.bounds.end(), port);
+
+        table.blocks[block] = uint32_t(it - table.bounds.begin()) - 1;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+PolicyClassifier::PolicyClassifier(const std::vector<Rule> &rules)
+{
+    if (rules.empty())
+        return;
+
+    _rules = rules.size();
+    _words = (_rules + 63) / 64;
+
+    Builder builder(*this);
+
+    builder.buildTrie(_srcTrie, rules, &Rule::srcPrefixes);
+    builder.buildTrie(_dstTrie, rules, &Rule::dstPrefixes);
+    builder.buildPortTable(_srcPorts, rules, &Rule::srcPorts);
+    builder.buildPortTable(_dstPorts, rules, &Rule::dstPorts);
+
+    for (size_t protocol = 0; protocol < _protocolSets.size(); ++protocol)
+    {
+        auto bits = builder.makeBits();
+
+        for (size_t r = 0; r < rules.size(); ++r)
+        {
+            if (rules[r].protocol < 0 || size_t(rules[r].protocol) == protocol)
+                Builder::setBit(bits, r);
+        }
+
+        _protocolSets[protocol] = builder.intern(bits);
+    }
+
+    for (size_t dscp = 0; dscp < _dscpSets.size(); ++dscp)
+    {
+        auto bits = builder.makeBits();
+
+        for (size_t r = 0; r < rules.size(); ++r)
+        {
+            const auto &dscps = rules[r].dscps;
+
+            if (dscps.empty() || std::find(dscps.begin(), dscps.end(), dscp) != dscps.end())
+                Builder::setBit(bits, r);
+        }
+
+        _dscpSets[dscp] = builder.intern(bits);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+int PolicyClassifier::classify(uint32_t srcAddr, uint32_t dstAddr, uint8_t protocol,
+                               bool hasPorts, uint16_t srcPort, uint16_t dstPort,
+                               uint8_t dscp) const noexcept
+{
+    if (_words == 0)
+        return NO_MATCH;
+
+    const uint64_t *src = &_sets[lookup(_srcTrie, srcAddr)];
+    const uint64_t *dst = &_sets[lookup(_dstTrie, dstAddr)];
+    const uint64_t *proto = &_sets[_protocolSets[protocol]];
+    const uint64_t *sport = &_sets[lookup(_srcPorts, hasPorts, srcPort)];
+    const uint64_t *dport = &_sets[lookup(_dstPorts, hasPorts, dstPort)];
+    const uint64_t *tos = &_sets[_dscpSets[dscp & 0x3f]];
+
+    // Only the words which have some rule in every set are visited: with
+    // specific rules, a prefix or port matches few of them
+    uint64_t candidates = src[0] & dst[0] & proto[0] & sport[0] & dport[0] & tos[0];
+
+    while (candidates)
+    {
+        const size_t first = size_t(__builtin_ctzll(candidates));
+        const size_t last = first == SUMMARY_BITS - 1 ? _words : first + 1;
+
+        for (size_t w = first + 1; w <= last; ++w)
+        {
+            const uint64_t match = src[w] & dst[w] & proto[w] & sport[w] & dport[w] & tos[w];
+
+            if (match)
+                return int((w - 1) * 64 + __builtin_ctzll(match));
+        }
+
+        candidates &= candidates - 1;
+    }
+
+    return NO_MATCH;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool PolicyClassifier::parseRule(const Config::ConfigNamespacedParagraph &namespace_data, Rule &rule)
+{
+    auto getList = [&](const std::string &fieldName) {
+        auto nsit = namespace_data.find(fieldName);
+        return nsit != namespace_data.end() ? splitList(nsit->second.first) : std::vector<std::string>();
+    };
+
+    auto parsePrefixes = [](const std::vector<std::string> &items, std::vector<Prefix> &prefixes) {
+        for (const auto &item : items)
+        {
+            const size_t slash = item.find('/');
+            const std::string addr = item.substr(0, slash);
+            in_addr inaddr = {0};
+
+            if (::inet_pton(AF_INET, addr.c_str(), &inaddr) != 1)
+                return false;
+
+            Prefix prefix;
+            prefix.len = slash == std::string::npos ? 32 : unsigned(std::stoul(item.substr(slash + 1)));
+
+            if (prefix.len > 32)
+                return false;
+
+            const uint32_t mask = prefix.len == 0 ? 0 : ~uint32_t(0) << (32 - prefix.len);
+            prefix.addr = ntohl(inaddr.s_addr) & mask;
+
+            prefixes.push_back(prefix);
+        }
+
+        return true;
+    };
+
+    auto parsePorts = [](const std::vector<std::string> &items, std::vector<PortRange> &ranges) {
+        for (const auto &item : items)
+        {
+            const size_t dash = item.find('-');
+            const int first = std::stoi(item.substr(0, dash));
+            const int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+
+            if (first < 0 || last < first || last > 0xffff)
+                return false;
+
+            ranges.push_back({uint16_t(first), uint16_t(last)});
+        }
+
+        return true;
+    };
+
+    try
+    {
+        // src_prefix, dst_prefix = "a.b.c.d/len, ..."
+        if (!parsePrefixes(getList("src_prefix"), rule.srcPrefixes) ||
+            !parsePrefixes(getList("dst_prefix"), rule.dstPrefixes))
+        {
+            return false;
+        }
+
+        // protocol = "tcp" | "udp" | "icmp" | N
+        const auto protocol = getList("protocol");
+
+        if (protocol.size() > 1)
+            return false;
+
+        if (!protocol.empty() && protocol[0] != "any")
+        {
+            if (protocol[0] == "tcp")
+                rule.protocol = IpPacketParser::IP_PROTO_TCP;
+            else if (protocol[0] == "udp")
+                rule.protocol = IpPacketParser::IP_PROTO_UDP;
+            else if (protocol[0] == "icmp")
+                rule.protocol = IpPacketParser::IP_PROTO_ICMP;
+            else
+                rule.protocol = std::stoi(protocol[0]);
+
+            if (rule.protocol < 0 || rule.protocol > 255)
+                return false;
+        }
+
+        // src_ports, dst_ports = "first-last, port, ..."
+        if (!parsePorts(getList("src_ports"), rule.srcPorts) ||
+            !parsePorts(getList("dst_ports"), rule.dstPorts))
+        {
+            return false;
+        }
+
+        // dscp = "N, ..."
+        for (const auto &item : getList("dscp"))
+        {
+            const int dscp = std::stoi(item);
+
+            if (dscp < 0 || dscp > 63)
+                return false;
+
+            rule.dscps.push_back(uint8_t(dscp));
+        }
+    }
+    catch (...)
+    {
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,191 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "QosPolicy.h"
+#include "Logger.h"
+#include "TokenBucket.h"
+#include "TunnelBundle.h"
+
+#include <cstdint>
+#include <sstream>
+
+/* -------------------------------------------------------------------------- */
+
+QosPolicy::QosPolicy()
+{
+    using namespace std::chrono_literals;
+
+    _classes[size_t(TrafficClass::Critical)].deadline = 300ms;
+    _classes[size_t(TrafficClass::Interactive)].deadline = 1000ms;
+    _classes[size_t(TrafficClass::Default)].deadline = 3000ms;
+    _classes[size_t(TrafficClass::Bulk)].deadline = 0ms;
+
+    _classes[size_t(TrafficClass::Critical)].weight = 1; // strict priority
+    _classes[size_t(TrafficClass::Interactive)].weight = 4;
+    _classes[size_t(TrafficClass::Default)].weight = 2;
+    _classes[size_t(TrafficClass::Bulk)].weight = 1;
+
+    // EF, AF41, best effort, CS1
+    _classes[size_t(TrafficClass::Critical)].outerDscp = 46;
+    _classes[size_t(TrafficClass::Interactive)].outerDscp = 34;
+    _classes[size_t(TrafficClass::Default)].outerDscp = 0;
+    _classes[size_t(TrafficClass::Bulk)].outerDscp = 8;
+
+    // Linux TC_PRIO_INTERACTIVE, TC_PRIO_INTERACTIVE_BULK,
+    // TC_PRIO_BESTEFFORT, TC_PRIO_BULK (no CAP_NET_ADMIN required)
+    _classes[size_t(TrafficClass::Critical)].socketPriority = 6;
+    _classes[size_t(TrafficClass::Interactive)].socketPriority = 4;
+    _classes[size_t(TrafficClass::Default)].socketPriority = 0;
+    _classes[size_t(TrafficClass::Bulk)].socketPriority = 2;
+}
+
+/* -------------------------------------------------------------------------- */
+
+QosPolicy &QosPolicy::getInstance()
+{
+    static QosPolicy _instance;
+    return _instance;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool QosPolicy::configure(const Config &config)
+{
+    const auto &cfgdata = config.data();
+
+    // [qos]
+    auto it = cfgdata.find("qos");
+
+    if (it == cfgdata.end())
+    {
+        return false;
+    }
+
+    const auto &namespace_data = it->second;
+
+    for (size_t i = 0; i < TRAFFIC_CLASS_COUNT; ++i)
+    {
+        const std::string className = trafficClassName(TrafficClass(i));
+        ClassPolicy &policy = _classes[i];
+
+        auto getNum = [&](const std::string &fieldName, int minVal, int maxVal, auto setter) {
+            auto nsit = namespace_data.find(className + fieldName);
+            if (nsit != namespace_data.end())
+            {
+                try
+                {
+                    const long n = std::stol(nsit->second.first);
+                    if (n >= minVal && n <= maxVal)
+                        setter(n);
+                    else
+                        TRACE(LOG_ERR, "QosPolicy %s%s out of range", className.c_str(), fieldName.c_str());
+                }
+                catch (...)
+                {
+                    TRACE(LOG_DEBUG, "QosPolicy config syntax error in %s%s format", className.c_str(), fieldName.c_str());
+                }
+            }
+        };
+
+        // <class>_deadline_ms = N
+        getNum("_deadline_ms", 0, INT32_MAX, [&](long n) { policy.deadline = std::chrono::milliseconds(n); });
+
+        // <class>_weight = N
+        getNum("_weight", 1, 1000, [&](long n) { policy.weight = unsigned(n); });
+
+        // <class>_outer_dscp = N
+        getNum("_outer_dscp", -1, 63, [&](long n) { policy.outerDscp = int(n); });
+
+        // <class>_so_priority = N
+        getNum("_so_priority", -1, 7, [&](long n) { policy.socketPriority = int(n); });
+
+        // <class>_rate_kbps = N, <class>_burst_kb = N
+        getNum("_rate_kbps", 0, INT32_MAX, [&](long n) { policy.rate = uint64_t(n) * 1000 / 8; });
+        getNum("_burst_kb", 0, INT32_MAX, [&](long n) { policy.burst = size_t(n) * 1024; });
+
+        if (policy.burst == 0)
+            policy.burst = TokenBucket::defaultBurst(policy.rate);
+
+        // <class>_bundle_us = N
+        getNum("_bundle_us", 0, BUNDLE_MAX_DELAY_US, [&](long n) { policy.bundleDelay = std::chrono::microseconds(n); });
+
+        // <class>_dscp = "list", <class>_ports = "list"
+        if (!parseClassMap(className, TrafficClass(i), namespace_data))
+        {
+            TRACE(LOG_ERR, "QosPolicy config syntax error in %s_dscp or %s_ports format",
+                  className.c_str(), className.c_str());
+        }
+    }
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool QosPolicy::parseClassMap(const std::string &className, TrafficClass tc,
+                              const Config::ConfigNamespacedParagraph &namespace_data)
+{
+    // Splits a list of items separated by commas and/or blanks
+    auto splitList = [](std::string text) {
+        for (auto &c : text)
+        {
+            if (c == ',')
+                c = ' ';
+        }
+
+        std::stringstream ss(text);
+        std::vector<std::string> items;
+        std::string item;
+
+        while (ss >> item)
+            items.push_back(item);
+
+        return items;
+    };
+
+    try
+    {
+        auto nsit = namespace_data.find(className + "_dscp");
+        if (nsit != namespace_data.end())
+        {
+            for (const auto &item : splitList(nsit->second.first))
+            {
+                const int dscp = std::stoi(item);
+
+                if (dscp < 0 || dscp > 63)
+                    return false;
+
+                _classMap.setDscpClass(uint8_t(dscp), tc);
+            }
+        }
+
+        nsit = namespace_data.find(className + "_ports");
+        if (nsit != namespace_data.end())
+        {
+            for (const auto &item : splitList(nsit->second.first))
+            {
+                const size_t dash = item.find('-');
+                const int first = std::stoi(item.substr(0, dash));
+                const int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+
+                if (first < 0 || last < first || last > 65535)
+                    return false;
+
+                _classMap.addPortRule(uint16_t(first), uint16_t(last), tc);
+            }
+        }
+    }
+    catch (...)
+    {
+        return false;
+    }
+
+    return true;
+}
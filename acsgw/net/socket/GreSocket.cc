@@ -9,6 +9,7 @@
 /* -------------------------------------------------------------------------- */
 
 #include "GreSocket.h"
+#include "Tools.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -24,6 +25,9 @@
 #include <assert.h>
 #include <unistd.h>
 #include <linux/if_packet.h>
+#include <linux/filter.h>
+
+#include <algorithm>
 
 /* -------------------------------------------------------------------------- */
 
@@ -74,6 +78,32 @@ int GreSocket::sendto(
 
 /* -------------------------------------------------------------------------- */
 
+int GreSocket::sendAt(
+    const char *buf,
+    int len,
+    const IpAddress &ip,
+    uint64_t departureNs,
+    int flags) const noexcept
+{
+   struct sockaddr_in remote_host = {0};
+   struct iovec iov = {const_cast<char *>(buf), size_t(std::max(len, 0))};
+   struct msghdr msg = {0};
+   Tools::TxTimeCmsg cmsg;
+
+   _format_sock_addr(remote_host, ip);
+
+   msg.msg_name = &remote_host;
+   msg.msg_namelen = sizeof(remote_host);
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+
+   Tools::setDepartureTime(msg, cmsg, departureNs);
+
+   return int(::sendmsg(getSocketDesc(), &msg, flags));
+}
+
+/* -------------------------------------------------------------------------- */
+
 /*
     0                   1                   2                   3
     0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
@@ -92,12 +122,41 @@ int GreSocket::sendto(
    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 */
 
+/*
+    0                   1                   2                   3
+    0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   |C|R|K|S|     Reserved0     | Ver |         Protocol Type         |
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   |      Checksum (optional)      |       Reserved1 (Optional)    |
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   |                         Key (optional)                        |
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   |                 Sequence Number (Optional)                    |
+   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+*/
+
+enum
+{
+   GRE_FLAG_C = 0x8000,
+   GRE_FLAG_R = 0x4000,
+   GRE_FLAG_K = 0x2000,
+   GRE_FLAG_S = 0x1000,
+   GRE_VERSION_MASK = 0x0007,
+   GRE_PROTO_IP = 0x0800
+};
+
+/* -------------------------------------------------------------------------- */
+
 int GreSocket::recvfrom(
     char *buf,
     int len,
     IpAddress &src_addr,
     int &payloadOffset,
-    int flags) const noexcept
+    Key &key,
+    Sequence &seq,
+    int flags,
+    uint32_t *kernelDrops) const noexcept
 
 {
    enum
@@ -105,39 +164,169 @@ int GreSocket::recvfrom(
       IHL_MIN_BLEN = 20,
       IHL_MAX_BLEN = 60,
       GRE_PROTO_OFFSET = 2,
-      GRE_PROTO_IP = 0x0800,
-      IP_SRC_ADDR_OFFSET = 12,
-      GRE_HEADER_LEN = 4
+      IP_SRC_ADDR_OFFSET = 12
    };
 
-   int n = recv(getSocketDesc(), buf, len, 0);
+   int n = 0;
+
+   if (kernelDrops)
+   {
+      Tools::RxQueueOverflowCmsg cmsg;
+      iovec iov = {buf, size_t(std::max(len, 0))};
+      msghdr msg;
+
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = cmsg.buf;
+      msg.msg_controllen = sizeof(cmsg.buf);
+
+      n = int(recvmsg(getSocketDesc(), &msg, flags));
+
+      if (n >= 0)
+         Tools::getRxQueueOverflow(msg, *kernelDrops);
+   }
+   else
+   {
+      n = recv(getSocketDesc(), buf, len, flags);
+   }
 
    if (n < 0)
       return -1;
 
+   if (n < IHL_MIN_BLEN + BASE_HEADER_LEN)
+      return 0;
+
    // Compute IP Header length (4 * low nibble of first byte of IP packet)
    int ihl = (buf[0] & 0x0f) << 2;
 
    // Validate IHL
-   if (ihl > IHL_MAX_BLEN || ihl < IHL_MIN_BLEN)
+   if (ihl > IHL_MAX_BLEN || ihl < IHL_MIN_BLEN || n < ihl + BASE_HEADER_LEN)
       return -1;
 
-   // Parse GRE header (expected all 0s)
-   if (*(uint16_t *)(buf + ihl) != 0)
+   uint16_t greFlags = 0;
+   uint16_t protocol = 0;
+   memcpy(&greFlags, buf + ihl, sizeof(greFlags));
+   memcpy(&protocol, buf + ihl + GRE_PROTO_OFFSET, sizeof(protocol));
+   greFlags = ntohs(greFlags);
+
+   // Version 0 without source routing (RFC 2784), carrying IPv4
+   if ((greFlags & (GRE_FLAG_R | GRE_VERSION_MASK)) != 0 || ntohs(protocol) != GRE_PROTO_IP)
       return 0;
 
-   // Expected Protocol code 0x800
-   uint16_t protocol = ntohs(*(uint16_t *)(buf + ihl + GRE_PROTO_OFFSET));
-   if (protocol != GRE_PROTO_IP)
+   // Optional fields: checksum (and reserved), key, sequence number
+   int headerLen = BASE_HEADER_LEN;
+
+   if (greFlags & GRE_FLAG_C)
+      headerLen += 4;
+
+   key.present = (greFlags & GRE_FLAG_K) != 0;
+   key.value = 0;
+
+   if (key.present)
+   {
+      if (n < ihl + headerLen + 4)
+         return 0;
+
+      memcpy(&key.value, buf + ihl + headerLen, sizeof(key.value));
+      key.value = ntohl(key.value);
+      headerLen += 4;
+   }
+
+   seq.present = (greFlags & GRE_FLAG_S) != 0;
+   seq.value = 0;
+
+   if (seq.present)
+   {
+      if (n < ihl + headerLen + 4)
+         return 0;
+
+      memcpy(&seq.value, buf + ihl + headerLen, sizeof(seq.value));
+      seq.value = ntohl(seq.value);
+      headerLen += 4;
+   }
+
+   if (n < ihl + headerLen)
       return 0;
 
    // Source IP address (of physical interface) is at offset 12 of IP packet
-   src_addr = IpAddress(htonl(*((uint32_t *)&buf[IP_SRC_ADDR_OFFSET])));
+   uint32_t srcAddr = 0;
+   memcpy(&srcAddr, buf + IP_SRC_ADDR_OFFSET, sizeof(srcAddr));
+   src_addr = IpAddress(htonl(srcAddr));
+
+   // IP packet payload starts after IP Header and GRE Header
+   payloadOffset = ihl + headerLen;
+
+   return n - ihl - headerLen;
+}
+
+/* -------------------------------------------------------------------------- */
+
+int GreSocket::makeHeader(char *buf, const Key &key, bool sequenced) noexcept
+{
+   const uint16_t greFlags = htons((key.present ? GRE_FLAG_K : 0) | (sequenced ? GRE_FLAG_S : 0));
+   const uint16_t protocol = htons(GRE_PROTO_IP);
+
+   memcpy(buf, &greFlags, sizeof(greFlags));
+   memcpy(buf + 2, &protocol, sizeof(protocol));
+
+   int len = BASE_HEADER_LEN;
 
-   // IP packet payload starts after IP Header + 4 bytes for GRE Header
-   payloadOffset = ihl + GRE_HEADER_LEN;
+   if (key.present)
+   {
+      const uint32_t value = htonl(key.value);
+      memcpy(buf + len, &value, sizeof(value));
+      len += 4;
+   }
+
+   if (sequenced)
+   {
+      memset(buf + len, 0, 4);
+      len += 4;
+   }
 
-   return n - ihl - GRE_HEADER_LEN;
+   return len;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool GreSocket::setSequence(char *header, size_t len, uint32_t seq) noexcept
+{
+   uint16_t greFlags = 0;
+
+   if (len < BASE_HEADER_LEN)
+      return false;
+
+   memcpy(&greFlags, header, sizeof(greFlags));
+   greFlags = ntohs(greFlags);
+
+   if (!(greFlags & GRE_FLAG_S))
+      return false;
+
+   // The sequence number follows the checksum and key fields, if any
+   const size_t offset = BASE_HEADER_LEN + (greFlags & GRE_FLAG_C ? 4 : 0) + (greFlags & GRE_FLAG_K ? 4 : 0);
+
+   if (len < offset + 4)
+      return false;
+
+   const uint32_t value = htonl(seq);
+   memcpy(header + offset, &value, sizeof(value));
+
+   return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool GreSocket::isSequenced(const char *header, size_t len) noexcept
+{
+   uint16_t greFlags = 0;
+
+   if (len < BASE_HEADER_LEN)
+      return false;
+
+   memcpy(&greFlags, header, sizeof(greFlags));
+
+   return (ntohs(greFlags) & GRE_FLAG_S) != 0;
 }
 
 /* -------------------------------------------------------------------------- */
@@ -192,6 +381,51 @@ bool GreSocket::bind(
 
 /* -------------------------------------------------------------------------- */
 
+bool GreSocket::connect(const IpAddress &ip) const noexcept
+{
+   struct sockaddr_in sin = {0};
+
+   _format_sock_addr(sin, ip);
+
+   return ::connect(getSocketDesc(), (struct sockaddr *)&sin, sizeof(sin)) == 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool GreSocket::attachGreFilter() const noexcept
+{
+   // Raw sockets see the IP header: X = its length, then GRE version 0,
+   // no routing and protocol type IPv4
+   struct sock_filter code[] = {
+      BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+      BPF_STMT(BPF_LD | BPF_H | BPF_IND, 0),
+      BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, GRE_FLAG_R | GRE_VERSION_MASK, 3, 0),
+      BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, GRE_PROTO_IP, 0, 1),
+      BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+      BPF_STMT(BPF_RET | BPF_K, 0)
+   };
+
+   struct sock_fprog prog = { (unsigned short)(sizeof(code) / sizeof(code[0])), code };
+
+   return setsockopt(getSocketDesc(), SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool GreSocket::setSendOnly() const noexcept
+{
+   struct sock_filter code[] = {
+      BPF_STMT(BPF_RET | BPF_K, 0)
+   };
+
+   struct sock_fprog prog = { 1, code };
+
+   return setsockopt(getSocketDesc(), SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
 bool GreSocket::close() noexcept
 {
    int sock = _sock;
@@ -201,3 +435,59 @@ bool GreSocket::close() noexcept
 }
 
 /* -------------------------------------------------------------------------- */
+
+bool GreSocket::setBusyPoll(int usecs) const noexcept
+{
+   return Tools::setBusyPoll(getSocketDesc(), usecs);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool GreSocket::setTrafficMarking(int dscp, int priority) const noexcept
+{
+   return Tools::setTrafficMarking(getSocketDesc(), dscp, priority);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool GreSocket::setDontFragment() const noexcept
+{
+   return Tools::setDontFragment(getSocketDesc());
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool GreSocket::setTxTime() const noexcept
+{
+   return Tools::setTxTime(getSocketDesc());
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool GreSocket::setBufferSize(bool receive, size_t bytes) const noexcept
+{
+   return Tools::setSocketBuffer(getSocketDesc(), receive, bytes);
+}
+
+/* -------------------------------------------------------------------------- */
+
+int GreSocket::bufferSize(bool receive) const noexcept
+{
+   return Tools::getSocketBuffer(getSocketDesc(), receive);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool GreSocket::setRxQueueOverflow() const noexcept
+{
+   return Tools::setRxQueueOverflow(getSocketDesc());
+}
+
+/* -------------------------------------------------------------------------- */
+
+int GreSocket::sendQueueBytes() const noexcept
+{
+   return Tools::getSendQueue(getSocketDesc());
+}
+
+/* -------------------------------------------------------------------------- */
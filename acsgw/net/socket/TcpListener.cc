@@ -18,8 +18,8 @@
 
 /* -------------------------------------------------------------------------- */
 
-TcpListener::TcpListener()
-    : TransportSocket(int(::socket(AF_INET, SOCK_STREAM, 0)))
+TcpListener::TcpListener(bool mptcp)
+    : TransportSocket(TcpSocket::openStream(mptcp))
     , _status(isValid() ? Status::VALID : Status::INVALID)
 {
 }
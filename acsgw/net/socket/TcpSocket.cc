@@ -11,8 +11,19 @@
 #include "TcpSocket.h"
 #include "IpAddress.h"
 
+#include <cerrno>
+#include <linux/mptcp.h>
+#include <netinet/in.h>
 #include <netinet/tcp.h>
 
+#ifndef IPPROTO_MPTCP
+#define IPPROTO_MPTCP 262
+#endif
+
+#ifndef SOL_MPTCP
+#define SOL_MPTCP 284
+#endif
+
 /* -------------------------------------------------------------------------- */
 
 TcpSocket &TcpSocket::operator<<(const std::string &text)
@@ -64,9 +75,39 @@ bool TcpSocket::connect()
 
 /* -------------------------------------------------------------------------- */
 
-TcpSocket::Handle TcpSocket::make(const std::string &remoteAddr, const Port &port, bool disableTcpDelay)
+bool TcpSocket::isMptcp() const
+{
+    mptcp_info info = {0};
+    socklen_t len = sizeof(info);
+
+    // Plain TCP sockets, and MPTCP ones which fell back, have no MPTCP info
+    if (::getsockopt(getSocketFd(), SOL_MPTCP, MPTCP_INFO, &info, &len) < 0 || len == 0)
+        return false;
+
+    return (info.mptcpi_flags & MPTCP_INFO_FLAG_FALLBACK) == 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+int TcpSocket::openStream(bool mptcp)
+{
+    if (mptcp)
+    {
+        const int sd = int(::socket(AF_INET, SOCK_STREAM, IPPROTO_MPTCP));
+
+        // Kernels without MPTCP, or with net.mptcp.enabled = 0, get TCP
+        if (sd >= 0 || (errno != EPROTONOSUPPORT && errno != EINVAL && errno != ENOPROTOOPT))
+            return sd;
+    }
+
+    return int(::socket(AF_INET, SOCK_STREAM, 0));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TcpSocket::Handle TcpSocket::make(const std::string &remoteAddr, const Port &port, bool disableTcpDelay, bool mptcp)
 {
-    auto sd = int(::socket(AF_INET, SOCK_STREAM, 0));
+    auto sd = openStream(mptcp);
 
     if (sd < 0)
         return nullptr;
@@ -91,9 +132,9 @@ TcpSocket::Handle TcpSocket::make(const std::string &remoteAddr, const Port &por
 
 /* -------------------------------------------------------------------------- */
 
-TcpSocket::Handle TcpSocket::make(bool disableTcpDelay)
+TcpSocket::Handle TcpSocket::make(bool disableTcpDelay, bool mptcp)
 {
-    auto sd = int(::socket(AF_INET, SOCK_STREAM, 0));
+    auto sd = openStream(mptcp);
 
     if (sd < 0)
         return nullptr;
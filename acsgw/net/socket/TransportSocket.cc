@@ -50,6 +50,34 @@ TransportSocket::RecvEvent TransportSocket::waitForRecvEvent(
 
 /* -------------------------------------------------------------------------- */
 
+bool TransportSocket::setBusyPoll(int usecs) noexcept
+{
+    return Tools::setBusyPoll(getSocketFd(), usecs);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TransportSocket::setTrafficMarking(int dscp, int priority) noexcept
+{
+    return Tools::setTrafficMarking(getSocketFd(), dscp, priority);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TransportSocket::setBufferSize(bool receive, size_t bytes) noexcept
+{
+    return Tools::setSocketBuffer(getSocketFd(), receive, bytes);
+}
+
+/* -------------------------------------------------------------------------- */
+
+int TransportSocket::sendQueueBytes() const noexcept
+{
+    return Tools::getSendQueue(getSocketFd());
+}
+
+/* -------------------------------------------------------------------------- */
+
 int TransportSocket::sendFile(const std::string &filepath) noexcept
 {
     std::ifstream ifs(filepath.c_str(), std::ios::in | std::ios::binary);
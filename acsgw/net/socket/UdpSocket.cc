@@ -10,6 +10,7 @@
 
 #include "UdpSocket.h"
 #include "IpAddress.h"
+#include "Tools.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -23,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <algorithm>
 
 
 /* -------------------------------------------------------------------------- */
@@ -79,6 +81,34 @@ int UdpSocket::sendto(
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+int UdpSocket::sendAt(
+      const char* buf,
+      int len,
+      const IpAddress& ip,
+      PortType port,
+      uint64_t departureNs,
+      int flags) const noexcept
+{
+   struct sockaddr_in remote_host = {0};
+   struct iovec iov = { const_cast<char*>(buf), size_t(std::max(len, 0)) };
+   struct msghdr msg = {0};
+   Tools::TxTimeCmsg cmsg;
+
+   _format_sock_addr(remote_host, ip, port);
+
+   msg.msg_name = &remote_host;
+   msg.msg_namelen = sizeof(remote_host);
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+
+   Tools::setDepartureTime(msg, cmsg, departureNs);
+
+   return int(::sendmsg(getSd(), &msg, flags));
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 int UdpSocket::recvfrom(
@@ -105,6 +135,91 @@ int UdpSocket::recvfrom(
 }
 
 
+/* -------------------------------------------------------------------------- */
+
+int UdpSocket::sendBatch(
+      const iovec* datagrams,
+      int count,
+      const IpAddress& ip,
+      PortType port,
+      int flags,
+      const uint64_t* departuresNs) const noexcept
+{
+   struct sockaddr_in remote_host = {0};
+   struct mmsghdr msgs[MAX_BATCH];
+   Tools::TxTimeCmsg cmsgs[MAX_BATCH];
+
+   _format_sock_addr(remote_host, ip, port);
+
+   count = std::min(count, int(MAX_BATCH));
+   memset(msgs, 0, sizeof(msgs[0]) * std::max(count, 0));
+
+   for (int i = 0; i < count; ++i)
+   {
+      msgs[i].msg_hdr.msg_name = &remote_host;
+      msgs[i].msg_hdr.msg_namelen = sizeof(remote_host);
+      msgs[i].msg_hdr.msg_iov = const_cast<iovec*>(&datagrams[i]);
+      msgs[i].msg_hdr.msg_iovlen = 1;
+
+      if (departuresNs)
+         Tools::setDepartureTime(msgs[i].msg_hdr, cmsgs[i], departuresNs[i]);
+   }
+
+   return ::sendmmsg(getSd(), msgs, unsigned(std::max(count, 0)), flags);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int UdpSocket::recvBatch(
+      const iovec* buffers,
+      int* lens,
+      IpAddress* src_addrs,
+      PortType* src_ports,
+      int count,
+      int flags,
+      uint32_t *kernelDrops) const noexcept
+{
+   struct sockaddr_in sources[MAX_BATCH];
+   struct mmsghdr msgs[MAX_BATCH];
+   Tools::RxQueueOverflowCmsg cmsgs[MAX_BATCH];
+
+   count = std::min(count, int(MAX_BATCH));
+   memset(msgs, 0, sizeof(msgs[0]) * std::max(count, 0));
+
+   for (int i = 0; i < count; ++i)
+   {
+      msgs[i].msg_hdr.msg_name = &sources[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(sources[i]);
+      msgs[i].msg_hdr.msg_iov = const_cast<iovec*>(&buffers[i]);
+      msgs[i].msg_hdr.msg_iovlen = 1;
+
+      if (kernelDrops)
+      {
+         msgs[i].msg_hdr.msg_control = cmsgs[i].buf;
+         msgs[i].msg_hdr.msg_controllen = sizeof(cmsgs[i].buf);
+      }
+   }
+
+   int recv_result = ::recvmmsg(getSd(), msgs, unsigned(std::max(count, 0)), flags, nullptr);
+
+   for (int i = 0; i < recv_result; ++i)
+   {
+      lens[i] = int(msgs[i].msg_len);
+      src_addrs[i] = IpAddress(htonl(sources[i].sin_addr.s_addr));
+      src_ports[i] = PortType(htons(sources[i].sin_port));
+   }
+
+   // The counter only grows, the last datagram has the latest one
+   if (kernelDrops && recv_result > 0)
+   {
+      Tools::getRxQueueOverflow(msgs[recv_result - 1].msg_hdr, *kernelDrops);
+   }
+
+   return recv_result;
+}
+
+
 /* -------------------------------------------------------------------------- */
 
 UdpSocket::PollingState UdpSocket::poll(struct timeval& timeout) const noexcept
@@ -181,6 +296,84 @@ bool UdpSocket::close() noexcept
 
 /* -------------------------------------------------------------------------- */
 
+bool UdpSocket::setReusePort() const noexcept
+{
+   int bool_val = 1;
+
+   return setsockopt(getSd(), SOL_SOCKET, SO_REUSEPORT, &bool_val, sizeof(bool_val)) == 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool UdpSocket::attachReusePortFilter(const struct sock_fprog &prog) const noexcept
+{
+   return setsockopt(getSd(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool UdpSocket::setBusyPoll(int usecs) const noexcept
+{
+   return Tools::setBusyPoll(getSd(), usecs);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool UdpSocket::setTrafficMarking(int dscp, int priority) const noexcept
+{
+   return Tools::setTrafficMarking(getSd(), dscp, priority);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool UdpSocket::setDontFragment() const noexcept
+{
+   return Tools::setDontFragment(getSd());
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool UdpSocket::setTxTime() const noexcept
+{
+   return Tools::setTxTime(getSd());
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool UdpSocket::setBufferSize(bool receive, size_t bytes) const noexcept
+{
+   return Tools::setSocketBuffer(getSd(), receive, bytes);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int UdpSocket::bufferSize(bool receive) const noexcept
+{
+   return Tools::getSocketBuffer(getSd(), receive);
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool UdpSocket::setRxQueueOverflow() const noexcept
+{
+   return Tools::setRxQueueOverflow(getSd());
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int UdpSocket::sendQueueBytes() const noexcept
+{
+   return Tools::getSendQueue(getSd());
+}
+
+
 #if 0
 /* -------------------------------------------------------------------------- */
 
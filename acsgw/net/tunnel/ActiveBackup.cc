@@ -0,0 +1,191 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "ActiveBackup.h"
+#include "Checksum.h"
+#include "Logger.h"
+
+#include <cstring>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+constexpr size_t GRE_PROBE_LEN = 20;
+constexpr uint8_t GRE_PROBE_PROTOCOL = 253; // experimentation and testing
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+ActiveBackup::ActiveBackup(const std::string &name,
+                           const ActiveBackupSettings &settings) : _name(name),
+                                                                   _settings(settings),
+                                                                   _sent(settings.replayPackets)
+{
+    const std::string prefix = "tunnel." + name;
+    auto &metrics = Metrics::getInstance();
+
+    _metrics.activeBearer = &metrics.get(prefix + ".active_bearer");
+    _metrics.failovers = &metrics.get(prefix + ".failovers");
+    _metrics.preemptions = &metrics.get(prefix + ".preemptions");
+    _metrics.replayedPackets = &metrics.get(prefix + ".replayed_packets");
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool ActiveBackup::elect(const Bearers &bearers, Clock::time_point now)
+{
+    const TunnelPath *current = nullptr;   // the active bearer, if still up
+    const TunnelPath *firstUp = nullptr;   // most preferred bearer which is up
+    const TunnelPath *stable = nullptr;    // same, up for the hold-down time
+    const TunnelPath *preferred = nullptr; // most preferred bearer
+
+    for (const auto &tp : bearers)
+    {
+        if (!preferred || tp->slot() < preferred->slot())
+            preferred = tp.get();
+
+        if (!tp->isUp(now))
+            continue;
+
+        if (int(tp->slot()) == _active)
+            current = tp.get();
+
+        if (!firstUp || tp->slot() < firstUp->slot())
+            firstUp = tp.get();
+
+        if (tp->upFor(now) >= _settings.holdDown && (!stable || tp->slot() < stable->slot()))
+            stable = tp.get();
+    }
+
+    if (current)
+    {
+        if (_settings.preempt && stable && stable->slot() < current->slot())
+            activate(*stable, false);
+
+        return false;
+    }
+
+    // Until a bearer is heard of, the most preferred one is used
+    if (!firstUp)
+    {
+        if (_active < 0 && preferred)
+            activate(*preferred, false);
+
+        return false;
+    }
+
+    // Bearers which have been up for a while are trusted first
+    const bool failover = _active >= 0;
+    activate(stable ? *stable : *firstUp, failover);
+
+    return failover;
+}
+
+/* -------------------------------------------------------------------------- */
+
+int ActiveBackup::select(const Bearers &bearers, const PathPolicy &path, Clock::time_point now) const noexcept
+{
+    if (path.includes(size_t(_active)))
+        return _active;
+
+    int firstUp = -1;
+    int preferred = -1;
+
+    for (const auto &tp : bearers)
+    {
+        const int slot = int(tp->slot());
+
+        if (!path.includes(tp->slot()))
+            continue;
+
+        if (preferred < 0 || slot < preferred)
+            preferred = slot;
+
+        if (tp->isUp(now) && (firstUp < 0 || slot < firstUp))
+            firstUp = slot;
+    }
+
+    return firstUp >= 0 ? firstUp : preferred;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void ActiveBackup::remember(const char *packet, size_t len, uint64_t pktid, TrafficClass tc, Clock::time_point now)
+{
+    if (_sent.empty())
+        return;
+
+    // The oldest packet is overwritten once the ring is full
+    const size_t index = (_head + _count) % _sent.size();
+
+    if (_count < _sent.size())
+        ++_count;
+    else
+        _head = (_head + 1) % _sent.size();
+
+    auto &sent = _sent[index];
+    sent.at = now;
+    sent.pktid = pktid;
+    sent.tc = tc;
+    sent.data.assign(packet, packet + len);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void ActiveBackup::activate(const TunnelPath &tp, bool failover)
+{
+    TRACE(LOG_WARNING, "ActiveBackup '%s' active bearer is now %s (%s)",
+          _name.c_str(), tp.name().c_str(),
+          failover ? "failover" : (_active < 0 ? "start" : "preemption"));
+
+    if (failover)
+        Metrics::add(*_metrics.failovers, 1);
+    else if (_active >= 0)
+        Metrics::add(*_metrics.preemptions, 1);
+
+    _active = int(tp.slot());
+
+    // 0 means no active bearer
+    Metrics::set(*_metrics.activeBearer, tp.slot() + 1);
+
+    // Packets sent on a bearer which is still up need no replay
+    if (!failover)
+        _count = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+size_t ActiveBackup::makeGreProbe(char *buf) noexcept
+{
+    memset(buf, 0, GRE_PROBE_LEN);
+
+    buf[0] = 0x45; // version 4, 20 bytes header
+    buf[3] = char(GRE_PROBE_LEN);
+    buf[9] = char(GRE_PROBE_PROTOCOL);
+
+    // TTL is 0: a probe leaked to the IP stack is never forwarded
+    const uint16_t checksum = Checksum::compute(buf, GRE_PROBE_LEN);
+    memcpy(buf + 10, &checksum, sizeof(checksum));
+
+    return GRE_PROBE_LEN;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool ActiveBackup::isGreProbe(const char *packet, size_t len) noexcept
+{
+    static const char zeroAddrs[8] = {0};
+
+    return len == GRE_PROBE_LEN &&
+           uint8_t(packet[9]) == GRE_PROBE_PROTOCOL &&
+           memcmp(packet + 12, zeroAddrs, sizeof(zeroAddrs)) == 0;
+}
@@ -0,0 +1,211 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "AdaptiveRedundancy.h"
+#include "Logger.h"
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+// Reports missed before a bearer is no longer usable
+constexpr int FEEDBACK_MISSED_MAX = 3;
+
+// True if bearer a has a lower loss than b or, with the same loss, a
+// shorter round trip time. If sticky, a must be better by more than
+// margin ppm of loss or a quarter of the round trip time, so that the
+// best bearer does not flap between similar ones.
+bool better(const TunnelPath &a, const TunnelPath &b, bool sticky, uint32_t margin) noexcept
+{
+    const uint32_t lossA = a.feedback().lossPpm();
+    const uint32_t lossB = b.feedback().lossPpm();
+
+    if (!sticky)
+        margin = 0;
+
+    if (lossA + margin < lossB)
+        return true;
+
+    if (lossB + margin < lossA || (!sticky && lossA != lossB))
+        return false;
+
+    const int64_t rttA = a.feedback().rttUs();
+    const int64_t rttB = b.feedback().rttUs();
+
+    if (rttA < 0)
+        return false;
+
+    return rttB < 0 || (sticky ? rttA * 4 < rttB * 3 : rttA < rttB);
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+AdaptiveRedundancy::AdaptiveRedundancy(const std::string &name,
+                                       const AdaptiveSettings &settings) : _name(name),
+                                                                           _settings(settings)
+{
+    const std::string prefix = "tunnel." + name;
+    auto &metrics = Metrics::getInstance();
+
+    _metrics.redundancy = &metrics.get(prefix + ".redundancy");
+    _metrics.changes = &metrics.get(prefix + ".redundancy_changes");
+    _metrics.bestBearer = &metrics.get(prefix + ".best_bearer");
+
+    // Every packet is mirrored until the bearers are reported on
+    Metrics::set(*_metrics.redundancy, unsigned(_level));
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool AdaptiveRedundancy::update(const Bearers &bearers, Clock::time_point now)
+{
+    if (now - _updatedAt < _settings.feedbackInterval)
+        return false;
+
+    _updatedAt = now;
+
+    const TunnelPath *current = nullptr; // the best bearer, if still usable
+    const TunnelPath *best = nullptr;
+
+    for (const auto &tp : bearers)
+    {
+        if (!usable(*tp, now))
+            continue;
+
+        if (int(tp->slot()) == _best)
+            current = tp.get();
+
+        if (!best || better(*tp, *best, false, 0))
+            best = tp.get();
+    }
+
+    if (current && !better(*best, *current, true, _settings.selectiveLossPpm / 2))
+        best = current;
+
+    const int bestSlot = best ? int(best->slot()) : -1;
+
+    if (bestSlot != _best)
+    {
+        TRACE(LOG_NOTICE, "AdaptiveRedundancy '%s' best bearer is now %s",
+              _name.c_str(), best ? best->name().c_str() : "none");
+
+        _best = bestSlot;
+
+        // 0 means no usable bearer
+        Metrics::set(*_metrics.bestBearer, bestSlot + 1);
+    }
+
+    const Redundancy wanted = target(best);
+
+    if (wanted >= _level)
+    {
+        _lowering = false;
+
+        if (wanted == _level)
+            return false;
+    }
+    else
+    {
+        // Redundancy is lowered once the bearers have been clean for a while
+        if (!_lowering)
+        {
+            _lowering = true;
+            _lowerSince = now;
+        }
+
+        if (now - _lowerSince < _settings.holdDown)
+            return false;
+
+        _lowering = false;
+    }
+
+    TRACE(LOG_WARNING, "AdaptiveRedundancy '%s' redundancy is now %s (was %s)",
+          _name.c_str(), levelName(wanted), levelName(_level));
+
+    _level = wanted;
+
+    Metrics::set(*_metrics.redundancy, unsigned(_level));
+    Metrics::add(*_metrics.changes, 1);
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+int AdaptiveRedundancy::select(const Bearers &bearers, const PathPolicy &path, Clock::time_point now) const noexcept
+{
+    if (_best >= 0 && path.includes(size_t(_best)))
+        return _best;
+
+    const TunnelPath *best = nullptr;
+    int preferred = -1;
+
+    for (const auto &tp : bearers)
+    {
+        const int slot = int(tp->slot());
+
+        if (!path.includes(tp->slot()))
+            continue;
+
+        if (preferred < 0 || slot < preferred)
+            preferred = slot;
+
+        if (usable(*tp, now) && (!best || better(*tp, *best, false, 0)))
+            best = tp.get();
+    }
+
+    return best ? int(best->slot()) : preferred;
+}
+
+/* -------------------------------------------------------------------------- */
+
+const char *AdaptiveRedundancy::levelName(Redundancy level) noexcept
+{
+    switch (level)
+    {
+    case Redundancy::Single:
+        return "single";
+    case Redundancy::Selective:
+        return "selective";
+    case Redundancy::Mirroring:
+    default:
+        return "mirroring";
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool AdaptiveRedundancy::usable(const TunnelPath &tp, Clock::time_point now) const noexcept
+{
+    return tp.measured() &&
+           tp.feedback().fresh(now, FEEDBACK_MISSED_MAX * tp.options().feedbackInterval);
+}
+
+/* -------------------------------------------------------------------------- */
+
+Redundancy AdaptiveRedundancy::target(const TunnelPath *best) const noexcept
+{
+    if (!best)
+        return Redundancy::Mirroring;
+
+    const uint32_t loss = best->feedback().lossPpm();
+    const int64_t rtt = best->feedback().rttUs();
+    const auto maxRtt = std::chrono::duration_cast<std::chrono::microseconds>(_settings.mirroringRtt);
+
+    if (loss > _settings.mirroringLossPpm || (maxRtt.count() > 0 && rtt > maxRtt.count()))
+        return Redundancy::Mirroring;
+
+    if (loss > _settings.selectiveLossPpm)
+        return Redundancy::Selective;
+
+    return Redundancy::Single;
+}
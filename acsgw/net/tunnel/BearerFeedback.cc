@@ -0,0 +1,185 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "BearerFeedback.h"
+#include "Checksum.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+constexpr size_t GRE_REPORT_HEADER_LEN = 20;
+constexpr uint8_t GRE_REPORT_PROTOCOL = 254; // experimentation and testing
+
+static_assert(GRE_REPORT_HEADER_LEN + sizeof(FeedbackReport) == FEEDBACK_GRE_LEN, "GRE report size");
+
+// Microseconds of the steady clock, wrapping (0 means none)
+uint32_t timestampOf(BearerFeedback::Clock::time_point now) noexcept
+{
+    const auto us = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch());
+    return std::max<uint32_t>(uint32_t(us.count()), 1);
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+void BearerFeedback::countFrame(uint16_t seq, size_t bytes) noexcept
+{
+    std::lock_guard<std::mutex> cs(_lock);
+
+    _receivedBytes += uint32_t(bytes);
+
+    // The first frame counts as expected too
+    if (!_started)
+    {
+        _started = true;
+        _lastSeq = seq;
+        _highest = uint64_t(seq) + 0x10000;
+        _reportedHighest = _highest - 1;
+        _received = 1;
+        return;
+    }
+
+    // Frames behind the highest one are late (reordered), not new
+    const int16_t delta = int16_t(uint16_t(seq - _lastSeq));
+
+    if (delta > 0)
+    {
+        _highest += uint64_t(delta);
+        _lastSeq = seq;
+    }
+
+    ++_received;
+}
+
+/* -------------------------------------------------------------------------- */
+
+FeedbackReport BearerFeedback::makeReport(Clock::time_point now) noexcept
+{
+    FeedbackReport report;
+    const int64_t ticks = now.time_since_epoch().count();
+
+    {
+        std::lock_guard<std::mutex> cs(_lock);
+
+        report.expected = htonl(uint32_t(_highest - _reportedHighest));
+        report.received = htonl(_received);
+        report.receivedBytes = htonl(_receivedBytes);
+        report.highestSeq = htonl(uint32_t(_lastSeq));
+        report.echoTimestamp = htonl(_peerTimestamp);
+        report.echoDelay = _peerTimestamp != 0 ?
+            htonl(uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                Clock::duration(ticks - _peerTimestampAt)).count())) :
+            0;
+
+        _reportedHighest = _highest;
+        _received = 0;
+        _receivedBytes = 0;
+    }
+
+    report.timestamp = htonl(timestampOf(now));
+    _reportedAt = ticks;
+
+    return report;
+}
+
+/* -------------------------------------------------------------------------- */
+
+FeedbackSample BearerFeedback::applyReport(const FeedbackReport &report, Clock::time_point now) noexcept
+{
+    FeedbackSample sample;
+    sample.expected = ntohl(report.expected);
+    sample.received = ntohl(report.received);
+    sample.receivedBytes = ntohl(report.receivedBytes);
+    sample.highestSeq = uint16_t(ntohl(report.highestSeq));
+
+    const uint32_t expected = sample.expected;
+    const uint32_t received = sample.received;
+    const uint32_t echoTimestamp = ntohl(report.echoTimestamp);
+    const uint32_t echoDelay = ntohl(report.echoDelay);
+
+    {
+        std::lock_guard<std::mutex> cs(_lock);
+
+        const uint32_t timestamp = ntohl(report.timestamp);
+
+        // Reports follow each other, so the timestamps of the peer measure
+        // the time the frames it reports on were received in
+        if (_peerTimestamp != 0)
+            sample.intervalUs = int64_t(uint32_t(timestamp - _peerTimestamp));
+
+        _peerTimestamp = timestamp;
+        _peerTimestampAt = now.time_since_epoch().count();
+    }
+
+    // Smoothed as the TCP SRTT (gain 1/8), a sample per report
+    if (expected > 0)
+    {
+        const uint32_t lost = expected - std::min(received, expected);
+        const uint32_t sample = uint32_t(uint64_t(lost) * 1000000 / expected);
+
+        _lossPpm = uint32_t((uint64_t(_lossPpm) * 7 + sample) / 8);
+    }
+
+    if (echoTimestamp != 0)
+    {
+        const int64_t rttSample = int64_t(uint32_t(timestampOf(now) - echoTimestamp - echoDelay));
+        const int64_t rtt = _rttUs;
+
+        _rttUs = rtt < 0 ? rttSample : (rtt * 7 + rttSample) / 8;
+        sample.rttUs = rttSample;
+    }
+
+    _appliedAt = now.time_since_epoch().count();
+
+    return sample;
+}
+
+/* -------------------------------------------------------------------------- */
+
+size_t BearerFeedback::makeGreReport(char *buf, const FeedbackReport &report) noexcept
+{
+    memset(buf, 0, GRE_REPORT_HEADER_LEN);
+
+    buf[0] = 0x45; // version 4, 20 bytes header
+    buf[3] = char(FEEDBACK_GRE_LEN);
+    buf[9] = char(GRE_REPORT_PROTOCOL);
+
+    // TTL is 0: a report leaked to the IP stack is never forwarded
+    const uint16_t checksum = Checksum::compute(buf, GRE_REPORT_HEADER_LEN);
+    memcpy(buf + 10, &checksum, sizeof(checksum));
+
+    memcpy(buf + GRE_REPORT_HEADER_LEN, &report, sizeof(report));
+
+    return FEEDBACK_GRE_LEN;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool BearerFeedback::parseGreReport(const char *packet, size_t len, FeedbackReport &report) noexcept
+{
+    static const char zeroAddrs[8] = {0};
+
+    if (len != FEEDBACK_GRE_LEN ||
+        uint8_t(packet[9]) != GRE_REPORT_PROTOCOL ||
+        memcmp(packet + 12, zeroAddrs, sizeof(zeroAddrs)) != 0)
+    {
+        return false;
+    }
+
+    memcpy(&report, packet + GRE_REPORT_HEADER_LEN, sizeof(report));
+
+    return true;
+}
@@ -0,0 +1,331 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "CongestionControl.h"
+#include "Logger.h"
+
+#include <algorithm>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+// Pacing gains, in eighths
+constexpr unsigned STARTUP_GAIN = 16;
+constexpr unsigned DRAIN_GAIN = 4;
+constexpr unsigned PROBE_GAINS[] = {10, 6, 8, 8, 8, 8, 8, 8};
+constexpr unsigned CWND_GAIN = 2;
+
+// Reports without 25% more bandwidth before start up is over
+constexpr unsigned FULL_BW_REPORTS = 3;
+
+constexpr uint64_t MIN_RATE = uint64_t(CC_MIN_RATE_KBPS) * 1000 / 8;
+constexpr uint64_t MIN_CWND = uint64_t(CC_MIN_CWND_KB) * 1024;
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+CongestionControl::CongestionControl(const std::string &prefix,
+                                     std::chrono::milliseconds reportInterval) : _reportInterval(reportInterval),
+                                                                                 _sentAt(CC_SEQ_RING)
+{
+    auto &metrics = Metrics::getInstance();
+
+    _metrics.state = &metrics.get(prefix + ".cc_state");
+    _metrics.rate = &metrics.get(prefix + ".cc_rate");
+    _metrics.cwnd = &metrics.get(prefix + ".cc_cwnd");
+    _metrics.inflight = &metrics.get(prefix + ".cc_inflight");
+    _metrics.minRttUs = &metrics.get(prefix + ".cc_min_rtt_us");
+    _metrics.lossTimeouts = &metrics.get(prefix + ".cc_loss_timeouts");
+
+    Metrics::set(*_metrics.rate, _rate);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool CongestionControl::awaitWindow(std::chrono::milliseconds timeout)
+{
+    if (!windowFull())
+        return true;
+
+    std::unique_lock<std::mutex> cs(_lock);
+
+    const auto deadline = Clock::now() + timeout;
+
+    while (windowFull())
+    {
+        const auto now = Clock::now();
+        const auto lostAt = _progressAt + lossTimeout();
+
+        if (now >= lostAt)
+        {
+            onLossTimeout();
+            break;
+        }
+
+        if (now >= deadline)
+            return false;
+
+        _windowCond.wait_until(cs, std::min(deadline, lostAt));
+    }
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void CongestionControl::onSend(uint16_t seq, size_t bytes) noexcept
+{
+    std::lock_guard<std::mutex> cs(_lock);
+
+    // The loss timer runs from the first frame in flight
+    if (_inflight == 0)
+        _progressAt = Clock::now();
+
+    _sentBytes += bytes;
+    _sentAt[seq % CC_SEQ_RING] = _sentBytes;
+    _nextSeq = uint16_t(seq + 1);
+    _sending = true;
+
+    _inflight += bytes;
+}
+
+/* -------------------------------------------------------------------------- */
+
+TokenBucket &CongestionControl::pacer() noexcept
+{
+    const uint64_t rate = _rate;
+
+    if (_pacer.rate() != rate)
+        _pacer.setRate(rate, TokenBucket::defaultBurst(rate));
+
+    return _pacer;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void CongestionControl::onFeedback(const FeedbackSample &sample, Clock::time_point now) noexcept
+{
+    std::lock_guard<std::mutex> cs(_lock);
+
+    if (sample.rttUs >= 0)
+    {
+        _rttUs = sample.rttUs;
+
+        if (_minRttUs < 0 || _rttUs <= _minRttUs || now - _minRttAt > std::chrono::seconds(CC_MIN_RTT_WINDOW_S))
+        {
+            _minRttUs = _rttUs;
+            _minRttAt = now;
+        }
+    }
+
+    // Frames sent after the highest one the peer has received are in
+    // flight (or lost, which the next reports tell)
+    const uint16_t ahead = uint16_t(_nextSeq - sample.highestSeq);
+
+    if (_sending && sample.received > 0 && ahead > 0 && ahead <= CC_SEQ_RING)
+    {
+        // Frames sent before a loss timeout are no longer in flight
+        const uint64_t delivered = std::max(_sentAt[sample.highestSeq % CC_SEQ_RING], _lostAt);
+
+        _inflight = _sentBytes - std::min(delivered, _sentBytes);
+    }
+
+    if (sample.received > 0 && sample.highestSeq != _highestSeq)
+    {
+        _highestSeq = sample.highestSeq;
+        _progressAt = now;
+    }
+
+    const int64_t intervalUs = sample.intervalUs > 0 ?
+        sample.intervalUs :
+        std::chrono::duration_cast<std::chrono::microseconds>(_reportInterval).count();
+
+    // A sender without enough to send does not measure the bandwidth
+    const uint64_t sentRate = (_sentBytes - _sentAtReport) * 1000000 / uint64_t(intervalUs);
+    const bool appLimited = sentRate < _rate / 2;
+
+    _sentAtReport = _sentBytes;
+
+    const uint64_t deliveryRate = sample.intervalUs > 0 ?
+        uint64_t(sample.receivedBytes) * 1000000 / uint64_t(sample.intervalUs) :
+        0;
+
+    if (deliveryRate > 0 && (!appLimited || deliveryRate > _btlBw))
+    {
+        addBwSample(deliveryRate);
+    }
+
+    // Heavy loss: the path does not carry what was estimated
+    const uint32_t lost = sample.expected - std::min(sample.received, sample.expected);
+
+    if (sample.expected > 0 && uint64_t(lost) * 1000000 / sample.expected > CC_LOSS_PPM && deliveryRate > 0)
+    {
+        for (auto &bw : _bw)
+            bw = std::min(bw, deliveryRate);
+
+        _btlBw = deliveryRate;
+
+        if (_state == State::Startup)
+            setState(State::Drain);
+    }
+
+    const uint64_t bdp = _minRttUs > 0 ? _btlBw * uint64_t(_minRttUs) / 1000000 : 0;
+    const bool queueing = _rttUs >= 0 && _minRttUs >= 0 &&
+                          _rttUs - _minRttUs > int64_t(CC_MAX_QUEUE_DELAY_MS) * 1000;
+
+    if (_state == State::Startup && !appLimited)
+    {
+        if (_btlBw >= _fullBw * 5 / 4)
+        {
+            _fullBw = _btlBw;
+            _fullBwReports = 0;
+        }
+        else if (++_fullBwReports >= FULL_BW_REPORTS)
+        {
+            setState(State::Drain);
+        }
+    }
+
+    if (_state == State::Startup && queueing)
+    {
+        setState(State::Drain);
+    }
+
+    if (_state == State::Drain && _inflight <= bdp)
+    {
+        setState(State::ProbeBw);
+        _cycleAt = now;
+    }
+
+    const uint64_t base = _btlBw > 0 ? _btlBw : uint64_t(CC_INITIAL_RATE_KBPS) * 1000 / 8;
+    const unsigned g = queueing ? std::min(gain(now), PROBE_GAINS[1]) : gain(now);
+
+    _rate = std::max(base * g / 8, MIN_RATE);
+
+    // The bytes in flight are known as of the report, a report interval
+    // of traffic later
+    if (bdp > 0)
+    {
+        const uint64_t reportBytes = _btlBw * uint64_t(_reportInterval.count()) / 1000;
+
+        _cwnd = std::max(CWND_GAIN * bdp + reportBytes, MIN_CWND);
+    }
+
+    Metrics::set(*_metrics.rate, _rate);
+    Metrics::set(*_metrics.cwnd, _cwnd == UINT64_MAX ? 0 : uint64_t(_cwnd));
+    Metrics::set(*_metrics.inflight, _inflight);
+    Metrics::set(*_metrics.minRttUs, uint64_t(std::max<int64_t>(_minRttUs, 0)));
+
+    _windowCond.notify_all();
+}
+
+/* -------------------------------------------------------------------------- */
+
+const char *CongestionControl::stateName(State state) noexcept
+{
+    switch (state)
+    {
+    case State::Startup:
+        return "startup";
+    case State::Drain:
+        return "drain";
+    case State::ProbeBw:
+    default:
+        return "probe-bw";
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void CongestionControl::addBwSample(uint64_t bw) noexcept
+{
+    _bw[_bwNext] = bw;
+    _bwNext = (_bwNext + 1) % CC_BW_WINDOW;
+
+    _btlBw = *std::max_element(std::begin(_bw), std::end(_bw));
+}
+
+/* -------------------------------------------------------------------------- */
+
+unsigned CongestionControl::gain(Clock::time_point now) noexcept
+{
+    switch (_state)
+    {
+    case State::Startup:
+        return STARTUP_GAIN;
+
+    case State::Drain:
+        return DRAIN_GAIN;
+
+    case State::ProbeBw:
+    default:
+        break;
+    }
+
+    // A phase of the cycle lasts a round trip, at least a report interval
+    const auto phase = std::max<Clock::duration>(
+        std::chrono::microseconds(std::max<int64_t>(_minRttUs, 0)), _reportInterval);
+
+    if (now - _cycleAt >= phase)
+    {
+        _cycle = (_cycle + 1) % (sizeof(PROBE_GAINS) / sizeof(PROBE_GAINS[0]));
+        _cycleAt = now;
+    }
+
+    return PROBE_GAINS[_cycle];
+}
+
+/* -------------------------------------------------------------------------- */
+
+CongestionControl::Clock::duration CongestionControl::lossTimeout() const noexcept
+{
+    const int64_t rttUs = _rttUs >= 0 ? _rttUs : int64_t(CC_INITIAL_RTT_MS) * 1000;
+
+    return 2 * std::chrono::microseconds(rttUs) + _reportInterval;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void CongestionControl::onLossTimeout() noexcept
+{
+    TRACE(LOG_WARNING, "CongestionControl %llu bytes in flight lost (bandwidth %llu B/s)",
+          (unsigned long long)_inflight, (unsigned long long)_btlBw);
+
+    _lostAt = _sentBytes;
+    _inflight = 0;
+
+    for (auto &bw : _bw)
+        bw /= 2;
+
+    _btlBw /= 2;
+    _rate = std::max(uint64_t(_rate) / 2, MIN_RATE);
+
+    if (_cwnd != UINT64_MAX)
+        _cwnd = std::max(uint64_t(_cwnd) / 2, MIN_CWND);
+
+    Metrics::add(*_metrics.lossTimeouts, 1);
+    Metrics::set(*_metrics.rate, _rate);
+    Metrics::set(*_metrics.cwnd, _cwnd == UINT64_MAX ? 0 : uint64_t(_cwnd));
+    Metrics::set(*_metrics.inflight, 0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void CongestionControl::setState(State state) noexcept
+{
+    TRACE(LOG_INFO, "CongestionControl %s -> %s (bandwidth %llu B/s, min RTT %lld us)",
+          stateName(_state), stateName(state), (unsigned long long)_btlBw, (long long)_minRttUs);
+
+    _state = state;
+
+    Metrics::set(*_metrics.state, unsigned(_state));
+}
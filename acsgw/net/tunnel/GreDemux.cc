@@ -0,0 +1,333 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "GreDemux.h"
+#include "Logger.h"
+#include "ThreadPolicy.h"
+#include "VirtualIfMgr.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+/* -------------------------------------------------------------------------- */
+
+GreDemux::Registration::Registration(Handle demux,
+                                     uint32_t remoteAddr,
+                                     const GreSocket::Key &key,
+                                     std::shared_ptr<Inbound> inbound) : _demux(std::move(demux)),
+                                                                         _remoteAddr(remoteAddr),
+                                                                         _key(key),
+                                                                         _inbound(std::move(inbound))
+{
+}
+
+/* -------------------------------------------------------------------------- */
+
+GreDemux::Registration::~Registration()
+{
+    _demux->delRoute(Route(_remoteAddr, _key));
+}
+
+/* -------------------------------------------------------------------------- */
+
+std::unique_ptr<GreDemux::Registration> GreDemux::registerBearer(
+    const IpAddress &localAddr,
+    const IpAddress &remoteAddr,
+    const GreSocket::Key &key,
+    std::chrono::microseconds spinBudget,
+    size_t rcvBuf,
+    size_t rcvBufMax)
+{
+    // A demultiplexer lives as long as the bearers registered to it
+    static std::mutex demuxLock;
+    static std::map<uint32_t, std::weak_ptr<GreDemux>> demuxes;
+
+    Handle demux;
+
+    {
+        std::lock_guard<std::mutex> cs(demuxLock);
+
+        auto &entry = demuxes[localAddr.to_uint32()];
+        demux = entry.lock();
+
+        if (!demux)
+        {
+            demux = std::make_shared<GreDemux>(localAddr);
+
+            if (!demux->open())
+                return nullptr;
+
+            entry = demux;
+        }
+    }
+
+    if (spinBudget.count() > 0 && !demux->_socket.setBusyPoll(int(spinBudget.count())))
+    {
+        TRACE(LOG_WARNING, "GreDemux SO_BUSY_POLL not set: '%s'", strerror(errno));
+    }
+
+    if (rcvBuf > 0 || rcvBufMax > 0)
+        demux->setRcvBuf(rcvBuf, rcvBufMax);
+
+    auto inbound = std::make_shared<Inbound>(GRE_INBOUND_QUEUE_LEN);
+
+    if (spinBudget.count() > 0)
+        inbound->setSpinBudget(spinBudget);
+
+    if (!demux->addRoute(Route(remoteAddr.to_uint32(), key), inbound))
+    {
+        TRACE(LOG_ERR, "GreDemux packets from %s (key %u) already go to another bearer",
+              remoteAddr.to_str().c_str(), unsigned(key.value));
+        return nullptr;
+    }
+
+    return std::unique_ptr<Registration>(
+        new Registration(std::move(demux), remoteAddr.to_uint32(), key, std::move(inbound)));
+}
+
+/* -------------------------------------------------------------------------- */
+
+GreDemux::GreDemux(const IpAddress &localAddr) : _localAddr(localAddr)
+{
+    const std::string prefix = "gre_demux." + localAddr.to_str();
+    auto &metrics = Metrics::getInstance();
+
+    _metrics.unknownDrops = &metrics.get(prefix + ".unknown_drops");
+    _metrics.queueDrops = &metrics.get(prefix + ".queue_drops");
+    _metrics.kernelDrops = &metrics.get(prefix + ".kernel_drops");
+    _metrics.rcvBufBytes = &metrics.get(prefix + ".rcvbuf_bytes");
+}
+
+/* -------------------------------------------------------------------------- */
+
+GreDemux::~GreDemux()
+{
+    _stop = true;
+
+    if (_thread)
+        _thread->join();
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool GreDemux::open()
+{
+    if (!_socket.isValid())
+    {
+        TRACE(LOG_ERR, "%s failed due an invalid socket", __FUNCTION__);
+        return false;
+    }
+
+    if (!_socket.bind(_localAddr, true /* reuse addr */))
+    {
+        TRACE(LOG_ERR, "%s bind(%s) failed with error: '%s'", __FUNCTION__,
+              _localAddr.to_str().c_str(), strerror(errno));
+        return false;
+    }
+
+    // Other GRE traffic of the host is not even queued on the socket
+    if (!_socket.attachGreFilter())
+    {
+        TRACE(LOG_WARNING, "%s GRE filter not attached: '%s'", __FUNCTION__, strerror(errno));
+    }
+
+    if (!_socket.setRxQueueOverflow())
+    {
+        TRACE(LOG_WARNING, "%s SO_RXQ_OVFL not set: '%s'", __FUNCTION__, strerror(errno));
+    }
+
+    Metrics::set(*_metrics.rcvBufBytes, uint64_t(std::max(_socket.bufferSize(true), 0)));
+
+    _thread = std::make_unique<std::thread>(&GreDemux::run, this);
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void GreDemux::setRcvBuf(size_t rcvBuf, size_t rcvBufMax)
+{
+    std::lock_guard<std::mutex> cs(_lock);
+
+    _rcvBufMax = std::max(_rcvBufMax, rcvBufMax);
+
+    // The socket is shared: it never shrinks for a bearer asking for less
+    if (rcvBuf <= _rcvBuf)
+        return;
+
+    if (!_socket.setBufferSize(true, rcvBuf))
+    {
+        TRACE(LOG_WARNING, "GreDemux %s SO_RCVBUF not set: '%s'", _localAddr.to_str().c_str(), strerror(errno));
+        return;
+    }
+
+    _rcvBuf = rcvBuf;
+
+    Metrics::set(*_metrics.rcvBufBytes, uint64_t(std::max(_socket.bufferSize(true), 0)));
+}
+
+/* -------------------------------------------------------------------------- */
+
+void GreDemux::countKernelDrops(uint32_t drops)
+{
+    const uint32_t newDrops = drops - _kernelDrops;
+
+    if (newDrops == 0)
+        return;
+
+    _kernelDrops = drops;
+
+    Metrics::add(*_metrics.kernelDrops, newDrops);
+
+    size_t rcvBuf = 0;
+    size_t rcvBufMax = 0;
+
+    {
+        std::lock_guard<std::mutex> cs(_lock);
+        rcvBuf = _rcvBuf;
+        rcvBufMax = _rcvBufMax;
+    }
+
+    // The buffer did not absorb a burst: it doubles
+    if (rcvBuf < rcvBufMax)
+    {
+        const int current = _socket.bufferSize(true);
+
+        setRcvBuf(std::min(std::max(rcvBuf, size_t(std::max(current, 0)) / 2) * 2, rcvBufMax), 0);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool GreDemux::addRoute(const Route &route, std::shared_ptr<Inbound> inbound)
+{
+    std::lock_guard<std::mutex> cs(_lock);
+
+    return _routes.emplace(route, std::move(inbound)).second;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void GreDemux::delRoute(const Route &route)
+{
+    std::lock_guard<std::mutex> cs(_lock);
+
+    _routes.erase(route);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void GreDemux::notifyFailure()
+{
+    ++_failures;
+
+    std::lock_guard<std::mutex> cs(_lock);
+
+    for (auto &route : _routes)
+        route.second->wakeAll();
+}
+
+/* -------------------------------------------------------------------------- */
+
+void GreDemux::run()
+{
+    ThreadPolicy::getInstance().apply(ThreadRole::Recv, ("gre-rx-" + _localAddr.to_str()).c_str());
+
+    std::vector<char> buf(VirtualIfMgr::MAX_PKT_SIZE);
+    bool failing = false;
+
+    while (!_stop)
+    {
+        // Wakes up now and then to check for the stop request
+        struct timeval timeout = {1, 0};
+
+        const auto pollst = _socket.poll(timeout);
+
+        if (pollst == GreSocket::PollingState::ERROR_IN_COMMUNICATION)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // The bearers go down until polling works again
+            if (!failing)
+            {
+                TRACE(LOG_ERR, "%s polling GRE socket of %s failed: '%s'", __FUNCTION__,
+                      _localAddr.to_str().c_str(), strerror(errno));
+
+                failing = true;
+                notifyFailure();
+            }
+
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            continue;
+        }
+
+        if (failing)
+        {
+            TRACE(LOG_NOTICE, "%s polling GRE socket of %s works again", __FUNCTION__,
+                  _localAddr.to_str().c_str());
+            failing = false;
+        }
+
+        if (pollst == GreSocket::PollingState::TIMEOUT_EXPIRED)
+            continue;
+
+        // Drains what is queued on the socket
+        while (true)
+        {
+            IpAddress remoteAddr;
+            GreSocket::Key key;
+            GreSocket::Sequence seq;
+            int payloadOffset = 0;
+            uint32_t drops = _kernelDrops;
+
+            const int n = _socket.recvfrom(buf.data(), int(buf.size()), remoteAddr, payloadOffset, key, seq,
+                                           MSG_DONTWAIT, &drops);
+
+            // Nothing left (or a broken packet, polling again is fine)
+            if (n < 0)
+                break;
+
+            countKernelDrops(drops);
+
+            // Not an IPv4-over-GRE packet
+            if (n == 0)
+                continue;
+
+            std::shared_ptr<Inbound> inbound;
+
+            {
+                std::lock_guard<std::mutex> cs(_lock);
+
+                auto it = _routes.find(Route(remoteAddr.to_uint32(), key));
+
+                if (it != _routes.end())
+                    inbound = it->second;
+            }
+
+            if (!inbound)
+            {
+                Metrics::add(*_metrics.unknownDrops, 1);
+                continue;
+            }
+
+            Frame frame;
+            frame.data.assign(buf.data() + payloadOffset, buf.data() + payloadOffset + n);
+            frame.remoteAddr = remoteAddr;
+            frame.seq = seq;
+
+            if (!inbound->push(std::move(frame)))
+            {
+                Metrics::add(*_metrics.queueDrops, 1);
+            }
+        }
+    }
+}
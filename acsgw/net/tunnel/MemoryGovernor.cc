@@ -0,0 +1,246 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "MemoryGovernor.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <string>
+
+/* -------------------------------------------------------------------------- */
+
+MemoryCharge &MemoryCharge::operator=(MemoryCharge &&other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+
+        _queueBudget = other._queueBudget;
+        _bytes = other._bytes;
+        _global = other._global;
+
+        other._queueBudget = nullptr;
+        other._bytes = 0;
+        other._global = false;
+    }
+
+    return *this;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void MemoryCharge::reset() noexcept
+{
+    if (_bytes == 0)
+        return;
+
+    if (_queueBudget)
+        _queueBudget->release(_bytes);
+
+    if (_global)
+        MemoryGovernor::getInstance().release(_bytes);
+
+    _queueBudget = nullptr;
+    _bytes = 0;
+    _global = false;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void MemoryCharge::merge(MemoryCharge &&other) noexcept
+{
+    if (_bytes == 0)
+    {
+        *this = std::move(other);
+        return;
+    }
+
+    if (other._queueBudget != _queueBudget || other._global != _global)
+        return;
+
+    _bytes += other._bytes;
+
+    other._queueBudget = nullptr;
+    other._bytes = 0;
+    other._global = false;
+}
+
+/* -------------------------------------------------------------------------- */
+
+MemoryGovernor::MemoryGovernor()
+{
+    _admitPct[size_t(TrafficClass::Critical)] = 100;
+    _admitPct[size_t(TrafficClass::Interactive)] = 90;
+    _admitPct[size_t(TrafficClass::Default)] = 70;
+    _admitPct[size_t(TrafficClass::Bulk)] = 50;
+
+    auto &metrics = Metrics::getInstance();
+
+    _metrics.usedBytes = &metrics.get("memory.used_bytes");
+    _metrics.backpressureWaits = &metrics.get("memory.backpressure_waits");
+
+    for (size_t i = 0; i < TRAFFIC_CLASS_COUNT; ++i)
+    {
+        _metrics.drops[i] = &metrics.get(
+            std::string("memory.") + trafficClassName(TrafficClass(i)) + "_drops");
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+MemoryGovernor &MemoryGovernor::getInstance()
+{
+    static MemoryGovernor _instance;
+    return _instance;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool MemoryGovernor::configure(const Config &config)
+{
+    const auto &cfgdata = config.data();
+
+    // [memory]
+    auto it = cfgdata.find("memory");
+
+    if (it == cfgdata.end())
+    {
+        return false;
+    }
+
+    const auto &namespace_data = it->second;
+
+    auto getNum = [&](const std::string &fieldName, unsigned long &retVal) {
+        auto nsit = namespace_data.find(fieldName);
+        if (nsit != namespace_data.end())
+        {
+            try
+            {
+                retVal = std::stoul(nsit->second.first);
+            }
+            catch (...)
+            {
+                TRACE(LOG_DEBUG, "MemoryGovernor config syntax error in %s format", fieldName.c_str());
+            }
+        }
+    };
+
+    // gateway_budget_kb = N
+    unsigned long budgetKb = _budget / 1024;
+    getNum("gateway_budget_kb", budgetKb);
+    _budget = size_t(budgetKb) * 1024;
+
+    // <class>_admit_pct = N
+    for (size_t i = 0; i < TRAFFIC_CLASS_COUNT; ++i)
+    {
+        unsigned long pct = _admitPct[i];
+        getNum(std::string(trafficClassName(TrafficClass(i))) + "_admit_pct", pct);
+        _admitPct[i] = pct > 100 ? 100 : unsigned(pct);
+    }
+
+    // backpressure_timeout_ms = N
+    unsigned long timeoutMs = _backpressureTimeout.count();
+    getNum("backpressure_timeout_ms", timeoutMs);
+    _backpressureTimeout = std::chrono::milliseconds(timeoutMs);
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool MemoryGovernor::tryCharge(size_t bytes, size_t limit) noexcept
+{
+    size_t cur = _used.load();
+
+    do
+    {
+        // Never starve the gateway: with nothing queued a frame is admitted
+        if (limit > 0 && cur > 0 && cur + bytes > limit)
+            return false;
+    } while (!_used.compare_exchange_weak(cur, cur + bytes));
+
+    Metrics::set(*_metrics.usedBytes, cur + bytes);
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void MemoryGovernor::release(size_t bytes) noexcept
+{
+    const size_t cur = _used.fetch_sub(bytes) - bytes;
+
+    Metrics::set(*_metrics.usedBytes, cur);
+
+    // Pairs with the waiters registration in admit()
+    if (_waiters.load() > 0)
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _roomAvailable.notify_all();
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+MemoryCharge MemoryGovernor::admit(ByteBudget &queueBudget, size_t bytes, TrafficClass tc, bool mayWait)
+{
+    if (!queueBudget.tryCharge(bytes))
+    {
+        Metrics::add(*_metrics.drops[size_t(tc)], 1);
+        return MemoryCharge();
+    }
+
+    // A zero limit means unlimited, so a class with 0% is given one byte
+    const size_t limit = _budget == 0 ? 0 : std::max<size_t>(1, _budget / 100 * _admitPct[size_t(tc)]);
+
+    if (tryCharge(bytes, limit))
+    {
+        return MemoryCharge(&queueBudget, bytes, true);
+    }
+
+    // Only critical traffic is worth holding the TUN reader back
+    if (mayWait && tc == TrafficClass::Critical && _backpressureTimeout.count() > 0)
+    {
+        Metrics::add(*_metrics.backpressureWaits, 1);
+
+        std::unique_lock<std::mutex> lock(_lock);
+        ++_waiters;
+
+        const bool admitted = _roomAvailable.wait_for(
+            lock, _backpressureTimeout, [&]() { return tryCharge(bytes, limit); });
+
+        --_waiters;
+
+        if (admitted)
+        {
+            return MemoryCharge(&queueBudget, bytes, true);
+        }
+    }
+
+    queueBudget.release(bytes);
+    Metrics::add(*_metrics.drops[size_t(tc)], 1);
+
+    TRACE(LOG_DEBUG, "MemoryGovernor dropped a %s frame of %zu bytes (%zu/%zu bytes in use)",
+          trafficClassName(tc), bytes, used(), _budget);
+
+    return MemoryCharge();
+}
+
+/* -------------------------------------------------------------------------- */
+
+MemoryCharge MemoryGovernor::admitLocal(ByteBudget &queueBudget, size_t bytes, std::chrono::milliseconds wait)
+{
+    if (!(wait.count() > 0 ? queueBudget.chargeWait(bytes, wait) : queueBudget.tryCharge(bytes)))
+    {
+        return MemoryCharge();
+    }
+
+    return MemoryCharge(&queueBudget, bytes, false);
+}
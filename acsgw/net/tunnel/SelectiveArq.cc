@@ -0,0 +1,381 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "SelectiveArq.h"
+#include "QosPolicy.h"
+#include "TunnelFragment.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+// Distance from b to a, in the sequence number space
+inline int16_t seqDiff(uint16_t a, uint16_t b) noexcept
+{
+    return int16_t(uint16_t(a - b));
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+SelectiveArq::SelectiveArq(const std::string &prefix) : _window(ARQ_WINDOW)
+{
+    auto &metrics = Metrics::getInstance();
+
+    _metrics.retransmits = &metrics.get(prefix + ".arq_retransmits");
+    _metrics.abandoned = &metrics.get(prefix + ".arq_abandoned");
+    _metrics.cwnd = &metrics.get(prefix + ".arq_cwnd");
+    _metrics.srttUs = &metrics.get(prefix + ".arq_srtt_us");
+
+    Metrics::set(*_metrics.cwnd, uint64_t(_cwnd));
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool SelectiveArq::awaitWindow(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> cs(_lock);
+
+    return _windowCond.wait_for(cs, timeout, [this]() { return _inflight < size_t(_cwnd); });
+}
+
+/* -------------------------------------------------------------------------- */
+
+uint16_t SelectiveArq::onSend(char *datagram, size_t len, TrafficClass tc, Clock::time_point now)
+{
+    std::lock_guard<std::mutex> cs(_lock);
+
+    const uint16_t seq = _nextSeq++;
+    auto &frame = _window[seq % ARQ_WINDOW];
+
+    // A frame a whole window old could no longer be acknowledged
+    if (frame.inUse)
+    {
+        release(frame);
+        Metrics::add(*_metrics.abandoned, 1);
+    }
+
+    if (uint16_t(_nextSeq - _oldest) > ARQ_WINDOW)
+    {
+        _oldest = uint16_t(_nextSeq - ARQ_WINDOW);
+    }
+
+    if (len >= sizeof(uint64_t))
+    {
+        uint64_t pktid = 0;
+        memcpy(&pktid, datagram + len - sizeof(pktid), sizeof(pktid));
+        pktid = setBearerSeq(pktid, seq);
+        memcpy(datagram + len - sizeof(pktid), &pktid, sizeof(pktid));
+    }
+
+    frame.data.assign(datagram, datagram + len);
+    frame.tc = tc;
+    frame.firstSentAt = now;
+    frame.sentAt = now;
+    frame.retransmits = 0;
+    frame.inUse = true;
+
+    ++_inflight;
+
+    return seq;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void SelectiveArq::onAck(const ArqAck &ack, Clock::time_point now, const Send &send)
+{
+    const uint16_t highest = ntohs(ack.highest);
+
+    std::lock_guard<std::mutex> cs(_lock);
+
+    // Acknowledgements of frames not sent yet are bogus
+    if (seqDiff(highest, _nextSeq) >= 0)
+    {
+        return;
+    }
+
+    size_t acked = 0;
+
+    for (uint16_t seq = _oldest; seq != _nextSeq; ++seq)
+    {
+        auto &frame = _window[seq % ARQ_WINDOW];
+
+        if (!frame.inUse)
+        {
+            continue;
+        }
+
+        const int d = seqDiff(highest, seq);
+
+        // Frames after the highest one received are still on their way
+        if (d < 0)
+        {
+            break;
+        }
+
+        const unsigned bit = unsigned(d) - 1;
+        const bool received = d == 0 ||
+                              (bit < ARQ_WINDOW && (ack.received[bit / 8] >> (bit % 8)) & 1);
+
+        if (received)
+        {
+            // Round trip times of retransmitted frames are ambiguous (Karn)
+            if (d == 0 && frame.retransmits == 0)
+            {
+                rttSample(now - frame.sentAt);
+            }
+
+            release(frame);
+            ++acked;
+            continue;
+        }
+
+        // Missing while later frames got through: lost, unless reordered.
+        // Critical frames are sent again as soon as one later frame arrives.
+        const int reorder = frame.tc == TrafficClass::Critical ? 1 : ARQ_REORDER_FRAMES;
+        const auto srtt = std::chrono::microseconds(std::max<int64_t>(_srttUs, 0));
+
+        if (d >= reorder && (frame.retransmits == 0 || now - frame.sentAt >= srtt))
+        {
+            onLoss(seq);
+            retransmit(frame, now, send);
+        }
+    }
+
+    // Slow start, then one more frame per window acknowledged
+    if (acked > 0)
+    {
+        _cwnd += _cwnd < _ssthresh ? double(acked) : double(acked) / _cwnd;
+        _cwnd = std::min(_cwnd, double(ARQ_WINDOW));
+
+        Metrics::set(*_metrics.cwnd, uint64_t(_cwnd));
+    }
+
+    advanceOldest();
+}
+
+/* -------------------------------------------------------------------------- */
+
+void SelectiveArq::onTick(Clock::time_point now, const Send &send)
+{
+    std::lock_guard<std::mutex> cs(_lock);
+
+    for (uint16_t seq = _oldest; seq != _nextSeq; ++seq)
+    {
+        auto &frame = _window[seq % ARQ_WINDOW];
+
+        if (frame.inUse && now - frame.sentAt >= rto(frame.retransmits))
+        {
+            onLoss(seq);
+            retransmit(frame, now, send);
+        }
+    }
+
+    advanceOldest();
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool SelectiveArq::onData(uint16_t seq) noexcept
+{
+    std::lock_guard<std::mutex> cs(_rxLock);
+
+    ++_rxUnacked;
+
+    if (!_rxStarted)
+    {
+        _rxStarted = true;
+        _rxHighest = seq;
+        return false;
+    }
+
+    const int d = seqDiff(seq, _rxHighest);
+
+    if (d > 0)
+    {
+        shiftRxMap(unsigned(d));
+        _rxHighest = seq;
+
+        // A gap is reported at once, to get the missing frames sooner
+        return d > 1 || _rxUnacked >= ARQ_ACK_FRAMES;
+    }
+
+    // Late or retransmitted frames fill a gap, duplicates mean that the
+    // acknowledgement was lost
+    const unsigned bit = unsigned(-d) - 1;
+
+    if (d < 0 && bit < ARQ_WINDOW)
+    {
+        _rxMap[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool SelectiveArq::ackPending() const noexcept
+{
+    std::lock_guard<std::mutex> cs(_rxLock);
+
+    return _rxUnacked > 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+ArqAck SelectiveArq::makeAck() noexcept
+{
+    std::lock_guard<std::mutex> cs(_rxLock);
+
+    ArqAck ack;
+    ack.highest = htons(_rxHighest);
+
+    for (size_t i = 0; i < sizeof(ack.received); ++i)
+    {
+        ack.received[i] = uint8_t(_rxMap[i / 8] >> ((i % 8) * 8));
+    }
+
+    _rxUnacked = 0;
+
+    return ack;
+}
+
+/* -------------------------------------------------------------------------- */
+
+SelectiveArq::Clock::duration SelectiveArq::rto(unsigned retransmits) const noexcept
+{
+    // As TCP (RFC 6298), with a much lower floor, backed off exponentially
+    const int64_t us = _srttUs < 0 ? 10 * ARQ_MIN_RTO_MS * 1000 :
+                                     std::max<int64_t>(_srttUs + 4 * _rttvarUs, ARQ_MIN_RTO_MS * 1000);
+
+    return std::chrono::microseconds(us << std::min(retransmits, 6u));
+}
+
+/* -------------------------------------------------------------------------- */
+
+void SelectiveArq::retransmit(Outstanding &frame, Clock::time_point now, const Send &send)
+{
+    // A copy arriving after the deadline of its class would be useless
+    const auto deadline = QosPolicy::getInstance().getDeadline(frame.tc);
+    const auto halfRtt = std::chrono::microseconds(std::max<int64_t>(_srttUs, 0) / 2);
+
+    if (frame.retransmits >= ARQ_MAX_RETRANSMITS ||
+        (deadline.count() > 0 && now + halfRtt - frame.firstSentAt > deadline))
+    {
+        release(frame);
+        Metrics::add(*_metrics.abandoned, 1);
+        return;
+    }
+
+    ++frame.retransmits;
+    frame.sentAt = now;
+
+    send(frame.data.data(), frame.data.size(), frame.tc);
+    Metrics::add(*_metrics.retransmits, 1);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void SelectiveArq::release(Outstanding &frame) noexcept
+{
+    frame.inUse = false;
+    --_inflight;
+
+    _windowCond.notify_one();
+}
+
+/* -------------------------------------------------------------------------- */
+
+void SelectiveArq::onLoss(uint16_t seq) noexcept
+{
+    // Frames sent before the window was reduced were sent at the old rate
+    if (_recovering && seqDiff(seq, _recoverySeq) < 0)
+    {
+        return;
+    }
+
+    _ssthresh = std::max(_cwnd / 2, double(ARQ_MIN_CWND));
+    _cwnd = _ssthresh;
+    _recovering = true;
+    _recoverySeq = _nextSeq;
+
+    Metrics::set(*_metrics.cwnd, uint64_t(_cwnd));
+}
+
+/* -------------------------------------------------------------------------- */
+
+void SelectiveArq::rttSample(Clock::duration rtt) noexcept
+{
+    const int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(rtt).count();
+
+    if (_srttUs < 0)
+    {
+        _srttUs = us;
+        _rttvarUs = us / 2;
+    }
+    else
+    {
+        _rttvarUs = (3 * _rttvarUs + std::abs(_srttUs - us)) / 4;
+        _srttUs = (7 * _srttUs + us) / 8;
+    }
+
+    Metrics::set(*_metrics.srttUs, uint64_t(_srttUs));
+}
+
+/* -------------------------------------------------------------------------- */
+
+void SelectiveArq::advanceOldest() noexcept
+{
+    while (_oldest != _nextSeq && !_window[_oldest % ARQ_WINDOW].inUse)
+    {
+        ++_oldest;
+    }
+
+    if (_recovering && seqDiff(_oldest, _recoverySeq) >= 0)
+    {
+        _recovering = false;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void SelectiveArq::shiftRxMap(unsigned n) noexcept
+{
+    constexpr unsigned WORDS = ARQ_WINDOW / 64;
+
+    const unsigned words = n / 64;
+    const unsigned bits = n % 64;
+
+    for (unsigned w = WORDS; w-- > 0;)
+    {
+        uint64_t v = 0;
+
+        if (w >= words)
+        {
+            v = _rxMap[w - words] << bits;
+
+            if (bits > 0 && w > words)
+                v |= _rxMap[w - words - 1] >> (64 - bits);
+        }
+
+        _rxMap[w] = v;
+    }
+
+    // The previous highest frame, received
+    if (n - 1 < ARQ_WINDOW)
+    {
+        _rxMap[(n - 1) / 64] |= uint64_t(1) << ((n - 1) % 64);
+    }
+}
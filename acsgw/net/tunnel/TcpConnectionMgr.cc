@@ -1,7 +1,9 @@
 /* -------------------------------------------------------------------------- */
 
 #include "TcpConnectionMgr.h"
+#include "ThreadPolicy.h"
 #include <list>
+#include <sstream>
 
 
 /* -------------------------------------------------------------------------- */
@@ -11,7 +13,11 @@ bool TcpConnectionMgr::run()
     if (_server)
     {
         TRACE(LOG_DEBUG, "TcpConnectionMgr::run() TCP SERVER mode");
-        _listener = TcpListener::create();
+        _listener = TcpListener::create(_mptcp);
+
+        // Accepted connections inherit the buffers, the window scale
+        // announced in their SYN-ACK depends on the receive one
+        applySocketBuffers(*_listener);
 
         if (_localAddr.operator int() == 0)
         {
@@ -39,15 +45,217 @@ bool TcpConnectionMgr::run()
         TRACE(LOG_DEBUG, "TcpConnectionMgr::run() TCP CLIENT mode");
     }
 
-    _connectionMgrHandle =
-        std::make_unique<std::thread>(&TcpConnectionMgr::runConnectionManagerThread, this);
+    // Each subflow is handled by its own thread. In server mode every 
+    // thread accepts one of the connections opened by the remote client
+    for (auto &sf : _subflows)
+    {
+        sf->thread =
+            std::make_unique<std::thread>(&TcpConnectionMgr::runConnectionManagerThread, this, std::ref(*sf));
+    }
 
     return true;
 }
 
 /* -------------------------------------------------------------------------- */
 
-int TcpConnectionMgr::recv(char *buf, int bufSize, int timeoutSec)
+void TcpConnectionMgr::makeSubflows(size_t subflows)
+{
+    if (subflows < 1)
+        subflows = 1;
+    else if (subflows > MAX_TCP_SUBFLOWS)
+        subflows = MAX_TCP_SUBFLOWS;
+
+    for (size_t i = 0; i < subflows; ++i)
+    {
+        auto sf = std::make_unique<Subflow>();
+        sf->index = i;
+
+        // Only the first subflow uses the configured port, 
+        // the others are bound to an ephemeral one
+        sf->localPort = i == 0 ? _localPort : 0;
+
+        _subflows.push_back(std::move(sf));
+    }
+
+    // Class ceilings apply to the bearer as a whole
+    for (size_t i = 0; i < TRAFFIC_CLASS_COUNT; ++i)
+    {
+        const auto &policy = QosPolicy::getInstance().getClassPolicy(TrafficClass(i));
+
+        _classShapers[i].configure(policy.rate, policy.burst);
+
+        for (auto &sf : _subflows)
+            sf->outgoingMessageQueue.setShaper(TrafficClass(i), &_classShapers[i]);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TcpConnectionMgr::makeMetrics()
+{
+    std::stringstream ss;
+    ss << "tcp_bearer." << _localAddr.to_str() << ":" << _localPort;
+
+    if (!_server)
+        ss << "-" << _remoteAddr.to_str() << ":" << _remotePort;
+
+    const std::string prefix = ss.str();
+    auto &metrics = Metrics::getInstance();
+
+    _metrics.sentFrames = &metrics.get(prefix + ".sent_frames");
+    _metrics.expiredDrops = &metrics.get(prefix + ".expired_drops");
+    _metrics.budgetDrops = &metrics.get(prefix + ".budget_drops");
+    _metrics.sojournUsTotal = &metrics.get(prefix + ".sojourn_us_total");
+    _metrics.sojournUsMax = &metrics.get(prefix + ".sojourn_us_max");
+    _metrics.shapingDelays = &metrics.get(prefix + ".shaping_delays");
+    _metrics.mptcpConnections = &metrics.get(prefix + ".mptcp_connections");
+    _metrics.mptcpFallbacks = &metrics.get(prefix + ".mptcp_fallbacks");
+    _metrics.sendQueueBytes = &metrics.get(prefix + ".send_queue_bytes");
+    _metrics.sendQueueMax = &metrics.get(prefix + ".send_queue_max");
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TcpConnectionMgr::setBusyPoll(std::chrono::microseconds spinBudget) noexcept
+{
+    _spinBudget = spinBudget;
+
+    _inboundMessageQueue.setSpinBudget(spinBudget);
+
+    for (auto &sf : _subflows)
+        sf->outgoingMessageQueue.setSpinBudget(spinBudget);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TcpConnectionMgr::checkMptcp(Subflow &sf)
+{
+    if (!_mptcp)
+        return;
+
+    // Either end may lack MPTCP: the connection then is a plain TCP one
+    if (sf.socket->isMptcp())
+    {
+        Metrics::add(*_metrics.mptcpConnections, 1);
+        return;
+    }
+
+    Metrics::add(*_metrics.mptcpFallbacks, 1);
+
+    TRACE(LOG_WARNING, "[%p/%zu] TcpConnectionMgr::checkMptcp connection fell back to TCP", this, sf.index);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TcpConnectionMgr::applySocketBuffers(TransportSocket &socket)
+{
+    if (_rcvBuf > 0 && !socket.setBufferSize(true, _rcvBuf))
+        TRACE(LOG_WARNING, "[%p] TcpConnectionMgr::applySocketBuffers SO_RCVBUF not set: '%s'", this, strerror(errno));
+
+    if (_sndBuf > 0 && !socket.setBufferSize(false, _sndBuf))
+        TRACE(LOG_WARNING, "[%p] TcpConnectionMgr::applySocketBuffers SO_SNDBUF not set: '%s'", this, strerror(errno));
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TcpConnectionMgr::sampleSendQueue(Subflow &sf, Clock::time_point now)
+{
+    if (now - sf.queueSampledAt < std::chrono::milliseconds(SEND_QUEUE_SAMPLE_MS))
+        return;
+
+    sf.queueSampledAt = now;
+
+    const int bytes = sf.socket->sendQueueBytes();
+
+    if (bytes < 0)
+        return;
+
+    // Subflows share the metric, the latest sample wins
+    Metrics::set(*_metrics.sendQueueBytes, unsigned(bytes));
+    Metrics::updateMax(*_metrics.sendQueueMax, unsigned(bytes));
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TcpConnectionMgr::dropIfExpired(const Frame &frame, Subflow &sf)
+{
+    const auto now = Clock::now();
+
+    if (!frame.expired(now))
+        return false;
+
+    Metrics::add(*_metrics.expiredDrops, 1);
+
+    TRACE(LOG_DEBUG, "TcpConnectionMgr [%p/%zu] dropped a frame expired after %lli ms in queue", this, sf.index,
+          (long long)std::chrono::duration_cast<std::chrono::milliseconds>(now - frame.enqueuedAt).count());
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TcpConnectionMgr::markSocket(Subflow &sf, TrafficClass tc)
+{
+    // Only a class change costs a setsockopt()
+    if (sf.markedClass == int(tc))
+        return;
+
+    const auto &policy = QosPolicy::getInstance().getClassPolicy(tc);
+
+    if (!sf.socket->setTrafficMarking(policy.outerDscp, policy.socketPriority))
+    {
+        TRACE(LOG_WARNING, "TcpConnectionMgr [%p/%zu] cannot mark %s segments: '%s'", this, sf.index,
+              trafficClassName(tc), strerror(errno));
+    }
+
+    sf.markedClass = int(tc);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TcpConnectionMgr::sendMessage(
+    Buffer&& buf, size_t subflow, std::chrono::milliseconds deadline, TrafficClass tc)
+{
+    const size_t n = _subflows.size();
+    subflow %= n;
+
+    // Fail over to the next connected subflow (if any)
+    for (size_t i = 1; i < n && !_subflows[subflow]->connected; ++i)
+    {
+        const size_t next = (subflow + i) % n;
+
+        if (_subflows[next]->connected)
+        {
+            subflow = next;
+            break;
+        }
+    }
+
+    Frame frame;
+
+    // The caller is the TUN reader, so it can be held back if the
+    // gateway is running out of memory
+    frame.charge = MemoryGovernor::getInstance().admit(_outgoingBudget, buf.size(), tc, true);
+
+    if (frame.charge.bytes() == 0)
+    {
+        Metrics::add(*_metrics.budgetDrops, 1);
+        return false;
+    }
+
+    frame.data = std::move(buf);
+    frame.tc = tc;
+    frame.enqueuedAt = Clock::now();
+
+    if (deadline.count() > 0)
+        frame.expiresAt = frame.enqueuedAt + deadline;
+
+    return _subflows[subflow]->outgoingMessageQueue.push(std::move(frame), tc);
+}
+
+/* -------------------------------------------------------------------------- */
+
+int TcpConnectionMgr::recv(TcpSocket &socket, char *buf, int bufSize, int timeoutSec)
 {
     if (!buf || bufSize < 0)
         return -1;
@@ -62,8 +270,33 @@ int TcpConnectionMgr::recv(char *buf, int bufSize, int timeoutSec)
 
     while (left > 0)
     {
+        // In busy-poll mode, spin on non-blocking reads before select()
+        if (_spinBudget.count() > 0)
+        {
+            const auto deadline = Clock::now() + _spinBudget;
+            int rbytes = -1;
+
+            do
+            {
+                rbytes = socket.recv(buf + offset, left, MSG_DONTWAIT);
+            } while (rbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && Clock::now() < deadline);
+
+            if (rbytes == 0)
+                return offset;
+
+            if (rbytes > 0)
+            {
+                offset += rbytes;
+                left -= rbytes;
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return -1;
+        }
+
         std::chrono::seconds sec(timeoutSec);
-        auto recvEv = _connectionSocket->waitForRecvEvent(sec);
+        auto recvEv = socket.waitForRecvEvent(sec);
 
         bool timeout = false;
         switch (recvEv)
@@ -81,7 +314,7 @@ int TcpConnectionMgr::recv(char *buf, int bufSize, int timeoutSec)
             return offset;
         }
 
-        int rbytes = _connectionSocket->recv(buf + offset, left);
+        int rbytes = socket.recv(buf + offset, left);
 
         if (rbytes == 0)
             return offset;
@@ -105,7 +338,7 @@ int TcpConnectionMgr::recv(char *buf, int bufSize, int timeoutSec)
 
 /* -------------------------------------------------------------------------- */
 
-int TcpConnectionMgr::send(const char *buf, int bufSize)
+int TcpConnectionMgr::send(TcpSocket &socket, const char *buf, int bufSize)
 {
     if (!buf || bufSize < 0)
         return -1;
@@ -118,7 +351,7 @@ int TcpConnectionMgr::send(const char *buf, int bufSize)
 
     while (left > 0)
     {
-        int wbytes = _connectionSocket->send(buf + offset, left);
+        int wbytes = socket.send(buf + offset, left);
 
         if (wbytes == 0)
             return offset;
@@ -141,57 +374,87 @@ int TcpConnectionMgr::send(const char *buf, int bufSize)
 
 /* -------------------------------------------------------------------------- */
 
-void TcpConnectionMgr::runRecv()
+void TcpConnectionMgr::runRecv(Subflow &sf)
 {
     const char *threadType = _server ? "runRecv[Server]:" : "runRecv[Client]:";
-    TRACE(LOG_DEBUG, "%s [%p] TcpConnectionMgr::runRecv+", threadType, this);
+    ThreadPolicy::getInstance().apply(ThreadRole::Tcp, "tcp-rx");
+    TRACE(LOG_DEBUG, "%s [%p/%zu] TcpConnectionMgr::runRecv+", threadType, this, sf.index);
 
-    while (_connected)
+    TcpSocket &socket = *sf.socket;
+
+    while (sf.connected)
     {
         uint32_t len = 0;
-        int res = recv((char *)&len, sizeof(len), RECV_TIMEOUT);
+        int res = recv(socket, (char *)&len, sizeof(len), RECV_TIMEOUT);
 
         if (res == 0)
             continue;
 
-        if (res < sizeof(len))
+        // A socket error (res < 0) or a truncated header
+        if (res < int(sizeof(len)))
         {
-            TRACE(LOG_ERR, "%s [%p] TcpConnectionMgr::runRecv cannot read message header", threadType, this);
-            _connected = false;
+            TRACE(LOG_ERR, "%s [%p/%zu] TcpConnectionMgr::runRecv cannot read message header", threadType, this, sf.index);
+            sf.connected = false;
+            break;
         }
 
         len = ntohl(len);
 
-        TRACE(LOG_DEBUG, "%s [%p] TcpConnectionMgr::runRecv len=%u", threadType, this, len);
+        TRACE(LOG_DEBUG, "%s [%p/%zu] TcpConnectionMgr::runRecv len=%u", threadType, this, sf.index, len);
 
-        if (len > 0 && len < (128 * 1024))
+        // Keepalives have no payload, only the pktid: every frame is read
+        // whole, pktid included
+        if (len < (128 * 1024))
         {
-            Buffer buf(len + 8);
-            if (recv((char *)buf.data(), len + 8, RECV_TIMEOUT) < len)
+            InboundFrame frame;
+
+            // Stop reading the socket while the inbound queue is over
+            // budget, so that TCP flow control pushes back on the sender,
+            // until the consumer releases some of it
+            while (sf.connected)
+            {
+                frame.charge = MemoryGovernor::admitLocal(_inboundBudget, len + 8,
+                                                          std::chrono::milliseconds(INBOUND_WAIT_MS));
+
+                if (frame.charge.bytes() > 0)
+                    break;
+            }
+
+            if (!sf.connected)
+                break;
+
+            frame.data.resize(len + 8);
+
+            if (recv(socket, (char *)frame.data.data(), int(len + 8), RECV_TIMEOUT) < int(len + 8))
             {
-                TRACE(LOG_ERR, "%s [%p] TcpConnectionMgr::runRecv len=%u failed", threadType, this, len);
-                _connected = false;
+                TRACE(LOG_ERR, "%s [%p/%zu] TcpConnectionMgr::runRecv len=%u failed", threadType, this, sf.index, len);
+                sf.connected = false;
             }
             else {
-                _inboundMessageQueue.push(std::move(buf));
+                _inboundMessageQueue.push(std::move(frame));
             }
         }
         else
         {
-            TRACE(LOG_ERR, "%s [%p] TcpConnectionMgr::runRecv wrong len %ul", threadType, this, len);
-            _connected = false;
+            TRACE(LOG_ERR, "%s [%p/%zu] TcpConnectionMgr::runRecv wrong len %ul", threadType, this, sf.index, len);
+            sf.connected = false;
         }
     }
 
-    TRACE(LOG_DEBUG, "%s [%p] TcpConnectionMgr::runRecv-", threadType, this);
+    // Let the sender notice the connection is down without waiting 
+    // for the pop timeout
+    sf.outgoingMessageQueue.wakeAll();
+
+    TRACE(LOG_DEBUG, "%s [%p/%zu] TcpConnectionMgr::runRecv-", threadType, this, sf.index);
 }
 
 /* -------------------------------------------------------------------------- */
 
-void TcpConnectionMgr::runConnectionManagerThread()
+void TcpConnectionMgr::runConnectionManagerThread(Subflow &sf)
 {
     const char *threadType = _server ? "runConnectionManagerThread[Server]:" : "runConnectionManagerThread[Client]:";
-    std::list<Buffer> retryQueue;
+    ThreadPolicy::getInstance().apply(ThreadRole::Tcp, "tcp-tx");
+    std::list<Frame> retryQueue;
     bool bindOK = false;
     while (1)
     {
@@ -199,16 +462,19 @@ void TcpConnectionMgr::runConnectionManagerThread()
         {
             if (!bindOK) 
             {
-                _connectionSocket = TcpSocket::make(_remoteAddr.to_str(), _remotePort);
+                sf.socket = TcpSocket::make(_remoteAddr.to_str(), _remotePort, true, _mptcp);
             
-                assert(_connectionSocket);
+                assert(sf.socket);
+
+                // Before connecting, the window scale depends on the receive buffer
+                applySocketBuffers(*sf.socket);
 
                 if (_localAddr.operator int() == 0)
                 { 
-                    if (!_connectionSocket->bind(getLocalPort()))
+                    if (!sf.socket->bind(sf.localPort))
                     {
                         perror("bind");
-                        TRACE(LOG_ERR, "%s [%p] TcpConnectionMgr::runConnectionManagerThread bind on port %i error (bug?)", threadType, this, getLocalPort());
+                        TRACE(LOG_ERR, "%s [%p/%zu] TcpConnectionMgr::runConnectionManagerThread bind on port %i error (bug?)", threadType, this, sf.index, sf.localPort);
                         std::this_thread::sleep_for(std::chrono::milliseconds(CONNECT_RETRY_INTV));
                         continue;
                     }
@@ -217,11 +483,11 @@ void TcpConnectionMgr::runConnectionManagerThread()
                 else
                 {
                     const auto lAddr = getLocalAddr().to_str();
-                    if (!_connectionSocket->bind(lAddr, getLocalPort()))
+                    if (!sf.socket->bind(lAddr, sf.localPort))
                     {
                         perror("bind");
-                        TRACE(LOG_ERR, "%s [%p] TcpConnectionMgr::runConnectionManagerThread bind on %s:%i error (bug?)", threadType, this,
-                              lAddr.c_str(), getLocalPort());
+                        TRACE(LOG_ERR, "%s [%p/%zu] TcpConnectionMgr::runConnectionManagerThread bind on %s:%i error (bug?)", threadType, this, sf.index,
+                              lAddr.c_str(), sf.localPort);
                         std::this_thread::sleep_for(std::chrono::milliseconds(CONNECT_RETRY_INTV));
                         continue;
                     }
@@ -229,11 +495,11 @@ void TcpConnectionMgr::runConnectionManagerThread()
                 }
             }
 
-            if (!_connectionSocket->connect())
+            if (!sf.socket->connect())
             {
                 const auto rAddr = getRemoteAddr().to_str();
-                TRACE(LOG_ERR, "%s [%p] TcpConnectionMgr::runConnectionManagerThread could not connect to %s:%i, retrying...", 
-                   threadType, this, rAddr.c_str(), getRemotePort());
+                TRACE(LOG_ERR, "%s [%p/%zu] TcpConnectionMgr::runConnectionManagerThread could not connect to %s:%i, retrying...", 
+                   threadType, this, sf.index, rAddr.c_str(), getRemotePort());
                 
                 std::this_thread::sleep_for(std::chrono::milliseconds(CONNECT_RETRY_INTV));
                 continue;
@@ -242,71 +508,107 @@ void TcpConnectionMgr::runConnectionManagerThread()
         else 
         {
 
-            TRACE(LOG_DEBUG, "%s [%p] TcpConnectionMgr::runConnectionManagerThread _connectionSocket = _listener->accept()", threadType, this);
-            _connectionSocket = _listener->accept();
+            TRACE(LOG_DEBUG, "%s [%p/%zu] TcpConnectionMgr::runConnectionManagerThread sf.socket = _listener->accept()", threadType, this, sf.index);
+            sf.socket = _listener->accept();
 
-            assert (_connectionSocket);
+            assert (sf.socket);
         }
 
-        _connected = true;
+        if (_spinBudget.count() > 0 && !sf.socket->setBusyPoll(int(_spinBudget.count())))
+        {
+            TRACE(LOG_WARNING, "%s [%p/%zu] TcpConnectionMgr::runConnectionManagerThread SO_BUSY_POLL not set", threadType, this, sf.index);
+        }
 
-        TRACE(LOG_WARNING, "%s [%p] TcpConnectionMgr::runConnectionManagerThread connected to server", threadType, this);
+        checkMptcp(sf);
 
-        auto receiverThread = std::make_unique<std::thread>(&TcpConnectionMgr::runRecv, this);
+        sf.markedClass = -1;
+        sf.connected = true;
+
+        TRACE(LOG_WARNING, "%s [%p/%zu] TcpConnectionMgr::runConnectionManagerThread connected to server", threadType, this, sf.index);
+
+        auto receiverThread = std::make_unique<std::thread>(&TcpConnectionMgr::runRecv, this, std::ref(sf));
         assert (receiverThread);
 
-        while (_connected)
+        while (sf.connected)
         {
-            Buffer buf;
+            Frame frame;
+            bool retry = false;
+
             if (!retryQueue.empty())
             {
-                buf = retryQueue.front();
+                retry = true;
+                frame = std::move(retryQueue.front());
+                retryQueue.pop_front();
+
+                // The frame which failed may have expired while reconnecting
+                if (dropIfExpired(frame, sf))
+                {
+                    continue;
+                }
             }
-            else if (!_outgoingMessageQueue.pop(buf, RECV_TIMEOUT * 1000, [&]() { return !_connected; }))
+            else if (!sf.outgoingMessageQueue.pop(frame, RECV_TIMEOUT * 1000, [&]() { return !sf.connected; }))
             {
-                if (!_connected)
+                if (!sf.connected)
                    break;
 
-                TRACE(LOG_DEBUG, "%s [%p] TcpConnectionMgr::runConnectionManagerThread pop timeout (continue)", threadType, this);
+                TRACE(LOG_DEBUG, "%s [%p/%zu] TcpConnectionMgr::runConnectionManagerThread pop timeout (continue)", threadType, this, sf.index);
+                continue;
+            }
+            else if (dropIfExpired(frame, sf))
+            {
                 continue;
             }
 
+            // Segments already in the socket buffer keep their marking
+            markSocket(sf, frame.tc);
+
+            // A retried frame has already been paced
+            if (!retry && TokenBucket::pace(frame.size(), {&_shaper, _tunnelShaper.get()}))
+            {
+                Metrics::add(*_metrics.shapingDelays, 1);
+            }
+
+            Buffer &buf = frame.data;
+
             // receive a buffer with room for 4 bytes on the top (to put the msg len) 
             uint32_t len = htonl(buf.size() - 4 - 8);
 
             // put the message len on top of the message
             memcpy(buf.data(), (char*) &len, 4);
             
-            TRACE(LOG_DEBUG, "%s [%p] TcpConnectionMgr::runConnectionManagerThread sending a message", threadType, this);
+            TRACE(LOG_DEBUG, "%s [%p/%zu] TcpConnectionMgr::runConnectionManagerThread sending a message", threadType, this, sf.index);
 
             // send len + msg in one shot
-            if (send(buf.data(), buf.size()) != buf.size())
+            if (send(*sf.socket, buf.data(), int(buf.size())) != int(buf.size()))
             {
-                if (retryQueue.empty()) 
-                {
-                    retryQueue.push_front(buf);
-                }
-                TRACE(LOG_ERR, "%s [%p] TcpConnectionMgr::runConnectionManagerThread cannot send the message", threadType, this);
-                _connected = false;
+                retryQueue.push_front(std::move(frame));
+
+                TRACE(LOG_ERR, "%s [%p/%zu] TcpConnectionMgr::runConnectionManagerThread cannot send the message", threadType, this, sf.index);
+                sf.connected = false;
                 break;
             }
             else {
-                if (!retryQueue.empty())
-                {
-                    retryQueue.pop_front();
-                }
+                const auto now = Clock::now();
+                const uint64_t sojournUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                    now - frame.enqueuedAt).count();
+
+                Metrics::add(*_metrics.sentFrames, 1);
+                Metrics::add(*_metrics.sojournUsTotal, sojournUs);
+                Metrics::updateMax(*_metrics.sojournUsMax, sojournUs);
+
+                sampleSendQueue(sf, now);
             }
         }
 
-        TRACE(LOG_DEBUG, "%s [%p] TcpConnectionMgr::runConnectionManagerThread connection DOWN", threadType, this);
+        TRACE(LOG_DEBUG, "%s [%p/%zu] TcpConnectionMgr::runConnectionManagerThread connection DOWN", threadType, this, sf.index);
 
         bindOK = false;
 
         receiverThread->join();
-        _connectionSocket->shutdown();
-        _connectionSocket = nullptr;
+        sf.socket->shutdown();
+        sf.socket = nullptr;
 
-        TRACE(LOG_DEBUG, "%s [%p] TcpConnectionMgr::runConnectionManagerThread receiverThread->join() completed", threadType, this);
+        TRACE(LOG_DEBUG, "%s [%p/%zu] TcpConnectionMgr::runConnectionManagerThread receiverThread->join() completed", threadType, this, sf.index);
 
     }
 }
@@ -15,6 +15,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <memory.h>
+#include <poll.h>
+#include <errno.h>
 
 /* -------------------------------------------------------------------------- */
 
@@ -58,7 +60,7 @@ static bool assign_ip(const std::string &ifname, const std::string ip)
 
 /* -------------------------------------------------------------------------- */
 
-TunTap ::TunTap(const std::string &ifname, const std::string &ip, int flags)
+TunTap ::TunTap(const std::string &ifname, const std::string &ip, int flags) : _ifname(ifname)
 {
     _fd = open("/dev/net/tun", O_RDWR);
 
@@ -89,3 +91,74 @@ TunTap ::TunTap(const std::string &ifname, const std::string &ip, int flags)
         }
     }
 }
+
+/* -------------------------------------------------------------------------- */
+
+bool TunTap::setBusyPoll(std::chrono::microseconds spinBudget)
+{
+    int flags = fcntl(_fd, F_GETFL, 0);
+
+    if (flags < 0)
+        return false;
+
+    flags = spinBudget.count() > 0 ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+
+    if (fcntl(_fd, F_SETFL, flags) < 0)
+        return false;
+
+    _spinBudget = spinBudget;
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunTap::setMtu(int mtu)
+{
+    struct ifreq ifr;
+    int sd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (sd < 0)
+    {
+        return false;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, _ifname.c_str(), IFNAMSIZ - 1);
+    ifr.ifr_mtu = mtu;
+
+    const bool ret = ioctl(sd, SIOCSIFMTU, (void *)&ifr) == 0;
+
+    close(sd);
+
+    return ret;
+}
+
+/* -------------------------------------------------------------------------- */
+
+int TunTap::spinReadPacket(char *buf, size_t bufsize)
+{
+    const auto deadline = std::chrono::steady_clock::now() + _spinBudget;
+
+    while (true)
+    {
+        int n = read(_fd, buf, bufsize);
+
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            return n;
+
+        if (std::chrono::steady_clock::now() < deadline)
+            continue;
+
+        // Spin budget exhausted, block until the next packet
+        struct pollfd pfd = {_fd, POLLIN, 0};
+
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+            return -1;
+
+        n = read(_fd, buf, bufsize);
+
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            return n;
+    }
+}
@@ -9,7 +9,15 @@
 /* -------------------------------------------------------------------------- */
 
 #include "TunnelBuilder.h"
+#include "Gtp.h"
 #include "Logger.h"
+#include "RouteMgr.h"
+#include "TunnelRoutes.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
 
 /*
 Example of a valid configuration file content
@@ -46,6 +54,7 @@ multipath      ="mirroring" # Defines the algo used in case of multiple paths*/
 
 TunnelBuilder::TunnelBuilder(Config &cfg)
 {
+    _shared = parseSharedDevice(cfg);
     _tunnels = parseCfg(cfg);
     _vifmgr = std::make_shared<VirtualIfMgr>();
 }
@@ -56,6 +65,11 @@ bool TunnelBuilder::buildTunnels()
 {
     bool ret = true;
 
+    if (!_shared.name.empty() && !createSharedDevice())
+    {
+        return false;
+    }
+
     for (const auto &tunnel : *_tunnels)
     {
         if (!createTunnel(tunnel.first, tunnel.second))
@@ -78,13 +92,19 @@ bool TunnelBuilder::createTunnel(const std::string &ifname, const Tunnel &tunnel
         return false;
     }
 
+    // Tunnels of the shared device have no device of their own
+    const bool shared = !_shared.name.empty();
+    std::string cmd;
+
     // Remove any Kernel-managed old instance of this tunnel
-    std::string cmd{"ip tunnel del "};
-    cmd += ifname;
-    auto ret = ::system(cmd.c_str());
-    (void) ret;
+    if (!shared)
+    {
+        cmd = "ip tunnel del " + ifname;
+        auto ret = ::system(cmd.c_str());
+        (void) ret;
+    }
     // If the tunnel has just one bearer and it is GRE, try to create a Kernel managed GRE tunnel
-    if (tunnel.bearers.size() == 1 && tunnel.bearers.begin()->tunnelProtocol == TunnelProtocol::Gre)
+    if (!shared && tunnel.bearers.size() == 1 && tunnel.bearers.begin()->tunnelProtocol == TunnelProtocol::Gre)
     {
         TRACE(LOG_DEBUG, "%s %s", __FUNCTION__, cmd.c_str());
 
@@ -96,6 +116,7 @@ bool TunnelBuilder::createTunnel(const std::string &ifname, const Tunnel &tunnel
             " mode " + tunnel.type +
             " remote " + bearer.remoteAddress +
             " local " + bearer.localAddress +
+            (bearer.options.greKey.present ? " key " + std::to_string(bearer.options.greKey.value) : "") +
             " ttl 255";
 
         TRACE(LOG_DEBUG, "%s %s", __FUNCTION__, cmd.c_str());
@@ -140,6 +161,27 @@ bool TunnelBuilder::createTunnel(const std::string &ifname, const Tunnel &tunnel
                       ifname.c_str());
     }
 
+    for (const auto &bearer : tunnel.bearers)
+    {
+        if (bearer.options.mptcp)
+        {
+            configureMptcp(bearer);
+        }
+    }
+
+    _mpTunnelMgr.setTunnelPolicy(ifname, tunnel.policy);
+    _mpTunnelMgr.setTunnelMtu(ifname, tunnel.mtu);
+
+    if (tunnel.activeBackup)
+    {
+        _mpTunnelMgr.setActiveBackup(ifname, tunnel.backup);
+    }
+
+    if (tunnel.adaptive)
+    {
+        _mpTunnelMgr.setAdaptiveRedundancy(ifname, tunnel.redundancy);
+    }
+
     for (auto bearer : tunnel.bearers)
     {
         try
@@ -151,7 +193,10 @@ bool TunnelBuilder::createTunnel(const std::string &ifname, const Tunnel &tunnel
                         IpAddress(bearer.remoteAddress),
                         bearer.port,
                         bearer.port,
-                        bearer.tunnelProtocol),
+                        bearer.tunnelProtocol,
+                        bearer.options,
+                        bearer.name,
+                        bearer.slot),
                     _vifmgr))
             {
                 TRACE(LOG_WARNING, "%s cannot add a bearer (%s-%s) to '%s'",
@@ -160,7 +205,7 @@ bool TunnelBuilder::createTunnel(const std::string &ifname, const Tunnel &tunnel
                       bearer.remoteAddress.c_str(),
                       ifname.c_str());
             }
-            else {
+            else if (!shared) {
                 cmd =
                     "ifconfig " +
                     ifname +
@@ -191,12 +236,223 @@ bool TunnelBuilder::createTunnel(const std::string &ifname, const Tunnel &tunnel
         }
     }
 
+    if (shared)
+    {
+        addSharedRoutes(ifname, tunnel);
+    }
+
     return true;
 
 }
 
 /* -------------------------------------------------------------------------- */
 
+bool TunnelBuilder::createSharedDevice()
+{
+    if (!_vifmgr->setSharedDevice(_shared.name, _shared.queues))
+    {
+        TRACE(LOG_ERR, "%s cannot open the shared device '%s'", __FUNCTION__, _shared.name.c_str());
+        return false;
+    }
+
+    if (_shared.spinBudget.count() > 0 && !_vifmgr->setBusyPoll(_shared.name, _shared.spinBudget))
+    {
+        TRACE(LOG_WARNING, "%s cannot set busy-poll mode on the shared device '%s'", __FUNCTION__,
+              _shared.name.c_str());
+    }
+
+    const std::string cmd = "ip link set dev " + _shared.name + " up";
+
+    TRACE(LOG_DEBUG, "%s %s", __FUNCTION__, cmd.c_str());
+
+    if (::system(cmd.c_str()) != 0)
+    {
+        TRACE(LOG_ERR, "%s could not run %s", __FUNCTION__, cmd.c_str());
+        return false;
+    }
+
+    RouteMgr routeMgr;
+
+    for (const auto &route : _shared.routes)
+    {
+        uint32_t addr = 0;
+        unsigned len = 0;
+
+        if (!TunnelRouteTable::parsePrefix(route, addr, len))
+        {
+            TRACE(LOG_ERR, "%s invalid shared route '%s'", __FUNCTION__, route.c_str());
+            continue;
+        }
+
+        if (!routeMgr.add(IpAddress(addr), _shared.name, "/" + std::to_string(len)))
+        {
+            TRACE(LOG_WARNING, "%s cannot add the shared route '%s'", __FUNCTION__, route.c_str());
+            continue;
+        }
+
+        TunnelRouteTable::getInstance().addDeviceRoute(addr, len);
+    }
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TunnelBuilder::addSharedRoutes(const std::string &ifname, const Tunnel &tunnel)
+{
+    // The local address belongs to the gateway, the remote one and the
+    // tunnel routes are reached through the shared device
+    std::string cmd = "ip addr add " + tunnel.localAddress + "/32 dev " + _shared.name;
+
+    TRACE(LOG_DEBUG, "%s %s", __FUNCTION__, cmd.c_str());
+
+    if (::system(cmd.c_str()) != 0)
+    {
+        TRACE(LOG_DEBUG, "%s could not run %s", __FUNCTION__, cmd.c_str());
+    }
+
+    auto prefixes = tunnel.routes;
+    prefixes.push_front(tunnel.remoteAddress);
+
+    RouteMgr routeMgr;
+
+    for (const auto &prefix : prefixes)
+    {
+        uint32_t addr = 0;
+        unsigned len = 0;
+
+        if (!TunnelRouteTable::parsePrefix(prefix, addr, len))
+        {
+            TRACE(LOG_ERR, "%s invalid route '%s' of tunnel '%s'", __FUNCTION__, prefix.c_str(), ifname.c_str());
+            continue;
+        }
+
+        auto &routes = TunnelRouteTable::getInstance();
+        routes.add(addr, len, ifname);
+
+        // Kernel routes of the prefixes outside the shared routes only
+        if (routes.deviceCovers(addr, len))
+        {
+            continue;
+        }
+
+        if (!routeMgr.add(IpAddress(addr), _shared.name, "/" + std::to_string(len)))
+        {
+            TRACE(LOG_DEBUG, "%s cannot add the kernel route '%s' of tunnel '%s'", __FUNCTION__,
+                  prefix.c_str(), ifname.c_str());
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TunnelBuilder::configureMptcp(const Bearer &bearer)
+{
+    if (bearer.mptcpEndpoints.empty())
+    {
+        return;
+    }
+
+    // Endpoints are both announced to the peer (server side) and used to
+    // open further subflows (client side), so either end may use them
+    for (const auto &endpoint : bearer.mptcpEndpoints)
+    {
+        const std::string cmd = "ip mptcp endpoint add " + endpoint + " subflow signal";
+
+        TRACE(LOG_DEBUG, "%s %s", __FUNCTION__, cmd.c_str());
+
+        // Fails if another bearer has already added the endpoint
+        if (::system(cmd.c_str()) != 0)
+        {
+            TRACE(LOG_DEBUG, "%s endpoint %s of bearer '%s' not added", __FUNCTION__,
+                  endpoint.c_str(), bearer.name.c_str());
+        }
+    }
+
+    const std::string limit = std::to_string(std::min<size_t>(bearer.mptcpEndpoints.size(), MPTCP_MAX_ENDPOINTS));
+    const std::string cmd = "ip mptcp limits set subflow " + limit + " add_addr_accepted " + limit;
+
+    TRACE(LOG_DEBUG, "%s %s", __FUNCTION__, cmd.c_str());
+
+    if (::system(cmd.c_str()) != 0)
+    {
+        TRACE(LOG_WARNING, "%s cannot set the MPTCP limits of bearer '%s'", __FUNCTION__, bearer.name.c_str());
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+TunnelBuilder::SharedDevice TunnelBuilder::parseSharedDevice(const Config &cfg)
+{
+    SharedDevice shared;
+
+    cfg.selectNameSpace("tunnels");
+
+    shared.name = cfg.getAttr("shared_device");
+
+    if (shared.name.empty())
+    {
+        return shared;
+    }
+
+    shared.routes = cfg.getAttrList("shared_routes");
+
+    const auto queues = cfg.getAttr("shared_queues");
+
+    if (!queues.empty())
+    {
+        try
+        {
+            const long n = std::stol(queues);
+
+            if (n < 1 || n > VirtualIfMgr::MAX_QUEUES)
+            {
+                TRACE(LOG_ERR, "TunnelBuilder shared_queues out of range 1-%i", int(VirtualIfMgr::MAX_QUEUES));
+            }
+            else
+            {
+                shared.queues = size_t(n);
+            }
+        }
+        catch (...)
+        {
+            TRACE(LOG_DEBUG, "TunnelBuilder config syntax error in shared_queues format");
+        }
+    }
+
+    // The queues are read for every tunnel, so that busy-poll mode is a
+    // setting of the device rather than of its tunnels
+    if (cfg.getAttr("shared_busy_poll") == "yes")
+    {
+        long spinBudgetUs = 50;
+        const auto budget = cfg.getAttr("shared_spin_budget_us");
+
+        if (!budget.empty())
+        {
+            try
+            {
+                spinBudgetUs = std::stol(budget);
+            }
+            catch (...)
+            {
+                TRACE(LOG_DEBUG, "TunnelBuilder config syntax error in shared_spin_budget_us format");
+            }
+
+            if (spinBudgetUs < 1 || spinBudgetUs > 65535)
+            {
+                TRACE(LOG_ERR, "TunnelBuilder shared_spin_budget_us out of range 1-65535");
+                spinBudgetUs = 50;
+            }
+        }
+
+        shared.spinBudget = std::chrono::microseconds(spinBudgetUs);
+    }
+
+    return shared;
+}
+
+/* -------------------------------------------------------------------------- */
+
 TunnelBuilder::LookupTblHandler TunnelBuilder::parseCfg(const Config &cfg)
 {
     LookupTbl tunnel_map;
@@ -207,18 +463,18 @@ TunnelBuilder::LookupTblHandler TunnelBuilder::parseCfg(const Config &cfg)
     auto getNum = [&](
                       const Config::ConfigNamespacedParagraph &nsp,
                       const std::string &fieldName,
-                      int minVal, int maxVal,
-                      uint16_t &retVal)
+                      long minVal, long maxVal,
+                      auto &retVal)
     {
         auto nsit = nsp.find(fieldName);
         if (nsit != nsp.end())
         {
             try
             {
-                int n = std::stoi(nsit->second.first);
+                long n = std::stol(nsit->second.first);
                 if (n >= minVal && n <= maxVal)
                 {
-                    retVal = uint16_t(n);
+                    retVal = std::decay_t<decltype(retVal)>(n);
                 }
             }
             catch (...)
@@ -228,31 +484,193 @@ TunnelBuilder::LookupTblHandler TunnelBuilder::parseCfg(const Config &cfg)
         }
     };
 
+    // <prefix>rate_kbps = N, <prefix>burst_kb = N (rate in bytes per second)
+    auto getRate = [&](
+                       const Config::ConfigNamespacedParagraph &nsp,
+                       const std::string &prefix,
+                       uint64_t &rate, size_t &burst)
+    {
+        uint32_t rateKbps = 0;
+        uint32_t burstKb = 0;
+        getNum(nsp, prefix + "rate_kbps", 0, INT32_MAX, rateKbps);
+        getNum(nsp, prefix + "burst_kb", 0, INT32_MAX, burstKb);
+
+        rate = uint64_t(rateKbps) * 1000 / 8;
+        burst = burstKb > 0 ? size_t(burstKb) * 1024 : TokenBucket::defaultBurst(rate);
+    };
+
     for (const auto &tunnel : listOfTunnels)
     {
         auto it = cfg.data().find(tunnel);
         uint16_t nPort = 28774; // default
+        bool portSet = false;
+        uint32_t localTeid = 0;
+        uint32_t remoteTeid = 0;
+        GreSocket::Key greKey;
+        uint16_t spinBudgetUs = 50;
+        uint16_t tunnelMtu = 0; // automatic
+        uint16_t reassemblyTimeoutMs = REASSEMBLY_TIMEOUT_MS;
+        uint16_t reassemblyMaxPackets = REASSEMBLY_MAX_PACKETS;
+        uint16_t keepaliveMs = KEEPALIVE_INTV_MS;
+        uint16_t deadMs = BEARER_DEAD_INTV_MS;
+        uint32_t holdDownMs = FAILBACK_HOLD_MS;
+        uint16_t replayPackets = REPLAY_MAX_PACKETS;
+        uint16_t feedbackMs = FEEDBACK_INTV_MS;
+        uint32_t selectiveLossPpm = SELECTIVE_LOSS_PPM;
+        uint32_t mirroringLossPpm = MIRRORING_LOSS_PPM;
+        uint16_t mirroringRttMs = 0;
+        uint32_t adaptHoldMs = ADAPT_HOLD_MS;
+        std::shared_ptr<TokenBucket> tunnelShaper;
 
         if (it != cfg.data().end())
         {
             const auto &namespace_data = it->second;
             getNum(namespace_data, "port", 1, 65535, nPort);
+            portSet = namespace_data.find("port") != namespace_data.end();
+            getNum(namespace_data, "local_teid", 0, UINT32_MAX, localTeid);
+            getNum(namespace_data, "remote_teid", 0, UINT32_MAX, remoteTeid);
+
+            greKey.present = namespace_data.find("gre_key") != namespace_data.end();
+            getNum(namespace_data, "gre_key", 0, UINT32_MAX, greKey.value);
+            getNum(namespace_data, "spin_budget_us", 1, 65535, spinBudgetUs);
+            getNum(namespace_data, "mtu", TUN_MIN_MTU, 65535, tunnelMtu);
+            getNum(namespace_data, "reassembly_timeout_ms", 1, 60000, reassemblyTimeoutMs);
+            getNum(namespace_data, "reassembly_max_packets", 1, 65535, reassemblyMaxPackets);
+            getNum(namespace_data, "keepalive_ms", KEEPALIVE_TICK_MS, 60000, keepaliveMs);
+            getNum(namespace_data, "dead_ms", KEEPALIVE_TICK_MS, 60000, deadMs);
+            getNum(namespace_data, "hold_down_ms", 0, 3600000, holdDownMs);
+            getNum(namespace_data, "replay_packets", 0, 65535, replayPackets);
+            getNum(namespace_data, "feedback_ms", KEEPALIVE_TICK_MS, 60000, feedbackMs);
+            getNum(namespace_data, "selective_loss_ppm", 0, 1000000, selectiveLossPpm);
+            getNum(namespace_data, "mirroring_loss_ppm", 0, 1000000, mirroringLossPpm);
+            getNum(namespace_data, "mirroring_rtt_ms", 0, 60000, mirroringRttMs);
+            getNum(namespace_data, "adapt_hold_ms", 0, 3600000, adaptHoldMs);
+
+            // A single bucket shapes the traffic of all the tunnel bearers
+            uint64_t rate = 0;
+            size_t burst = 0;
+            getRate(namespace_data, "", rate, burst);
+
+            if (rate > 0)
+            {
+                tunnelShaper = std::make_shared<TokenBucket>(rate, burst);
+            }
         }
 
         cfg.selectNameSpace(tunnel);
+
+        // Busy-poll mode applies to every bearer of the tunnel
+        const bool busyPoll = cfg.getAttr("busy_poll") == "yes";
+
         Tunnel &tunnel_data = tunnel_map[tunnel];
         tunnel_data.localAddress = cfg.getAttr("local_address");
         tunnel_data.remoteAddress = cfg.getAttr("remote_address");
         const auto &type = cfg.getAttr("type");
         tunnel_data.type = type.empty() ? "gre" : type; // if type is not def set gre
         auto bearers = cfg.getAttrList("bearers");
+        tunnel_data.routes = cfg.getAttrList("routes");
 
         tunnel_data.port = nPort;
+        tunnel_data.mtu.fixed = tunnelMtu;
+        tunnel_data.mtu.mssClamp = cfg.getAttr("mss_clamp") != "no";
+        tunnel_data.mtu.fragmentation = cfg.getAttr("fragmentation") == "yes";
+        tunnel_data.mtu.reassemblyTimeout = std::chrono::milliseconds(reassemblyTimeoutMs);
+        tunnel_data.mtu.reassemblyMaxPackets = reassemblyMaxPackets;
+
+        if (!parseMultipathMode(cfg.getAttr("multipath"), tunnel_data.multipath))
+        {
+            TRACE(LOG_ERR, "TunnelBuilder unknown multipath mode of tunnel '%s'", tunnel.c_str());
+        }
+
+        if (bearers.size() > MAX_TUNNEL_BEARERS)
+        {
+            TRACE(LOG_ERR, "TunnelBuilder tunnel '%s' has more than %i bearers", tunnel.c_str(), MAX_TUNNEL_BEARERS);
+            bearers.resize(MAX_TUNNEL_BEARERS);
+        }
+
+        PathPolicy defaultPath;
+        defaultPath.mode = tunnel_data.multipath;
+
+        if (!parseDelayedCopy(cfg, tunnel, bearers, defaultPath))
+        {
+            TRACE(LOG_ERR, "TunnelBuilder invalid delayed copy settings of tunnel '%s'", tunnel.c_str());
+        }
+
+        tunnel_data.policy = parsePolicies(cfg, tunnel, bearers, defaultPath);
+
+        // Either the tunnel or some of its services may use active-backup
+        // or adaptive redundancy
+        auto usesMode = [&](MultipathMode mode) {
+            return tunnel_data.policy &&
+                (tunnel_data.policy->defaultPath.mode == mode ||
+                 std::any_of(tunnel_data.policy->paths.begin(), tunnel_data.policy->paths.end(),
+                             [mode](const PathPolicy &path) { return path.mode == mode; }));
+        };
+
+        tunnel_data.activeBackup = usesMode(MultipathMode::ActiveBackup);
+        tunnel_data.adaptive = usesMode(MultipathMode::Adaptive);
+
+        cfg.selectNameSpace(tunnel);
+
+        if (deadMs <= keepaliveMs)
+        {
+            TRACE(LOG_ERR, "TunnelBuilder dead_ms of tunnel '%s' is not above keepalive_ms", tunnel.c_str());
+            deadMs = uint16_t(std::min(3 * keepaliveMs, 60000));
+        }
+
+        tunnel_data.backup.keepaliveInterval = std::chrono::milliseconds(keepaliveMs);
+        tunnel_data.backup.deadInterval = std::chrono::milliseconds(deadMs);
+        tunnel_data.backup.preempt = cfg.getAttr("preempt") != "no";
+        tunnel_data.backup.holdDown = std::chrono::milliseconds(holdDownMs);
+        tunnel_data.backup.replayPackets = replayPackets;
+
+        if (mirroringLossPpm < selectiveLossPpm)
+        {
+            TRACE(LOG_ERR, "TunnelBuilder mirroring_loss_ppm of tunnel '%s' is below selective_loss_ppm", tunnel.c_str());
+            mirroringLossPpm = selectiveLossPpm;
+        }
+
+        tunnel_data.redundancy.feedbackInterval = std::chrono::milliseconds(feedbackMs);
+        tunnel_data.redundancy.selectiveLossPpm = selectiveLossPpm;
+        tunnel_data.redundancy.mirroringLossPpm = mirroringLossPpm;
+        tunnel_data.redundancy.mirroringRtt = std::chrono::milliseconds(mirroringRttMs);
+        tunnel_data.redundancy.holdDown = std::chrono::milliseconds(adaptHoldMs);
+
+        // duplicate_classes = "list" of traffic class names
+        const auto duplicateClasses = cfg.getAttrList("duplicate_classes");
+
+        if (!duplicateClasses.empty())
+        {
+            tunnel_data.redundancy.duplicateClasses = 0;
+
+            for (const auto &className : duplicateClasses)
+            {
+                size_t i = 0;
+
+                while (i < TRAFFIC_CLASS_COUNT && className != trafficClassName(TrafficClass(i)))
+                {
+                    ++i;
+                }
+
+                if (i == TRAFFIC_CLASS_COUNT)
+                {
+                    TRACE(LOG_ERR, "TunnelBuilder unknown traffic class '%s' of tunnel '%s'",
+                          className.c_str(), tunnel.c_str());
+                    continue;
+                }
+
+                tunnel_data.redundancy.duplicateClasses |= 1u << i;
+            }
+        }
+
+        size_t slot = 0;
 
         for (const auto &bearer : bearers)
         {
             cfg.selectNameSpace(bearer);
             Bearer bearer_data;
+            bearer_data.name = bearer;
+            bearer_data.slot = slot++;
             bearer_data.localAddress = cfg.getAttr("local_address");
             bearer_data.remoteAddress = cfg.getAttr("remote_address");
 
@@ -264,16 +682,149 @@ TunnelBuilder::LookupTblHandler TunnelBuilder::parseCfg(const Config &cfg)
             {
                 bearer_data.tunnelProtocol = TunnelProtocol::Tcp;
             }
+            else if (protocol_type == "mptcp")
+            {
+                // TCP connections the kernel spreads over several paths
+                bearer_data.tunnelProtocol = TunnelProtocol::Tcp;
+                bearer_data.options.mptcp = true;
+                bearer_data.mptcpEndpoints = cfg.getAttrList("mptcp_endpoints");
+            }
             else if (protocol_type == "udp")
             {
                 bearer_data.tunnelProtocol = TunnelProtocol::Udp;
             }
+            else if (protocol_type == "rudp")
+            {
+                // UDP with selective retransmission of the lost frames
+                bearer_data.tunnelProtocol = TunnelProtocol::Udp;
+                bearer_data.options.reliable = true;
+            }
+            else if (protocol_type == "gtp")
+            {
+                bearer_data.tunnelProtocol = TunnelProtocol::Gtp;
+            }
             else
             {
                 bearer_data.tunnelProtocol = TunnelProtocol::Gre;
             }
 
-            bearer_data.port = nPort;
+            // GTP-U peers expect the standard port
+            const bool gtp = bearer_data.tunnelProtocol == TunnelProtocol::Gtp;
+            bearer_data.port = gtp && !portSet ? GTP1U_PORT : nPort;
+            bearer_data.options.localTeid = localTeid;
+            bearer_data.options.remoteTeid = remoteTeid;
+            bearer_data.options.greKey = greKey;
+
+            auto bit = cfg.data().find(bearer);
+
+            if (bit != cfg.data().end())
+            {
+                uint16_t subflows = 1;
+                getNum(bit->second, "subflows", 1, MAX_TCP_SUBFLOWS, subflows);
+                bearer_data.options.subflows = subflows;
+
+                uint16_t rxShards = 1;
+                getNum(bit->second, "rx_shards", 1, MAX_RX_SHARDS, rxShards);
+                bearer_data.options.rxShards = rxShards;
+
+                uint16_t queueBudgetKb = DEFAULT_QUEUE_BUDGET_KB;
+                getNum(bit->second, "queue_budget_kb", 1, 65535, queueBudgetKb);
+                bearer_data.options.queueBudget = size_t(queueBudgetKb) * 1024;
+
+                uint32_t rcvBufKb = 0;
+                uint32_t sndBufKb = 0;
+                getNum(bit->second, "rcvbuf_kb", 0, SOCKBUF_MAX_KB, rcvBufKb);
+                getNum(bit->second, "sndbuf_kb", 0, SOCKBUF_MAX_KB, sndBufKb);
+                bearer_data.options.rcvBuf = size_t(rcvBufKb) * 1024;
+                bearer_data.options.sndBuf = size_t(sndBufKb) * 1024;
+
+                auto &options = bearer_data.options;
+                getRate(bit->second, "", options.rate, options.burst);
+                getRate(bit->second, "police_", options.policeRate, options.policeBurst);
+
+                // Bearers may use their own TEIDs
+                getNum(bit->second, "local_teid", 0, UINT32_MAX, options.localTeid);
+                getNum(bit->second, "remote_teid", 0, UINT32_MAX, options.remoteTeid);
+
+                if (bit->second.find("gre_key") != bit->second.end())
+                {
+                    options.greKey.present = true;
+                    getNum(bit->second, "gre_key", 0, UINT32_MAX, options.greKey.value);
+                }
+            }
+
+            if (gtp && (bearer_data.options.localTeid == 0 || bearer_data.options.remoteTeid == 0))
+            {
+                TRACE(LOG_ERR, "TunnelBuilder GTP bearer '%s' has no local_teid/remote_teid", bearer.c_str());
+            }
+
+            if (cfg.getAttr("subflow_dispatch") == "class")
+            {
+                bearer_data.options.subflowDispatch = SubflowDispatch::Class;
+            }
+
+            // Departure times are honoured by the fq qdisc of the egress device
+            if (cfg.getAttr("txtime") == "yes")
+            {
+                bearer_data.options.txTime = bearer_data.tunnelProtocol != TunnelProtocol::Tcp;
+            }
+
+            // Any acsgw peer takes bundles, GTP and GRE ones do not.
+            // Bundles do not start with an inner packet, so that receive
+            // shards cannot steer them by flow: the peer of a sharded
+            // bearer (configured alike) would reorder its flows
+            if (cfg.getAttr("bundle") == "yes")
+            {
+                bearer_data.options.bundling = bearer_data.tunnelProtocol == TunnelProtocol::Udp;
+
+                if (bearer_data.options.bundling && bearer_data.options.rxShards > 1)
+                {
+                    TRACE(LOG_WARNING, "TunnelBuilder bearer '%s' has rx_shards, bundle ignored", bearer.c_str());
+                    bearer_data.options.bundling = false;
+                }
+            }
+
+            // TCP buffers are left to the kernel autotuning
+            if (cfg.getAttr("socket_buffers") == "auto")
+            {
+                bearer_data.options.autoBuffers = bearer_data.tunnelProtocol != TunnelProtocol::Tcp;
+            }
+
+            bearer_data.options.busyPoll = busyPoll;
+            bearer_data.options.spinBudget = std::chrono::microseconds(spinBudgetUs);
+            bearer_data.options.tunnelShaper = tunnelShaper;
+
+            if (tunnel_data.activeBackup)
+            {
+                bearer_data.options.keepaliveInterval = tunnel_data.backup.keepaliveInterval;
+                bearer_data.options.deadInterval = tunnel_data.backup.deadInterval;
+            }
+
+            if (tunnel_data.adaptive)
+            {
+                bearer_data.options.feedbackInterval = tunnel_data.redundancy.feedbackInterval;
+            }
+
+            // Congestion control needs frequent reports, which the adaptive
+            // redundancy (if any) takes too
+            if (cfg.getAttr("congestion_control") == "yes")
+            {
+                const auto protocol = bearer_data.tunnelProtocol;
+                auto &options = bearer_data.options;
+
+                if ((protocol == TunnelProtocol::Udp && !options.reliable) || protocol == TunnelProtocol::Gre)
+                {
+                    const auto ccInterval = std::chrono::milliseconds(CC_FEEDBACK_INTV_MS);
+
+                    options.congestionControl = true;
+                    options.feedbackInterval = options.feedbackInterval.count() > 0 ?
+                        std::min(options.feedbackInterval, ccInterval) : ccInterval;
+                }
+                else
+                {
+                    TRACE(LOG_ERR, "TunnelBuilder bearer '%s' has no congestion control (UDP and GRE only)", bearer.c_str());
+                }
+            }
 
             tunnel_data.bearers.push_back(std::move(bearer_data));
         }
@@ -281,3 +832,172 @@ TunnelBuilder::LookupTblHandler TunnelBuilder::parseCfg(const Config &cfg)
 
     return std::make_shared<LookupTbl>(std::move(tunnel_map));
 }
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelBuilder::parseMultipathMode(const std::string &text, MultipathMode &mode)
+{
+    if (text.empty() || text == "mirroring")
+    {
+        mode = MultipathMode::Mirroring;
+    }
+    else if (text == "balanced")
+    {
+        mode = MultipathMode::Balanced;
+    }
+    else if (text == "active-backup")
+    {
+        mode = MultipathMode::ActiveBackup;
+    }
+    else if (text == "adaptive")
+    {
+        mode = MultipathMode::Adaptive;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+TunnelPolicy::Handle TunnelBuilder::parsePolicies(
+    const Config &cfg, const std::string &tunnel,
+    const std::list<std::string> &bearers, const PathPolicy &defaultPath)
+{
+    cfg.selectNameSpace(tunnel);
+    const auto policies = cfg.getAttrList("policies");
+
+    if (policies.empty() && defaultPath.mode == MultipathMode::Mirroring && defaultPath.copyDelay.count() == 0)
+    {
+        return nullptr;
+    }
+
+    auto policy = std::make_shared<TunnelPolicy>();
+    policy->defaultPath = defaultPath;
+
+    std::vector<PolicyClassifier::Rule> rules;
+
+    for (const auto &name : policies)
+    {
+        auto it = cfg.data().find(name);
+
+        if (it == cfg.data().end())
+        {
+            TRACE(LOG_ERR, "TunnelBuilder policy '%s' of tunnel '%s' not found", name.c_str(), tunnel.c_str());
+            continue;
+        }
+
+        PolicyClassifier::Rule rule;
+
+        if (!PolicyClassifier::parseRule(it->second, rule))
+        {
+            TRACE(LOG_ERR, "TunnelBuilder config syntax error in policy '%s'", name.c_str());
+            continue;
+        }
+
+        cfg.selectNameSpace(name);
+
+        // Services take the tunnel settings they do not override
+        PathPolicy path = defaultPath;
+
+        if (!parseMultipathMode(cfg.getAttr("multipath"), path.mode))
+        {
+            TRACE(LOG_ERR, "TunnelBuilder unknown multipath mode of policy '%s'", name.c_str());
+            continue;
+        }
+
+        if (!parseDelayedCopy(cfg, name, bearers, path))
+        {
+            TRACE(LOG_ERR, "TunnelBuilder invalid delayed copy settings of policy '%s'", name.c_str());
+            continue;
+        }
+
+        // bearers = "list", by default all of the tunnel bearers
+        const auto pathBearers = cfg.getAttrList("bearers");
+        bool validPath = true;
+
+        if (!pathBearers.empty())
+        {
+            path.bearers = 0;
+
+            for (const auto &bearer : pathBearers)
+            {
+                const auto slot = std::find(bearers.begin(), bearers.end(), bearer);
+
+                if (slot == bearers.end())
+                {
+                    TRACE(LOG_ERR, "TunnelBuilder policy '%s' refers to bearer '%s', not part of tunnel '%s'",
+                          name.c_str(), bearer.c_str(), tunnel.c_str());
+                    validPath = false;
+                    break;
+                }
+
+                path.bearers |= uint64_t(1) << std::distance(bearers.begin(), slot);
+            }
+        }
+
+        if (validPath)
+        {
+            rules.push_back(std::move(rule));
+            policy->paths.push_back(path);
+        }
+    }
+
+    policy->classifier = PolicyClassifier(rules);
+
+    TRACE(LOG_NOTICE, "TunnelBuilder compiled %zu policies of tunnel '%s'", rules.size(), tunnel.c_str());
+
+    return policy;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelBuilder::parseDelayedCopy(
+    const Config &cfg, const std::string &name,
+    const std::list<std::string> &bearers, PathPolicy &path)
+{
+    cfg.selectNameSpace(name);
+
+    // copy_delay_ms = N
+    const auto delay = cfg.getAttr("copy_delay_ms");
+
+    if (!delay.empty())
+    {
+        long ms = -1;
+
+        try
+        {
+            ms = std::stol(delay);
+        }
+        catch (...)
+        {
+        }
+
+        if (ms < 0 || ms > COPY_MAX_DELAY_MS)
+        {
+            return false;
+        }
+
+        path.copyDelay = std::chrono::milliseconds(ms);
+    }
+
+    // copy_bearer = "name", by default the bearer the packet is sent on
+    const auto bearer = cfg.getAttr("copy_bearer");
+
+    if (!bearer.empty())
+    {
+        const auto slot = std::find(bearers.begin(), bearers.end(), bearer);
+
+        if (slot == bearers.end())
+        {
+            return false;
+        }
+
+        path.copyBearer = int(std::distance(bearers.begin(), slot));
+    }
+
+    return true;
+}
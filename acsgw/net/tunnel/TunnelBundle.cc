@@ -0,0 +1,143 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "TunnelBundle.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+constexpr size_t ENTRY_HEADER_LEN = sizeof(uint16_t);
+constexpr size_t PKTID_LEN = sizeof(uint64_t);
+
+// Smallest entry: IPv4 header and pktid
+constexpr size_t MIN_ENTRY_LEN = ENTRY_HEADER_LEN + 20 + PKTID_LEN;
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+TunnelBundle::TunnelBundle(size_t maxLen) : _maxLen(maxLen)
+{
+    _data.reserve(maxLen);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelBundle::bundleable(const char *frame, size_t len) noexcept
+{
+    if (len <= PKTID_LEN || len > BUNDLE_MAX_PACKET_LEN + PKTID_LEN)
+    {
+        return false;
+    }
+
+    uint64_t pktid = 0;
+    memcpy(&pktid, frame + len - PKTID_LEN, sizeof(pktid));
+
+    return getFrameKind(pktid) == FrameKind::Packet;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelBundle::add(const char *frame, size_t len)
+{
+    if (_data.size() + ENTRY_HEADER_LEN + len + PKTID_LEN > _maxLen)
+    {
+        return false;
+    }
+
+    const uint16_t entryLen = htons(uint16_t(len));
+    const char *header = (const char *)&entryLen;
+
+    _data.insert(_data.end(), header, header + ENTRY_HEADER_LEN);
+    _data.insert(_data.end(), frame, frame + len);
+    ++_count;
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelBundle::full() const noexcept
+{
+    return _data.size() + MIN_ENTRY_LEN + PKTID_LEN > _maxLen;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TunnelBundle::finish(Buffer &datagram)
+{
+    const uint64_t pktid = makeFramePktId(0, FrameKind::Bundle);
+    const char *trailer = (const char *)&pktid;
+
+    _data.insert(_data.end(), trailer, trailer + PKTID_LEN);
+
+    datagram = std::move(_data);
+
+    _data.clear();
+    _count = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelUnbundler::load(const char *payload, size_t len)
+{
+    // Every entry must be whole, or none is taken
+    for (size_t offset = 0; offset < len;)
+    {
+        uint16_t entryLen = 0;
+
+        if (len - offset < ENTRY_HEADER_LEN)
+        {
+            return false;
+        }
+
+        memcpy(&entryLen, payload + offset, sizeof(entryLen));
+        entryLen = ntohs(entryLen);
+
+        if (entryLen <= PKTID_LEN || len - offset - ENTRY_HEADER_LEN < entryLen)
+        {
+            return false;
+        }
+
+        offset += ENTRY_HEADER_LEN + entryLen;
+    }
+
+    _data.assign(payload, payload + len);
+    _next = 0;
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+int TunnelUnbundler::next(char *buf, size_t size) noexcept
+{
+    if (_next >= _data.size())
+    {
+        return -1;
+    }
+
+    uint16_t entryLen = 0;
+    memcpy(&entryLen, _data.data() + _next, sizeof(entryLen));
+    entryLen = ntohs(entryLen);
+
+    const char *entry = _data.data() + _next + ENTRY_HEADER_LEN;
+    _next += ENTRY_HEADER_LEN + entryLen;
+
+    const size_t len = std::min(size_t(entryLen), size);
+    memcpy(buf, entry, len);
+
+    return int(len);
+}
@@ -0,0 +1,163 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "TunnelFragment.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+#include <iterator>
+
+/* -------------------------------------------------------------------------- */
+
+TunnelReassembler::TunnelReassembler(const std::string &name,
+                                     std::chrono::milliseconds timeout,
+                                     size_t maxPackets) : _timeout(timeout),
+                                                          _maxPackets(std::max<size_t>(maxPackets, 1))
+{
+    const std::string prefix = "tunnel." + name;
+    auto &metrics = Metrics::getInstance();
+
+    _metrics.reassembled = &metrics.get(prefix + ".reassembled_packets");
+    _metrics.timeouts = &metrics.get(prefix + ".reassembly_timeouts");
+    _metrics.evictions = &metrics.get(prefix + ".reassembly_evictions");
+    _metrics.malformed = &metrics.get(prefix + ".malformed_fragments");
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelReassembler::add(uint64_t seq, const char *frame, size_t len, Buffer &packet)
+{
+    FragmentHeader header;
+
+    if (len <= sizeof(header))
+    {
+        Metrics::add(*_metrics.malformed, 1);
+        return false;
+    }
+
+    memcpy(&header, frame, sizeof(header));
+
+    const uint32_t offset = ntohs(header.offset);
+    const uint32_t length = ntohs(header.length);
+    const uint32_t sliceLen = uint32_t(len - sizeof(header));
+
+    if (length == 0 || offset + sliceLen > length)
+    {
+        Metrics::add(*_metrics.malformed, 1);
+        return false;
+    }
+
+    const auto now = Clock::now();
+    std::lock_guard<std::mutex> cs(_lock);
+
+    // Entries are in creation order, so the expired ones are at the front
+    while (!_entries.empty() && _entries.front().expiresAt <= now)
+    {
+        TRACE(LOG_DEBUG, "TunnelReassembler dropped incomplete packet %llu",
+              (unsigned long long)_entries.front().seq);
+
+        erase(_entries.begin());
+        Metrics::add(*_metrics.timeouts, 1);
+    }
+
+    // Late copies of the fragments of a delivered packet (i.e. mirrored
+    // on a slower bearer) must not start a new one
+    if (_completed.count(seq) > 0)
+    {
+        return false;
+    }
+
+    auto it = _index.find(seq);
+    Entries::iterator entry;
+
+    if (it != _index.end())
+    {
+        entry = it->second;
+
+        if (entry->data.size() != length)
+        {
+            Metrics::add(*_metrics.malformed, 1);
+            return false;
+        }
+    }
+    else
+    {
+        if (_entries.size() >= _maxPackets)
+        {
+            erase(_entries.begin());
+            Metrics::add(*_metrics.evictions, 1);
+        }
+
+        entry = _entries.emplace(_entries.end());
+        entry->seq = seq;
+        entry->expiresAt = now + _timeout;
+        entry->data.resize(length);
+
+        _index.emplace(seq, entry);
+    }
+
+    memcpy(entry->data.data() + offset, frame + sizeof(header), sliceLen);
+
+    if (!cover(entry->ranges, offset, offset + sliceLen, length))
+    {
+        return false;
+    }
+
+    packet = std::move(entry->data);
+    erase(entry);
+
+    _completed.insert(seq);
+    _completedHistory.push_back(seq);
+
+    if (_completedHistory.size() > 2 * _maxPackets)
+    {
+        _completed.erase(_completedHistory.front());
+        _completedHistory.pop_front();
+    }
+
+    Metrics::add(*_metrics.reassembled, 1);
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TunnelReassembler::erase(Entries::iterator it)
+{
+    _index.erase(it->seq);
+    _entries.erase(it);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelReassembler::cover(Ranges &ranges, uint32_t first, uint32_t last, uint32_t length)
+{
+    // Ranges are kept sorted and disjoint; a packet has a few of them
+    auto it = std::lower_bound(ranges.begin(), ranges.end(), std::make_pair(first, first));
+
+    if (it != ranges.begin() && std::prev(it)->second >= first)
+        --it;
+
+    auto end = it;
+
+    while (end != ranges.end() && end->first <= last)
+    {
+        first = std::min(first, end->first);
+        last = std::max(last, end->second);
+        ++end;
+    }
+
+    it = ranges.erase(it, end);
+    ranges.insert(it, std::make_pair(first, last));
+
+    return ranges.size() == 1 && ranges.front().first == 0 && ranges.front().second == length;
+}
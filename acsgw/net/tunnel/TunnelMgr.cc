@@ -9,19 +9,114 @@
 /* -------------------------------------------------------------------------- */
 
 #include "MpTunnel.h"
+#include "ActiveBackup.h"
+#include "AdaptiveRedundancy.h"
 #include "VirtualIfMgr.h"
 #include "GreSocket.h"
+#include "GtpU.h"
 #include "TcpSocket.h"
 #include "UdpSocket.h"
 #include "Logger.h"
 #include "TcpListener.h"
 #include "IpPacketParser.h"
+#include "QosPolicy.h"
+#include "ThreadPolicy.h"
+#include "Tools.h"
+#include "TunnelRoutes.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <string>
 #include <sstream>
 #include <map>
 #include <memory>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+// Polls a non-blocking receive function until it returns data or
+// the spin budget is exhausted
+template <class RecvFunc>
+static int spinRecv(RecvFunc recvFunc, std::chrono::microseconds spinBudget)
+{
+   const auto deadline = std::chrono::steady_clock::now() + spinBudget;
+   int n = -1;
+
+   do
+   {
+      n = recvFunc();
+   } while (n < 0 && std::chrono::steady_clock::now() < deadline);
+
+   return n;
+}
+
+/* -------------------------------------------------------------------------- */
+
+// Datagrams read at once from a UDP socket, then consumed one by one
+class UdpRecvBatch
+{
+public:
+   UdpRecvBatch() : _data(BEARER_RX_BATCH * SLOT_SIZE)
+   {
+   }
+
+   // Reads the datagrams queued on the socket, returns false if none
+   bool fill(const UdpSocket &socket, int flags) noexcept
+   {
+      iovec buffers[BEARER_RX_BATCH];
+
+      for (size_t i = 0; i < BEARER_RX_BATCH; ++i)
+      {
+         buffers[i].iov_base = _data.data() + i * SLOT_SIZE;
+         buffers[i].iov_len = SLOT_SIZE;
+      }
+
+      const int n = socket.recvBatch(buffers, _lens, _srcAddrs, _srcPorts, BEARER_RX_BATCH, flags, &_kernelDrops);
+
+      _count = n > 0 ? size_t(n) : 0;
+      _next = 0;
+
+      return _count > 0;
+   }
+
+   // Datagrams the kernel has dropped on the socket since the last call
+   uint32_t newDrops() noexcept
+   {
+      const uint32_t drops = _kernelDrops - _kernelDropsRead;
+      _kernelDropsRead = _kernelDrops;
+
+      return drops;
+   }
+
+   // Copies the next datagram into buf, returns its length (-1 if none is left)
+   int next(char *buf, size_t size, IpAddress &srcAddr, UdpSocket::PortType &srcPort) noexcept
+   {
+      if (_next >= _count)
+         return -1;
+
+      const size_t i = _next++;
+      const size_t len = std::min(size_t(_lens[i]), size);
+
+      memcpy(buf, _data.data() + i * SLOT_SIZE, len);
+      srcAddr = _srcAddrs[i];
+      srcPort = _srcPorts[i];
+
+      return int(len);
+   }
+
+private:
+   static constexpr size_t SLOT_SIZE = VirtualIfMgr::MAX_PKT_SIZE;
+
+   std::vector<char> _data;
+   int _lens[BEARER_RX_BATCH] = {0};
+   IpAddress _srcAddrs[BEARER_RX_BATCH];
+   UdpSocket::PortType _srcPorts[BEARER_RX_BATCH] = {0};
+   size_t _count = 0;
+   size_t _next = 0;
+   uint32_t _kernelDrops = 0; // counter of the socket (SO_RXQ_OVFL)
+   uint32_t _kernelDropsRead = 0;
+};
 
 /* -------------------------------------------------------------------------- */
 
@@ -46,6 +141,42 @@ bool TunnelPath::makeGreSocket() noexcept
       return false;
    }
 
+   // Packets are received by the GRE demultiplexer of the local address,
+   // the bearer socket only sends: connected to the peer, the kernel
+   // does not even consider it for the packets of the other GRE peers
+   if (!_greSocket->connect(_remoteAddr) || !_greSocket->setSendOnly())
+   {
+      TRACE(LOG_WARNING, "%s GRE socket not made send-only: '%s'", __FUNCTION__, strerror(errno));
+   }
+
+   _greReceiver = GreDemux::registerBearer(
+      _localAddr, _remoteAddr, _options.greKey,
+      _options.busyPoll ? _options.spinBudget : std::chrono::microseconds(0),
+      _options.rcvBuf, _options.autoBuffers ? size_t(SOCKBUF_MAX_KB) * 1024 : 0);
+
+   if (!_greReceiver)
+   {
+      TRACE(LOG_ERR, "%s cannot receive GRE packets from %s", __FUNCTION__, _remoteAddr.to_str().c_str());
+
+      return false;
+   }
+
+   if (!_greSocket->setDontFragment())
+   {
+      TRACE(LOG_WARNING, "%s DF bit not set: '%s'", __FUNCTION__, strerror(errno));
+   }
+
+   // Without it frames are paced by the sender
+   if (_options.txTime && !(_txTime = _greSocket->setTxTime()))
+   {
+      TRACE(LOG_WARNING, "%s SO_TXTIME not set: '%s'", __FUNCTION__, strerror(errno));
+   }
+
+   setSocketBuffers(true, _options.rcvBuf);
+   setSocketBuffers(false, _options.sndBuf);
+
+   makeTxQueue();
+
    return true;
 }
 
@@ -62,14 +193,26 @@ bool TunnelPath::makeTcpConnection() noexcept
             _localAddr.to_str().c_str(), _localPort, 
             _remoteAddr.to_str().c_str(), _remotePort); 
 
-      _tcpConnectionMgr = std::make_shared<TcpConnectionMgr>(_localAddr, _localPort, _remoteAddr, _remotePort);
+      _tcpConnectionMgr = std::make_shared<TcpConnectionMgr>(
+         _localAddr, _localPort, _remoteAddr, _remotePort, _options.subflows);
    }
    else
    {
       TRACE(LOG_DEBUG, ">>> %s creating server listener for %s:%i", __FUNCTION__,
             _localAddr.to_str().c_str(), _localPort);
 
-      _tcpConnectionMgr = std::make_shared<TcpConnectionMgr>(_localAddr, _localPort);
+      _tcpConnectionMgr = std::make_shared<TcpConnectionMgr>(
+         _localAddr, _localPort, _options.subflows);
+   }
+
+   _tcpConnectionMgr->setQueueBudget(_options.queueBudget);
+   _tcpConnectionMgr->setShaping(_options.rate, _options.burst, _options.tunnelShaper);
+   _tcpConnectionMgr->setMptcp(_options.mptcp);
+   _tcpConnectionMgr->setSocketBuffers(_options.rcvBuf, _options.sndBuf);
+
+   if (_options.busyPoll)
+   {
+      _tcpConnectionMgr->setBusyPoll(_options.spinBudget);
    }
 
    return _tcpConnectionMgr->run();
@@ -77,27 +220,130 @@ bool TunnelPath::makeTcpConnection() noexcept
 
 /* -------------------------------------------------------------------------- */
 
+// Reuseport program spreading the datagrams of a bearer over shards
+// sockets by inner flow. The packets of a flow must all hash alike: only
+// TCP/UDP packets with DF set (which are never fragmented) hash on IPv4
+// addresses and ports, any other packet (a fragment or a packet that
+// could be fragmented) on addresses only. The inner packet is at
+// payloadOffset of the UDP payload; anything else (i.e. tunnel
+// fragments) goes to shard 0.
+static std::vector<sock_filter> makeShardFilter(uint32_t payloadOffset, uint32_t shards)
+{
+   const uint32_t o = payloadOffset;
+
+   return {
+      /*  0 */ BPF_STMT(BPF_LD | BPF_B | BPF_ABS, o),
+      /*  1 */ BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xf0),
+      /*  2 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x40, 0, 25),    // IPv4, else 28
+      /*  3 */ BPF_STMT(BPF_LD | BPF_W | BPF_ABS, o + 12),          // source
+      /*  4 */ BPF_STMT(BPF_MISC | BPF_TAX, 0),
+      /*  5 */ BPF_STMT(BPF_LD | BPF_W | BPF_ABS, o + 16),          // destination
+      /*  6 */ BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+      /*  7 */ BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x9e3779b1),
+      /*  8 */ BPF_STMT(BPF_ST, 0),
+      /*  9 */ BPF_STMT(BPF_LD | BPF_B | BPF_ABS, o + 9),           // protocol
+      /* 10 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, 1, 0),
+      /* 11 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 9), // else 21
+      /* 12 */ BPF_STMT(BPF_LD | BPF_H | BPF_ABS, o + 6),           // DF/MF/offset
+      /* 13 */ BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x7fff),
+      /* 14 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x4000, 0, 6),    // DF only, else 21
+      /* 15 */ BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, o),              // header length
+      /* 16 */ BPF_STMT(BPF_LD | BPF_W | BPF_IND, o),               // ports
+      /* 17 */ BPF_STMT(BPF_MISC | BPF_TAX, 0),
+      /* 18 */ BPF_STMT(BPF_LD | BPF_MEM, 0),
+      /* 19 */ BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+      /* 20 */ BPF_STMT(BPF_ST, 0),
+      /* 21 */ BPF_STMT(BPF_LD | BPF_MEM, 0),                       // mix the hash
+      /* 22 */ BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 0x85ebca6b),
+      /* 23 */ BPF_STMT(BPF_MISC | BPF_TAX, 0),
+      /* 24 */ BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 16),
+      /* 25 */ BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+      /* 26 */ BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, shards),
+      /* 27 */ BPF_STMT(BPF_RET | BPF_A, 0),
+      /* 28 */ BPF_STMT(BPF_RET | BPF_K, 0)
+   };
+}
+
+/* -------------------------------------------------------------------------- */
+
 bool TunnelPath::makeUdpSocket() noexcept
 {
-   _udpSocket = std::make_unique<UdpSocket>();
+   const size_t shards = std::max<size_t>(1, std::min<size_t>(_options.rxShards, MAX_RX_SHARDS));
+
+   for (size_t i = 0; i < shards; ++i)
+   {
+      auto socket = std::make_shared<UdpSocket>();
+
+      if (!socket || !socket->isValid())
+      {
+         TRACE(LOG_ERR, "%s failed due an invalid socket", __FUNCTION__);
+
+         return false;
+      }
+
+      // Shards share the bearer address and port
+      if (shards > 1 && !socket->setReusePort())
+      {
+         TRACE(LOG_ERR, "%s SO_REUSEPORT not set: '%s'", __FUNCTION__, strerror(errno));
+
+         return false;
+      }
+
+      if (!socket->bind(_localPort, _localAddr, true /* reuse addr */))
+      {
+         TRACE(LOG_ERR, "%s bind(%s) failed with error: '%s'", __FUNCTION__,
+               _localAddr.to_str().c_str(), strerror(errno));
+
+         return false;
+      }
+
+      if (_options.busyPoll && !socket->setBusyPoll(int(_options.spinBudget.count())))
+      {
+         TRACE(LOG_WARNING, "%s SO_BUSY_POLL not set: '%s'", __FUNCTION__, strerror(errno));
+      }
+
+      // Received datagrams tell how many the kernel has dropped
+      if (!socket->setRxQueueOverflow())
+      {
+         TRACE(LOG_WARNING, "%s SO_RXQ_OVFL not set: '%s'", __FUNCTION__, strerror(errno));
+      }
 
-   assert(_udpSocket);
+      _udpShards.push_back(std::move(socket));
+   }
+
+   // The first shard also transmits
+   _udpSocket = _udpShards.front();
 
-   if (!_udpSocket || !_udpSocket->isValid())
+   if (shards > 1)
    {
-      TRACE(LOG_ERR, "%s failed due an invalid socket", __FUNCTION__);
+      const uint32_t payloadOffset = _protocol == TunnelProtocol::Gtp ? uint32_t(GtpU::LONG_HEADER_LEN) : 0;
+      auto filter = makeShardFilter(payloadOffset, uint32_t(shards));
+      const sock_fprog prog = { (unsigned short)filter.size(), filter.data() };
 
-      return false;
+      // Without the program the kernel spreads datagrams by their
+      // outer addresses, so they would all go to the same shard
+      if (!_udpSocket->attachReusePortFilter(prog))
+      {
+         TRACE(LOG_WARNING, "%s reuseport steering not attached: '%s'", __FUNCTION__, strerror(errno));
+      }
    }
 
-   if (!_udpSocket->bind(_localPort, _localAddr, true /* reuse addr */))
+   if (!_udpSocket->setDontFragment())
    {
-      TRACE(LOG_ERR, "%s bind(%s) failed with error: '%s'", __FUNCTION__,
-            _localAddr.to_str().c_str(), strerror(errno));
+      TRACE(LOG_WARNING, "%s DF bit not set: '%s'", __FUNCTION__, strerror(errno));
+   }
 
-      return false;
+   // Without it frames are paced by the sender
+   if (_options.txTime && !(_txTime = _udpSocket->setTxTime()))
+   {
+      TRACE(LOG_WARNING, "%s SO_TXTIME not set: '%s'", __FUNCTION__, strerror(errno));
    }
 
+   setSocketBuffers(true, _options.rcvBuf);
+   setSocketBuffers(false, _options.sndBuf);
+
+   makeTxQueue();
+
    return true;
 }
 
@@ -106,211 +352,1297 @@ bool TunnelPath::makeUdpSocket() noexcept
 TunnelPath::TunnelPath(const TunnelPath::Bearer &tp) : _localAddr(tp.localAddress()),
                                                        _remoteAddr(tp.remoteAddr()),
                                                        _localPort(tp.localPort()),
-                                                       _remotePort(tp.remotePort())
+                                                       _remotePort(tp.remotePort()),
+                                                       _protocol(tp.getTunnelProtocol()),
+                                                       _options(tp.options()),
+                                                       _name(tp.name()),
+                                                       _slot(tp.slot())
 {
+   _shaper.configure(_options.rate, _options.burst);
+   _policer.configure(_options.policeRate, _options.policeBurst);
+
+   const std::string prefix = "bearer." + (_name.empty() ? std::string(*this) : _name);
+   auto &metrics = Metrics::getInstance();
+
+   _metrics.shapingDelays = &metrics.get(prefix + ".shaping_delays");
+   _metrics.policedDrops = &metrics.get(prefix + ".policed_drops");
+   _metrics.pathMtu = &metrics.get(prefix + ".path_mtu");
+   _metrics.fragmentedPackets = &metrics.get(prefix + ".fragmented_packets");
+   _metrics.badChecksums = &metrics.get(prefix + ".bad_checksums");
+   _metrics.lossPpm = &metrics.get(prefix + ".loss_ppm");
+   _metrics.rttUs = &metrics.get(prefix + ".rtt_us");
+   _metrics.delayedCopies = &metrics.get(prefix + ".delayed_copies");
+   _metrics.delayedCopyDrops = &metrics.get(prefix + ".delayed_copy_drops");
+   _metrics.expiredDrops = &metrics.get(prefix + ".expired_drops");
+   _metrics.bundles = &metrics.get(prefix + ".bundles");
+   _metrics.bundledPackets = &metrics.get(prefix + ".bundled_packets");
+   _metrics.rxKernelDrops = &metrics.get(prefix + ".rx_kernel_drops");
+   _metrics.sendQueueBytes = &metrics.get(prefix + ".send_queue_bytes");
+   _metrics.sendQueueMax = &metrics.get(prefix + ".send_queue_max");
+   _metrics.rcvBufBytes = &metrics.get(prefix + ".rcvbuf_bytes");
+   _metrics.sndBufBytes = &metrics.get(prefix + ".sndbuf_bytes");
+
+   if (_options.reliable && _protocol == TunnelProtocol::Udp)
+   {
+      _arq = std::make_unique<SelectiveArq>(prefix);
+   }
+   else if (_options.congestionControl && measured() &&
+            (_protocol == TunnelProtocol::Udp || _protocol == TunnelProtocol::Gre))
+   {
+      _cc = std::make_unique<CongestionControl>(prefix, _options.feedbackInterval);
+   }
 }
 
 /* -------------------------------------------------------------------------- */
 
-int MpTunnelMgr::tunnelRecvThreadFunc(
-    const std::string &name,
-    MpTunnelMgr *tmPtr,
-    std::shared_ptr<VirtualIfMgr> vifPtr,
-    TunnelPath::Handle tpPtr)
+void TunnelPath::setSocketBuffers(bool receive, size_t bytes) noexcept
 {
-   assert(tmPtr);
-   assert(vifPtr);
+   // The GRE receive socket belongs to the demultiplexer
+   if (receive && _protocol == TunnelProtocol::Gre)
+      return;
 
-   try
+   int size = -1;
+
+   if (_greSocket)
    {
-      TunnelPath &tp = *tpPtr;
+      if (bytes > 0 && !_greSocket->setBufferSize(receive, bytes))
+         TRACE(LOG_WARNING, "%s socket buffer not set: '%s'", __FUNCTION__, strerror(errno));
 
-      // Manager will wait for unloking the mutex
-      // while thread is terminanting
-      struct tunnelLockGrd
+      size = _greSocket->bufferSize(receive);
+   }
+   else if (_udpSocket)
+   {
+      for (const auto &socket : _udpShards)
       {
-         TunnelPath &_t;
+         if (bytes > 0 && !socket->setBufferSize(receive, bytes))
+            TRACE(LOG_WARNING, "%s socket buffer not set: '%s'", __FUNCTION__, strerror(errno));
 
-         tunnelLockGrd(TunnelPath &t) : _t(t)
-         {
-            _t.lock();
-         }
+         // Only the first shard transmits
+         if (!receive)
+            break;
+      }
 
-         ~tunnelLockGrd() { _t.unlock(); }
-      } grd(tp);
+      size = _udpSocket->bufferSize(receive);
+   }
 
-      char buf[VirtualIfMgr::MAX_PKT_SIZE] = {0};
+   if (bytes > 0)
+      (receive ? _rcvBuf : _sndBuf) = bytes;
 
-      // TODO improve this
-      static Ip4DupDetector ip4DupDetector;
+   Metrics::set(receive ? *_metrics.rcvBufBytes : *_metrics.sndBufBytes, uint64_t(std::max(size, 0)));
+}
 
-      while (true)
-      {
-         if (tp.removeReqPending())
-         {
-            return 0;
-         }
+/* -------------------------------------------------------------------------- */
 
-         struct timeval timeout = {0};
-         timeout.tv_usec = 0;
-         timeout.tv_sec = 5;
+void TunnelPath::sampleSockets(Clock::time_point now) noexcept
+{
+   if (!_greSocket && !_udpSocket)
+      return;
 
-         TRACE(LOG_NOTICE, "%s %s", __FUNCTION__, "Waiting for packets");
-         int payloadOffset = 0;
-         IpAddress remoteAddr;
-         size_t rbytescnt = 0;
-         int socketType = 0;
+   const int64_t nowTicks = now.time_since_epoch().count();
+   int64_t sampledAt = _sampledAt;
 
-         if (tp.getGreSocket())
-         {
-            GreSocket::PollingState pollst = tp.getGreSocket()->poll(timeout);
+   // A single thread samples at a time
+   if (nowTicks - sampledAt < Clock::duration(std::chrono::milliseconds(SOCKBUF_SAMPLE_MS)).count() ||
+       !_sampledAt.compare_exchange_strong(sampledAt, nowTicks))
+   {
+      return;
+   }
 
-            if (pollst == GreSocket::PollingState::TIMEOUT_EXPIRED)
-               continue;
-            else if (pollst == GreSocket::PollingState::ERROR_IN_COMMUNICATION)
-               return -1;
+   const int sendQueue = _greSocket ? _greSocket->sendQueueBytes() : _udpSocket->sendQueueBytes();
 
-            payloadOffset = 0;
+   if (sendQueue >= 0)
+   {
+      Metrics::set(*_metrics.sendQueueBytes, unsigned(sendQueue));
+      Metrics::updateMax(*_metrics.sendQueueMax, unsigned(sendQueue));
+   }
 
-            rbytescnt = tp.getGreSocket()->recvfrom(buf, sizeof(buf), remoteAddr, payloadOffset);
+   if (!_options.autoBuffers)
+      return;
 
-            socketType = 1;
-         }
-         else if (tp.getUdpSocket())
-         {
-            UdpSocket::PollingState pollst = tp.getUdpSocket()->poll(timeout);
+   constexpr size_t MAX_BUFFER = size_t(SOCKBUF_MAX_KB) * 1024;
 
-            if (pollst == UdpSocket::PollingState::TIMEOUT_EXPIRED)
-               continue;
-            else if (pollst == UdpSocket::PollingState::ERROR_IN_COMMUNICATION)
-               return -1;
+   // The kernel reports twice the size requested, which covers its overhead
+   const auto requested = [this](bool receive) {
+      const int size = _greSocket ? _greSocket->bufferSize(receive) : _udpSocket->bufferSize(receive);
+      return std::max(receive ? _rcvBuf : _sndBuf, size_t(std::max(size, 0)) / 2);
+   };
 
-            payloadOffset = 0; // no additional header for now
-            UdpSocket::PortType remotePort = 0;
+   // The receive buffer holds twice the bytes received in a round trip,
+   // and doubles while the kernel drops datagrams
+   if (_udpSocket)
+   {
+      const uint64_t elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(
+         Clock::duration(nowTicks - sampledAt)).count();
+      const uint64_t rxBytes = _rxBytes;
+      const uint64_t kernelDrops = _rxKernelDrops;
 
-            rbytescnt = tp.getUdpSocket()->recvfrom(buf, sizeof(buf), remoteAddr, remotePort);
+      const uint64_t rxRate = elapsedUs > 0 ? (rxBytes - _rxBytesSampled) * 1000000 / elapsedUs : 0;
+      const int64_t rttUs = measured() && _feedback.rttUs() > 0 ? _feedback.rttUs() : int64_t(SOCKBUF_RTT_MS) * 1000;
+      const size_t current = requested(true);
 
-            socketType = 2;
-         }
-         else if (tp.getTcpConnMgr())
-         {
-            TcpConnectionMgr::Buffer msg;
-            if (!tp.getTcpConnMgr()->recvMessage(msg, timeout.tv_sec * 1000)) {
-               // timeout expired
-               continue;           
-            }
-            
-            rbytescnt = msg.size();
-            
-            if (msg.size()>0) {
-               memcpy(buf, msg.data(), rbytescnt);
-            }
-            
-            payloadOffset = 0; // no additional header for now
+      size_t target = size_t(2 * rxRate * uint64_t(rttUs) / 1000000);
 
-            socketType = 3;
-         }
-         else
-         {
-            TRACE(LOG_ERR,
-            "%s TCP connection invalid, (tpPtr=%p) "
-            "related to the tunnel for ndd %s",
-            __FUNCTION__, tpPtr, name.c_str());
-            return -1;      
-         }
+      if (kernelDrops != _rxKernelDropsSampled)
+         target = std::max(target, current * 2);
 
-         if (rbytescnt > 0)
-         {
-            uint64_t pktid = 0;
-            
-            if (socketType >1 ) 
-            {
-               memcpy((char*) &pktid, buf+rbytescnt-sizeof(sizeof(pktid)), sizeof(pktid));
-               rbytescnt -= sizeof(pktid);
-            }
-            
-            IpPacketParser ipParser(buf + payloadOffset, rbytescnt);
+      _rxBytesSampled = rxBytes;
+      _rxKernelDropsSampled = kernelDrops;
 
-            ipParser.dump(std::cout);
+      if (std::min(target, MAX_BUFFER) > current)
+         setSocketBuffers(true, std::min(target, MAX_BUFFER));
+   }
 
-            const auto packetDuplicated = (socketType<2 && ipParser.isIcmp() && ip4DupDetector.isADuplicated(ipParser)) ||
-                                          socketType>1 && ip4DupDetector.isADuplicated(pktid);
+   // The send buffer doubles once the queue fills half of it
+   const size_t current = requested(false);
 
-            /// DEBUG ONLY
-            /// std::stringstream ss;
-            /// ss << pktid << std::endl;
-            /// auto pktids = ss.str();
-            /// TRACE(LOG_NOTICE, "**** %s PACKET id=%08x from %s to ndd %s (pktid=%s)",
-            ///         __FUNCTION__, ipParser.getIdent(), std::string(remoteAddr).c_str(), name.c_str(), pktids.c_str());
+   if (sendQueue >= 0 && size_t(sendQueue) > current && current < MAX_BUFFER)
+      setSocketBuffers(false, std::min(current * 2, MAX_BUFFER));
+}
 
-            if (packetDuplicated)
-            {
-               TRACE(LOG_NOTICE, "%s discarded DUP PACKET id=%08x from %s to ndd %s",
-                     __FUNCTION__, ipParser.getIdent(), std::string(remoteAddr).c_str(), name.c_str());
-            }
-            else {
-               vifPtr->announcePacket(name.c_str(), buf + payloadOffset, rbytescnt);
+/* -------------------------------------------------------------------------- */
 
-               TRACE(LOG_NOTICE, "%s announced packet from %s to ndd %s",
-                     __FUNCTION__, std::string(remoteAddr).c_str(), name.c_str());
-            }
-         }
-         else if (rbytescnt == 0)
-         {
-            TRACE(LOG_ERR,
-                  "%s timeout (it's ok) & continue while NO packets in this (timeout) interval from "
-                  "tunnel for ndd %s",
-                  __FUNCTION__, name.c_str());
-         }
-         else
-         {
-            TRACE(LOG_ERR,
-                  "%s failed receiving packet from "
-                  "tunnel for ndd %s",
-                  __FUNCTION__, name.c_str());
+void TunnelPath::makeTxQueue()
+{
+   _txBudget.setLimit(_options.queueBudget);
+   _txQueue = std::make_unique<TxQueue>(BEARER_TX_QUEUE_LEN, QosPolicy::getInstance().getQuanta());
 
-            return -1;
-         }
-      }
-   }
-   catch (Exception)
+   if (_options.busyPoll)
    {
-      TRACE(LOG_ERR,
-         "%s detected an unmanaged exception handling the tunnel (tpPtr=%p) for ndd %s",
-         __FUNCTION__, tpPtr, name.c_str());
-      return -1;
+      _txQueue->setSpinBudget(_options.spinBudget);
    }
-   catch (...)
+
+   // Per class rate ceilings
+   for (size_t i = 0; i < TRAFFIC_CLASS_COUNT; ++i)
    {
-      TRACE(LOG_ERR,
-         "%s detected an unknown exception handling the tunnel (tpPtr=%p) for ndd %s",
-         __FUNCTION__, tpPtr, name.c_str());
-      assert(0);
-   }
+      const auto &policy = QosPolicy::getInstance().getClassPolicy(TrafficClass(i));
 
-   return 0;
+      _classShapers[i].configure(policy.rate, policy.burst);
+      _txQueue->setShaper(TrafficClass(i), &_classShapers[i]);
+   }
 }
 
 /* -------------------------------------------------------------------------- */
 
-int MpTunnelMgr::tunnelXmitThreadFunc(
-    MpTunnelMgr *tmPtr,
-    std::shared_ptr<VirtualIfMgr> vifPtr)
+bool TunnelPath::queueFrame(const char *header, size_t headerLen,
+                            const char *payload, size_t len, TrafficClass tc)
 {
-   assert(tmPtr);
-   assert(vifPtr);
+   if (!_txQueue)
+      return false;
 
-   std::string if_name;
+   TxFrame txFrame;
 
-   uint64_t pktid = 0;
+   // The caller is the TUN reader, so it can be held back if the
+   // gateway is running out of memory
+   txFrame.charge = MemoryGovernor::getInstance().admit(_txBudget, headerLen + len, tc, true);
 
-   try
-   {
-      while (true)
-      {
-         char buf[VirtualIfMgr::MAX_PKT_SIZE + 8] = {0};
+   if (txFrame.charge.bytes() == 0)
+      return false;
 
-         // GRE Header with protocol type 0x0800
+   txFrame.data.reserve(headerLen + len);
+   txFrame.data.assign(header, header + headerLen);
+   txFrame.data.insert(txFrame.data.end(), payload, payload + len);
+   txFrame.tc = tc;
+   txFrame.queuedAt = Clock::now();
+
+   return _txQueue->push(std::move(txFrame), tc);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelPath::queueFragments(const char *packet, size_t len, uint64_t pktid, TrafficClass tc)
+{
+   constexpr int MIN_FRAGMENT_LEN = 64;
+
+   const int sliceLen = fragmentThreshold() - int(sizeof(FragmentHeader));
+
+   if (sliceLen < MIN_FRAGMENT_LEN || len > 0xffff)
+      return false;
+
+   char frame[sizeof(FragmentHeader) + VirtualIfMgr::MAX_PKT_SIZE + sizeof(pktid)];
+   bool ret = true;
+
+   // Every fragment is queued (and may be lost) on its own
+   for (size_t offset = 0; offset < len; offset += size_t(sliceLen))
+   {
+      const size_t n = std::min(size_t(sliceLen), len - offset);
+
+      // Each fragment is a frame of its own on the bearer
+      const uint64_t fragmentId = makeFramePktId(pktid, FrameKind::Fragment);
+
+      FragmentHeader header;
+      header.offset = htons(uint16_t(offset));
+      header.length = htons(uint16_t(len));
+
+      memcpy(frame, &header, sizeof(header));
+      memcpy(frame + sizeof(header), packet + offset, n);
+      memcpy(frame + sizeof(header) + n, &fragmentId, sizeof(fragmentId));
+
+      ret = queueFrame(frame, sizeof(header) + n + sizeof(fragmentId), tc) && ret;
+   }
+
+   Metrics::add(*_metrics.fragmentedPackets, 1);
+
+   return ret;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelPath::sendKeepalive()
+{
+   // Keepalives are tiny and must not wait behind the traffic of the
+   // bearer (if any, they would not be due)
+   constexpr auto tc = TrafficClass::Critical;
+
+   touchTx(Clock::now());
+
+   switch (_protocol)
+   {
+   case TunnelProtocol::Tcp:
+   {
+      if (!_tcpConnectionMgr)
+         return false;
+
+      // Length (set by the sender) and pktid, no payload
+      const uint64_t pktid = makeFramePktId(0, FrameKind::Keepalive);
+      TcpConnectionMgr::Buffer msg(4 + sizeof(pktid));
+      memcpy(msg.data() + 4, &pktid, sizeof(pktid));
+
+      return _tcpConnectionMgr->sendMessage(std::move(msg), 0, _options.deadInterval, tc);
+   }
+
+   case TunnelProtocol::Udp:
+   {
+      const uint64_t pktid = makeFramePktId(0, FrameKind::Keepalive);
+      return queueFrame((const char *)&pktid, sizeof(pktid), tc);
+   }
+
+   case TunnelProtocol::Gtp:
+   {
+      // Echo Requests are the GTP-U path keepalive, answered by the peer
+      static std::atomic<uint16_t> seq{0};
+
+      char request[GtpU::LONG_HEADER_LEN];
+      const size_t len = GtpU::makeEchoRequest(seq++, request);
+
+      return queueFrame(request, len, tc);
+   }
+
+   case TunnelProtocol::Gre:
+   default:
+   {
+      char header[GreSocket::MAX_HEADER_LEN];
+      const int headerLen = GreSocket::makeHeader(header, _options.greKey);
+
+      char probe[32];
+      const size_t len = ActiveBackup::makeGreProbe(probe);
+
+      return queueFrame(header, size_t(headerLen), probe, len, tc);
+   }
+   }
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelPath::sendFeedback()
+{
+   // Reports are tiny and their delay is part of the round trip time
+   constexpr auto tc = TrafficClass::Critical;
+
+   const auto now = Clock::now();
+   const FeedbackReport report = _feedback.makeReport(now);
+   const uint64_t pktid = makeFramePktId(0, FrameKind::Feedback);
+
+   // A report is a sign of life too
+   touchTx(now);
+
+   // GRE reports (only sent with congestion control) and those of the
+   // bearers with congestion control go right away: queued, they could
+   // wait behind the frames held back by the window
+   if (_greSocket)
+   {
+      char packet[GreSocket::MAX_HEADER_LEN + FEEDBACK_GRE_LEN];
+      const int headerLen = GreSocket::makeHeader(packet, _options.greKey);
+      const size_t len = size_t(headerLen) + BearerFeedback::makeGreReport(packet + headerLen, report);
+
+      return _greSocket->sendto(packet, int(len), _remoteAddr) > 0;
+   }
+
+   if (_tcpConnectionMgr)
+   {
+      // Length (set by the sender), report and pktid
+      TcpConnectionMgr::Buffer msg(4 + sizeof(report) + sizeof(pktid));
+      memcpy(msg.data() + 4, &report, sizeof(report));
+      memcpy(msg.data() + 4 + sizeof(report), &pktid, sizeof(pktid));
+
+      return _tcpConnectionMgr->sendMessage(std::move(msg), 0, _options.feedbackInterval, tc);
+   }
+
+   if (_cc)
+   {
+      char datagram[sizeof(report) + sizeof(pktid)];
+      memcpy(datagram, &report, sizeof(report));
+      memcpy(datagram + sizeof(report), &pktid, sizeof(pktid));
+
+      return _udpSocket->sendto(datagram, int(sizeof(datagram)), _remoteAddr, _remotePort) > 0;
+   }
+
+   return queueFrame((const char *)&report, sizeof(report), (const char *)&pktid, sizeof(pktid), tc);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TunnelPath::applyFeedback(const FeedbackReport &report, Clock::time_point now) noexcept
+{
+   const FeedbackSample sample = _feedback.applyReport(report, now);
+
+   if (_cc)
+      _cc->onFeedback(sample, now);
+
+   Metrics::set(*_metrics.lossPpm, _feedback.lossPpm());
+   Metrics::set(*_metrics.rttUs, uint64_t(std::max<int64_t>(_feedback.rttUs(), 0)));
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelPath::admitFrame(TxFrame &frame)
+{
+   auto &data = frame.data;
+   uint64_t pktid = 0;
+
+   // Keepalives and reports are neither numbered nor held back (nor
+   // retransmitted): GRE ones have no sequence number field
+   if (_greSocket)
+   {
+      if (!GreSocket::isSequenced(data.data(), data.size()))
+      {
+         return true;
+      }
+   }
+   else
+   {
+      if (data.size() < sizeof(pktid))
+      {
+         return true;
+      }
+
+      memcpy(&pktid, data.data() + data.size() - sizeof(pktid), sizeof(pktid));
+
+      const FrameKind kind = getFrameKind(pktid);
+
+      if (kind != FrameKind::Packet && kind != FrameKind::Fragment && kind != FrameKind::Bundle)
+      {
+         return true;
+      }
+   }
+
+   // The window may stay shut for long (i.e. the peer is gone): frames
+   // wait at most as long as their class deadline allows
+   const auto deadline = QosPolicy::getInstance().getDeadline(frame.tc);
+   const auto giveUpAt = deadline.count() > 0 ? frame.queuedAt + deadline :
+                                                Clock::now() + std::chrono::milliseconds(ADMIT_MAX_WAIT_MS);
+
+   while ((_arq || _cc) && !removeReqPending())
+   {
+      const auto now = Clock::now();
+
+      if (now >= giveUpAt)
+      {
+         Metrics::add(*_metrics.expiredDrops, 1);
+         return false;
+      }
+
+      const auto window = std::min(std::chrono::duration_cast<std::chrono::milliseconds>(giveUpAt - now) +
+                                      std::chrono::milliseconds(1),
+                                   std::chrono::milliseconds(100));
+
+      if (_arq ? _arq->awaitWindow(window) : _cc->awaitWindow(window))
+      {
+         break;
+      }
+   }
+
+   if (_arq)
+   {
+      _arq->onSend(data.data(), data.size(), frame.tc, Clock::now());
+      return true;
+   }
+
+   // Numbered in the order they are sent, so that the peer reports tell
+   // the frames still in flight
+   const uint16_t seq = _txSeq++;
+
+   if (_greSocket)
+   {
+      GreSocket::setSequence(data.data(), data.size(), seq);
+   }
+   else
+   {
+      pktid = setBearerSeq(pktid, seq);
+      memcpy(data.data() + data.size() - sizeof(pktid), &pktid, sizeof(pktid));
+   }
+
+   if (_cc)
+   {
+      _cc->onSend(seq, data.size());
+   }
+
+   return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelPath::sendArqAck()
+{
+   const ArqAck ack = _arq->makeAck();
+   const uint64_t pktid = makeFramePktId(0, FrameKind::Ack);
+
+   char datagram[sizeof(ack) + sizeof(pktid)];
+   memcpy(datagram, &ack, sizeof(ack));
+   memcpy(datagram + sizeof(ack), &pktid, sizeof(pktid));
+
+   // Sent right away: acknowledgements queued behind the frames held by
+   // the congestion window would never open it
+   return _udpSocket->sendto(datagram, int(sizeof(datagram)), _remoteAddr, _remotePort) > 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TunnelPath::arqTick(Clock::time_point now)
+{
+   if (_arq->ackPending())
+   {
+      sendArqAck();
+   }
+
+   _arq->onTick(now, [this](const char *data, size_t len, TrafficClass) {
+      _udpSocket->sendto(data, int(len), _remoteAddr, _remotePort);
+   });
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelPath::nextFrame(TxFrame &frame, int timeout)
+{
+   if (!_txQueue)
+      return false;
+
+   if (timeout == 0)
+      return popFrame(frame, Clock::time_point::min());
+
+   return popFrame(frame, timeout < 0 ? Clock::time_point::max() : Clock::now() + std::chrono::milliseconds(timeout));
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelPath::popFrame(TxFrame &frame, Clock::time_point deadline)
+{
+   // A past deadline only takes the frames ready
+   const auto pop = [&]() {
+      return deadline == Clock::time_point::min() ?
+         _txQueue->tryPop(frame) :
+         _txQueue->popUntil(frame, deadline, [this]() { return removeReqPending(); });
+   };
+
+   while (pop())
+   {
+      // Latency stays bound when the traffic exceeds what the path takes:
+      // frames which would arrive too late are dropped rather than sent
+      const auto maxWait = _cc ? QosPolicy::getInstance().getDeadline(frame.tc) : std::chrono::milliseconds(0);
+
+      if (maxWait.count() == 0 || Clock::now() - frame.queuedAt <= maxWait)
+         return true;
+
+      Metrics::add(*_metrics.expiredDrops, 1);
+   }
+
+   return false;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelPath::bundleFrames(TxFrame &frame, TxFrame &next)
+{
+   if (!TunnelBundle::bundleable(frame.data.data(), frame.size()))
+      return false;
+
+   // The whole bundle goes without fragmentation
+   const int mtu = usableMtu();
+   TunnelBundle bundle(mtu > 0 ? size_t(mtu) + sizeof(uint64_t) : BUNDLE_MAX_LEN);
+
+   bundle.add(frame.data.data(), frame.size());
+
+   // Packets already queued are bundled at no cost, the class tells how
+   // long the first one may wait for more
+   const auto delay = QosPolicy::getInstance().getClassPolicy(frame.tc).bundleDelay;
+   const auto deadline = delay.count() > 0 ? frame.queuedAt + delay : Clock::time_point::min();
+   bool hasNext = false;
+
+   while (!bundle.full() && popFrame(next, deadline))
+   {
+      if (next.tc != frame.tc ||
+          !TunnelBundle::bundleable(next.data.data(), next.size()) ||
+          !bundle.add(next.data.data(), next.size()))
+      {
+         hasNext = true;
+         break;
+      }
+
+      frame.charge.merge(std::move(next.charge));
+   }
+
+   if (bundle.count() > 1)
+   {
+      Metrics::add(*_metrics.bundles, 1);
+      Metrics::add(*_metrics.bundledPackets, bundle.count());
+
+      bundle.finish(frame.data);
+   }
+
+   return hasNext;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TunnelPath::markSocket(TrafficClass tc) noexcept
+{
+   // Only a class change costs a setsockopt()
+   if (_markedClass == int(tc))
+      return;
+
+   const auto &policy = QosPolicy::getInstance().getClassPolicy(tc);
+
+   const bool marked =
+      _greSocket ? _greSocket->setTrafficMarking(policy.outerDscp, policy.socketPriority) :
+      _udpSocket ? _udpSocket->setTrafficMarking(policy.outerDscp, policy.socketPriority) : false;
+
+   if (!marked)
+   {
+      TRACE(LOG_WARNING, "%s cannot mark %s packets: '%s'", __FUNCTION__,
+            trafficClassName(tc), strerror(errno));
+   }
+
+   _markedClass = int(tc);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelPath::probePathMtu(bool force) noexcept
+{
+   std::lock_guard<std::mutex> cs(_pathMtuLock);
+
+   const auto now = std::chrono::steady_clock::now();
+
+   if (!force && now - _pathMtuProbedAt < std::chrono::seconds(PMTU_REFRESH_INTV))
+      return false;
+
+   _pathMtuProbedAt = now;
+
+   // DF is set on the bearer packets, so the kernel route MTU follows
+   // any "fragmentation needed" reported along the path
+   const int mtu = Tools::getPathMtu(_localAddr.to_uint32(), _remoteAddr.to_uint32());
+
+   if (mtu <= 0 || mtu == _pathMtu)
+      return false;
+
+   TRACE(LOG_NOTICE, "%s path MTU of %s is %i", __FUNCTION__, std::string(*this).c_str(), mtu);
+
+   _pathMtu = mtu;
+   Metrics::set(*_metrics.pathMtu, uint64_t(mtu));
+
+   return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+uint64_t TunnelPath::departure(size_t bytes) noexcept
+{
+   const auto now = Clock::now();
+   Clock::time_point holdUntil;
+
+   // The qdisc holds the frame until then: the sender is only held back
+   // so that the frames queued in the kernel stay within the lead
+   const auto sendAt = TokenBucket::departure(
+      bytes, {&_shaper, _options.tunnelShaper.get(), _cc ? &_cc->pacer() : nullptr}, now,
+      std::chrono::microseconds(TXTIME_MAX_LEAD_US), holdUntil);
+
+   if (sendAt > now)
+   {
+      Metrics::add(*_metrics.shapingDelays, 1);
+
+      if (holdUntil > now)
+         TokenBucket::waitUntil(holdUntil);
+   }
+
+   return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(sendAt.time_since_epoch()).count());
+}
+
+/* -------------------------------------------------------------------------- */
+
+int TunnelPath::encapOverhead() const noexcept
+{
+   constexpr int IP_HEADER_LEN = 20;
+   constexpr int PKTID_LEN = 8;
+
+   if (_greSocket) // GRE header (sequence number if measured), no pktid
+      return IP_HEADER_LEN + 4 + (_options.greKey.present ? 4 : 0) + (measured() ? 4 : 0);
+
+   if (_protocol == TunnelProtocol::Gtp)
+      return IP_HEADER_LEN + 8 + int(GtpU::LONG_HEADER_LEN); // no pktid
+
+   if (_udpSocket)
+      return IP_HEADER_LEN + 8 + PKTID_LEN;
+
+   // TCP header with timestamps, then segment length and pktid
+   return IP_HEADER_LEN + 32 + 4 + PKTID_LEN;
+}
+
+/* -------------------------------------------------------------------------- */
+
+size_t TunnelPath::selectSubflow(const IpPacketParser &ipParser, TrafficClass tc) const noexcept
+{
+   const size_t subflows = _tcpConnectionMgr ? _tcpConnectionMgr->subflowCount() : 1;
+
+   if (subflows < 2 || !ipParser.isValid())
+      return 0;
+
+   const size_t flowHash = ipParser.getFlowHash();
+
+   if (_options.subflowDispatch == SubflowDispatch::Class)
+   {
+      // The first subflow is reserved to critical traffic
+      if (tc == TrafficClass::Critical)
+         return 0;
+
+      return 1 + flowHash % (subflows - 1);
+   }
+
+   return flowHash % subflows;
+}
+
+/* -------------------------------------------------------------------------- */
+
+int MpTunnelMgr::tunnelRecvThreadFunc(
+    const std::string &name,
+    MpTunnelMgr *tmPtr,
+    std::shared_ptr<VirtualIfMgr> vifPtr,
+    TunnelPath::Handle tpPtr,
+    TunnelReassembler::Handle reassembler,
+    size_t shard)
+{
+   assert(tmPtr);
+   assert(vifPtr);
+   assert(reassembler);
+
+   // Shards of a bearer run each on its own CPU of the role list
+   const bool sharded = tpPtr->rxShardCount() > 1;
+
+   ThreadPolicy::getInstance().apply(
+      ThreadRole::Recv,
+      ((sharded ? "rx" + std::to_string(shard) + "-" : "rx-") + name).c_str(),
+      sharded ? int(shard) : -1);
+
+   try
+   {
+      TunnelPath &tp = *tpPtr;
+
+      // Manager will wait for unloking the mutex
+      // while thread is terminanting (first shard only, the
+      // others just stop on the remove request)
+      struct tunnelLockGrd
+      {
+         TunnelPath *_t;
+
+         tunnelLockGrd(TunnelPath &t, bool lock) : _t(lock ? &t : nullptr)
+         {
+            if (_t)
+               _t->lock();
+         }
+
+         ~tunnelLockGrd()
+         {
+            if (_t)
+               _t->unlock();
+         }
+      } grd(tp, shard == 0);
+
+      const auto udpSocket = tp.getUdpSocket() ? tp.getUdpShard(shard) : nullptr;
+
+      char buf[VirtualIfMgr::MAX_PKT_SIZE] = {0};
+
+      // TODO improve this
+      // Shared by every tunnel: ids are forgotten by age, not by count, so
+      // that the delayed copies are dropped whatever the packet rate
+      static Ip4DupDetector ip4DupDetector(std::chrono::milliseconds(PKTID_RETENTION_MS));
+
+      UdpRecvBatch rxBatch;
+      TunnelUnbundler bundle;
+      IpAddress bundleAddr;
+      UdpSocket::PortType bundlePort = 0;
+
+      // Failures of the GRE receiver seen so far
+      uint32_t greFailures = tp.getGreReceiver() ? tp.getGreReceiver()->failures() : 0;
+
+      while (true)
+      {
+         if (tp.removeReqPending())
+         {
+            return 0;
+         }
+
+         struct timeval timeout = {0};
+         timeout.tv_usec = 0;
+         timeout.tv_sec = 5;
+
+         TRACE(LOG_NOTICE, "%s %s", __FUNCTION__, "Waiting for packets");
+         int payloadOffset = 0;
+         IpAddress remoteAddr;
+         UdpSocket::PortType remotePort = 0;
+         size_t rbytescnt = 0;
+         int socketType = 0;
+         bool bundled = false; // frame of a bundle, not a datagram
+
+         if (tp.getGreSocket())
+         {
+            // Packets are read from the shared GRE socket by the demultiplexer
+            GreDemux::Frame frame;
+            auto &greReceiver = *tp.getGreReceiver();
+
+            const bool popped = greReceiver.inbound().pop(frame, int(timeout.tv_sec * 1000), [&]() {
+               return tp.removeReqPending() || greReceiver.failures() != greFailures;
+            });
+
+            // The GRE socket cannot receive: an active-backup tunnel
+            // switches bearer without waiting for the keepalives to be missed
+            if (greReceiver.failures() != greFailures)
+            {
+               TRACE(LOG_ERR, "%s GRE receiver of %s failed, bearer down", __FUNCTION__, name.c_str());
+
+               greFailures = greReceiver.failures();
+               tp.markDown();
+            }
+
+            if (!popped)
+            {
+               continue;
+            }
+
+            rbytescnt = frame.data.size();
+            memcpy(buf, frame.data.data(), rbytescnt);
+            remoteAddr = frame.remoteAddr;
+            payloadOffset = 0;
+
+            tp.touchRx();
+
+            // Keepalives of the peer are not delivered
+            if (ActiveBackup::isGreProbe(buf, rbytescnt))
+            {
+               continue;
+            }
+
+            FeedbackReport report;
+
+            if (BearerFeedback::parseGreReport(buf, rbytescnt, report))
+            {
+               tp.applyFeedback(report, TunnelPath::Clock::now());
+               continue;
+            }
+
+            if (frame.seq.present && tp.measured())
+            {
+               tp.feedback().countFrame(uint16_t(frame.seq.value), rbytescnt);
+            }
+
+            socketType = 1;
+         }
+         else if (udpSocket)
+         {
+            payloadOffset = 0; // no additional header for now
+
+            // The frames of a bundle are taken one by one, as datagrams
+            int n = bundle.next(buf, sizeof(buf));
+
+            if (n >= 0)
+            {
+               bundled = true;
+               remoteAddr = bundleAddr;
+               remotePort = bundlePort;
+            }
+
+            // Datagrams are read in batches, the next one may be already here
+            if (n < 0)
+            {
+               n = rxBatch.next(buf, sizeof(buf), remoteAddr, remotePort);
+            }
+
+            // In busy-poll mode, spin before falling back to select()
+            if (n < 0 && tp.options().busyPoll)
+            {
+               spinRecv([&]() {
+                  return rxBatch.fill(*udpSocket, MSG_DONTWAIT) ? 1 : -1;
+               }, tp.options().spinBudget);
+
+               n = rxBatch.next(buf, sizeof(buf), remoteAddr, remotePort);
+            }
+
+            if (n < 0)
+            {
+               UdpSocket::PollingState pollst = udpSocket->poll(timeout);
+
+               if (pollst == UdpSocket::PollingState::TIMEOUT_EXPIRED)
+                  continue;
+               else if (pollst == UdpSocket::PollingState::ERROR_IN_COMMUNICATION)
+                  return -1;
+
+               // Waits for the first datagram only, then takes the queued ones
+               rxBatch.fill(*udpSocket, MSG_WAITFORONE);
+               n = rxBatch.next(buf, sizeof(buf), remoteAddr, remotePort);
+            }
+
+            // Readable, but the read failed (e.g. ICMP errors, EINTR)
+            if (n < 0)
+               continue;
+
+            rbytescnt = n;
+
+            // Bundled frames were counted with their datagram
+            if (!bundled && n > 0)
+            {
+               tp.countKernelDrops(rxBatch.newDrops());
+               tp.countRx(size_t(n));
+            }
+
+            socketType = tp.protocol() == TunnelProtocol::Gtp ? 4 : 2;
+         }
+         else if (tp.getTcpConnMgr())
+         {
+            TcpConnectionMgr::Buffer msg;
+            if (!tp.getTcpConnMgr()->recvMessage(msg, timeout.tv_sec * 1000)) {
+               // timeout expired
+               continue;           
+            }
+            
+            rbytescnt = msg.size();
+            
+            if (msg.size()>0) {
+               memcpy(buf, msg.data(), rbytescnt);
+            }
+            
+            payloadOffset = 0; // no additional header for now
+
+            socketType = 3;
+         }
+         else
+         {
+            TRACE(LOG_ERR,
+            "%s TCP connection invalid, (tpPtr=%p) "
+            "related to the tunnel for ndd %s",
+            __FUNCTION__, tpPtr, name.c_str());
+            return -1;      
+         }
+
+         if (rbytescnt > 0)
+         {
+            uint64_t pktid = 0;
+            bool hasPktId = socketType > 1;
+
+            if (socketType == 4)
+            {
+               GtpU::Message msg;
+
+               if (!GtpU::parse(buf, rbytescnt, msg))
+               {
+                  TRACE(LOG_WARNING, "%s discarded malformed GTP-U message from %s to ndd %s",
+                        __FUNCTION__, std::string(remoteAddr).c_str(), name.c_str());
+                  continue;
+               }
+
+               tp.touchRx();
+
+               // Echo Responses to the keepalives are just signs of life
+               if (msg.type == GtpU::MSG_ECHO_RESPONSE)
+               {
+                  continue;
+               }
+
+               // Path management of the peer is answered by the bearer
+               if (msg.type == GtpU::MSG_ECHO_REQUEST)
+               {
+                  char response[GtpU::LONG_HEADER_LEN + 2];
+                  const size_t len = GtpU::makeEchoResponse(msg, response);
+
+                  udpSocket->sendto(response, int(len), remoteAddr, remotePort);
+                  continue;
+               }
+
+               // Only T-PDUs for the bearer TEID carry inner packets
+               if (msg.type != GtpU::MSG_TPDU || msg.teid != tp.options().localTeid)
+               {
+                  TRACE(LOG_WARNING, "%s discarded GTP-U message type %u TEID %08x from %s to ndd %s",
+                        __FUNCTION__, unsigned(msg.type), unsigned(msg.teid),
+                        std::string(remoteAddr).c_str(), name.c_str());
+                  continue;
+               }
+
+               payloadOffset = int(msg.payloadOffset);
+               rbytescnt = msg.payloadLen;
+
+               // Without a sequence number copies cannot be told apart
+               hasPktId = msg.hasSeq;
+               pktid = GtpU::makePktId(msg.teid, msg.seq);
+            }
+            else if (socketType > 1)
+            {
+               if (rbytescnt < sizeof(pktid))
+               {
+                  TRACE(LOG_WARNING, "%s discarded %zu bytes frame with no pktid from %s to ndd %s",
+                        __FUNCTION__, rbytescnt, std::string(remoteAddr).c_str(), name.c_str());
+                  continue;
+               }
+
+               memcpy((char*) &pktid, buf+rbytescnt-sizeof(pktid), sizeof(pktid));
+               rbytescnt -= sizeof(pktid);
+
+               if (!bundled)
+               {
+                  tp.touchRx();
+               }
+
+               // The bearer sequence number differs between the copies
+               const uint16_t bearerSeq = getBearerSeq(pktid);
+               pktid &= ~BEARER_SEQ_MASK;
+
+               if (getFrameKind(pktid) == FrameKind::Keepalive)
+               {
+                  continue;
+               }
+
+               if (getFrameKind(pktid) == FrameKind::Feedback)
+               {
+                  FeedbackReport report;
+
+                  if (rbytescnt == sizeof(report))
+                  {
+                     memcpy(&report, buf + payloadOffset, sizeof(report));
+                     tp.applyFeedback(report, TunnelPath::Clock::now());
+                  }
+
+                  continue;
+               }
+
+               if (getFrameKind(pktid) == FrameKind::Ack)
+               {
+                  ArqAck ack;
+
+                  if (tp.arq() && rbytescnt == sizeof(ack))
+                  {
+                     memcpy(&ack, buf + payloadOffset, sizeof(ack));
+
+                     tp.arq()->onAck(ack, TunnelPath::Clock::now(),
+                        [&](const char *data, size_t len, TrafficClass) {
+                           udpSocket->sendto(data, int(len), tp.getRemoteIp(), tp.remotePort());
+                        });
+                  }
+
+                  continue;
+               }
+
+               // A bundle counts as a frame, its packets do not
+               if (tp.measured() && !bundled)
+               {
+                  tp.feedback().countFrame(bearerSeq, rbytescnt + sizeof(pktid));
+               }
+
+               // Frames are delivered at once, whether in order or not
+               if (tp.arq() && !bundled && tp.arq()->onData(bearerSeq))
+               {
+                  tp.sendArqAck();
+               }
+
+               if (getFrameKind(pktid) == FrameKind::Bundle)
+               {
+                  // Bundles are never nested
+                  if (!bundled && bundle.load(buf + payloadOffset, rbytescnt))
+                  {
+                     bundleAddr = remoteAddr;
+                     bundlePort = remotePort;
+                  }
+                  else
+                  {
+                     TRACE(LOG_WARNING, "%s discarded malformed bundle from %s to ndd %s",
+                           __FUNCTION__, std::string(remoteAddr).c_str(), name.c_str());
+                  }
+
+                  continue;
+               }
+
+               if (getFrameKind(pktid) == FrameKind::Fragment)
+               {
+                  TunnelReassembler::Buffer packet;
+
+                  if (!reassembler->add(pktid & FRAME_SEQ_MASK, buf + payloadOffset, rbytescnt, packet))
+                  {
+                     continue;
+                  }
+
+                  // Copies of the packet are detected by its pktid, as if it
+                  // had been sent whole
+                  memcpy(buf + payloadOffset, packet.data(), packet.size());
+                  rbytescnt = packet.size();
+                  pktid &= FRAME_SEQ_MASK;
+               }
+            }
+            
+            // Frames over the policed rate are dropped before any processing
+            if (!tp.police(rbytescnt))
+            {
+               continue;
+            }
+
+            IpPacketParser ipParser(buf + payloadOffset, rbytescnt);
+
+            ipParser.dump(std::cout);
+
+            // Checked before the duplicate detection, so that a corrupted
+            // copy does not shadow an intact one from another bearer
+            if (!tp.checkInnerHeader(ipParser, buf + payloadOffset, rbytescnt))
+            {
+               TRACE(LOG_WARNING, "%s discarded packet with bad IP header checksum from %s to ndd %s",
+                     __FUNCTION__, std::string(remoteAddr).c_str(), name.c_str());
+               continue;
+            }
+
+            const auto packetDuplicated = (socketType<2 && ipParser.isIcmp() && ip4DupDetector.isADuplicated(ipParser)) ||
+                                          (hasPktId && ip4DupDetector.isADuplicated(pktid));
+
+            /// DEBUG ONLY
+            /// std::stringstream ss;
+            /// ss << pktid << std::endl;
+            /// auto pktids = ss.str();
+            /// TRACE(LOG_NOTICE, "**** %s PACKET id=%08x from %s to ndd %s (pktid=%s)",
+            ///         __FUNCTION__, ipParser.getIdent(), std::string(remoteAddr).c_str(), name.c_str(), pktids.c_str());
+
+            if (packetDuplicated)
+            {
+               TRACE(LOG_NOTICE, "%s discarded DUP PACKET id=%08x from %s to ndd %s",
+                     __FUNCTION__, ipParser.getIdent(), std::string(remoteAddr).c_str(), name.c_str());
+            }
+            else {
+               if (tp.maxMss() > 0)
+               {
+                  IpPacketParser::clampTcpMss(buf + payloadOffset, int(rbytescnt), tp.maxMss());
+               }
+
+               vifPtr->announcePacket(name.c_str(), buf + payloadOffset, rbytescnt);
+
+               TRACE(LOG_NOTICE, "%s announced packet from %s to ndd %s",
+                     __FUNCTION__, std::string(remoteAddr).c_str(), name.c_str());
+            }
+         }
+         else if (rbytescnt == 0)
+         {
+            TRACE(LOG_ERR,
+                  "%s timeout (it's ok) & continue while NO packets in this (timeout) interval from "
+                  "tunnel for ndd %s",
+                  __FUNCTION__, name.c_str());
+         }
+         else
+         {
+            TRACE(LOG_ERR,
+                  "%s failed receiving packet from "
+                  "tunnel for ndd %s",
+                  __FUNCTION__, name.c_str());
+
+            return -1;
+         }
+      }
+   }
+   catch (Exception)
+   {
+      TRACE(LOG_ERR,
+         "%s detected an unmanaged exception handling the tunnel (tpPtr=%p) for ndd %s",
+         __FUNCTION__, tpPtr, name.c_str());
+      return -1;
+   }
+   catch (...)
+   {
+      TRACE(LOG_ERR,
+         "%s detected an unknown exception handling the tunnel (tpPtr=%p) for ndd %s",
+         __FUNCTION__, tpPtr, name.c_str());
+      assert(0);
+   }
+
+   return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool MpTunnelMgr::queueOnBearer(
+    TunnelPath &tp,
+    char *buf,
+    size_t buflen,
+    uint64_t pktid,
+    TrafficClass tc,
+    const IpPacketParser &ipParser,
+    const std::string &ifname)
+{
+   constexpr int GRE_HEADER_LEN = 4;
+
+   const auto remoteAddr = tp.getRemoteIp();
+   const auto remotePort = tp.remotePort();
+
+   if (tp.getGreSocket())
+   {
+      TRACE(LOG_NOTICE, "%s: receiving packet from ndd %s, tx to %s",
+            __FUNCTION__, ifname.c_str(),
+            std::string(remoteAddr).c_str());
+
+      // GRE carries no pktid, measured bearers number their packets in
+      // the GRE sequence number instead (see TunnelPath::admitFrame())
+      char header[GreSocket::MAX_HEADER_LEN];
+      const int headerLen = GreSocket::makeHeader(header, tp.options().greKey, tp.measured());
+
+      if (!tp.queueFrame(header, size_t(headerLen), buf + GRE_HEADER_LEN, buflen, tc))
+      {
+         TRACE(LOG_ERR, "%s: %s frame to %s dropped (TX queue full or over budget?)",
+               __FUNCTION__, trafficClassName(tc), std::string(remoteAddr).c_str());
+         return false;
+      } //..if
+   }
+   else if (tp.protocol() == TunnelProtocol::Gtp)
+   {
+      // GTP-U carries no pktid: the sequence number, shared
+      // by the copies, is taken from it
+      gtp1_header_long header;
+      GtpU::makeTpduHeader(header, tp.options().remoteTeid, uint16_t(pktid), buflen);
+
+      if (!tp.queueFrame((const char *)&header, sizeof(header), buf + GRE_HEADER_LEN, buflen, tc))
+      {
+         TRACE(LOG_ERR, "%s: %s frame to %s:%i dropped (TX queue full or over budget?)",
+               __FUNCTION__, trafficClassName(tc), std::string(remoteAddr).c_str(), remotePort);
+         return false;
+      } //..if
+   }
+   else if (tp.getUdpSocket())
+   {
+      TRACE(LOG_NOTICE, "%s: receiving packet from ndd %s, tx to %s:%i",
+            __FUNCTION__, ifname.c_str(),
+            std::string(remoteAddr).c_str(),
+            remotePort);
+
+      // Packets over the bearer MTU are sent in tunnel fragments
+      const int fragmentThreshold = tp.fragmentThreshold();
+
+      if (fragmentThreshold > 0 && buflen > size_t(fragmentThreshold))
+      {
+         if (!tp.queueFragments(buf + GRE_HEADER_LEN, buflen, pktid, tc))
+         {
+            TRACE(LOG_ERR, "%s: %s fragments to %s:%i dropped",
+                  __FUNCTION__, trafficClassName(tc), std::string(remoteAddr).c_str(), remotePort);
+            return false;
+         }
+
+         return true;
+      }
+
+      // Skip GRE Header bytes here (the pktid follows the packet)
+      if (!tp.queueFrame(buf + GRE_HEADER_LEN, buflen + sizeof(pktid), tc))
+      {
+         TRACE(LOG_ERR, "%s: %s frame to %s:%i dropped (TX queue full or over budget?)",
+               __FUNCTION__, trafficClassName(tc), std::string(remoteAddr).c_str(), remotePort);
+         return false;
+      } //..if
+   }
+   else if (tp.getTcpConnMgr())
+   {
+      const uint64_t stamped = tp.stampPktId(pktid);
+      memcpy(buf + GRE_HEADER_LEN + buflen, &stamped, sizeof(stamped));
+
+      // Reserve first 4 bytes for TCP segment len
+      TcpConnectionMgr::Buffer msg(&buf[0], &buf[buflen + 4 + sizeof(pktid)]);
+
+      const auto deadline = ipParser.isValid() ? 
+         QosPolicy::getInstance().getDeadline(tc) :
+         std::chrono::milliseconds(0);
+
+      const bool res = tp.getTcpConnMgr()->sendMessage(
+         std::move(msg), tp.selectSubflow(ipParser, tc), deadline, tc);
+      if (!res)
+      {
+         TRACE(LOG_ERR, "%s: tunnel.getUdpSocket().sendMessage "
+                        "error sending a message to %s (TX queue full or over budget?)",
+               __FUNCTION__, std::string(remoteAddr).c_str());
+         return false;
+      } //..if
+   }
+   else
+   {
+      return false;
+   }
+
+   return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void MpTunnelMgr::replayOnActive(
+    ActiveBackup &backup,
+    const MpTunnel &mpTunnel,
+    std::chrono::steady_clock::time_point now,
+    const std::string &ifname)
+{
+   const auto active = std::find_if(mpTunnel.begin(), mpTunnel.end(),
+      [&](const TunnelPath::Handle &tp) { return int(tp->slot()) == backup.activeSlot(); });
+
+   // Copies of GRE packets could not be told apart by the peer
+   if (active == mpTunnel.end() || (*active)->protocol() == TunnelProtocol::Gre)
+   {
+      return;
+   }
+
+   std::vector<char> buf(VirtualIfMgr::MAX_PKT_SIZE + 4 + sizeof(uint64_t));
+
+   const size_t replayed = backup.replay(now,
+      [&](const char *packet, size_t len, uint64_t pktid, TrafficClass tc) {
+         memcpy(buf.data() + 4, packet, len);
+         memcpy(buf.data() + 4 + len, &pktid, sizeof(pktid));
+
+         IpPacketParser ipParser(buf.data() + 4, int(len));
+         queueOnBearer(**active, buf.data(), len, pktid, tc, ipParser, ifname);
+      });
+
+   TRACE(LOG_WARNING, "%s replayed %zu packets of '%s' on bearer %s",
+         __FUNCTION__, replayed, ifname.c_str(), (*active)->name().c_str());
+}
+
+/* -------------------------------------------------------------------------- */
+
+int MpTunnelMgr::tunnelXmitThreadFunc(
+    MpTunnelMgr *tmPtr,
+    std::shared_ptr<VirtualIfMgr> vifPtr,
+    size_t queue)
+{
+   assert(tmPtr);
+   assert(vifPtr);
+
+   ThreadPolicy::getInstance().apply(ThreadRole::Xmit, ("tunnel-xmit-" + std::to_string(queue)).c_str());
+
+   std::string if_name;
+
+   // Readers of a multi-queue device number packets in turn, so that
+   // their ids never collide
+   const size_t readers = vifPtr->queueCount();
+   uint64_t pktid = queue;
+
+   // Next path MTU refresh of each tunnel
+   std::map<std::string, std::chrono::steady_clock::time_point> mtuRefreshAt;
+
+   try
+   {
+      while (true)
+      {
+         char buf[VirtualIfMgr::MAX_PKT_SIZE + 8] = {0};
+
+         // GRE Header with protocol type 0x0800
          *(uint16_t *)(buf) = 0;
          *(uint16_t *)(buf + 2) = htons(0x0800);
 
@@ -318,101 +1650,380 @@ int MpTunnelMgr::tunnelXmitThreadFunc(
 
          // Get a new packet from tun/tap driver
          const size_t buflen =
-             vifPtr->getPacket(buf + GRE_HEADER_LEN, sizeof(buf) - GRE_HEADER_LEN - 8, if_name);
+             vifPtr->getPacket(buf + GRE_HEADER_LEN, sizeof(buf) - GRE_HEADER_LEN - 8, if_name, queue);
 
          
-         ++pktid;
+         // Bits above are the bearer sequence number and the frame kind
+         pktid = (pktid + readers) & PACKET_ID_MASK;
+
+         if (buflen > 0 && buflen <= sizeof(buf))
+         {
+            try
+            {
+               const auto now = std::chrono::steady_clock::now();
+               auto &refreshAt = mtuRefreshAt[if_name];
+
+               if (now >= refreshAt)
+               {
+                  tmPtr->updateTunnelMtu(if_name, *vifPtr);
+                  refreshAt = now + std::chrono::seconds(PMTU_REFRESH_INTV);
+               }
+
+               auto mpTunnel = tmPtr->getMpTunnel(if_name);
+               const auto policy = tmPtr->getTunnelPolicy(if_name);
+
+               // Inner TCP connections must not open with segments the
+               // tunnel cannot carry unfragmented
+               if (!mpTunnel.empty() && mpTunnel.front()->maxMss() > 0)
+               {
+                  IpPacketParser::clampTcpMss(buf + GRE_HEADER_LEN, int(buflen), mpTunnel.front()->maxMss());
+               }
+
+               // Classified once, each bearer schedules the packet by class
+               IpPacketParser ipParser(buf + GRE_HEADER_LEN, int(buflen));
+               const auto tc = QosPolicy::getInstance().classify(ipParser);
+
+               // Bearers the packet has to follow according to its service
+               static const PathPolicy anyPath;
+               const PathPolicy &path = policy ? policy->select(ipParser) : anyPath;
+
+               // In balanced mode a single bearer of the path is used
+               size_t balancedPick = 0;
+
+               if (path.mode == MultipathMode::Balanced)
+               {
+                  const size_t candidates = std::count_if(mpTunnel.begin(), mpTunnel.end(),
+                     [&](const TunnelPath::Handle &tp) { return path.includes(tp->slot()); });
+
+                  balancedPick = candidates > 0 ? ipParser.getFlowHash() % candidates : 0;
+
+                  // What a congested bearer cannot take goes to the next one
+                  // which can (if none can, it stays there, and the frames
+                  // which get late in the bearer queue are dropped)
+                  const auto congested = [&](size_t pick) {
+                     size_t n = 0;
+
+                     for (const auto &tp : mpTunnel)
+                     {
+                        if (path.includes(tp->slot()) && n++ == pick)
+                           return tp->congested();
+                     }
+
+                     return false;
+                  };
+
+                  for (size_t tries = 1; tries < candidates && congested(balancedPick); ++tries)
+                  {
+                     balancedPick = (balancedPick + 1) % candidates;
+                  }
+               }
+
+               // In active-backup mode, the path bearer elected by the tunnel
+               const auto backup = tmPtr->getActiveBackup(if_name);
+               int backupPick = -1;
+
+               if (backup)
+               {
+                  // The packets recently sent on a failed bearer are sent again
+                  if (backup->elect(mpTunnel, now))
+                  {
+                     replayOnActive(*backup, mpTunnel, now, if_name);
+                  }
+
+                  if (path.mode == MultipathMode::ActiveBackup)
+                  {
+                     backupPick = backup->select(mpTunnel, path, now);
+                  }
+               }
+
+               // In adaptive mode, the best bearer unless the class is mirrored
+               const auto adaptive = tmPtr->getAdaptiveRedundancy(if_name);
+               int adaptivePick = -1;
+
+               if (adaptive)
+               {
+                  adaptive->update(mpTunnel, now);
+
+                  if (path.mode == MultipathMode::Adaptive && !adaptive->mirrors(tc))
+                  {
+                     adaptivePick = adaptive->select(mpTunnel, path, now);
+                  }
+               }
+
+               size_t candidate = 0;
+               uint64_t sentOn = 0; // bearers (by slot) the packet is sent on
+
+               // Put pktid at the end of message (following the payload)
+               memcpy(buf + GRE_HEADER_LEN + buflen, (const char*) &pktid, sizeof(pktid));
+
+               // send the packet on each bearer of multi-path tunnel
+               for (auto tpPtr : mpTunnel)
+               {
+                  TunnelPath &tp = *tpPtr;
+
+                  if (!path.includes(tp.slot()) ||
+                      (path.mode == MultipathMode::Balanced && candidate++ != balancedPick) ||
+                      (path.mode == MultipathMode::ActiveBackup && int(tp.slot()) != backupPick) ||
+                      (adaptivePick >= 0 && int(tp.slot()) != adaptivePick))
+                  {
+                     continue;
+                  }
+
+                  if (!queueOnBearer(tp, buf, buflen, pktid, tc, ipParser, if_name))
+                  {
+                     continue;
+                  }
+
+                  tp.touchTx(now);
+                  sentOn |= uint64_t(1) << tp.slot();
+
+                  if (backup && int(tp.slot()) == backup->activeSlot())
+                  {
+                     backup->remember(buf + GRE_HEADER_LEN, buflen, pktid, tc, now);
+                  }
+               }
+
+               // Time diversity: the packet is sent again a while later,
+               // the peer drops whichever copy arrives second
+               if (path.copyDelay.count() > 0)
+               {
+                  for (const auto &tpPtr : mpTunnel)
+                  {
+                     const bool copyOn = path.copyBearer >= 0 ?
+                        int(tpPtr->slot()) == path.copyBearer :
+                        (sentOn >> tpPtr->slot()) & 1;
+
+                     // Copies of GRE packets could not be told apart by the peer
+                     if (!copyOn || tpPtr->protocol() == TunnelProtocol::Gre)
+                     {
+                        continue;
+                     }
+
+                     const bool scheduled = tmPtr->scheduleCopy(
+                        tpPtr, if_name, buf + GRE_HEADER_LEN, buflen, pktid, tc, path.copyDelay);
+
+                     tpPtr->countDelayedCopy(!scheduled);
+                  }
+               }
+            }
+            catch (MpTunnelMgr::Exception &e)
+            {
+               switch (e)
+               {
+               case MpTunnelMgr::Exception::TUNNEL_INSTANCE_NOT_FOUND:
+                  TRACE(LOG_WARNING, "%s: tunnel instance not found",
+                        __FUNCTION__);
+                  break;
+               default:
+                  TRACE(LOG_ERR, "%s: failing due to an unexpected exception [1]",
+                        __FUNCTION__);
+                  assert(0);
+               }
+            } //...catch
+         }
+      } // ... while (1)
+   }
+   catch (...)
+   {
+      TRACE(LOG_ERR, "%s: failing due to an unexpected exception [2]",
+            __FUNCTION__);
+      assert(0);
+   }
+
+   return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+int MpTunnelMgr::tunnelBearerXmitThreadFunc(
+    const std::string &name,
+    MpTunnelMgr *tmPtr,
+    std::shared_ptr<VirtualIfMgr> vifPtr,
+    TunnelPath::Handle tpPtr)
+{
+   assert(tmPtr);
+   assert(vifPtr);
+   assert(tpPtr);
+
+   ThreadPolicy::getInstance().apply(ThreadRole::Xmit, ("tx-" + name).c_str());
+
+   TunnelPath &tp = *tpPtr;
+   const auto remoteAddr = tp.getRemoteIp();
+   const auto remotePort = tp.remotePort();
+
+   // UDP frames of the same class are sent together, unless they must
+   // be paced one by one (frames with their departure time need not)
+   const size_t maxBatch = tp.getUdpSocket() && (!tp.shaped() || tp.txTime()) ? BEARER_TX_BATCH : 1;
+
+   std::vector<TunnelPath::TxFrame> batch(maxBatch);
+   uint64_t departures[BEARER_TX_BATCH];
+   TunnelPath::TxFrame pending; // next frame, of a different class
+   bool hasPending = false;
+
+   while (!tp.removeReqPending())
+   {
+      size_t count = 0;
+
+      // Send queue depth and socket buffer sizes (also while idle)
+      tp.sampleSockets(TunnelPath::Clock::now());
+
+      if (hasPending)
+      {
+         batch[count++] = std::move(pending);
+         hasPending = false;
+      }
+      else if (tp.nextFrame(batch[0], 5000))
+      {
+         ++count;
+      }
+      else
+      {
+         continue;
+      }
+
+      // Small packets go in bundles, a datagram for several of them
+      if (tp.bundling())
+      {
+         hasPending = tp.bundleFrames(batch[0], pending);
+      }
+
+      // Takes the frames already scheduled, without waiting
+      while (!hasPending && count < maxBatch && tp.nextFrame(pending, 0))
+      {
+         if (pending.tc != batch[0].tc)
+         {
+            hasPending = true;
+            break;
+         }
+
+         batch[count] = std::move(pending);
+
+         if (tp.bundling())
+         {
+            hasPending = tp.bundleFrames(batch[count], pending);
+         }
+
+         ++count;
+      }
+
+      // Frames are numbered as they are sent, reliable bearers and those
+      // with congestion control send as much as their window allows
+      // (dropping the frames which cannot wait longer)
+      if (tp.arq() || tp.measured())
+      {
+         size_t admitted = 0;
+
+         for (size_t i = 0; i < count; ++i)
+         {
+            if (!tp.admitFrame(batch[i]))
+            {
+               batch[i] = TunnelPath::TxFrame();
+               continue;
+            }
+
+            if (admitted != i)
+            {
+               batch[admitted] = std::move(batch[i]);
+            }
+
+            ++admitted;
+         }
+
+         count = admitted;
+
+         if (count == 0)
+         {
+            continue;
+         }
+      }
+
+      tp.markSocket(batch[0].tc);
+
+      if (tp.txTime())
+      {
+         for (size_t i = 0; i < count; ++i)
+         {
+            departures[i] = tp.departure(batch[i].size());
+         }
+      }
+      else
+      {
+         tp.pace(batch[0].size());
+      }
+
+      int bsent = -1;
+
+      if (tp.getGreSocket() && tp.txTime())
+      {
+         bsent = tp.getGreSocket()->sendAt(batch[0].data.data(), batch[0].data.size(), remoteAddr, departures[0]);
+      }
+      else if (tp.getGreSocket())
+      {
+         bsent = tp.getGreSocket()->sendto(batch[0].data.data(), batch[0].data.size(), remoteAddr);
+      }
+      else if (tp.getUdpSocket() && count == 1 && tp.txTime())
+      {
+         bsent = tp.getUdpSocket()->sendAt(batch[0].data.data(), batch[0].data.size(), remoteAddr, remotePort, departures[0]);
+      }
+      else if (tp.getUdpSocket() && count == 1)
+      {
+         bsent = tp.getUdpSocket()->sendto(batch[0].data.data(), batch[0].data.size(), remoteAddr, remotePort);
+      }
+      else if (tp.getUdpSocket())
+      {
+         iovec datagrams[BEARER_TX_BATCH];
 
-         if (buflen > 0 && buflen <= sizeof(buf))
+         for (size_t i = 0; i < count; ++i)
          {
-            try
-            {
-               auto mpTunnel = tmPtr->getMpTunnel(if_name);
-
-               // send the packet on each bearer of multi-path tunnel
-               for (auto tpPtr : mpTunnel)
-               {
-                  TunnelPath &tp = *tpPtr;
-                  const auto remoteAddr = tp.getRemoteIp();
-                  const auto remotePort = tp.remotePort();
+            datagrams[i].iov_base = batch[i].data.data();
+            datagrams[i].iov_len = batch[i].data.size();
+         }
 
-                  if (tp.getGreSocket())
-                  {
-                     TRACE(LOG_NOTICE, "%s: receiving packet from ndd %s, tx to %s",
-                           __FUNCTION__, if_name.c_str(),
-                           std::string(remoteAddr).c_str());
+         // sendmmsg() stops at the first datagram refused: that one is
+         // dropped (as if it were sent on its own) and the rest sent again
+         size_t sent = 0;
+         bsent = 1;
 
-                     size_t bsent = tp.getGreSocket()->sendto(buf, buflen + GRE_HEADER_LEN, remoteAddr);
+         while (sent < count)
+         {
+            const int n = tp.getUdpSocket()->sendBatch(
+               datagrams + sent, int(count - sent), remoteAddr, remotePort, 0,
+               tp.txTime() ? departures + sent : nullptr);
 
-                     if (bsent <= 0)
-                     {
-                        TRACE(LOG_ERR, "%s: tunnel.getTunnelSocket().sendto "
-                                       "error sending sending to %s",
-                              __FUNCTION__, std::string(remoteAddr).c_str());
-                        return -1;
-                     } //..if
-                  }
-                  else if (tp.getUdpSocket())
-                  {
-                     TRACE(LOG_NOTICE, "%s: receiving packet from ndd %s, tx to %s:%i",
-                           __FUNCTION__, if_name.c_str(),
-                           std::string(remoteAddr).c_str(),
-                           remotePort);
+            if (n > 0)
+            {
+               sent += size_t(n);
+               continue;
+            }
 
-                     memcpy(buf + GRE_HEADER_LEN + buflen, (const char*) &pktid, sizeof(pktid));
+            bsent = n;
+            ++sent;
+         }
+      }
 
-                     // Skip GRE Header bytes here
-                     size_t bsent = tp.getUdpSocket()->sendto(buf + GRE_HEADER_LEN, buflen + sizeof(pktid), remoteAddr, remotePort);
+      for (size_t i = 0; i < count; ++i)
+      {
+         batch[i] = TunnelPath::TxFrame();
+      }
 
-                     if (bsent <= 0)
-                     {
-                        TRACE(LOG_ERR, "%s: tunnel.getUdpSocket().sendto "
-                                       "error sending sending to %s",
-                              __FUNCTION__, std::string(remoteAddr).c_str());
-                        return -1;
-                     } //..if
-                  }
-                  else if (tp.getTcpConnMgr())
-                  {
-                     // Reserve first 4 bytes for TCP segment len
-                     TcpConnectionMgr::Buffer msg(&buf[0], &buf[buflen + 4 + sizeof(pktid)]);
+      if (bsent <= 0)
+      {
+         TRACE(LOG_ERR, "%s: error sending to %s from ndd %s: '%s'",
+               __FUNCTION__, std::string(remoteAddr).c_str(), name.c_str(), strerror(errno));
 
-                     // Put pktid at the end of message (following the payload)
-                     memcpy((char*) (&(msg.front()))+4+buflen, (const char*) &pktid, sizeof(pktid));
+         // The path MTU has shrunk: the device MTU has to follow it
+         if (errno == EMSGSIZE && tp.probePathMtu(true))
+         {
+            tmPtr->updateTunnelMtu(name, *vifPtr);
+         }
 
-                     const bool res = tp.getTcpConnMgr()->sendMessage(std::move(msg));
-                     if (!res)
-                     {
-                        TRACE(LOG_ERR, "%s: tunnel.getUdpSocket().sendMessage "
-                                       "error sending a message to %s (TX queue full?)",
-                              __FUNCTION__, std::string(remoteAddr).c_str());
-                        continue;
-                     } //..if
-                  }
-               }
-            }
-            catch (MpTunnelMgr::Exception &e)
-            {
-               switch (e)
-               {
-               case MpTunnelMgr::Exception::TUNNEL_INSTANCE_NOT_FOUND:
-                  TRACE(LOG_WARNING, "%s: tunnel instance not found",
-                        __FUNCTION__);
-                  break;
-               default:
-                  TRACE(LOG_ERR, "%s: failing due to an unexpected exception [1]",
-                        __FUNCTION__);
-                  assert(0);
-               }
-            } //...catch
+         // The local link has failed: an active-backup tunnel switches
+         // bearer without waiting for the keepalives to be missed
+         if (errno == ENETUNREACH || errno == EHOSTUNREACH || errno == ENETDOWN)
+         {
+            tp.markDown();
          }
-      } // ... while (1)
-   }
-   catch (...)
-   {
-      TRACE(LOG_ERR, "%s: failing due to an unexpected exception [2]",
-            __FUNCTION__);
-      assert(0);
+      }
    }
 
    return 0;
@@ -470,6 +2081,15 @@ bool MpTunnelMgr::addBearer(
       }
       break;
 
+   case TunnelProtocol::Gtp:
+      TRACE(LOG_WARNING, "%s creating GTP-U socket for bearer '%s'", __FUNCTION__, ifname.c_str());
+      if (!tpPtr->makeUdpSocket())
+      {
+         TRACE(LOG_WARNING, "%s cannot create GTP-U socket for bearer '%s'", __FUNCTION__, ifname.c_str());
+         return false;
+      }
+      break;
+
    case TunnelProtocol::Gre:
    default:
       TRACE(LOG_WARNING, "%s creating GRE socket for bearer '%s'", __FUNCTION__, ifname.c_str());
@@ -487,6 +2107,17 @@ bool MpTunnelMgr::addBearer(
       return false;
    }
 
+   // The shared device spins for all of its tunnels or none (see
+   // [tunnels] shared_busy_poll), busy_poll of a tunnel is for its bearers
+   if (bearer.options().busyPoll && !vifPtr->sharedDevice().empty())
+   {
+      TRACE(LOG_NOTICE, "%s busy-poll mode of i/f '%s' left to the shared device", __FUNCTION__, ifname.c_str());
+   }
+   else if (bearer.options().busyPoll && !vifPtr->setBusyPoll(ifname, bearer.options().spinBudget))
+   {
+      TRACE(LOG_WARNING, "%s cannot set busy-poll mode on i/f '%s'", __FUNCTION__, ifname.c_str());
+   }
+
    if (!_rpeer2dev.insert(
                       std::make_pair(bearer.remoteAddr().to_uint32(), ifname))
             .second)
@@ -508,17 +2139,24 @@ bool MpTunnelMgr::addBearer(
       _dev2mpTunnel.insert({ifname, std::move(tg)});
    }
 
-   // There is a single tx thread for all the tunnels
-   if (_tunnelXmitThreadObj == nullptr)
+   updateTunnelMtu(ifname, *vifPtr);
+
+   // There is a single TUN reader for all the tunnels (one per queue of
+   // a shared device), which queues frames on the bearers transmit
+   // schedulers
+   while (_tunnelXmitThreadObjs.size() < vifPtr->queueCount())
    {
-      _tunnelXmitThreadObj.reset(
+      _tunnelXmitThreadObjs.emplace_back(
           new std::thread(
               &MpTunnelMgr::tunnelXmitThreadFunc,
               this,
-              vifPtr));
+              vifPtr,
+              _tunnelXmitThreadObjs.size()));
 
-      if (_tunnelXmitThreadObj == nullptr)
+      if (_tunnelXmitThreadObjs.back() == nullptr)
       {
+         _tunnelXmitThreadObjs.pop_back();
+
          // clean up allocated resources
          _dev2mpTunnel.erase(ifname);
          _rpeer2dev.erase(bearer.remoteAddr().to_uint32());
@@ -526,18 +2164,247 @@ bool MpTunnelMgr::addBearer(
       }
    }
 
-   // Create a receiver thread for this tunnel instance
-   std::thread recv_thread(
-       &MpTunnelMgr::tunnelRecvThreadFunc,
-       ifname, this, vifPtr, tpPtr);
+   // Fragments from any bearer of the tunnel are reassembled together
+   auto &reassembler = _dev2reassembler[ifname];
+
+   if (!reassembler)
+   {
+      const auto &settings = _dev2mtu[ifname];
+      reassembler = std::make_shared<TunnelReassembler>(
+          ifname, settings.reassemblyTimeout, settings.reassemblyMaxPackets);
+   }
+
+   // Create a receiver thread for each shard of this tunnel instance
+   for (size_t shard = 0; shard < tpPtr->rxShardCount(); ++shard)
+   {
+      std::thread recv_thread(
+          &MpTunnelMgr::tunnelRecvThreadFunc,
+          ifname, this, vifPtr, tpPtr, reassembler, shard);
+
+      recv_thread.detach();
+   }
+
+   // Retransmission timers of reliable bearers tick with the keepalives,
+   // which send the reports of the bearers with congestion control too
+   if (tpPtr->arq() || tpPtr->cc())
+   {
+      startKeepaliveThread();
+   }
+
+   // UDP, GTP and GRE bearers drain their transmit scheduler on their own thread
+   if (bearer.getTunnelProtocol() != TunnelProtocol::Tcp)
+   {
+      std::thread xmit_thread(
+          &MpTunnelMgr::tunnelBearerXmitThreadFunc,
+          ifname, this, vifPtr, tpPtr);
+
+      xmit_thread.detach();
+   }
+
+   return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+int MpTunnelMgr::tunnelKeepaliveThreadFunc(MpTunnelMgr *tmPtr)
+{
+   assert(tmPtr);
+
+   ThreadPolicy::getInstance().apply(ThreadRole::Control, "tunnel-keepalive");
+
+   std::vector<TunnelPath::Handle> bearers;
+
+   while (true)
+   {
+      std::this_thread::sleep_for(std::chrono::milliseconds(KEEPALIVE_TICK_MS));
+
+      bearers.clear();
+
+      {
+         lock_guard_t with(tmPtr->_lock);
+
+         for (const auto &tunnel : tmPtr->_dev2mpTunnel)
+         {
+            bearers.insert(bearers.end(), tunnel.second.begin(), tunnel.second.end());
+         }
+      }
+
+      const auto now = TunnelPath::Clock::now();
+
+      for (const auto &tp : bearers)
+      {
+         if (tp->removeReqPending())
+         {
+            continue;
+         }
+
+         if (tp->feedbackDue(now) && !tp->sendFeedback())
+         {
+            TRACE(LOG_DEBUG, "%s feedback on bearer %s dropped", __FUNCTION__, tp->name().c_str());
+         }
+
+         if (tp->arq())
+         {
+            tp->arqTick(now);
+         }
+
+         // Bearers which have sent anything within the interval need no keepalive
+         if (tp->keepaliveDue(now) && !tp->sendKeepalive())
+         {
+            TRACE(LOG_DEBUG, "%s keepalive on bearer %s dropped", __FUNCTION__, tp->name().c_str());
+         }
+      }
+   }
+
+   return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+int MpTunnelMgr::tunnelCopyThreadFunc(MpTunnelMgr *tmPtr)
+{
+   assert(tmPtr);
+
+   ThreadPolicy::getInstance().apply(ThreadRole::Xmit, "tunnel-copies");
+
+   std::vector<DelayedCopy> due;
+   std::vector<char> buf(VirtualIfMgr::MAX_PKT_SIZE + 4 + sizeof(uint64_t));
+
+   while (true)
+   {
+      {
+         std::unique_lock<std::mutex> cs(tmPtr->_copyLock);
+         auto &wheel = tmPtr->_copyWheel;
+
+         // Ticks only while copies are pending
+         if (wheel.empty())
+         {
+            tmPtr->_copyCond.wait(cs, [&]() { return !wheel.empty(); });
+         }
+         else
+         {
+            tmPtr->_copyCond.wait_until(cs, wheel.nextTick());
+         }
+
+         wheel.advance(TunnelPath::Clock::now(), [&](DelayedCopy &&copy) {
+            due.push_back(std::move(copy));
+         });
+      }
+
+      // Queued as the original packets, out of the lock
+      for (auto &copy : due)
+      {
+         TunnelPath &tp = *copy.tp;
+
+         if (tp.removeReqPending())
+         {
+            continue;
+         }
+
+         const size_t len = copy.packet.size();
+
+         memcpy(buf.data() + 4, copy.packet.data(), len);
+         memcpy(buf.data() + 4 + len, &copy.pktid, sizeof(copy.pktid));
+
+         IpPacketParser ipParser(buf.data() + 4, int(len));
+
+         if (queueOnBearer(tp, buf.data(), len, copy.pktid, copy.tc, ipParser, copy.ifname))
+         {
+            tp.touchTx(TunnelPath::Clock::now());
+         }
+      }
+
+      due.clear();
+   }
+
+   return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool MpTunnelMgr::scheduleCopy(
+    const TunnelPath::Handle &tp,
+    const std::string &ifname,
+    const char *packet,
+    size_t len,
+    uint64_t pktid,
+    TrafficClass tc,
+    std::chrono::milliseconds delay)
+{
+   DelayedCopy copy;
+   copy.tp = tp;
+   copy.ifname = ifname;
+   copy.packet.assign(packet, packet + len);
+   copy.pktid = pktid;
+   copy.tc = tc;
+
+   std::lock_guard<std::mutex> cs(_copyLock);
+
+   if (_copyWheel.size() >= COPY_MAX_PENDING)
+   {
+      return false;
+   }
+
+   if (_copyThreadObj == nullptr)
+   {
+      _copyThreadObj.reset(
+          new std::thread(
+              &MpTunnelMgr::tunnelCopyThreadFunc,
+              this));
+   }
+
+   // The thread sleeps while the wheel is empty
+   if (_copyWheel.empty())
+   {
+      _copyCond.notify_one();
+   }
 
-   recv_thread.detach();
+   _copyWheel.schedule(TunnelPath::Clock::now() + delay, std::move(copy));
 
    return true;
 }
 
 /* -------------------------------------------------------------------------- */
 
+void MpTunnelMgr::setActiveBackup(const std::string &ifname, const ActiveBackupSettings &settings)
+{
+   lock_guard_t cs(_lock);
+
+   _dev2backup[ifname] = std::make_shared<ActiveBackup>(ifname, settings);
+
+   startKeepaliveThread();
+}
+
+/* -------------------------------------------------------------------------- */
+
+void MpTunnelMgr::setAdaptiveRedundancy(const std::string &ifname, const AdaptiveSettings &settings)
+{
+   lock_guard_t cs(_lock);
+
+   _dev2adaptive[ifname] = std::make_shared<AdaptiveRedundancy>(ifname, settings);
+
+   // Feedback reports are sent along with the keepalives
+   startKeepaliveThread();
+}
+
+/* -------------------------------------------------------------------------- */
+
+void MpTunnelMgr::startKeepaliveThread()
+{
+   lock_guard_t cs(_lock);
+
+   // Keepalives of the bearers of every tunnel are sent by a single thread
+   if (_keepaliveThreadObj == nullptr)
+   {
+      _keepaliveThreadObj.reset(
+          new std::thread(
+              &MpTunnelMgr::tunnelKeepaliveThreadFunc,
+              this));
+   }
+}
+
+/* -------------------------------------------------------------------------- */
+
 MpTunnelMgr::MpTunnel MpTunnelMgr::getMpTunnel(const std::string &ifname)
 {
    lock_guard_t with(_lock);
@@ -555,6 +2422,89 @@ MpTunnelMgr::MpTunnel MpTunnelMgr::getMpTunnel(const std::string &ifname)
 
 /* -------------------------------------------------------------------------- */
 
+void MpTunnelMgr::updateTunnelMtu(const std::string &ifname, VirtualIfMgr &vif)
+{
+   constexpr int IP_TCP_HEADERS_LEN = 40;
+
+   lock_guard_t with(_lock);
+
+   auto it = _dev2mpTunnel.find(ifname);
+
+   if (it == _dev2mpTunnel.end())
+   {
+      return;
+   }
+
+   auto &tunnelMtu = _dev2mtu[ifname];
+   int mtu = -1;        // smallest MTU of the bearers which do not fragment
+   int minUsable = -1;  // smallest MTU of all the bearers
+
+   for (const auto &tp : it->second)
+   {
+      tp->probePathMtu();
+
+      const int usable = tp->usableMtu();
+
+      if (usable <= 0)
+         continue;
+
+      minUsable = minUsable > 0 ? std::min(minUsable, usable) : usable;
+
+      const bool fragments = tunnelMtu.fragmentation && tp->protocol() == TunnelProtocol::Udp;
+
+      tp->setFragmentThreshold(fragments ? usable : 0);
+
+      if (!fragments)
+         mtu = mtu > 0 ? std::min(mtu, usable) : usable;
+   }
+
+   if (tunnelMtu.fixed > 0)
+   {
+      mtu = tunnelMtu.fixed;
+   }
+   else if (mtu <= 0)
+   {
+      // Either no path MTU is known yet, or every bearer fragments
+      if (minUsable <= 0)
+         return;
+
+      mtu = TUN_DEFAULT_MTU;
+   }
+   else if (mtu < TUN_MIN_MTU)
+   {
+      TRACE(LOG_WARNING, "%s usable MTU of '%s' (%i) below %i, bearers will fragment",
+            __FUNCTION__, ifname.c_str(), mtu, TUN_MIN_MTU);
+      mtu = TUN_MIN_MTU;
+   }
+
+   // TCP segments are sized so that no bearer has to fragment them
+   const int mssMtu = minUsable > 0 ? std::min(mtu, minUsable) : mtu;
+   const uint16_t mss = tunnelMtu.mssClamp ? uint16_t(std::max(mssMtu, TUN_MIN_MTU) - IP_TCP_HEADERS_LEN) : 0;
+
+   for (const auto &tp : it->second)
+   {
+      tp->setMaxMss(mss);
+   }
+
+   if (mtu == tunnelMtu.current)
+   {
+      return;
+   }
+
+   if (!vif.setMtu(ifname, mtu))
+   {
+      TRACE(LOG_WARNING, "%s cannot set MTU %i on i/f '%s': '%s'",
+            __FUNCTION__, mtu, ifname.c_str(), strerror(errno));
+      return;
+   }
+
+   TRACE(LOG_NOTICE, "%s MTU of i/f '%s' set to %i", __FUNCTION__, ifname.c_str(), mtu);
+
+   tunnelMtu.current = mtu;
+}
+
+/* -------------------------------------------------------------------------- */
+
 bool MpTunnelMgr::delMpTunnel(const std::string &ifname) noexcept
 {
    lock_guard_t with(_lock);
@@ -570,15 +2520,27 @@ bool MpTunnelMgr::delMpTunnel(const std::string &ifname) noexcept
          // notify to the receiver thread that
          // we are going to delete the tunnel instance
          tunnelInstance->notifyRemoveReqPending();
+      }
 
+      for (auto &tunnelInstance : mpTunnel->second)
+      {
          // wait until recv thread terminates execution
          tunnelInstance->lock();
-
-         //remove the tunnel instance
-         _dev2mpTunnel.erase(ifname);
-
          tunnelInstance->unlock(); // reset lock counter
       }
+
+      // Every bearer is stopped: remove the tunnel instances (which frees
+      // the list iterated above)
+      _dev2mpTunnel.erase(ifname);
+      _dev2policy.erase(ifname);
+      _dev2mtu.erase(ifname);
+      _dev2reassembler.erase(ifname);
+      _dev2backup.erase(ifname);
+      _dev2adaptive.erase(ifname);
+
+      // Packets of the shared device are no longer sent to it
+      TunnelRouteTable::getInstance().delTunnel(ifname);
+
       return true;
    }
 
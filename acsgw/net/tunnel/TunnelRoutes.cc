@@ -0,0 +1,292 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "TunnelRoutes.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <functional>
+
+/* -------------------------------------------------------------------------- */
+
+TunnelRouteTable &TunnelRouteTable::getInstance()
+{
+    static TunnelRouteTable _instance;
+    return _instance;
+}
+
+/* -------------------------------------------------------------------------- */
+
+TunnelRouteTable::TunnelRouteTable()
+{
+    std::lock_guard<std::mutex> cs(_lock);
+
+    publish();
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelRouteTable::parsePrefix(const std::string &text, uint32_t &addr, unsigned &len)
+{
+    const size_t slash = text.find('/');
+    in_addr inaddr = {0};
+
+    if (::inet_pton(AF_INET, text.substr(0, slash).c_str(), &inaddr) != 1)
+        return false;
+
+    try
+    {
+        len = slash == std::string::npos ? 32 : unsigned(std::stoul(text.substr(slash + 1)));
+    }
+    catch (...)
+    {
+        return false;
+    }
+
+    if (len > 32)
+        return false;
+
+    const uint32_t mask = len == 0 ? 0 : ~uint32_t(0) << (32 - len);
+    addr = ntohl(inaddr.s_addr) & mask;
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TunnelRouteTable::add(uint32_t addr, unsigned len, const std::string &tunnel)
+{
+    len = std::min(len, 32u);
+    addr &= len == 0 ? 0 : ~uint32_t(0) << (32 - len);
+
+    std::lock_guard<std::mutex> cs(_lock);
+
+    auto &route = _routes[Prefix(addr, len)];
+
+    if (route == tunnel)
+        return;
+
+    route = tunnel;
+
+    publish();
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelRouteTable::del(uint32_t addr, unsigned len)
+{
+    len = std::min(len, 32u);
+    addr &= len == 0 ? 0 : ~uint32_t(0) << (32 - len);
+
+    std::lock_guard<std::mutex> cs(_lock);
+
+    if (_routes.erase(Prefix(addr, len)) == 0)
+        return false;
+
+    publish();
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TunnelRouteTable::delTunnel(const std::string &tunnel)
+{
+    std::lock_guard<std::mutex> cs(_lock);
+
+    const size_t count = _routes.size();
+
+    for (auto it = _routes.begin(); it != _routes.end();)
+        it = it->second == tunnel ? _routes.erase(it) : std::next(it);
+
+    if (_routes.size() != count)
+        publish();
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelRouteTable::lookup(uint32_t addr, std::string &tunnel) const
+{
+    // Each reader keeps the trie it took until a change is published
+    thread_local std::shared_ptr<const Trie> trie;
+    thread_local uint64_t version = 0;
+
+    if (!trie || _version.load(std::memory_order_acquire) != version)
+    {
+        std::lock_guard<std::mutex> cs(_lock);
+
+        trie = _trie;
+        version = _version;
+    }
+
+    const TrieNode *node = &trie->nodes[0];
+
+    for (int shift = 28;; shift -= 4)
+    {
+        const TrieEntry &entry = (*node)[(addr >> shift) & 0xf];
+
+        if (entry.child < 0)
+        {
+            if (entry.tunnel == NO_TUNNEL)
+                return false;
+
+            tunnel = trie->tunnels[size_t(entry.tunnel)];
+            return true;
+        }
+
+        node = &trie->nodes[size_t(entry.child)];
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+size_t TunnelRouteTable::size() const
+{
+    std::lock_guard<std::mutex> cs(_lock);
+
+    return _routes.size();
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TunnelRouteTable::setDevice(const std::string &device)
+{
+    std::lock_guard<std::mutex> cs(_lock);
+
+    _device = device;
+}
+
+/* -------------------------------------------------------------------------- */
+
+std::string TunnelRouteTable::device() const
+{
+    std::lock_guard<std::mutex> cs(_lock);
+
+    return _device;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TunnelRouteTable::addDeviceRoute(uint32_t addr, unsigned len)
+{
+    len = std::min(len, 32u);
+    addr &= len == 0 ? 0 : ~uint32_t(0) << (32 - len);
+
+    std::lock_guard<std::mutex> cs(_lock);
+
+    _deviceRoutes.emplace_back(addr, len);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool TunnelRouteTable::deviceCovers(uint32_t addr, unsigned len) const
+{
+    std::lock_guard<std::mutex> cs(_lock);
+
+    return std::any_of(_deviceRoutes.begin(), _deviceRoutes.end(), [&](const Prefix &route) {
+        const uint32_t mask = route.second == 0 ? 0 : ~uint32_t(0) << (32 - route.second);
+        return route.second <= len && (addr & mask) == route.first;
+    });
+}
+
+/* -------------------------------------------------------------------------- */
+
+void TunnelRouteTable::publish()
+{
+    // A prefix ending within a trie node, covering the entries whose
+    // first 'bits' bits are equal to those of 'value'
+    struct NodePrefix
+    {
+        unsigned bits;
+        unsigned value;
+        int32_t tunnel;
+    };
+
+    auto trie = std::make_shared<Trie>();
+    std::vector<std::vector<NodePrefix>> nodePrefixes(1);
+    std::map<std::string, int32_t> tunnelIds;
+    int32_t defaultTunnel = NO_TUNNEL;
+
+    trie->nodes.assign(1, TrieNode());
+
+    // Shorter prefixes first, so that longer ones override them
+    std::vector<std::pair<Prefix, const std::string *>> routes;
+
+    for (const auto &route : _routes)
+        routes.emplace_back(route.first, &route.second);
+
+    std::stable_sort(routes.begin(), routes.end(),
+                     [](const auto &a, const auto &b) { return a.first.second < b.first.second; });
+
+    for (const auto &route : routes)
+    {
+        const uint32_t addr = route.first.first;
+        const unsigned len = route.first.second;
+
+        auto id = tunnelIds.emplace(*route.second, int32_t(trie->tunnels.size()));
+
+        if (id.second)
+            trie->tunnels.push_back(*route.second);
+
+        if (len == 0)
+        {
+            defaultTunnel = id.first->second;
+            continue;
+        }
+
+        // Walk down to the node where the prefix ends
+        const unsigned depth = (len - 1) / 4;
+        size_t node = 0;
+
+        for (unsigned d = 0; d < depth; ++d)
+        {
+            const unsigned nibble = (addr >> (28 - 4 * d)) & 0xf;
+
+            if (trie->nodes[node][nibble].child < 0)
+            {
+                trie->nodes[node][nibble].child = int32_t(trie->nodes.size());
+                trie->nodes.emplace_back();
+                nodePrefixes.emplace_back();
+            }
+
+            node = size_t(trie->nodes[node][nibble].child);
+        }
+
+        nodePrefixes[node].push_back({len - 4 * depth, (addr >> (28 - 4 * depth)) & 0xf, id.first->second});
+    }
+
+    // Every entry holds the tunnel of the longest prefix covering it, so
+    // a lookup just takes the one of the last entry it visits
+    std::function<void(size_t, int32_t)> fill = [&](size_t node, int32_t inherited) {
+        for (unsigned e = 0; e < 16; ++e)
+        {
+            int32_t tunnel = inherited;
+
+            for (const auto &prefix : nodePrefixes[node])
+            {
+                if ((e >> (4 - prefix.bits)) == (prefix.value >> (4 - prefix.bits)))
+                    tunnel = prefix.tunnel;
+            }
+
+            trie->nodes[node][e].tunnel = tunnel;
+
+            if (trie->nodes[node][e].child >= 0)
+                fill(size_t(trie->nodes[node][e].child), tunnel);
+        }
+    };
+
+    fill(0, defaultTunnel);
+
+    _trie = std::move(trie);
+    _version.fetch_add(1, std::memory_order_release);
+
+    TRACE(LOG_DEBUG, "TunnelRouteTable %zu routes, %zu trie nodes", _routes.size(), _trie->nodes.size());
+}
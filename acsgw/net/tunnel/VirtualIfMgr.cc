@@ -30,11 +30,48 @@
 #include "MacAddress.h"
 #include "IpAddress.h"
 #include "TunTap.h"
+#include "TunnelRoutes.h"
+
+#include <algorithm>
+#include <cstring>
+
+/* -------------------------------------------------------------------------- */
+
+bool VirtualIfMgr::setSharedDevice(const std::string &name, size_t queues) noexcept
+{
+   queues = std::max<size_t>(1, std::min<size_t>(queues, MAX_QUEUES));
+
+   // Each queue is a descriptor attached to the same device
+   try
+   {
+      for (size_t i = 0; i < queues; ++i)
+      {
+         _queues.push_back(std::make_shared<TunTap>(name, "", IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE));
+      }
+   }
+   catch (TunTap::Exception e)
+   {
+      _queues.clear();
+      return false;
+   }
+
+   _sharedDev = name;
+   TunnelRouteTable::getInstance().setDevice(name);
+   _unroutedDrops = &Metrics::getInstance().get("tun." + name + ".unrouted_drops");
+
+   return true;
+}
 
 /* -------------------------------------------------------------------------- */
 
 ssize_t VirtualIfMgr::addIf(const std::string &ifname) noexcept
 {
+   // Tunnels of the shared device are just names of its routes
+   if (!_queues.empty()) {
+      _devs.emplace(ifname, _queues.front());
+      return 0;
+   }
+
    if (_devs.find(ifname) == _devs.end()) {
       try 
       {
@@ -74,13 +111,37 @@ ssize_t VirtualIfMgr::announcePacket(
 /* -------------------------------------------------------------------------- */
 
 ssize_t VirtualIfMgr::getPacket(char *buf, size_t bufsize,
-                                std::string &ifname) noexcept
+                                std::string &ifname, size_t queue) noexcept
 {
    assert(buf && bufsize >= 0);
 
    if (bufsize == 0)
       return 0;
 
+   if (!_queues.empty()) {
+      auto &dev = _queues[queue % _queues.size()];
+
+      while (true) {
+         const ssize_t n = dev->readPacket(buf, bufsize);
+
+         if (n <= 0) {
+            return n;
+         }
+
+         // The tunnel is the route of the IPv4 destination
+         if (n >= 20 && (buf[0] & 0xf0) == 0x40) {
+            uint32_t dst = 0;
+            memcpy(&dst, buf + 16, sizeof(dst));
+
+            if (TunnelRouteTable::getInstance().lookup(ntohl(dst), ifname)) {
+               return n;
+            }
+         }
+
+         Metrics::add(*_unroutedDrops, 1);
+      }
+   }
+
    auto it = _devs.begin();
 
    if (it == _devs.end()) {
@@ -97,3 +158,69 @@ ssize_t VirtualIfMgr::getPacket(char *buf, size_t bufsize,
 }
 
 /* -------------------------------------------------------------------------- */
+
+bool VirtualIfMgr::setBusyPoll(
+    const std::string &ifname,
+    std::chrono::microseconds spinBudget) noexcept
+{
+   // The queues of the shared device are read for all of its tunnels:
+   // only the device as a whole can spin
+   if (!_queues.empty()) {
+      if (ifname != _sharedDev) {
+         return false;
+      }
+
+      bool ret = true;
+
+      for (auto &dev : _queues)
+         ret = dev->setBusyPoll(spinBudget) && ret;
+
+      return ret;
+   }
+
+   auto it = _devs.find(ifname);
+
+   if (it == _devs.end()) {
+      return false;
+   }
+
+   return it->second->setBusyPoll(spinBudget);
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool VirtualIfMgr::setMtu(
+    const std::string &ifname,
+    int mtu) noexcept
+{
+   auto it = _devs.find(ifname);
+
+   if (it == _devs.end()) {
+      return false;
+   }
+
+   // No tunnel of the shared device may get packets it cannot carry
+   if (!_queues.empty()) {
+      _mtus[ifname] = mtu;
+
+      int sharedMtu = mtu;
+
+      for (const auto &tunnelMtu : _mtus)
+         sharedMtu = std::min(sharedMtu, tunnelMtu.second);
+
+      if (sharedMtu == _sharedMtu) {
+         return true;
+      }
+
+      if (!_queues.front()->setMtu(sharedMtu)) {
+         return false;
+      }
+
+      _sharedMtu = sharedMtu;
+      return true;
+   }
+
+   return it->second->setMtu(mtu);
+}
+
+/* -------------------------------------------------------------------------- */
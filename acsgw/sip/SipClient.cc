@@ -101,6 +101,7 @@ SipClient::~SipClient()
     if (_connectionMgrHandle)
     {
         _stop = true;
+        _sendMsg.wakeAll();
         _connectionMgrHandle->join();
     }
 }
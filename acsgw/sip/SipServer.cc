@@ -15,6 +15,7 @@
 #include "TextTokenizer.h"
 #include "LogicalIpAddrMgr.h"
 #include "RouteMgr.h"
+#include "TunnelRoutes.h"
 #include "Logger.h"
 
 #include <thread>
@@ -80,6 +81,22 @@ private:
         return ip;
     }
 
+    // Routes ip to a tunnel: its own device, or the shared one, which
+    // hands the packets to the tunnel by inner destination
+    bool addTunnelRoute(const IpAddress &ip, const std::string &tunnelId)
+    {
+        auto &routes = TunnelRouteTable::getInstance();
+        const auto device = routes.device();
+
+        if (device.empty())
+            return _routeMgr.add(ip, tunnelId);
+
+        routes.add(ip.to_uint32(), 32, tunnelId);
+
+        // The shared routes may already lead ip to the device
+        return routes.deviceCovers(ip.to_uint32(), 32) || _routeMgr.add(ip, device);
+    }
+
     bool updateDns() 
     {
         if (_dnsHostsFilename.empty())
@@ -243,7 +260,7 @@ SipResponse::Handle SipServerTask::processRequest(const SipParsedMessage &messag
                 }
 
                 // add local route to ip via tunnelid
-                _routeMgr.add(ip, tunnelId);
+                addTunnelRoute(ip, tunnelId);
 
                 //  SIP/2.0 200 OK
                 //  CSeq: 1 REGISTER
@@ -356,7 +373,7 @@ SipResponse::Handle SipServerTask::processResponse(const SipParsedMessage &messa
         else if (!to.empty() && !tunnelId.empty() && message.isResposeOK())
         {
             // We want to set the route to reach out the serveragent via tunnel i/f
-            _routeMgr.add(IpAddress(to), tunnelId);
+            addTunnelRoute(IpAddress(to), tunnelId);
         }
 
         return std::make_shared<SipResponse>(message, message.getResponseCode());
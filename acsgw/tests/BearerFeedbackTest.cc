@@ -0,0 +1,152 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "BearerFeedback.h"
+#include "Checksum.h"
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+
+#include <cstring>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+using Clock = BearerFeedback::Clock;
+using std::chrono::milliseconds;
+
+const Clock::time_point T0 = Clock::time_point(std::chrono::seconds(1000));
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+TEST(BearerFeedback, CountsLossAcrossSequenceWrap)
+{
+   BearerFeedback receiver;
+   BearerFeedback sender;
+
+   // 100 frames from 65500 (wrapping at 65536), every tenth one lost
+   for (unsigned i = 0; i < 100; ++i)
+   {
+      if (i % 10 != 5)
+         receiver.countFrame(uint16_t(65500 + i), 100);
+   }
+
+   const FeedbackSample sample = sender.applyReport(receiver.makeReport(T0), T0);
+
+   EXPECT_EQ(sample.expected, 100u);
+   EXPECT_EQ(sample.received, 90u);
+   EXPECT_EQ(sample.receivedBytes, 9000u);
+   EXPECT_EQ(sample.highestSeq, uint16_t(65500 + 99));
+
+   // Smoothed with gain 1/8
+   EXPECT_EQ(sender.lossPpm(), 100000u / 8);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(BearerFeedback, LateFramesAreNotExpectedTwice)
+{
+   BearerFeedback receiver;
+
+   for (uint16_t seq : {10, 11, 13, 14, 12, 15})
+      receiver.countFrame(seq, 10);
+
+   FeedbackReport report = receiver.makeReport(T0);
+   EXPECT_EQ(ntohl(report.expected), 6u);
+   EXPECT_EQ(ntohl(report.received), 6u);
+   EXPECT_EQ(ntohl(report.highestSeq), 15u);
+
+   // The next report covers the frames since
+   receiver.countFrame(17, 10);
+
+   report = receiver.makeReport(T0 + milliseconds(100));
+   EXPECT_EQ(ntohl(report.expected), 2u);
+   EXPECT_EQ(ntohl(report.received), 1u);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(BearerFeedback, EchoedTimestampsMeasureRtt)
+{
+   BearerFeedback a;
+   BearerFeedback b;
+
+   // a -> b takes 10 ms, b answers 5 ms later, b -> a takes 5 ms
+   b.applyReport(a.makeReport(T0), T0 + milliseconds(10));
+
+   const FeedbackSample sample = a.applyReport(b.makeReport(T0 + milliseconds(15)), T0 + milliseconds(20));
+
+   EXPECT_EQ(sample.rttUs, 15000);
+   EXPECT_EQ(a.rttUs(), 15000);
+
+   // No timestamp of a was echoed to b yet
+   EXPECT_EQ(b.rttUs(), -1);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(BearerFeedback, ReportIntervalFromPeerTimestamps)
+{
+   BearerFeedback receiver;
+   BearerFeedback sender;
+
+   EXPECT_EQ(sender.applyReport(receiver.makeReport(T0), T0).intervalUs, 0);
+   EXPECT_EQ(sender.applyReport(receiver.makeReport(T0 + milliseconds(20)), T0).intervalUs, 20000);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(BearerFeedback, ReportsDueAndFresh)
+{
+   BearerFeedback receiver;
+   BearerFeedback sender;
+
+   receiver.makeReport(T0);
+   EXPECT_FALSE(receiver.reportDue(T0 + milliseconds(99), milliseconds(100)));
+   EXPECT_TRUE(receiver.reportDue(T0 + milliseconds(100), milliseconds(100)));
+
+   EXPECT_FALSE(sender.fresh(T0, milliseconds(300)));
+   sender.applyReport(receiver.makeReport(T0), T0);
+   EXPECT_TRUE(sender.fresh(T0 + milliseconds(300), milliseconds(300)));
+   EXPECT_FALSE(sender.fresh(T0 + milliseconds(301), milliseconds(300)));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(BearerFeedback, GreReportRoundTrip)
+{
+   BearerFeedback receiver;
+   receiver.countFrame(7, 1000);
+
+   const FeedbackReport report = receiver.makeReport(T0);
+
+   char packet[FEEDBACK_GRE_LEN];
+   ASSERT_EQ(BearerFeedback::makeGreReport(packet, report), size_t(FEEDBACK_GRE_LEN));
+
+   EXPECT_TRUE(Checksum::verifyIpv4Header(packet, sizeof(packet)));
+
+   FeedbackReport parsed;
+   ASSERT_TRUE(BearerFeedback::parseGreReport(packet, sizeof(packet), parsed));
+   EXPECT_EQ(memcmp(&parsed, &report, sizeof(report)), 0);
+
+   // Not a report: length, protocol, addresses
+   EXPECT_FALSE(BearerFeedback::parseGreReport(packet, sizeof(packet) - 1, parsed));
+
+   packet[9] = 17;
+   EXPECT_FALSE(BearerFeedback::parseGreReport(packet, sizeof(packet), parsed));
+
+   packet[9] = char(254);
+   packet[15] = 1;
+   EXPECT_FALSE(BearerFeedback::parseGreReport(packet, sizeof(packet), parsed));
+}
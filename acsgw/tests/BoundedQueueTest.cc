@@ -0,0 +1,261 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "BoundedQueue.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+template <class Queue>
+class BoundedQueueTest : public ::testing::Test
+{
+};
+
+using QueueTypes = ::testing::Types<BoundedQueue<int>, BoundedQueue<int, QueueMode::Spsc>>;
+TYPED_TEST_SUITE(BoundedQueueTest, QueueTypes);
+
+/* -------------------------------------------------------------------------- */
+
+TYPED_TEST(BoundedQueueTest, CapacityIsRoundedUpToPowerOfTwo)
+{
+   TypeParam queue(5);
+
+   EXPECT_EQ(queue.capacity(), 8u);
+   EXPECT_TRUE(queue.empty());
+}
+
+/* -------------------------------------------------------------------------- */
+
+TYPED_TEST(BoundedQueueTest, FullQueueRejectsAndKeepsItem)
+{
+   TypeParam queue(4);
+
+   for (int i = 0; i < 4; ++i)
+      ASSERT_TRUE(queue.push(int(i)));
+
+   int item = 42;
+   EXPECT_FALSE(queue.tryPush(std::move(item)));
+   EXPECT_EQ(item, 42);
+   EXPECT_EQ(queue.size(), 4u);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TYPED_TEST(BoundedQueueTest, WrapsAroundInOrder)
+{
+   TypeParam queue(4);
+   int next = 0;
+   int expected = 0;
+
+   // Indices go many times around the ring, with varying fill levels
+   for (int round = 0; round < 1000; ++round)
+   {
+      const int n = 1 + round % 4;
+
+      for (int i = 0; i < n; ++i)
+         ASSERT_TRUE(queue.push(int(next++)));
+
+      for (int i = 0; i < n; ++i)
+      {
+         int item = -1;
+         ASSERT_TRUE(queue.pop(item, 0));
+         ASSERT_EQ(item, expected++);
+      }
+   }
+
+   int item = -1;
+   EXPECT_FALSE(queue.pop(item, 0));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TYPED_TEST(BoundedQueueTest, PushNStopsWhenFull)
+{
+   TypeParam queue(4);
+   int items[6] = {0, 1, 2, 3, 4, 5};
+
+   EXPECT_EQ(queue.push_n(items, 6), 4u);
+   EXPECT_EQ(queue.size(), 4u);
+
+   int out[8] = {};
+   EXPECT_EQ(queue.pop_n(out, 8, 0), 4u);
+
+   for (int i = 0; i < 4; ++i)
+      EXPECT_EQ(out[i], i);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TYPED_TEST(BoundedQueueTest, PopNAcrossWrapAround)
+{
+   TypeParam queue(8);
+   int next = 0;
+   int expected = 0;
+
+   for (int round = 0; round < 100; ++round)
+   {
+      int items[5];
+      std::iota(items, items + 5, next);
+      ASSERT_EQ(queue.push_n(items, 5), 5u);
+      next += 5;
+
+      int out[3];
+      size_t popped = 0;
+
+      while (popped < 5)
+      {
+         const size_t n = queue.pop_n(out, std::min<size_t>(3, 5 - popped), 0);
+         ASSERT_GT(n, 0u);
+
+         for (size_t i = 0; i < n; ++i)
+            ASSERT_EQ(out[i], expected++);
+
+         popped += n;
+      }
+   }
+}
+
+/* -------------------------------------------------------------------------- */
+
+TYPED_TEST(BoundedQueueTest, PopTimesOutWhenEmpty)
+{
+   TypeParam queue(4);
+   int item = 0;
+
+   const auto start = std::chrono::steady_clock::now();
+
+   EXPECT_FALSE(queue.pop(item, 20));
+   EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+   EXPECT_EQ(queue.pop_n(&item, 1, 0), 0u);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TYPED_TEST(BoundedQueueTest, BlockedPopWakesOnPush)
+{
+   TypeParam queue(4);
+   int item = 0;
+
+   std::thread producer([&queue] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      queue.push(7);
+   });
+
+   EXPECT_TRUE(queue.pop(item, 5000));
+   EXPECT_EQ(item, 7);
+
+   producer.join();
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(BoundedQueue, MoveOnlyItems)
+{
+   BoundedQueue<std::unique_ptr<int>> queue(2);
+
+   ASSERT_TRUE(queue.push(std::make_unique<int>(3)));
+
+   std::unique_ptr<int> item;
+   ASSERT_TRUE(queue.pop(item, 0));
+   ASSERT_TRUE(item);
+   EXPECT_EQ(*item, 3);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(BoundedQueue, DestroysQueuedItems)
+{
+   auto tracker = std::make_shared<int>(0);
+
+   {
+      BoundedQueue<std::shared_ptr<int>, QueueMode::Spsc> spsc(4);
+      BoundedQueue<std::shared_ptr<int>> mpmc(4);
+
+      spsc.push(std::shared_ptr<int>(tracker));
+      mpmc.push(std::shared_ptr<int>(tracker));
+
+      EXPECT_EQ(tracker.use_count(), 3);
+   }
+
+   EXPECT_EQ(tracker.use_count(), 1);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(BoundedQueue, MpmcDeliversEveryItemOnce)
+{
+   constexpr int PRODUCERS = 4;
+   constexpr int ITEMS = 20000;
+
+   BoundedQueue<int> queue(64);
+   std::vector<std::thread> threads;
+   std::vector<long> sums(PRODUCERS, 0);
+
+   for (int p = 0; p < PRODUCERS; ++p)
+   {
+      threads.emplace_back([&queue, p] {
+         for (int i = 0; i < ITEMS; ++i)
+         {
+            while (!queue.push(p * ITEMS + i))
+               std::this_thread::yield();
+         }
+      });
+
+      threads.emplace_back([&queue, &sums, p] {
+         int item = 0;
+
+         for (int i = 0; i < ITEMS; ++i)
+         {
+            ASSERT_TRUE(queue.pop(item, 5000));
+            sums[p] += item;
+         }
+      });
+   }
+
+   for (auto &thread : threads)
+      thread.join();
+
+   const long total = PRODUCERS * ITEMS;
+   EXPECT_EQ(std::accumulate(sums.begin(), sums.end(), 0L), total * (total - 1) / 2);
+   EXPECT_TRUE(queue.empty());
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(BoundedQueue, SpscKeepsOrderAcrossThreads)
+{
+   constexpr int ITEMS = 100000;
+
+   BoundedQueue<int, QueueMode::Spsc> queue(16);
+
+   std::thread producer([&queue] {
+      for (int i = 0; i < ITEMS; ++i)
+      {
+         while (!queue.push(int(i)))
+            std::this_thread::yield();
+      }
+   });
+
+   int item = -1;
+
+   for (int i = 0; i < ITEMS; ++i)
+   {
+      ASSERT_TRUE(queue.pop(item, 5000));
+      ASSERT_EQ(item, i);
+   }
+
+   producer.join();
+}
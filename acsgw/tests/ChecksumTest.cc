@@ -0,0 +1,180 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "Checksum.h"
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+const char *const KERNELS[] = {"scalar", "sse2", "avx2"};
+
+// Folded sum in network order, by 16-bit words (RFC 1071)
+uint16_t reference(const uint8_t *data, size_t len)
+{
+   uint32_t sum = 0;
+
+   for (size_t i = 0; i < len; i += 2)
+   {
+      sum += uint32_t(data[i]) << 8;
+
+      if (i + 1 < len)
+         sum += data[i + 1];
+
+      sum = (sum & 0xffff) + (sum >> 16);
+   }
+
+   return uint16_t(sum);
+}
+
+uint16_t kernelSum(Checksum::SumKernel kernel, const void *data, size_t len)
+{
+   return ntohs(Checksum::fold(kernel(data, len, 0)));
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+TEST(Checksum, Rfc1071Example)
+{
+   const uint8_t data[] = {0x00, 0x01, 0xf2, 0x03, 0xf4, 0xf5, 0xf6, 0xf7};
+
+   EXPECT_EQ(ntohs(Checksum::fold(Checksum::sum(data, sizeof(data)))), 0xddf2);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(Checksum, VerifiesIpv4Header)
+{
+   uint8_t header[] = {0x45, 0x00, 0x00, 0x73, 0x00, 0x00, 0x40, 0x00, 0x40, 0x11,
+                       0xb8, 0x61, 0xc0, 0xa8, 0x00, 0x01, 0xc0, 0xa8, 0x00, 0xc7};
+
+   EXPECT_TRUE(Checksum::verifyIpv4Header(reinterpret_cast<const char *>(header), sizeof(header)));
+
+   header[10] = header[11] = 0;
+   const uint16_t checksum = Checksum::compute(header, sizeof(header));
+   EXPECT_EQ(ntohs(checksum), 0xb861);
+
+   header[15] = 2;
+   EXPECT_FALSE(Checksum::verifyIpv4Header(reinterpret_cast<const char *>(header), sizeof(header)));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(Checksum, IncrementalUpdate)
+{
+   uint8_t header[] = {0x45, 0x00, 0x00, 0x73, 0x00, 0x00, 0x40, 0x00, 0x40, 0x11,
+                       0xb8, 0x61, 0xc0, 0xa8, 0x00, 0x01, 0xc0, 0xa8, 0x00, 0xc7};
+
+   uint16_t checksum;
+   memcpy(&checksum, header + 10, sizeof(checksum));
+
+   // New source address
+   uint32_t oldAddr, newAddr = htonl(0x0a000001);
+   memcpy(&oldAddr, header + 12, sizeof(oldAddr));
+   memcpy(header + 12, &newAddr, sizeof(newAddr));
+
+   checksum = Checksum::update(checksum, oldAddr, newAddr);
+   memcpy(header + 10, &checksum, sizeof(checksum));
+
+   EXPECT_TRUE(Checksum::verify(header, sizeof(header)));
+
+   // New TTL and protocol
+   uint16_t oldWord, newWord = htons(0x3f06);
+   memcpy(&oldWord, header + 8, sizeof(oldWord));
+   memcpy(header + 8, &newWord, sizeof(newWord));
+
+   checksum = Checksum::update(checksum, oldWord, newWord);
+   memcpy(header + 10, &checksum, sizeof(checksum));
+
+   EXPECT_TRUE(Checksum::verify(header, sizeof(header)));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(Checksum, KernelsKnownAnswers)
+{
+   // Bytes 0x01, of odd length: words 0x0101 and a trailing 0x0100
+   const std::vector<uint8_t> ones(1 + 2 * 100, 0x01);
+
+   // Bytes 0xff: carries wrap around at every word, the trailing byte of
+   // an odd length is 0xff00
+   const std::vector<uint8_t> full(65535, 0xff);
+
+   for (const char *name : KERNELS)
+   {
+      const auto kernel = Checksum::findKernel(name);
+
+      if (!kernel)
+         continue;
+
+      EXPECT_EQ(kernelSum(kernel, ones.data(), ones.size()), 100 * 0x0101 + 0x0100) << name;
+      EXPECT_EQ(kernelSum(kernel, ones.data() + 1, ones.size() - 1), 100 * 0x0101) << name;
+      EXPECT_EQ(kernelSum(kernel, full.data(), full.size() - 1), 0xffff) << name;
+      EXPECT_EQ(kernelSum(kernel, full.data(), full.size()), 0xff00) << name;
+      EXPECT_EQ(kernelSum(kernel, full.data(), 0), 0) << name;
+   }
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(Checksum, KernelsMatchReference)
+{
+   std::mt19937 rng(1);
+   std::vector<uint8_t> data(2048 + 64);
+
+   for (auto &byte : data)
+      byte = uint8_t(rng());
+
+   size_t kernels = 0;
+
+   for (const char *name : KERNELS)
+   {
+      const auto kernel = Checksum::findKernel(name);
+
+      if (!kernel)
+         continue;
+
+      ++kernels;
+
+      // Every length around the loop strides, at unaligned starts
+      for (size_t offset = 0; offset < 8; ++offset)
+      {
+         for (size_t len = 0; len <= 300; ++len)
+         {
+            ASSERT_EQ(kernelSum(kernel, data.data() + offset, len), reference(data.data() + offset, len))
+               << name << " offset " << offset << " length " << len;
+         }
+
+         for (size_t len : {1399, 1400, 1401, 2047, 2048})
+         {
+            ASSERT_EQ(kernelSum(kernel, data.data() + offset, len), reference(data.data() + offset, len))
+               << name << " offset " << offset << " length " << len;
+         }
+      }
+
+      // The initial sum is added
+      EXPECT_EQ(Checksum::fold(kernel(data.data(), 1400, 0x12345)),
+                Checksum::fold(kernel(data.data(), 1400, 0) + 0x12345))
+         << name;
+   }
+
+   EXPECT_GE(kernels, 1u);
+   EXPECT_TRUE(Checksum::findKernel("neon") == nullptr);
+}
@@ -0,0 +1,99 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "CongestionControl.h"
+
+#include <gtest/gtest.h>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+constexpr auto REPORT_INTERVAL = std::chrono::milliseconds(20);
+constexpr size_t FRAME_LEN = 1000;
+
+// Report of frames received up to highestSeq, at 1 MB/s with a 10 ms RTT
+FeedbackSample makeSample(uint16_t highestSeq)
+{
+   FeedbackSample sample;
+   sample.expected = 20;
+   sample.received = 20;
+   sample.receivedBytes = 20000;
+   sample.intervalUs = 20000;
+   sample.rttUs = 10000;
+   sample.highestSeq = highestSeq;
+
+   return sample;
+}
+
+// Sends frames until the window is full, returns the next sequence number
+uint16_t fillWindow(CongestionControl &cc, uint16_t seq)
+{
+   while (!cc.windowFull())
+      cc.onSend(seq++, FRAME_LEN);
+
+   return seq;
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+TEST(CongestionControl, ReportsOpenTheWindow)
+{
+   CongestionControl cc("test.cc_reports", REPORT_INTERVAL);
+
+   cc.onSend(0, FRAME_LEN);
+   cc.onFeedback(makeSample(0), CongestionControl::Clock::now());
+
+   const uint16_t next = fillWindow(cc, 1);
+   EXPECT_FALSE(cc.awaitWindow(std::chrono::milliseconds(1)));
+
+   // Every frame but the last one received
+   cc.onFeedback(makeSample(uint16_t(next - 2)), CongestionControl::Clock::now());
+
+   EXPECT_FALSE(cc.windowFull());
+   EXPECT_TRUE(cc.awaitWindow(std::chrono::milliseconds(1)));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(CongestionControl, UnreportedFramesAreLostAfterTimeout)
+{
+   CongestionControl cc("test.cc_loss", REPORT_INTERVAL);
+
+   cc.onSend(0, FRAME_LEN);
+   cc.onFeedback(makeSample(0), CongestionControl::Clock::now());
+
+   const uint64_t rate = cc.rate();
+   uint16_t next = fillWindow(cc, 1);
+
+   // No more reports (the path is down): the window opens again after
+   // twice the RTT plus a report interval, at half the rate
+   const auto start = CongestionControl::Clock::now();
+
+   EXPECT_TRUE(cc.awaitWindow(std::chrono::milliseconds(1000)));
+   EXPECT_GE(CongestionControl::Clock::now() - start, std::chrono::milliseconds(35));
+   EXPECT_FALSE(cc.windowFull());
+   EXPECT_LE(cc.rate(), rate / 2);
+
+   // A late report of a frame sent before the timeout does not count
+   // the frames sent since as delivered (nor gives a bandwidth sample)
+   next = fillWindow(cc, next);
+
+   FeedbackSample late = makeSample(5);
+   late.intervalUs = 0;
+   cc.onFeedback(late, CongestionControl::Clock::now());
+
+   EXPECT_TRUE(cc.windowFull());
+
+   cc.onFeedback(makeSample(uint16_t(next - 1)), CongestionControl::Clock::now());
+   EXPECT_FALSE(cc.windowFull());
+}
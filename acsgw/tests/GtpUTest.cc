@@ -0,0 +1,146 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "GtpU.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+TEST(GtpU, TpduRoundTrip)
+{
+   const std::vector<char> payload(100, 'p');
+
+   gtp1_header_long header;
+   GtpU::makeTpduHeader(header, 0x01020304, 777, payload.size());
+
+   std::vector<char> msg(sizeof(header));
+   memcpy(msg.data(), &header, sizeof(header));
+   msg.insert(msg.end(), payload.begin(), payload.end());
+
+   GtpU::Message parsed;
+   ASSERT_TRUE(GtpU::parse(msg.data(), msg.size(), parsed));
+
+   EXPECT_EQ(parsed.type, GtpU::MSG_TPDU);
+   EXPECT_EQ(parsed.teid, 0x01020304u);
+   EXPECT_TRUE(parsed.hasSeq);
+   EXPECT_EQ(parsed.seq, 777);
+   EXPECT_EQ(parsed.payloadOffset, GtpU::LONG_HEADER_LEN);
+   EXPECT_EQ(parsed.payloadLen, payload.size());
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(GtpU, ShortHeaderHasNoSequence)
+{
+   gtp1_header_short header;
+   header.flags = GtpU::FLAGS_V1;
+   header.type = GtpU::MSG_TPDU;
+   header.length = htons(4);
+   header.tei = htonl(5);
+
+   char msg[sizeof(header) + 4] = {};
+   memcpy(msg, &header, sizeof(header));
+
+   GtpU::Message parsed;
+   ASSERT_TRUE(GtpU::parse(msg, sizeof(msg), parsed));
+
+   EXPECT_FALSE(parsed.hasSeq);
+   EXPECT_EQ(parsed.teid, 5u);
+   EXPECT_EQ(parsed.payloadOffset, GtpU::SHORT_HEADER_LEN);
+   EXPECT_EQ(parsed.payloadLen, 4u);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(GtpU, SkipsExtensionHeaders)
+{
+   // Long header announcing an extension of 4 bytes, then a payload of 3
+   gtp1_header_long header;
+   GtpU::makeTpduHeader(header, 9, 1, 4 + 3);
+   header.flags |= GtpU::FLAG_E;
+   header.next = 0x85;
+
+   std::vector<char> msg(sizeof(header));
+   memcpy(msg.data(), &header, sizeof(header));
+
+   const char extension[] = {1, 0x10, 0x20, 0}; // length 1 (x4), no next one
+   msg.insert(msg.end(), extension, extension + sizeof(extension));
+   msg.insert(msg.end(), {'a', 'b', 'c'});
+
+   GtpU::Message parsed;
+   ASSERT_TRUE(GtpU::parse(msg.data(), msg.size(), parsed));
+
+   EXPECT_EQ(parsed.payloadOffset, GtpU::LONG_HEADER_LEN + 4);
+   EXPECT_EQ(parsed.payloadLen, 3u);
+   EXPECT_EQ(msg[parsed.payloadOffset], 'a');
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(GtpU, RejectsMalformedMessages)
+{
+   gtp1_header_long header;
+   GtpU::makeTpduHeader(header, 9, 1, 10);
+
+   std::vector<char> msg(sizeof(header) + 10);
+   memcpy(msg.data(), &header, sizeof(header));
+
+   GtpU::Message parsed;
+
+   // Truncated
+   EXPECT_FALSE(GtpU::parse(msg.data(), msg.size() - 1, parsed));
+   EXPECT_FALSE(GtpU::parse(msg.data(), GtpU::SHORT_HEADER_LEN - 1, parsed));
+
+   // GTP version 2
+   msg[0] = char(0x48);
+   EXPECT_FALSE(GtpU::parse(msg.data(), msg.size(), parsed));
+
+   // Extension header of length 0
+   header.flags |= GtpU::FLAG_E;
+   header.next = 0x85;
+   memcpy(msg.data(), &header, sizeof(header));
+   msg[sizeof(header)] = 0;
+   EXPECT_FALSE(GtpU::parse(msg.data(), msg.size(), parsed));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(GtpU, EchoResponseAnswersRequest)
+{
+   char request[GtpU::LONG_HEADER_LEN];
+   const size_t requestLen = GtpU::makeEchoRequest(42, request);
+
+   GtpU::Message parsedRequest;
+   ASSERT_TRUE(GtpU::parse(request, requestLen, parsedRequest));
+   EXPECT_EQ(parsedRequest.type, GtpU::MSG_ECHO_REQUEST);
+   EXPECT_EQ(parsedRequest.teid, 0u);
+
+   char response[GtpU::LONG_HEADER_LEN + 2];
+   const size_t responseLen = GtpU::makeEchoResponse(parsedRequest, response);
+
+   GtpU::Message parsedResponse;
+   ASSERT_TRUE(GtpU::parse(response, responseLen, parsedResponse));
+   EXPECT_EQ(parsedResponse.type, GtpU::MSG_ECHO_RESPONSE);
+   EXPECT_EQ(parsedResponse.seq, 42);
+   EXPECT_EQ(parsedResponse.payloadLen, 2u);
+   EXPECT_EQ(response[parsedResponse.payloadOffset], char(GtpU::IE_RECOVERY));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(GtpU, PktIdsOfCopiesMatch)
+{
+   EXPECT_EQ(GtpU::makePktId(7, 100), GtpU::makePktId(7, 100));
+   EXPECT_NE(GtpU::makePktId(7, 100), GtpU::makePktId(8, 100));
+   EXPECT_NE(GtpU::makePktId(7, 100), GtpU::makePktId(7, 101));
+}
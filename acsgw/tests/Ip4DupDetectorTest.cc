@@ -0,0 +1,57 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "IpPacketParser.h"
+
+#include <gtest/gtest.h>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+using Clock = Ip4DupDetector::Clock;
+using std::chrono::milliseconds;
+
+const Clock::time_point T0 = Clock::time_point(std::chrono::seconds(1000));
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+TEST(Ip4DupDetector, CopiesWithinTheRetentionAreDropped)
+{
+   Ip4DupDetector detector(milliseconds(2000));
+
+   EXPECT_FALSE(detector.isADuplicated(1, T0));
+   EXPECT_TRUE(detector.isADuplicated(1, T0 + milliseconds(1999)));
+
+   // Forgotten afterwards: a new packet with the same (wrapped) id
+   EXPECT_FALSE(detector.isADuplicated(1, T0 + milliseconds(2000)));
+   EXPECT_TRUE(detector.isADuplicated(1, T0 + milliseconds(2001)));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(Ip4DupDetector, RetentionDoesNotDependOnThePacketRate)
+{
+   Ip4DupDetector detector(milliseconds(2000));
+
+   // 100 kpps for one second: the first copies are remembered, unlike
+   // with a history of a fixed number of ids
+   for (uint64_t id = 0; id < 100000; ++id)
+      ASSERT_FALSE(detector.isADuplicated(id, T0 + std::chrono::microseconds(10 * id)));
+
+   const auto late = T0 + milliseconds(1000);
+
+   for (uint64_t id = 0; id < 100000; id += 997)
+      EXPECT_TRUE(detector.isADuplicated(id, late)) << id;
+
+   EXPECT_FALSE(detector.isADuplicated(100000, late));
+}
@@ -0,0 +1,234 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "MemoryGovernor.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+using std::chrono::milliseconds;
+using Clock = std::chrono::steady_clock;
+
+// 100 kB of budget: the classes are admitted up to 50, 70, 90 and 100 kB
+class MemoryGovernorTest : public ::testing::Test
+{
+protected:
+   MemoryGovernor &governor = MemoryGovernor::getInstance();
+   ByteBudget queue;
+
+   void SetUp() override
+   {
+      Config config;
+      config.selectNameSpace("memory");
+      config.add("gateway_budget_kb", "100", Config::Type::NUMBER);
+      config.add("backpressure_timeout_ms", "50", Config::Type::NUMBER);
+
+      ASSERT_TRUE(governor.configure(config));
+      ASSERT_EQ(governor.used(), 0u);
+   }
+
+   void TearDown() override
+   {
+      EXPECT_EQ(governor.used(), 0u);
+      EXPECT_EQ(queue.used(), 0u);
+   }
+
+   MemoryCharge admit(size_t bytes, TrafficClass tc, bool mayWait = false)
+   {
+      return governor.admit(queue, bytes, tc, mayWait);
+   }
+
+   static uint64_t drops(const char *tc)
+   {
+      return Metrics::getInstance().get(std::string("memory.") + tc + "_drops");
+   }
+};
+
+constexpr size_t KB = 1024;
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+TEST_F(MemoryGovernorTest, LowerClassesAreDroppedFirst)
+{
+   const uint64_t bulkDrops = drops("bulk");
+   const uint64_t defaultDrops = drops("default");
+
+   MemoryCharge a = admit(60 * KB, TrafficClass::Default);
+   ASSERT_EQ(a.bytes(), 60 * KB);
+
+   // Over the bulk threshold
+   EXPECT_EQ(admit(1, TrafficClass::Bulk).bytes(), 0u);
+   EXPECT_EQ(drops("bulk"), bulkDrops + 1);
+
+   // Up to the default threshold, but not past it
+   MemoryCharge b = admit(10 * KB, TrafficClass::Default);
+   EXPECT_EQ(b.bytes(), 10 * KB);
+   EXPECT_EQ(admit(KB + 1, TrafficClass::Default).bytes(), 0u);
+   EXPECT_EQ(drops("default"), defaultDrops + 1);
+
+   MemoryCharge c = admit(20 * KB, TrafficClass::Interactive);
+   EXPECT_EQ(c.bytes(), 20 * KB);
+   EXPECT_EQ(admit(1, TrafficClass::Interactive).bytes(), 0u);
+
+   MemoryCharge d = admit(10 * KB, TrafficClass::Critical);
+   EXPECT_EQ(d.bytes(), 10 * KB);
+   EXPECT_EQ(admit(1, TrafficClass::Critical).bytes(), 0u);
+
+   // Dropped frames are not charged to their queue either
+   EXPECT_EQ(governor.used(), 100 * KB);
+   EXPECT_EQ(queue.used(), 100 * KB);
+
+   // Released memory is available again
+   a.reset();
+   EXPECT_EQ(admit(KB, TrafficClass::Bulk).bytes(), KB);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST_F(MemoryGovernorTest, EmptyQueuesAlwaysAcceptAFrame)
+{
+   ByteBudget small(1000);
+
+   // Larger than the limit, but the queue is empty
+   ASSERT_TRUE(small.tryCharge(5000));
+   EXPECT_FALSE(small.tryCharge(1));
+
+   small.release(5000);
+   EXPECT_TRUE(small.tryCharge(1));
+   small.release(1);
+
+   // Likewise the gateway: a frame larger than the class share is
+   // admitted if nothing is queued
+   EXPECT_EQ(admit(80 * KB, TrafficClass::Bulk).bytes(), 80 * KB);
+
+   // A queue over its limit drops the frame before the gateway is charged
+   queue.setLimit(10 * KB);
+
+   MemoryCharge a = admit(8 * KB, TrafficClass::Critical);
+   EXPECT_EQ(admit(4 * KB, TrafficClass::Critical).bytes(), 0u);
+   EXPECT_EQ(governor.used(), 8 * KB);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST_F(MemoryGovernorTest, CriticalFramesWaitForMemoryBriefly)
+{
+   const auto waits = Metrics::getInstance().get("memory.backpressure_waits").load();
+
+   MemoryCharge full = admit(100 * KB, TrafficClass::Critical);
+   ASSERT_EQ(full.bytes(), 100 * KB);
+
+   // Other classes, or callers which cannot wait, are dropped at once
+   auto start = Clock::now();
+   EXPECT_EQ(admit(KB, TrafficClass::Interactive, true).bytes(), 0u);
+   EXPECT_EQ(admit(KB, TrafficClass::Critical, false).bytes(), 0u);
+   EXPECT_LT(Clock::now() - start, milliseconds(40));
+
+   // Admitted as soon as memory is released
+   std::thread consumer([&]() {
+      std::this_thread::sleep_for(milliseconds(10));
+      full.reset();
+   });
+
+   start = Clock::now();
+   MemoryCharge a = admit(KB, TrafficClass::Critical, true);
+   consumer.join();
+
+   EXPECT_EQ(a.bytes(), KB);
+   EXPECT_LT(Clock::now() - start, milliseconds(45));
+
+   // Dropped after the backpressure timeout
+   MemoryCharge b = admit(99 * KB, TrafficClass::Critical);
+   ASSERT_EQ(b.bytes(), 99 * KB);
+
+   start = Clock::now();
+   EXPECT_EQ(admit(KB, TrafficClass::Critical, true).bytes(), 0u);
+   EXPECT_GE(Clock::now() - start, milliseconds(50));
+
+   EXPECT_EQ(Metrics::getInstance().get("memory.backpressure_waits"), waits + 2);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST_F(MemoryGovernorTest, MergeTakesOverChargesOfTheSameBudgets)
+{
+   ByteBudget other;
+
+   MemoryCharge a = admit(KB, TrafficClass::Default);
+   MemoryCharge b = admit(2 * KB, TrafficClass::Default);
+
+   a.merge(std::move(b));
+   EXPECT_EQ(a.bytes(), 3 * KB);
+   EXPECT_EQ(b.bytes(), 0u);
+
+   // Other queue, or not charged to the gateway: kept apart
+   MemoryCharge c = governor.admit(other, KB, TrafficClass::Default, false);
+   a.merge(std::move(c));
+   EXPECT_EQ(a.bytes(), 3 * KB);
+   EXPECT_EQ(c.bytes(), KB);
+
+   MemoryCharge local = MemoryGovernor::admitLocal(queue, KB);
+   a.merge(std::move(local));
+   EXPECT_EQ(local.bytes(), KB);
+
+   // An empty charge takes over any other
+   MemoryCharge empty;
+   empty.merge(std::move(local));
+   EXPECT_EQ(empty.bytes(), KB);
+   EXPECT_EQ(local.bytes(), 0u);
+
+   EXPECT_EQ(governor.used(), 4 * KB);
+   EXPECT_EQ(queue.used(), 4 * KB);
+
+   // Released once, whole
+   a.reset();
+   empty.reset();
+   c.reset();
+
+   EXPECT_EQ(other.used(), 0u);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST_F(MemoryGovernorTest, LocalChargesWaitForTheQueueToDrain)
+{
+   queue.setLimit(10 * KB);
+
+   MemoryCharge full = MemoryGovernor::admitLocal(queue, 10 * KB);
+   ASSERT_EQ(full.bytes(), 10 * KB);
+
+   EXPECT_EQ(MemoryGovernor::admitLocal(queue, KB).bytes(), 0u);
+
+   auto start = Clock::now();
+   EXPECT_EQ(MemoryGovernor::admitLocal(queue, KB, milliseconds(20)).bytes(), 0u);
+   EXPECT_GE(Clock::now() - start, milliseconds(20));
+
+   std::thread consumer([&]() {
+      std::this_thread::sleep_for(milliseconds(10));
+      full.reset();
+   });
+
+   start = Clock::now();
+   MemoryCharge a = MemoryGovernor::admitLocal(queue, KB, milliseconds(1000));
+   consumer.join();
+
+   EXPECT_EQ(a.bytes(), KB);
+   EXPECT_LT(Clock::now() - start, milliseconds(500));
+
+   // Local charges do not use the gateway budget
+   EXPECT_EQ(governor.used(), 0u);
+}
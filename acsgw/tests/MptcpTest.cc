@@ -0,0 +1,157 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "TcpConnectionMgr.h"
+#include "TcpListener.h"
+#include "TcpSocket.h"
+
+#include <gtest/gtest.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+#ifndef IPPROTO_MPTCP
+#define IPPROTO_MPTCP 262
+#endif
+
+bool mptcpAvailable()
+{
+   const int sd = ::socket(AF_INET, SOCK_STREAM, IPPROTO_MPTCP);
+
+   if (sd < 0)
+      return false;
+
+   ::close(sd);
+   return true;
+}
+
+// Connection over loopback, between a client and a listener opened as
+// MPTCP ones or not
+struct Connection
+{
+   TcpListener::Handle listener;
+   TcpSocket::Handle client;
+   TcpSocket::Handle server;
+
+   Connection(bool clientMptcp, bool serverMptcp)
+   {
+      listener = TcpListener::create(serverMptcp);
+
+      if (!listener->bind("127.0.0.1", 0) || !listener->listen())
+         return;
+
+      sockaddr_in sin = {};
+      socklen_t len = sizeof(sin);
+
+      if (::getsockname(listener->getSocketFd(), reinterpret_cast<sockaddr *>(&sin), &len) < 0)
+         return;
+
+      client = TcpSocket::make("127.0.0.1", ntohs(sin.sin_port), true, clientMptcp);
+
+      if (client && client->connect())
+         server = listener->accept();
+   }
+};
+
+// Exposes the MPTCP accounting of the subflow connections
+class MptcpBearer : public TcpConnectionMgr
+{
+public:
+   explicit MptcpBearer(TranspPort port) : TcpConnectionMgr(IpAddress("127.0.0.1"), port)
+   {
+      setMptcp(true);
+   }
+
+   void connected(const TcpSocket::Handle &socket)
+   {
+      Subflow sf;
+      sf.socket = socket;
+      checkMptcp(sf);
+   }
+
+   static uint64_t metric(TranspPort port, const char *what)
+   {
+      return Metrics::getInstance().get("tcp_bearer.127.0.0.1:" + std::to_string(port) + "." + what);
+   }
+};
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+TEST(Mptcp, ConnectionOverLoopback)
+{
+   if (!mptcpAvailable())
+      GTEST_SKIP() << "IPPROTO_MPTCP not available";
+
+   Connection conn(true, true);
+
+   ASSERT_TRUE(conn.server);
+   EXPECT_TRUE(conn.client->isMptcp());
+   EXPECT_TRUE(conn.server->isMptcp());
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(Mptcp, FallsBackToTcp)
+{
+   if (!mptcpAvailable())
+      GTEST_SKIP() << "IPPROTO_MPTCP not available";
+
+   // A plain TCP peer, either end
+   Connection toTcp(true, false);
+
+   ASSERT_TRUE(toTcp.server);
+   EXPECT_FALSE(toTcp.client->isMptcp());
+   EXPECT_FALSE(toTcp.server->isMptcp());
+
+   Connection fromTcp(false, true);
+
+   ASSERT_TRUE(fromTcp.server);
+   EXPECT_FALSE(fromTcp.client->isMptcp());
+   EXPECT_FALSE(fromTcp.server->isMptcp());
+
+   // Data still flows
+   const char msg[] = "ping";
+   char buf[sizeof(msg)] = {0};
+
+   ASSERT_EQ(::send(toTcp.client->getSocketFd(), msg, sizeof(msg), 0), ssize_t(sizeof(msg)));
+   ASSERT_EQ(::recv(toTcp.server->getSocketFd(), buf, sizeof(buf), MSG_WAITALL), ssize_t(sizeof(msg)));
+   EXPECT_STREQ(buf, msg);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(Mptcp, ConnectionsAndFallbacksAreCounted)
+{
+   if (!mptcpAvailable())
+      GTEST_SKIP() << "IPPROTO_MPTCP not available";
+
+   const TcpConnectionMgr::TranspPort port = 65001;
+   MptcpBearer bearer(port);
+
+   Connection mptcp(true, true);
+   Connection fallback(true, false);
+
+   ASSERT_TRUE(mptcp.server);
+   ASSERT_TRUE(fallback.server);
+
+   bearer.connected(mptcp.client);
+   bearer.connected(mptcp.server);
+   bearer.connected(fallback.client);
+
+   EXPECT_EQ(MptcpBearer::metric(port, "mptcp_connections"), 2u);
+   EXPECT_EQ(MptcpBearer::metric(port, "mptcp_fallbacks"), 1u);
+}
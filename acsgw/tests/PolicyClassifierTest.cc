@@ -0,0 +1,267 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "PolicyClassifier.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+using Rule = PolicyClassifier::Rule;
+
+struct Packet
+{
+   uint32_t src = 0;
+   uint32_t dst = 0;
+   uint8_t protocol = 0;
+   bool hasPorts = false;
+   uint16_t srcPort = 0;
+   uint16_t dstPort = 0;
+   uint8_t dscp = 0;
+};
+
+bool inPrefixes(const std::vector<PolicyClassifier::Prefix> &prefixes, uint32_t addr)
+{
+   return prefixes.empty() ||
+      std::any_of(prefixes.begin(), prefixes.end(), [addr](const PolicyClassifier::Prefix &p) {
+         const uint32_t mask = p.len == 0 ? 0 : ~uint32_t(0) << (32 - p.len);
+         return (addr & mask) == p.addr;
+      });
+}
+
+bool inPorts(const std::vector<PolicyClassifier::PortRange> &ranges, bool hasPorts, uint16_t port)
+{
+   if (ranges.empty())
+      return true;
+
+   return hasPorts && std::any_of(ranges.begin(), ranges.end(), [port](const PolicyClassifier::PortRange &r) {
+             return port >= r.first && port <= r.last;
+          });
+}
+
+// First matching rule, by linear scan
+int reference(const std::vector<Rule> &rules, const Packet &pkt)
+{
+   for (size_t i = 0; i < rules.size(); ++i)
+   {
+      const Rule &rule = rules[i];
+
+      if (inPrefixes(rule.srcPrefixes, pkt.src) && inPrefixes(rule.dstPrefixes, pkt.dst) &&
+          (rule.protocol < 0 || rule.protocol == pkt.protocol) &&
+          inPorts(rule.srcPorts, pkt.hasPorts, pkt.srcPort) &&
+          inPorts(rule.dstPorts, pkt.hasPorts, pkt.dstPort) &&
+          (rule.dscps.empty() || std::find(rule.dscps.begin(), rule.dscps.end(), pkt.dscp) != rule.dscps.end()))
+      {
+         return int(i);
+      }
+   }
+
+   return PolicyClassifier::NO_MATCH;
+}
+
+int classify(const PolicyClassifier &classifier, const Packet &pkt)
+{
+   return classifier.classify(pkt.src, pkt.dst, pkt.protocol, pkt.hasPorts, pkt.srcPort, pkt.dstPort, pkt.dscp);
+}
+
+PolicyClassifier::Prefix prefix(uint32_t addr, unsigned len)
+{
+   PolicyClassifier::Prefix p;
+   p.addr = len == 0 ? 0 : addr & (~uint32_t(0) << (32 - len));
+   p.len = len;
+   return p;
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+TEST(PolicyClassifier, EmptyClassifierMatchesNothing)
+{
+   PolicyClassifier classifier;
+
+   EXPECT_EQ(classifier.classify(0x0a000001, 0x0a000002, 17, true, 1, 2, 0), PolicyClassifier::NO_MATCH);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(PolicyClassifier, FirstMatchingRuleWins)
+{
+   std::vector<Rule> rules(3);
+
+   rules[0].dstPrefixes = {prefix(0x0a020000, 16)};
+   rules[0].protocol = 17;
+   rules[0].dstPorts = {{5000, 5010}};
+
+   rules[1].dstPrefixes = {prefix(0x0a000000, 8)};
+
+   rules[2].dscps = {46};
+
+   PolicyClassifier classifier(rules);
+
+   EXPECT_EQ(classifier.size(), 3u);
+   EXPECT_EQ(classifier.classify(0x01010101, 0x0a020304, 17, true, 1234, 5005, 46), 0);
+   EXPECT_EQ(classifier.classify(0x01010101, 0x0a020304, 17, true, 1234, 5011, 46), 1);
+   EXPECT_EQ(classifier.classify(0x01010101, 0x0a020304, 6, true, 1234, 5005, 0), 1);
+   EXPECT_EQ(classifier.classify(0x01010101, 0x0b020304, 6, true, 1234, 5005, 46), 2);
+   EXPECT_EQ(classifier.classify(0x01010101, 0x0b020304, 6, true, 1234, 5005, 0), PolicyClassifier::NO_MATCH);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(PolicyClassifier, PortRulesNeedATransportHeader)
+{
+   std::vector<Rule> rules(2);
+
+   rules[0].srcPorts = {{0, 0xffff}};
+   rules[1].protocol = 1;
+
+   PolicyClassifier classifier(rules);
+
+   EXPECT_EQ(classifier.classify(1, 2, 1, true, 7, 7, 0), 0);
+   EXPECT_EQ(classifier.classify(1, 2, 1, false, 0, 0, 0), 1);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(PolicyClassifier, PortRangeBoundaries)
+{
+   std::vector<Rule> rules(1);
+   rules[0].dstPorts = {{0, 0}, {255, 256}, {1000, 1000}, {65535, 65535}};
+
+   PolicyClassifier classifier(rules);
+
+   for (uint32_t port : {0u, 255u, 256u, 1000u, 65535u})
+      EXPECT_EQ(classifier.classify(1, 2, 17, true, 9, uint16_t(port), 0), 0) << port;
+
+   for (uint32_t port : {1u, 254u, 257u, 999u, 1001u, 65534u})
+      EXPECT_EQ(classifier.classify(1, 2, 17, true, 9, uint16_t(port), 0), PolicyClassifier::NO_MATCH) << port;
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(PolicyClassifier, MatchesLinearScanOnRandomRules)
+{
+   std::mt19937 rng(1);
+   const uint32_t bases[] = {0x0a000000, 0x0a010000, 0xc0a80000, 0xac100000};
+
+   auto randomAddr = [&] { return bases[rng() % 4] | (rng() & 0x0001ffff); };
+
+   auto randomPrefix = [&] {
+      static const unsigned lens[] = {0, 7, 8, 12, 16, 17, 23, 24, 30, 32};
+      return prefix(randomAddr(), lens[rng() % 10]);
+   };
+
+   auto randomRange = [&] {
+      const uint16_t first = uint16_t(rng() % 2000);
+      return PolicyClassifier::PortRange{first, uint16_t(first + rng() % 300)};
+   };
+
+   std::vector<Rule> rules(300);
+
+   for (auto &rule : rules)
+   {
+      for (unsigned n = rng() % 3; n > 0; --n)
+         rule.srcPrefixes.push_back(randomPrefix());
+
+      for (unsigned n = rng() % 3; n > 0; --n)
+         rule.dstPrefixes.push_back(randomPrefix());
+
+      if (rng() % 2)
+         rule.protocol = rng() % 2 ? 6 : 17;
+
+      for (unsigned n = rng() % 3; n > 0; --n)
+         rule.srcPorts.push_back(randomRange());
+
+      for (unsigned n = rng() % 3; n > 0; --n)
+         rule.dstPorts.push_back(randomRange());
+
+      for (unsigned n = rng() % 3; n > 0; --n)
+         rule.dscps.push_back(uint8_t(rng() % 64));
+   }
+
+   PolicyClassifier classifier(rules);
+   size_t matched = 0;
+
+   for (int i = 0; i < 20000; ++i)
+   {
+      Packet pkt;
+      pkt.src = randomAddr();
+      pkt.dst = randomAddr();
+      pkt.protocol = rng() % 3 == 0 ? 1 : (rng() % 2 ? 6 : 17);
+      pkt.hasPorts = pkt.protocol != 1;
+      pkt.srcPort = pkt.hasPorts ? uint16_t(rng() % 2500) : 0;
+      pkt.dstPort = pkt.hasPorts ? uint16_t(rng() % 2500) : 0;
+      pkt.dscp = uint8_t(rng() % 64);
+
+      const int expected = reference(rules, pkt);
+      ASSERT_EQ(classify(classifier, pkt), expected) << "packet " << i;
+
+      matched += expected != PolicyClassifier::NO_MATCH;
+   }
+
+   // Both outcomes are exercised
+   EXPECT_GT(matched, 1000u);
+   EXPECT_LT(matched, 19000u);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(PolicyClassifier, ParsesRuleFields)
+{
+   Config::ConfigNamespacedParagraph section;
+   section["src_prefix"] = {"10.1.2.3/16, 10.3.0.0/24", Config::Type::STRING};
+   section["dst_prefix"] = {"10.2.0.1", Config::Type::STRING};
+   section["protocol"] = {"udp", Config::Type::STRING};
+   section["dst_ports"] = {"5000-5010, 6000", Config::Type::STRING};
+   section["dscp"] = {"46, 48", Config::Type::STRING};
+
+   Rule rule;
+   ASSERT_TRUE(PolicyClassifier::parseRule(section, rule));
+
+   ASSERT_EQ(rule.srcPrefixes.size(), 2u);
+   EXPECT_EQ(rule.srcPrefixes[0].addr, 0x0a010000u);
+   EXPECT_EQ(rule.srcPrefixes[0].len, 16u);
+   ASSERT_EQ(rule.dstPrefixes.size(), 1u);
+   EXPECT_EQ(rule.dstPrefixes[0].len, 32u);
+   EXPECT_EQ(rule.protocol, 17);
+   ASSERT_EQ(rule.dstPorts.size(), 2u);
+   EXPECT_EQ(rule.dstPorts[1].first, 6000);
+   EXPECT_EQ(rule.dstPorts[1].last, 6000);
+   EXPECT_EQ(rule.dscps, (std::vector<uint8_t>{46, 48}));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(PolicyClassifier, RejectsMalformedRules)
+{
+   const std::pair<const char *, const char *> bad[] = {
+      {"src_prefix", "10.0.0.0/33"},
+      {"dst_prefix", "10.0.0"},
+      {"protocol", "256"},
+      {"dst_ports", "10-5"},
+      {"src_ports", "70000"},
+   };
+
+   for (const auto &field : bad)
+   {
+      Config::ConfigNamespacedParagraph section;
+      section[field.first] = {field.second, Config::Type::STRING};
+
+      Rule rule;
+      EXPECT_FALSE(PolicyClassifier::parseRule(section, rule)) << field.first << "=" << field.second;
+   }
+}
@@ -0,0 +1,259 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "SelectiveArq.h"
+#include "TunnelFragment.h"
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+
+#include <cstring>
+#include <set>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+using Clock = SelectiveArq::Clock;
+using std::chrono::milliseconds;
+
+const Clock::time_point T0 = Clock::time_point(std::chrono::seconds(1000));
+
+// Sends count frames of class tc at now, returns their sequence numbers
+std::vector<uint16_t> sendFrames(SelectiveArq &arq, size_t count, TrafficClass tc, Clock::time_point now)
+{
+   std::vector<uint16_t> seqs;
+
+   for (size_t i = 0; i < count; ++i)
+   {
+      std::vector<char> frame(100, char('a' + i % 26));
+      const uint64_t pktid = makeFramePktId(i, FrameKind::Packet);
+      const char *trailer = (const char *)&pktid;
+
+      frame.insert(frame.end(), trailer, trailer + sizeof(pktid));
+      seqs.push_back(arq.onSend(frame.data(), frame.size(), tc, now));
+
+      // The bearer sequence number is stamped into the frame
+      uint64_t stamped = 0;
+      memcpy(&stamped, frame.data() + frame.size() - sizeof(stamped), sizeof(stamped));
+      EXPECT_EQ(getBearerSeq(stamped), seqs.back());
+   }
+
+   return seqs;
+}
+
+// Acknowledgement of the frames from first to highest, but the missing ones
+ArqAck makeAck(uint16_t first, uint16_t highest, const std::set<uint16_t> &missing)
+{
+   SelectiveArq receiver("test.arq_receiver");
+
+   for (uint16_t seq = first; seq != uint16_t(highest + 1); ++seq)
+   {
+      if (!missing.count(seq))
+         receiver.onData(seq);
+   }
+
+   return receiver.makeAck();
+}
+
+// Records the sequence numbers of the frames sent again
+struct Retransmits
+{
+   std::vector<uint16_t> seqs;
+
+   SelectiveArq::Send send()
+   {
+      return [this](const char *data, size_t len, TrafficClass) {
+         uint64_t pktid = 0;
+         memcpy(&pktid, data + len - sizeof(pktid), sizeof(pktid));
+         seqs.push_back(getBearerSeq(pktid));
+      };
+   }
+};
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+TEST(SelectiveArq, ReceiverAcksGapsAtOnce)
+{
+   SelectiveArq receiver("test.arq_gaps");
+
+   EXPECT_FALSE(receiver.ackPending());
+
+   // In-order frames are acknowledged together
+   EXPECT_FALSE(receiver.onData(10));
+   EXPECT_FALSE(receiver.onData(11));
+   EXPECT_FALSE(receiver.onData(12));
+   EXPECT_TRUE(receiver.onData(13));
+   EXPECT_TRUE(receiver.ackPending());
+
+   receiver.makeAck();
+   EXPECT_FALSE(receiver.ackPending());
+
+   // 14 and 16 missing
+   EXPECT_TRUE(receiver.onData(15));
+   EXPECT_TRUE(receiver.onData(17));
+
+   ArqAck ack = receiver.makeAck();
+   EXPECT_EQ(ntohs(ack.highest), 17);
+   EXPECT_EQ(ack.received[0], 0x7a); // 16 and 14 missing (bits 0, 2)
+
+   // A late frame fills its gap and is acknowledged at once
+   EXPECT_TRUE(receiver.onData(16));
+
+   ack = receiver.makeAck();
+   EXPECT_EQ(ntohs(ack.highest), 17);
+   EXPECT_EQ(ack.received[0], 0x7b); // 14 missing, 9 never sent (bit 7)
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(SelectiveArq, ReceiverMapAcrossSequenceWrap)
+{
+   SelectiveArq receiver("test.arq_wrap");
+
+   for (uint16_t seq = 65530; seq != 70; ++seq)
+   {
+      if (seq != 2)
+         receiver.onData(seq);
+   }
+
+   const ArqAck ack = receiver.makeAck();
+   EXPECT_EQ(ntohs(ack.highest), 69);
+
+   // Bit i: 69 - 1 - i received, 2 missing (bit 66)
+   for (unsigned bit = 0; bit < 75; ++bit)
+      EXPECT_EQ((ack.received[bit / 8] >> (bit % 8)) & 1, bit == 66 ? 0 : 1) << bit;
+
+   // Nothing before the first frame
+   for (unsigned bit = 75; bit < ARQ_WINDOW; ++bit)
+      EXPECT_EQ((ack.received[bit / 8] >> (bit % 8)) & 1, 0) << bit;
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(SelectiveArq, WindowOpensOnAcks)
+{
+   SelectiveArq arq("test.arq_window");
+   Retransmits retransmits;
+
+   const auto seqs = sendFrames(arq, ARQ_INITIAL_CWND, TrafficClass::Default, T0);
+   EXPECT_FALSE(arq.awaitWindow(milliseconds(0)));
+
+   arq.onAck(makeAck(seqs.front(), seqs.back(), {}), T0 + milliseconds(10), retransmits.send());
+
+   EXPECT_TRUE(arq.awaitWindow(milliseconds(0)));
+   EXPECT_TRUE(retransmits.seqs.empty());
+
+   // Slow start: one more frame per frame acknowledged
+   sendFrames(arq, 2 * ARQ_INITIAL_CWND, TrafficClass::Default, T0 + milliseconds(10));
+   EXPECT_FALSE(arq.awaitWindow(milliseconds(0)));
+
+   // Acknowledgements of frames not sent yet are ignored
+   arq.onAck(makeAck(0, 1000, {}), T0 + milliseconds(20), retransmits.send());
+   EXPECT_FALSE(arq.awaitWindow(milliseconds(0)));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(SelectiveArq, RetransmitsFramesReportedMissing)
+{
+   SelectiveArq arq("test.arq_missing");
+   Retransmits retransmits;
+
+   sendFrames(arq, 8, TrafficClass::Default, T0);
+
+   // 2 is lost, 6 could still be on its way (reordered)
+   const ArqAck ack = makeAck(0, 7, {2, 6});
+
+   arq.onAck(ack, T0 + milliseconds(10), retransmits.send());
+   EXPECT_EQ(retransmits.seqs, std::vector<uint16_t>({2}));
+
+   // Not again before a round trip
+   arq.onAck(ack, T0 + milliseconds(15), retransmits.send());
+   EXPECT_EQ(retransmits.seqs.size(), 1u);
+
+   arq.onAck(ack, T0 + milliseconds(20), retransmits.send());
+   EXPECT_EQ(retransmits.seqs, std::vector<uint16_t>({2, 2}));
+
+   // Both received at last: nothing is left in flight
+   arq.onAck(makeAck(0, 7, {}), T0 + milliseconds(25), retransmits.send());
+   arq.onTick(T0 + milliseconds(10000), retransmits.send());
+
+   EXPECT_EQ(retransmits.seqs.size(), 2u);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(SelectiveArq, CriticalFramesAreNotLeftForReordering)
+{
+   SelectiveArq arq("test.arq_critical");
+   Retransmits retransmits;
+
+   sendFrames(arq, 2, TrafficClass::Critical, T0);
+   arq.onAck(makeAck(0, 1, {0}), T0 + milliseconds(10), retransmits.send());
+
+   EXPECT_EQ(retransmits.seqs, std::vector<uint16_t>({0}));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(SelectiveArq, TimeoutsBackOffUntilAbandoned)
+{
+   SelectiveArq arq("test.arq_timeouts");
+   Retransmits retransmits;
+
+   sendFrames(arq, 1, TrafficClass::Bulk, T0);
+
+   // Without RTT samples the timeout is 10 times the floor, then doubles
+   // at every retransmission
+   auto at = T0 + milliseconds(10 * ARQ_MIN_RTO_MS);
+   auto rto = milliseconds(10 * ARQ_MIN_RTO_MS);
+
+   for (unsigned i = 0; i < ARQ_MAX_RETRANSMITS; ++i)
+   {
+      arq.onTick(at - milliseconds(1), retransmits.send());
+      EXPECT_EQ(retransmits.seqs.size(), i);
+
+      arq.onTick(at, retransmits.send());
+      EXPECT_EQ(retransmits.seqs.size(), i + 1);
+
+      rto *= 2;
+      at += rto;
+   }
+
+   // Given up: the frame leaves the window
+   arq.onTick(at, retransmits.send());
+   EXPECT_EQ(retransmits.seqs.size(), size_t(ARQ_MAX_RETRANSMITS));
+
+   arq.onTick(at + milliseconds(100000), retransmits.send());
+   EXPECT_EQ(retransmits.seqs.size(), size_t(ARQ_MAX_RETRANSMITS));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(SelectiveArq, FramesPastTheirDeadlineAreAbandoned)
+{
+   SelectiveArq arq("test.arq_deadline");
+   Retransmits retransmits;
+
+   // Critical frames are useless after 300 ms (the default policy)
+   sendFrames(arq, 1, TrafficClass::Critical, T0);
+
+   arq.onTick(T0 + milliseconds(200), retransmits.send());
+   EXPECT_EQ(retransmits.seqs.size(), 1u);
+
+   arq.onTick(T0 + milliseconds(600), retransmits.send());
+   arq.onTick(T0 + milliseconds(100000), retransmits.send());
+   EXPECT_EQ(retransmits.seqs.size(), 1u);
+}
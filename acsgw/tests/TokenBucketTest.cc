@@ -0,0 +1,224 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "TokenBucket.h"
+
+#include <gtest/gtest.h>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+using Clock = TokenBucket::Clock;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+const Clock::time_point T0 = Clock::time_point(std::chrono::seconds(1000));
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TokenBucket, UnlimitedBucketAcceptsEverything)
+{
+   TokenBucket bucket;
+
+   EXPECT_FALSE(bucket.limited());
+
+   for (int i = 0; i < 1000; ++i)
+      ASSERT_TRUE(bucket.tryConsume(65535, T0));
+
+   EXPECT_EQ(bucket.reserve(65535, T0), T0);
+   EXPECT_TRUE(bucket.conforms(T0));
+   EXPECT_EQ(bucket.conformAt(T0), T0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TokenBucket, BurstAllowance)
+{
+   // 1 MB/s: 1000 bytes cost 1 ms, the burst allows 10 ms back to back
+   TokenBucket bucket(1000000, 10000);
+
+   size_t accepted = 0;
+
+   while (bucket.tryConsume(1000, T0))
+      ++accepted;
+
+   // The burst, plus the frame which starts it
+   EXPECT_EQ(accepted, 11u);
+
+   EXPECT_FALSE(bucket.conforms(T0));
+   EXPECT_EQ(bucket.conformAt(T0), T0 + milliseconds(1));
+   EXPECT_FALSE(bucket.tryConsume(1000, T0 + microseconds(999)));
+   EXPECT_TRUE(bucket.tryConsume(1000, T0 + milliseconds(1)));
+
+   // An idle bucket does not store more than its burst
+   accepted = 0;
+
+   while (bucket.tryConsume(1000, T0 + std::chrono::seconds(10)))
+      ++accepted;
+
+   EXPECT_EQ(accepted, 11u);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TokenBucket, SteadyStateRate)
+{
+   const uint64_t rate = 1000000;
+   const size_t burst = 3000;
+   TokenBucket bucket(rate, burst);
+
+   // 1500 byte frames offered at 15 MB/s for a second
+   size_t bytes = 0;
+
+   for (int i = 0; i < 10000; ++i)
+   {
+      if (bucket.tryConsume(1500, T0 + microseconds(100 * i)))
+         bytes += 1500;
+   }
+
+   EXPECT_GE(bytes, rate - 1500);
+   EXPECT_LE(bytes, rate + burst + 1500);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TokenBucket, ReservationsAreSpacedAtTheRate)
+{
+   TokenBucket bucket(1000000, 0);
+
+   auto previous = T0;
+
+   for (int i = 0; i < 100; ++i)
+   {
+      const auto sendAt = bucket.reserve(1000, T0);
+
+      EXPECT_EQ(sendAt, T0 + milliseconds(i));
+      EXPECT_GE(sendAt, previous);
+      previous = sendAt;
+   }
+
+   // Once the bookings are past, the bucket starts again from now
+   EXPECT_EQ(bucket.reserve(1000, T0 + std::chrono::seconds(1)), T0 + std::chrono::seconds(1));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TokenBucket, ReserveOnBearerTunnelAndCongestionBuckets)
+{
+   TokenBucket bearer(2000000, 0);
+   TokenBucket tunnel(1000000, 0);
+   TokenBucket cc(4000000, 0);
+   TokenBucket unlimited;
+
+   // The slowest bucket sets the pace, missing ones are ignored
+   for (int i = 0; i < 10; ++i)
+   {
+      const auto sendAt = TokenBucket::reserve(1000, {&bearer, &tunnel, nullptr, &cc, &unlimited}, T0);
+      EXPECT_EQ(sendAt, T0 + milliseconds(i));
+   }
+
+   // Every limited bucket booked the bytes
+   EXPECT_EQ(bearer.conformAt(T0), T0 + microseconds(5000));
+   EXPECT_EQ(tunnel.conformAt(T0), T0 + microseconds(10000));
+   EXPECT_EQ(cc.conformAt(T0), T0 + microseconds(2500));
+
+   // The congestion controller slows down (keeping its bookings): it
+   // becomes the slowest one from the next frame on
+   cc.setRate(100000, 0);
+   EXPECT_EQ(TokenBucket::reserve(1000, {&bearer, &tunnel, &cc}, T0), T0 + milliseconds(10));
+   EXPECT_EQ(TokenBucket::reserve(1000, {&bearer, &tunnel, &cc}, T0), T0 + microseconds(12500));
+   EXPECT_EQ(TokenBucket::reserve(1000, {&bearer, &tunnel, &cc}, T0), T0 + microseconds(22500));
+
+   EXPECT_EQ(TokenBucket::reserve(1000, {nullptr, &unlimited}, T0), T0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TokenBucket, ReceivePolicingDrops)
+{
+   // A policer of received frames (see TunnelPath::police()) at 100 kB/s:
+   // 1500 byte frames cost 15 ms, two of them fit in the burst
+   TokenBucket policer(100000, 3000);
+
+   // 10 frames back to back: the burst and the frame which starts it pass
+   size_t accepted = 0;
+
+   for (int i = 0; i < 10; ++i)
+      accepted += policer.tryConsume(1500, T0) ? 1 : 0;
+
+   EXPECT_EQ(accepted, 3u);
+
+   // Dropped frames are not booked: the policer conforms again after
+   // the accepted ones only
+   EXPECT_EQ(policer.conformAt(T0), T0 + milliseconds(15));
+
+   // 300 kB/s received for a second: a third of it passes
+   size_t bytes = 0;
+
+   for (int i = 0; i < 200; ++i)
+   {
+      if (policer.tryConsume(1500, T0 + milliseconds(100) + microseconds(5000 * i)))
+         bytes += 1500;
+   }
+
+   EXPECT_NEAR(double(bytes), 100000.0, 3000.0 + 1500.0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TokenBucket, DeparturesWithinTheLead)
+{
+   // 10 MB/s: 1000 byte frames every 100 us, the sender may run 2 ms ahead
+   TokenBucket bearer(10000000, 0);
+   TokenBucket tunnel;
+   const auto maxLead = microseconds(2000);
+
+   auto now = T0;
+   auto previous = T0;
+   size_t held = 0;
+
+   // A sender much faster than the rate: 1 us per frame
+   for (int i = 0; i < 1000; ++i)
+   {
+      Clock::time_point holdUntil;
+      const auto sendAt = TokenBucket::departure(1000, {&bearer, &tunnel, nullptr}, now, maxLead, holdUntil);
+
+      EXPECT_EQ(sendAt, T0 + microseconds(100 * i));
+      EXPECT_GE(sendAt, previous);
+      previous = sendAt;
+
+      // Blocked only beyond the lead, and then until it is back within
+      if (sendAt - now > maxLead)
+      {
+         EXPECT_EQ(holdUntil, sendAt - maxLead);
+         ++held;
+      }
+      else
+      {
+         EXPECT_EQ(holdUntil, now);
+      }
+
+      now = std::max(now, holdUntil) + microseconds(1);
+   }
+
+   // Frames are queued ahead up to the lead, then the sender follows the rate
+   EXPECT_GT(held, 900u);
+   EXPECT_LE(previous - now, maxLead);
+
+   // An idle bearer departs at once
+   Clock::time_point holdUntil;
+   const auto later = now + std::chrono::seconds(1);
+
+   EXPECT_EQ(TokenBucket::departure(1000, {&bearer}, later, maxLead, holdUntil), later);
+   EXPECT_EQ(holdUntil, later);
+}
@@ -0,0 +1,152 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "TunnelBundle.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <vector>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+using Buffer = std::vector<char>;
+
+// Inner packet of len bytes (filled with fill) followed by its pktid
+Buffer makeFrame(size_t len, char fill, uint64_t seq, FrameKind kind = FrameKind::Packet)
+{
+   Buffer frame(len, fill);
+   const uint64_t pktid = makeFramePktId(seq, kind);
+   const char *trailer = (const char *)&pktid;
+
+   frame.insert(frame.end(), trailer, trailer + sizeof(pktid));
+
+   return frame;
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TunnelBundle, OnlySmallPacketsAreBundleable)
+{
+   const Buffer small = makeFrame(100, 'a', 1);
+   const Buffer largest = makeFrame(BUNDLE_MAX_PACKET_LEN, 'b', 2);
+   const Buffer large = makeFrame(BUNDLE_MAX_PACKET_LEN + 1, 'c', 3);
+   const Buffer fragment = makeFrame(100, 'd', 4, FrameKind::Fragment);
+
+   EXPECT_TRUE(TunnelBundle::bundleable(small.data(), small.size()));
+   EXPECT_TRUE(TunnelBundle::bundleable(largest.data(), largest.size()));
+   EXPECT_FALSE(TunnelBundle::bundleable(large.data(), large.size()));
+   EXPECT_FALSE(TunnelBundle::bundleable(fragment.data(), fragment.size()));
+   EXPECT_FALSE(TunnelBundle::bundleable(small.data(), sizeof(uint64_t)));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TunnelBundle, RoundTrip)
+{
+   TunnelBundle bundle(BUNDLE_MAX_LEN);
+   std::vector<Buffer> frames;
+
+   for (size_t i = 0; i < 5; ++i)
+   {
+      frames.push_back(makeFrame(20 + i * 30, char('a' + i), i));
+      ASSERT_TRUE(bundle.add(frames.back().data(), frames.back().size()));
+   }
+
+   EXPECT_EQ(bundle.count(), 5u);
+
+   Buffer datagram;
+   bundle.finish(datagram);
+
+   EXPECT_EQ(bundle.count(), 0u);
+   EXPECT_LE(datagram.size(), size_t(BUNDLE_MAX_LEN));
+
+   uint64_t pktid = 0;
+   memcpy(&pktid, datagram.data() + datagram.size() - sizeof(pktid), sizeof(pktid));
+   EXPECT_EQ(getFrameKind(pktid), FrameKind::Bundle);
+
+   TunnelUnbundler unbundler;
+   ASSERT_TRUE(unbundler.load(datagram.data(), datagram.size() - sizeof(pktid)));
+
+   char buf[BUNDLE_MAX_LEN];
+
+   for (const auto &frame : frames)
+   {
+      const int len = unbundler.next(buf, sizeof(buf));
+
+      ASSERT_EQ(len, int(frame.size()));
+      EXPECT_EQ(Buffer(buf, buf + len), frame);
+   }
+
+   EXPECT_EQ(unbundler.next(buf, sizeof(buf)), -1);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TunnelBundle, StopsAtMaxLen)
+{
+   const size_t maxLen = 200;
+   TunnelBundle bundle(maxLen);
+   const Buffer frame = makeFrame(20, 'x', 1); // smallest entry, 2 + 28 bytes
+
+   size_t added = 0;
+
+   while (bundle.add(frame.data(), frame.size()))
+      ++added;
+
+   // Entries and the bundle pktid fit in maxLen
+   EXPECT_EQ(added, (maxLen - sizeof(uint64_t)) / (2 + frame.size()));
+   EXPECT_TRUE(bundle.full());
+
+   Buffer datagram;
+   bundle.finish(datagram);
+   EXPECT_LE(datagram.size(), maxLen);
+
+   // A finished bundle starts again empty
+   EXPECT_FALSE(bundle.full());
+   EXPECT_TRUE(bundle.add(frame.data(), frame.size()));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TunnelBundle, RejectsMalformedBundles)
+{
+   TunnelBundle bundle(BUNDLE_MAX_LEN);
+   const Buffer frame = makeFrame(60, 'y', 1);
+
+   bundle.add(frame.data(), frame.size());
+   bundle.add(frame.data(), frame.size());
+
+   Buffer datagram;
+   bundle.finish(datagram);
+
+   const size_t payloadLen = datagram.size() - sizeof(uint64_t);
+   TunnelUnbundler unbundler;
+
+   // Truncated entry, truncated entry header
+   EXPECT_FALSE(unbundler.load(datagram.data(), payloadLen - 1));
+   EXPECT_FALSE(unbundler.load(datagram.data(), 2 + frame.size() + 1));
+
+   // Entry too short to hold a pktid
+   Buffer shortEntry = {0, 8};
+   shortEntry.insert(shortEntry.end(), 8, 'z');
+   EXPECT_FALSE(unbundler.load(shortEntry.data(), shortEntry.size()));
+
+   // Nothing is loaded from a malformed bundle
+   char buf[BUNDLE_MAX_LEN];
+   EXPECT_EQ(unbundler.next(buf, sizeof(buf)), -1);
+
+   EXPECT_TRUE(unbundler.load(datagram.data(), payloadLen));
+   EXPECT_EQ(unbundler.next(buf, sizeof(buf)), int(frame.size()));
+}
@@ -0,0 +1,246 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "TunnelFragment.h"
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <random>
+#include <thread>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+using Buffer = TunnelReassembler::Buffer;
+using std::chrono::milliseconds;
+
+Buffer makePacket(size_t len, unsigned seed)
+{
+   std::mt19937 rng(seed);
+   Buffer packet(len);
+
+   for (auto &byte : packet)
+      byte = char(rng());
+
+   return packet;
+}
+
+// Fragment frame carrying [first, last) of packet, declaring length
+Buffer makeFragment(const Buffer &packet, size_t first, size_t last, size_t length)
+{
+   FragmentHeader header;
+   header.offset = htons(uint16_t(first));
+   header.length = htons(uint16_t(length));
+
+   Buffer frame((const char *)&header, (const char *)&header + sizeof(header));
+   frame.insert(frame.end(), packet.begin() + first, packet.begin() + last);
+
+   return frame;
+}
+
+Buffer makeFragment(const Buffer &packet, size_t first, size_t last)
+{
+   return makeFragment(packet, first, last, packet.size());
+}
+
+bool add(TunnelReassembler &reassembler, uint64_t seq, const Buffer &frame, Buffer &packet)
+{
+   return reassembler.add(seq, frame.data(), frame.size(), packet);
+}
+
+uint64_t metric(const std::string &name, const char *what)
+{
+   return Metrics::getInstance().get("tunnel." + name + "." + what);
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TunnelReassembler, OutOfOrderOverlappingSlices)
+{
+   TunnelReassembler reassembler("test_reasm_slices");
+   const Buffer packet = makePacket(1000, 1);
+   Buffer result;
+
+   // Slices of bearers with different MTUs, overlapping
+   EXPECT_FALSE(add(reassembler, 1, makeFragment(packet, 600, 1000), result));
+   EXPECT_FALSE(add(reassembler, 1, makeFragment(packet, 0, 300), result));
+   EXPECT_FALSE(add(reassembler, 1, makeFragment(packet, 250, 550), result));
+   ASSERT_TRUE(add(reassembler, 1, makeFragment(packet, 500, 650), result));
+
+   EXPECT_EQ(result, packet);
+   EXPECT_EQ(metric("test_reasm_slices", "reassembled_packets"), 1u);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TunnelReassembler, RandomSlicesOfManyPackets)
+{
+   TunnelReassembler reassembler("test_reasm_random");
+   std::mt19937 rng(2);
+
+   for (uint64_t seq = 0; seq < 200; ++seq)
+   {
+      const Buffer packet = makePacket(1 + rng() % 1500, unsigned(seq));
+
+      // Slices of two bearers cutting the packet at different sizes
+      std::vector<Buffer> frames;
+
+      for (size_t mtu : {1 + rng() % 600, 1 + rng() % 600})
+      {
+         for (size_t first = 0; first < packet.size(); first += mtu)
+            frames.push_back(makeFragment(packet, first, std::min(first + mtu, packet.size())));
+      }
+
+      std::shuffle(frames.begin(), frames.end(), rng);
+
+      Buffer result;
+      size_t completions = 0;
+
+      for (const auto &frame : frames)
+      {
+         if (add(reassembler, seq, frame, result))
+         {
+            ++completions;
+            EXPECT_EQ(result, packet) << seq;
+         }
+      }
+
+      // Completed once, the remaining slices are late copies
+      EXPECT_EQ(completions, 1u) << seq;
+   }
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TunnelReassembler, DuplicateFragments)
+{
+   TunnelReassembler reassembler("test_reasm_dups");
+   const Buffer packet = makePacket(800, 3);
+   const Buffer first = makeFragment(packet, 0, 400);
+   Buffer result;
+
+   EXPECT_FALSE(add(reassembler, 7, first, result));
+   EXPECT_FALSE(add(reassembler, 7, first, result));
+   ASSERT_TRUE(add(reassembler, 7, makeFragment(packet, 400, 800), result));
+
+   EXPECT_EQ(result, packet);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TunnelReassembler, MalformedFragments)
+{
+   const std::string name = "test_reasm_malformed";
+   TunnelReassembler reassembler(name);
+   const Buffer packet = makePacket(1000, 4);
+   Buffer result;
+
+   EXPECT_FALSE(add(reassembler, 1, makeFragment(packet, 0, 500), result));
+
+   // A length other than the one of the first fragment
+   EXPECT_FALSE(add(reassembler, 1, makeFragment(packet, 500, 1000, 1200), result));
+   EXPECT_EQ(metric(name, "malformed_fragments"), 1u);
+
+   // A slice past the end of the packet
+   EXPECT_FALSE(add(reassembler, 1, makeFragment(packet, 900, 1000, 950), result));
+   EXPECT_EQ(metric(name, "malformed_fragments"), 2u);
+
+   // No length at all
+   EXPECT_FALSE(add(reassembler, 1, makeFragment(packet, 0, 10, 0), result));
+   EXPECT_EQ(metric(name, "malformed_fragments"), 3u);
+
+   // A header with no slice, a truncated header
+   const Buffer headerOnly = makeFragment(packet, 500, 500);
+   EXPECT_FALSE(add(reassembler, 1, headerOnly, result));
+   EXPECT_FALSE(reassembler.add(1, headerOnly.data(), headerOnly.size() - 1, result));
+   EXPECT_EQ(metric(name, "malformed_fragments"), 5u);
+
+   // None of them was taken
+   ASSERT_TRUE(add(reassembler, 1, makeFragment(packet, 500, 1000), result));
+   EXPECT_EQ(result, packet);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TunnelReassembler, EvictsTheOldestPacket)
+{
+   const std::string name = "test_reasm_evict";
+   TunnelReassembler reassembler(name, milliseconds(REASSEMBLY_TIMEOUT_MS), 4);
+   const Buffer packet = makePacket(600, 5);
+   const Buffer head = makeFragment(packet, 0, 300);
+   const Buffer tail = makeFragment(packet, 300, 600);
+   Buffer result;
+
+   for (uint64_t seq = 0; seq < 5; ++seq)
+      EXPECT_FALSE(add(reassembler, seq, head, result));
+
+   EXPECT_EQ(metric(name, "reassembly_evictions"), 1u);
+
+   // The first packet starts again from its tail, the others complete
+   EXPECT_FALSE(add(reassembler, 0, tail, result));
+
+   for (uint64_t seq = 2; seq < 5; ++seq)
+      EXPECT_TRUE(add(reassembler, seq, tail, result)) << seq;
+
+   EXPECT_EQ(metric(name, "reassembly_evictions"), 2u);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TunnelReassembler, IncompletePacketsExpire)
+{
+   const std::string name = "test_reasm_timeout";
+   TunnelReassembler reassembler(name, milliseconds(20));
+   const Buffer packet = makePacket(600, 6);
+   Buffer result;
+
+   EXPECT_FALSE(add(reassembler, 1, makeFragment(packet, 0, 300), result));
+
+   std::this_thread::sleep_for(milliseconds(40));
+
+   // Expired when the next fragment arrives: it starts a new packet
+   EXPECT_FALSE(add(reassembler, 1, makeFragment(packet, 300, 600), result));
+   EXPECT_EQ(metric(name, "reassembly_timeouts"), 1u);
+
+   ASSERT_TRUE(add(reassembler, 1, makeFragment(packet, 0, 300), result));
+   EXPECT_EQ(result, packet);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TunnelReassembler, LateCopiesOfCompletedPackets)
+{
+   const size_t maxPackets = 4;
+   TunnelReassembler reassembler("test_reasm_late", milliseconds(REASSEMBLY_TIMEOUT_MS), maxPackets);
+   const Buffer packet = makePacket(600, 7);
+   const Buffer whole = makeFragment(packet, 0, 600);
+   Buffer result;
+
+   ASSERT_TRUE(add(reassembler, 0, whole, result));
+
+   // Mirrored copies of the packet, by a slower bearer
+   EXPECT_FALSE(add(reassembler, 0, makeFragment(packet, 0, 300), result));
+   EXPECT_FALSE(add(reassembler, 0, whole, result));
+
+   // Remembered for twice as many packets as are reassembled together
+   for (uint64_t seq = 1; seq < 2 * maxPackets; ++seq)
+      ASSERT_TRUE(add(reassembler, seq, whole, result));
+
+   EXPECT_FALSE(add(reassembler, 0, whole, result));
+
+   ASSERT_TRUE(add(reassembler, 2 * maxPackets, whole, result));
+   EXPECT_TRUE(add(reassembler, 0, whole, result));
+}
@@ -0,0 +1,174 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "TunnelRoutes.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <string>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+// The table is a singleton: each test removes the routes of its tunnels
+class TunnelRouteTableTest : public ::testing::Test
+{
+protected:
+   TunnelRouteTable &routes = TunnelRouteTable::getInstance();
+
+   void TearDown() override
+   {
+      for (const char *tunnel : {"tun-a", "tun-b", "tun-c", "tun-d"})
+         routes.delTunnel(tunnel);
+
+      for (int i = 0; i < 8; ++i)
+         routes.delTunnel("tun-" + std::to_string(i));
+   }
+
+   std::string lookup(uint32_t addr) const
+   {
+      std::string tunnel;
+      return routes.lookup(addr, tunnel) ? tunnel : "";
+   }
+};
+
+uint32_t ip(const char *text)
+{
+   uint32_t addr = 0;
+   unsigned len = 0;
+
+   TunnelRouteTable::parsePrefix(text, addr, len);
+
+   return addr;
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TunnelRouteTableParse, Prefixes)
+{
+   uint32_t addr = 0;
+   unsigned len = 0;
+
+   ASSERT_TRUE(TunnelRouteTable::parsePrefix("10.1.2.3/16", addr, len));
+   EXPECT_EQ(addr, 0x0a010000u);
+   EXPECT_EQ(len, 16u);
+
+   ASSERT_TRUE(TunnelRouteTable::parsePrefix("192.168.1.7", addr, len));
+   EXPECT_EQ(addr, 0xc0a80107u);
+   EXPECT_EQ(len, 32u);
+
+   ASSERT_TRUE(TunnelRouteTable::parsePrefix("1.2.3.4/0", addr, len));
+   EXPECT_EQ(addr, 0u);
+   EXPECT_EQ(len, 0u);
+
+   EXPECT_FALSE(TunnelRouteTable::parsePrefix("10.1.2/8", addr, len));
+   EXPECT_FALSE(TunnelRouteTable::parsePrefix("10.1.2.3/33", addr, len));
+   EXPECT_FALSE(TunnelRouteTable::parsePrefix("10.1.2.3/x", addr, len));
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST_F(TunnelRouteTableTest, LongestPrefixWins)
+{
+   routes.add(ip("10.0.0.0"), 8, "tun-a");
+   routes.add(ip("10.1.0.0"), 16, "tun-b");
+   routes.add(ip("10.1.2.0"), 23, "tun-c");
+   routes.add(ip("10.1.2.9"), 32, "tun-d");
+
+   EXPECT_EQ(lookup(ip("10.200.0.1")), "tun-a");
+   EXPECT_EQ(lookup(ip("10.1.200.1")), "tun-b");
+   EXPECT_EQ(lookup(ip("10.1.3.1")), "tun-c");
+   EXPECT_EQ(lookup(ip("10.1.2.9")), "tun-d");
+   EXPECT_EQ(lookup(ip("10.1.2.10")), "tun-c");
+   EXPECT_EQ(lookup(ip("11.0.0.1")), "");
+
+   // A prefix is routed to a single tunnel
+   routes.add(ip("10.1.0.0"), 16, "tun-d");
+   EXPECT_EQ(lookup(ip("10.1.200.1")), "tun-d");
+
+   EXPECT_TRUE(routes.del(ip("10.1.0.0"), 16));
+   EXPECT_FALSE(routes.del(ip("10.1.0.0"), 16));
+   EXPECT_EQ(lookup(ip("10.1.200.1")), "tun-a");
+
+   routes.delTunnel("tun-a");
+   EXPECT_EQ(lookup(ip("10.200.0.1")), "");
+   EXPECT_EQ(lookup(ip("10.1.3.1")), "tun-c");
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST_F(TunnelRouteTableTest, DefaultRoute)
+{
+   routes.add(0, 0, "tun-a");
+   routes.add(ip("172.16.0.0"), 12, "tun-b");
+
+   EXPECT_EQ(lookup(ip("8.8.8.8")), "tun-a");
+   EXPECT_EQ(lookup(ip("172.31.255.255")), "tun-b");
+   EXPECT_EQ(lookup(ip("172.32.0.0")), "tun-a");
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST_F(TunnelRouteTableTest, MatchesLinearScanOnRandomRoutes)
+{
+   std::mt19937 rng(1);
+   std::map<std::pair<uint32_t, unsigned>, std::string> reference;
+
+   for (int i = 0; i < 500; ++i)
+   {
+      const unsigned len = rng() % 33;
+      const uint32_t addr = (0x0a000000 | (rng() & 0x00ffffff)) & (len == 0 ? 0 : ~uint32_t(0) << (32 - len));
+      const std::string tunnel = "tun-" + std::to_string(rng() % 8);
+
+      routes.add(addr, len, tunnel);
+      reference[{addr, len}] = tunnel;
+   }
+
+   for (int i = 0; i < 20000; ++i)
+   {
+      const uint32_t addr = rng() % 4 ? 0x0a000000 | (rng() & 0x00ffffff) : uint32_t(rng());
+
+      std::string expected;
+      int longest = -1;
+
+      for (const auto &route : reference)
+      {
+         const unsigned len = route.first.second;
+         const uint32_t mask = len == 0 ? 0 : ~uint32_t(0) << (32 - len);
+
+         if ((addr & mask) == route.first.first && int(len) > longest)
+         {
+            longest = int(len);
+            expected = route.second;
+         }
+      }
+
+      ASSERT_EQ(lookup(addr), expected) << std::hex << addr;
+   }
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST_F(TunnelRouteTableTest, DeviceRoutesCoverTheirPrefixes)
+{
+   routes.addDeviceRoute(ip("172.16.0.0"), 12);
+
+   EXPECT_TRUE(routes.deviceCovers(ip("172.16.0.0"), 12));
+   EXPECT_TRUE(routes.deviceCovers(ip("172.20.1.0"), 24));
+   EXPECT_TRUE(routes.deviceCovers(ip("172.31.255.255"), 32));
+   EXPECT_FALSE(routes.deviceCovers(ip("172.16.0.0"), 11));
+   EXPECT_FALSE(routes.deviceCovers(ip("172.32.0.1"), 32));
+   EXPECT_FALSE(routes.deviceCovers(ip("10.0.0.1"), 32));
+}
@@ -0,0 +1,199 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "TxScheduler.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+
+/* -------------------------------------------------------------------------- */
+
+namespace {
+
+struct Frame
+{
+   size_t len = 0;
+   TrafficClass tc = TrafficClass::Default;
+
+   size_t size() const noexcept
+   {
+      return len;
+   }
+};
+
+using Scheduler = TxScheduler<Frame>;
+
+constexpr size_t QUEUE_LEN = 4096;
+
+void push(Scheduler &scheduler, TrafficClass tc, size_t len, size_t count = 1)
+{
+   for (size_t i = 0; i < count; ++i)
+      ASSERT_TRUE(scheduler.push(Frame{len, tc}, tc));
+}
+
+Scheduler::Quanta makeQuanta(size_t critical, size_t interactive, size_t def, size_t bulk)
+{
+   Scheduler::Quanta quanta;
+   quanta[size_t(TrafficClass::Critical)] = critical;
+   quanta[size_t(TrafficClass::Interactive)] = interactive;
+   quanta[size_t(TrafficClass::Default)] = def;
+   quanta[size_t(TrafficClass::Bulk)] = bulk;
+
+   return quanta;
+}
+
+} // namespace
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TxScheduler, CriticalFramesGoFirst)
+{
+   Scheduler scheduler(QUEUE_LEN, makeQuanta(1500, 1500, 1500, 1500));
+   Frame frame;
+
+   push(scheduler, TrafficClass::Bulk, 1000, 10);
+   push(scheduler, TrafficClass::Default, 1000, 10);
+   push(scheduler, TrafficClass::Interactive, 1000, 10);
+   push(scheduler, TrafficClass::Critical, 100, 3);
+
+   for (int i = 0; i < 3; ++i)
+   {
+      ASSERT_TRUE(scheduler.tryPop(frame));
+      EXPECT_EQ(frame.tc, TrafficClass::Critical);
+   }
+
+   ASSERT_TRUE(scheduler.tryPop(frame));
+   EXPECT_NE(frame.tc, TrafficClass::Critical);
+
+   // Also while the other classes are being served
+   push(scheduler, TrafficClass::Critical, 100);
+
+   ASSERT_TRUE(scheduler.tryPop(frame));
+   EXPECT_EQ(frame.tc, TrafficClass::Critical);
+
+   EXPECT_EQ(scheduler.size(), 29u);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TxScheduler, BytesFollowTheQuantaUnderBacklog)
+{
+   Scheduler scheduler(QUEUE_LEN, makeQuanta(1500, 3000, 2000, 1000));
+
+   // Frames of different sizes in every class
+   push(scheduler, TrafficClass::Interactive, 100, 3000);
+   push(scheduler, TrafficClass::Default, 500, 600);
+   push(scheduler, TrafficClass::Bulk, 1000, 300);
+
+   std::array<size_t, TRAFFIC_CLASS_COUNT> bytes = {0};
+   size_t total = 0;
+   Frame frame;
+
+   while (total < 300000)
+   {
+      ASSERT_TRUE(scheduler.tryPop(frame));
+      bytes[size_t(frame.tc)] += frame.len;
+      total += frame.len;
+   }
+
+   const double interactive = double(bytes[size_t(TrafficClass::Interactive)]);
+   const double def = double(bytes[size_t(TrafficClass::Default)]);
+   const double bulk = double(bytes[size_t(TrafficClass::Bulk)]);
+
+   EXPECT_NEAR(interactive / bulk, 3.0, 0.05);
+   EXPECT_NEAR(def / bulk, 2.0, 0.05);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TxScheduler, IdleClassesDoNotBuildUpDeficit)
+{
+   Scheduler scheduler(QUEUE_LEN, makeQuanta(1500, 1500, 1500, 1500));
+   Frame frame;
+
+   // Only the default class has traffic for a long time
+   push(scheduler, TrafficClass::Default, 1500, 1000);
+
+   for (int i = 0; i < 500; ++i)
+   {
+      ASSERT_TRUE(scheduler.tryPop(frame));
+      EXPECT_EQ(frame.tc, TrafficClass::Default);
+   }
+
+   // A class becoming active gets its share, not a burst
+   push(scheduler, TrafficClass::Bulk, 1500, 100);
+
+   size_t bulk = 0;
+
+   for (int i = 0; i < 20; ++i)
+   {
+      ASSERT_TRUE(scheduler.tryPop(frame));
+      bulk += frame.tc == TrafficClass::Bulk ? 1 : 0;
+   }
+
+   EXPECT_GE(bulk, 9u);
+   EXPECT_LE(bulk, 11u);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TxScheduler, ThrottledClassDoesNotBlockTheOthers)
+{
+   Scheduler scheduler(QUEUE_LEN, makeQuanta(1500, 1500, 1500, 1500));
+
+   // 1 kB/s: two frames (burst plus one) and then nothing for seconds
+   TokenBucket shaper(1000, 1500);
+   scheduler.setShaper(TrafficClass::Default, &shaper);
+
+   push(scheduler, TrafficClass::Default, 1500, 10);
+   push(scheduler, TrafficClass::Bulk, 1500, 10);
+
+   std::array<size_t, TRAFFIC_CLASS_COUNT> frames = {0};
+   Frame frame;
+
+   while (scheduler.tryPop(frame))
+      ++frames[size_t(frame.tc)];
+
+   EXPECT_EQ(frames[size_t(TrafficClass::Bulk)], 10u);
+   EXPECT_EQ(frames[size_t(TrafficClass::Default)], 2u);
+
+   // The consumer does not wait for the throttled class past its deadline
+   const auto start = Scheduler::Clock::now();
+   EXPECT_FALSE(scheduler.pop(frame, 20));
+   EXPECT_LT(Scheduler::Clock::now() - start, std::chrono::milliseconds(500));
+   EXPECT_EQ(scheduler.size(), 8u);
+}
+
+/* -------------------------------------------------------------------------- */
+
+TEST(TxScheduler, ThrottledCriticalClassIsSkipped)
+{
+   Scheduler scheduler(QUEUE_LEN, makeQuanta(1500, 1500, 1500, 1500));
+
+   TokenBucket shaper(1000, 100);
+   scheduler.setShaper(TrafficClass::Critical, &shaper);
+
+   push(scheduler, TrafficClass::Critical, 1000, 3);
+   push(scheduler, TrafficClass::Interactive, 100, 3);
+
+   Frame frame;
+
+   ASSERT_TRUE(scheduler.tryPop(frame));
+   EXPECT_EQ(frame.tc, TrafficClass::Critical);
+
+   for (int i = 0; i < 3; ++i)
+   {
+      ASSERT_TRUE(scheduler.tryPop(frame));
+      EXPECT_EQ(frame.tc, TrafficClass::Interactive);
+   }
+
+   EXPECT_FALSE(scheduler.tryPop(frame));
+}
@@ -0,0 +1,144 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "Metrics.h"
+#include "Logger.h"
+#include "ThreadPolicy.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <stdio.h>
+
+/* -------------------------------------------------------------------------- */
+
+Metrics &Metrics::getInstance()
+{
+    static Metrics _instance;
+    return _instance;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool Metrics::configure(const Config &config)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    // We cannot configure twice
+    if (_exporter)
+    {
+        return false;
+    }
+
+    const auto &cfgdata = config.data();
+
+    // [metrics]
+    auto it = cfgdata.find("metrics");
+
+    if (it == cfgdata.end())
+    {
+        return false;
+    }
+
+    const auto &namespace_data = it->second;
+
+    // file = "path"
+    auto nsit = namespace_data.find("file");
+    if (nsit != namespace_data.end())
+    {
+        _fileName = nsit->second.first;
+    }
+
+    // interval = N
+    nsit = namespace_data.find("interval");
+    if (nsit != namespace_data.end())
+    {
+        try
+        {
+            _interval = std::max(1, std::stoi(nsit->second.first));
+        }
+        catch (...)
+        {
+        }
+    }
+
+    if (_fileName.empty())
+    {
+        return false;
+    }
+
+    _exporter = std::make_unique<std::thread>([this]() {
+        ThreadPolicy::getInstance().apply(ThreadRole::Control, "metrics");
+
+        while (true)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(_interval));
+            exportToFile();
+        }
+    });
+
+    _exporter->detach();
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+Metrics::Value &Metrics::get(const std::string &name)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    auto &metric = _metrics[name];
+
+    if (!metric)
+    {
+        metric = std::make_unique<Value>(0);
+    }
+
+    return *metric;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void Metrics::describe(std::ostream &os) const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    for (const auto &[name, value] : _metrics)
+    {
+        os << name << " " << value->load(std::memory_order_relaxed) << std::endl;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void Metrics::exportToFile() const
+{
+    // Write a temporary file and rename it, so readers never see
+    // a partially written snapshot
+    const std::string tmpFileName = _fileName + ".tmp";
+
+    {
+        std::ofstream os(tmpFileName, std::ios::out | std::ios::trunc);
+
+        if (!os.is_open())
+        {
+            TRACE(LOG_ERR, "Metrics cannot write %s", tmpFileName.c_str());
+            return;
+        }
+
+        describe(os);
+    }
+
+    if (::rename(tmpFileName.c_str(), _fileName.c_str()) != 0)
+    {
+        TRACE(LOG_ERR, "Metrics cannot rename %s", tmpFileName.c_str());
+    }
+}
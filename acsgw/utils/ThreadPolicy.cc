@@ -0,0 +1,232 @@
+//
+// This file is part of acsgw
+// Copyright (c) Antonino Calderone (antonino.calderone@gmail.com)
+// All rights reserved.
+// Licensed under the MIT License.
+// See COPYING file in the project root for full license information.
+//
+
+/* -------------------------------------------------------------------------- */
+
+#include "ThreadPolicy.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MPOL_LOCAL
+#define MPOL_LOCAL 4
+#endif
+
+/* -------------------------------------------------------------------------- */
+
+static const char *threadRoleName(ThreadRole role) noexcept
+{
+    switch (role)
+    {
+    case ThreadRole::Xmit:
+        return "xmit";
+    case ThreadRole::Recv:
+        return "recv";
+    case ThreadRole::Tcp:
+        return "tcp";
+    case ThreadRole::Control:
+    default:
+        return "control";
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+ThreadPolicy &ThreadPolicy::getInstance()
+{
+    static ThreadPolicy _instance;
+    return _instance;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool ThreadPolicy::parseCpuList(const std::string &text, std::vector<int> &cpus)
+{
+    cpus.clear();
+
+    size_t pos = 0;
+
+    while (pos < text.size())
+    {
+        size_t end = text.find(',', pos);
+
+        if (end == std::string::npos)
+            end = text.size();
+
+        const std::string item = text.substr(pos, end - pos);
+        pos = end + 1;
+
+        if (item.find_first_not_of(" \t") == std::string::npos)
+            continue;
+
+        try
+        {
+            const size_t dash = item.find('-');
+
+            const int first = std::stoi(item.substr(0, dash));
+            const int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+
+            if (first < 0 || last < first || last >= CPU_SETSIZE)
+                return false;
+
+            for (int cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        }
+        catch (...)
+        {
+            return false;
+        }
+    }
+
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool ThreadPolicy::configure(const Config &config)
+{
+    const auto &cfgdata = config.data();
+
+    // [threads]
+    auto it = cfgdata.find("threads");
+
+    if (it == cfgdata.end())
+    {
+        return false;
+    }
+
+    const auto &namespace_data = it->second;
+
+    for (size_t i = 0; i < THREAD_ROLE_COUNT; ++i)
+    {
+        const std::string roleName = threadRoleName(ThreadRole(i));
+        RolePolicy &policy = _roles[i];
+
+        // <role>_cpus = "list"
+        auto nsit = namespace_data.find(roleName + "_cpus");
+        if (nsit != namespace_data.end() && !parseCpuList(nsit->second.first, policy.cpus))
+        {
+            TRACE(LOG_ERR, "ThreadPolicy config syntax error in %s_cpus format", roleName.c_str());
+            policy.cpus.clear();
+        }
+
+        // <role>_priority = N
+        nsit = namespace_data.find(roleName + "_priority");
+        if (nsit != namespace_data.end())
+        {
+            try
+            {
+                const int minPriority = sched_get_priority_min(SCHED_FIFO);
+                const int maxPriority = sched_get_priority_max(SCHED_FIFO);
+                const int priority = std::stoi(nsit->second.first);
+
+                policy.priority = priority <= 0 ? 0 : std::min(std::max(priority, minPriority), maxPriority);
+            }
+            catch (...)
+            {
+                TRACE(LOG_ERR, "ThreadPolicy config syntax error in %s_priority format", roleName.c_str());
+            }
+        }
+    }
+
+    // numa_local = "yes"
+    auto nsit = namespace_data.find("numa_local");
+    _numaLocal = nsit != namespace_data.end() && nsit->second.first == "yes";
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool ThreadPolicy::apply(ThreadRole role, const char *name, int slot) const noexcept
+{
+    bool ret = true;
+
+    if (name)
+    {
+        char threadName[16] = {0};
+        strncpy(threadName, name, sizeof(threadName) - 1);
+        pthread_setname_np(pthread_self(), threadName);
+    }
+
+    const RolePolicy &policy = _roles[size_t(role)];
+
+    if (!policy.cpus.empty())
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+
+        if (slot >= 0)
+        {
+            CPU_SET(policy.cpus[size_t(slot) % policy.cpus.size()], &cpuset);
+        }
+        else
+        {
+            for (const auto cpu : policy.cpus)
+                CPU_SET(cpu, &cpuset);
+        }
+
+        const int err = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+
+        if (err != 0)
+        {
+            TRACE(LOG_WARNING, "ThreadPolicy cannot set %s thread affinity: '%s'",
+                  threadRoleName(role), strerror(err));
+            ret = false;
+        }
+    }
+
+    if (policy.priority > 0)
+    {
+        struct sched_param param = {0};
+        param.sched_priority = policy.priority;
+
+        // Requires CAP_SYS_NICE (or a suitable RLIMIT_RTPRIO)
+        const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+        if (err != 0)
+        {
+            TRACE(LOG_WARNING, "ThreadPolicy cannot set %s thread SCHED_FIFO priority %i: '%s'",
+                  threadRoleName(role), policy.priority, strerror(err));
+            ret = false;
+        }
+    }
+
+    // Pacing sleeps of data-plane threads are a few microseconds long, so
+    // they must not be deferred by the default 50 us timer slack
+    if (role != ThreadRole::Control && ::prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0) != 0)
+    {
+        TRACE(LOG_WARNING, "ThreadPolicy cannot set %s thread timer slack: '%s'",
+              threadRoleName(role), strerror(errno));
+        ret = false;
+    }
+
+    // Memory first touched by data-plane threads (i.e. packet buffers)
+    // is taken from the NUMA node they are running on
+    if (_numaLocal && role != ThreadRole::Control)
+    {
+        if (::syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0) != 0)
+        {
+            TRACE(LOG_WARNING, "ThreadPolicy cannot set %s thread memory policy: '%s'",
+                  threadRoleName(role), strerror(errno));
+            ret = false;
+        }
+    }
+
+    return ret;
+}
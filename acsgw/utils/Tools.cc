@@ -10,10 +10,36 @@
 
 #include "Tools.h"
 
+#include <arpa/inet.h>
+#include <linux/net_tstamp.h>
+#include <netinet/in.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cstring>
+
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+#endif
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+
 /* -------------------------------------------------------------------------- */
 
 void Tools::convertDurationInTimeval(const TimeoutInterval &d, timeval &tv)
@@ -107,3 +133,183 @@ bool Tools::splitLineInTokens(const std::string &line,
 
     return true;
 }
+
+/* -------------------------------------------------------------------------- */
+
+bool Tools::setBusyPoll(int sd, int usecs)
+{
+    if (::setsockopt(sd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) != 0)
+        return false;
+
+    // Available since Linux 5.11, ignored otherwise
+    int prefer = 1;
+    ::setsockopt(sd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer));
+
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool Tools::setTrafficMarking(int sd, int dscp, int priority)
+{
+    // IP_TOS also resets the socket priority, so it must be set first
+    if (dscp >= 0)
+    {
+        int tos = (dscp & 0x3f) << 2;
+
+        if (::setsockopt(sd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) != 0)
+            return false;
+    }
+
+    if (priority >= 0 && ::setsockopt(sd, SOL_SOCKET, SO_PRIORITY, &priority, sizeof(priority)) != 0)
+        return false;
+
+    return true;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool Tools::setDontFragment(int sd)
+{
+    int pmtudisc = IP_PMTUDISC_DO;
+
+    return ::setsockopt(sd, IPPROTO_IP, IP_MTU_DISCOVER, &pmtudisc, sizeof(pmtudisc)) == 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int Tools::getPathMtu(uint32_t localAddr, uint32_t remoteAddr)
+{
+    const int sd = ::socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (sd < 0)
+        return -1;
+
+    sockaddr_in sa = {0};
+    sa.sin_family = AF_INET;
+
+    // A failing bind just leaves the source address to the routing table
+    if (localAddr != 0)
+    {
+        sa.sin_addr.s_addr = htonl(localAddr);
+        ::bind(sd, (const sockaddr *)&sa, sizeof(sa));
+    }
+
+    // Connecting a datagram socket only binds it to the route, nothing is sent
+    sa.sin_addr.s_addr = htonl(remoteAddr);
+    sa.sin_port = htons(9); // discard
+
+    int mtu = -1;
+    socklen_t len = sizeof(mtu);
+
+    if (!setDontFragment(sd) ||
+        ::connect(sd, (const sockaddr *)&sa, sizeof(sa)) != 0 ||
+        ::getsockopt(sd, IPPROTO_IP, IP_MTU, &mtu, &len) != 0)
+    {
+        mtu = -1;
+    }
+
+    ::close(sd);
+
+    return mtu;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool Tools::setTxTime(int sd)
+{
+    sock_txtime config = {0};
+    config.clockid = CLOCK_MONOTONIC;
+    config.flags = 0;
+
+    return ::setsockopt(sd, SOL_SOCKET, SO_TXTIME, &config, sizeof(config)) == 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+void Tools::setDepartureTime(msghdr &msg, TxTimeCmsg &cmsg, uint64_t departureNs)
+{
+    msg.msg_control = cmsg.buf;
+    msg.msg_controllen = sizeof(cmsg.buf);
+
+    cmsghdr *hdr = CMSG_FIRSTHDR(&msg);
+    hdr->cmsg_level = SOL_SOCKET;
+    hdr->cmsg_type = SCM_TXTIME;
+    hdr->cmsg_len = CMSG_LEN(sizeof(departureNs));
+
+    memcpy(CMSG_DATA(hdr), &departureNs, sizeof(departureNs));
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool Tools::setSocketBuffer(int sd, bool receive, size_t bytes)
+{
+    int size = int(std::min<size_t>(bytes, INT32_MAX / 2));
+
+    // The forced variant is not bound by net.core.[rw]mem_max, but needs
+    // CAP_NET_ADMIN
+    if (::setsockopt(sd, SOL_SOCKET, receive ? SO_RCVBUFFORCE : SO_SNDBUFFORCE, &size, sizeof(size)) == 0)
+        return true;
+
+    return ::setsockopt(sd, SOL_SOCKET, receive ? SO_RCVBUF : SO_SNDBUF, &size, sizeof(size)) == 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int Tools::getSocketBuffer(int sd, bool receive)
+{
+    int size = -1;
+    socklen_t len = sizeof(size);
+
+    if (::getsockopt(sd, SOL_SOCKET, receive ? SO_RCVBUF : SO_SNDBUF, &size, &len) != 0)
+        return -1;
+
+    return size;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool Tools::setRxQueueOverflow(int sd)
+{
+    int on = 1;
+
+    return ::setsockopt(sd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) == 0;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+bool Tools::getRxQueueOverflow(const msghdr &msg, uint32_t &drops)
+{
+    for (cmsghdr *hdr = CMSG_FIRSTHDR(&msg); hdr; hdr = CMSG_NXTHDR(const_cast<msghdr *>(&msg), hdr))
+    {
+        if (hdr->cmsg_level == SOL_SOCKET && hdr->cmsg_type == SO_RXQ_OVFL &&
+            hdr->cmsg_len >= CMSG_LEN(sizeof(drops)))
+        {
+            memcpy(&drops, CMSG_DATA(hdr), sizeof(drops));
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/* -------------------------------------------------------------------------- */
+
+int Tools::getSendQueue(int sd)
+{
+    int bytes = -1;
+
+    if (::ioctl(sd, SIOCOUTQ, &bytes) != 0)
+        return -1;
+
+    return bytes;
+}